@@ -0,0 +1,1635 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+#include "Benchmarks.h"
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <limits>
+#include <rmsprofile.h>
+
+#include "DirectedEdgeMesh.h"
+#include "IMeshBVTree.h"
+#include "PointKdTree.h"
+#include "ParticleGrid.h"
+#include "ExpMapGenerator.h"
+#include "ExpMapBatch.h"
+#include "ExpMapVoronoi.h"
+#include "ExpMapSurfaceCache.h"
+#include "MeshUtils.h"
+#include "VertexWeights.h"
+#include "SparseLinearSolver.h"
+#include "CompressedSparseMatrix.h"
+#include <SparseLinearSystem.h>
+#include <Wm4IntrRay3Triangle3.h>
+#include <Wm4DistVector3Triangle3.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <cstdio>
+#include <unistd.h>
+#endif
+#include "VectorUtil.h"
+
+using namespace rms;
+
+
+// _RMSTUNE_time() is seconds on windows and milliseconds elsewhere
+static double BenchSeconds( int nTimer )
+{
+#ifdef _WIN32
+	return _RMSTUNE_time(nTimer);
+#else
+	return _RMSTUNE_time(nTimer) / 1000.0;
+#endif
+}
+
+static double BenchAccumSeconds( int nTimer )
+{
+#ifdef _WIN32
+	return _RMSTUNE_accum_time(nTimer);
+#else
+	return _RMSTUNE_accum_time(nTimer) / 1000.0;
+#endif
+}
+
+static void PrintRate( const char * pLabel, double fQueries, int nTimer, unsigned long long nChecksum )
+{
+	double fSeconds = BenchSeconds(nTimer);
+	std::cerr << "    " << pLabel << " : " << fSeconds << "s  ";
+	if ( fSeconds > 0 )
+		std::cerr << (fQueries / fSeconds) / 1.0e6 << " Mq/s";
+	std::cerr << "   [" << nChecksum << "]" << std::endl;
+}
+
+
+/*
+ * IMesh-interface queries, so both backends pay the same virtual call overhead
+ */
+static void BenchmarkIMeshQueries( const IMesh & mesh, int nRounds )
+{
+	unsigned int nMaxTri = mesh.GetMaxTriangleID();
+	unsigned int nMaxVtx = mesh.GetMaxVertexID();
+
+	unsigned long long nChecksum = 0;
+	IMesh::TriangleID vNbrs[3];
+	_RMSTUNE_start(10);
+	for ( int r = 0; r < nRounds; ++r ) {
+		for ( unsigned int tID = 0; tID < nMaxTri; ++tID ) {
+			if ( ! mesh.IsTriangle(tID) )
+				continue;
+			mesh.FindNeighbours(tID, vNbrs);
+			nChecksum += (vNbrs[0] != IMesh::InvalidID) + (vNbrs[1] != IMesh::InvalidID) + (vNbrs[2] != IMesh::InvalidID);
+		}
+	}
+	_RMSTUNE_end(10);
+	PrintRate("FindNeighbours    ", (double)nRounds * mesh.GetTriangleCount(), 10, nChecksum);
+
+	nChecksum = 0;
+	_RMSTUNE_start(10);
+	for ( int r = 0; r < nRounds; ++r ) {
+		for ( unsigned int vID = 0; vID < nMaxVtx; ++vID ) {
+			if ( ! mesh.IsVertex(vID) )
+				continue;
+			IMesh::VtxNbrItr itr(vID);
+			mesh.BeginVtxTriangles(itr);
+			while ( mesh.GetNextVtxTriangle(itr) != IMesh::InvalidID )
+				++nChecksum;
+		}
+	}
+	_RMSTUNE_end(10);
+	PrintRate("VtxTriangles      ", (double)nRounds * mesh.GetVertexCount(), 10, nChecksum);
+
+	nChecksum = 0;
+	_RMSTUNE_start(10);
+	for ( int r = 0; r < nRounds; ++r ) {
+		for ( unsigned int vID = 0; vID < nMaxVtx; ++vID ) {
+			if ( mesh.IsVertex(vID) && mesh.IsBoundaryVertex(vID) )
+				++nChecksum;
+		}
+	}
+	_RMSTUNE_end(10);
+	PrintRate("IsBoundaryVertex  ", (double)nRounds * mesh.GetVertexCount(), 10, nChecksum);
+}
+
+
+void rms::BenchmarkMeshNeighbourQueries( const VFTriangleMesh & mesh, int nRounds )
+{
+	VFTriangleMesh vfmesh(mesh);
+
+	_RMSTUNE_start(10);
+	DirectedEdgeMesh demesh(vfmesh);
+	_RMSTUNE_end(10);
+	std::cerr << "[BenchmarkMeshNeighbourQueries] " << vfmesh.GetVertexCount() << " vertices, "
+		<< vfmesh.GetTriangleCount() << " triangles, " << nRounds << " rounds" << std::endl;
+	std::cerr << "    DirectedEdgeMesh conversion : " << BenchSeconds(10) << "s" << std::endl;
+
+	unsigned int nMaxVtx = vfmesh.GetMaxVertexID();
+	std::vector<IMesh::VertexID> vRing;
+	unsigned long long nChecksum;
+
+	for ( int nPass = 0; nPass < 3; ++nPass ) {
+		if ( nPass == 0 )
+			std::cerr << "  VFTriangleMesh" << std::endl;
+		else if ( nPass == 1 ) {
+			vfmesh.FreezeTopology();
+			std::cerr << "  VFTriangleMesh (frozen topology)" << std::endl;
+		} else
+			std::cerr << "  DirectedEdgeMesh" << std::endl;
+
+		if ( nPass < 2 )
+			BenchmarkIMeshQueries(vfmesh, nRounds);
+		else
+			BenchmarkIMeshQueries(demesh, nRounds);
+
+		nChecksum = 0;
+		_RMSTUNE_start(10);
+		for ( int r = 0; r < nRounds; ++r ) {
+			for ( unsigned int vID = 0; vID < nMaxVtx; ++vID ) {
+				if ( ! vfmesh.IsVertex(vID) )
+					continue;
+				bool bOK = ( nPass < 2 ) ?
+					vfmesh.VertexOneRing(vID, vRing, true) : demesh.VertexOneRing(vID, vRing);
+				if ( bOK )
+					nChecksum += vRing.size();
+			}
+		}
+		_RMSTUNE_end(10);
+		PrintRate("VertexOneRing     ", (double)nRounds * vfmesh.GetVertexCount(), 10, nChecksum);
+	}
+}
+
+
+
+// counts queries where result differs from reference (up to tolerance on distances)
+static unsigned long long CountMismatches( const std::vector<float> & vDist, const std::vector<float> & vRefDist )
+{
+	unsigned long long nBad = 0;
+	for ( unsigned int i = 0; i < vDist.size(); ++i ) {
+		if ( fabs(vDist[i] - vRefDist[i]) > 1.0e-5f * (1.0f + vRefDist[i]) )
+			++nBad;
+	}
+	return nBad;
+}
+// same, for the first vSampleRef.size() queries only (brute-force reference on a sample)
+static unsigned long long CountSampleMismatches( const std::vector<float> & vDist, const std::vector<float> & vSampleRef )
+{
+	return CountMismatches( std::vector<float>( vDist.begin(), vDist.begin() + vSampleRef.size() ), vSampleRef );
+}
+
+// brute-force reference for the BVTree queries: distance to nearest triangle, and ray hit distance (-1 for a miss)
+static float BruteForceNearestDistance( const std::vector<Wml::Triangle3f> & vTriangles, const Wml::Vector3f & vPoint )
+{
+	float fNearest = std::numeric_limits<float>::max();
+	for ( unsigned int j = 0; j < vTriangles.size(); ++j ) {
+		float fDist = Wml::DistVector3Triangle3f( vPoint, vTriangles[j] ).Get();
+		if ( fDist < fNearest )
+			fNearest = fDist;
+	}
+	return fNearest;
+}
+static float BruteForceRayDistance( const std::vector<Wml::Triangle3f> & vTriangles, const Wml::Vector3f & vOrigin, const Wml::Vector3f & vDirection )
+{
+	float fNearest = -1.0f;
+	Wml::Ray3f ray( vOrigin, vDirection );
+	for ( unsigned int j = 0; j < vTriangles.size(); ++j ) {
+		Wml::IntrRay3Triangle3f intr( ray, vTriangles[j] );
+		if ( intr.Find() && (fNearest < 0 || intr.GetRayT() < fNearest) )
+			fNearest = intr.GetRayT();
+	}
+	return fNearest;
+}
+
+// query points are mesh vertices plus a small random offset (like projecting a deformed copy back
+// onto the surface). Rays start at those points and point at a random vertex.
+static void MakeBVTreeQueries( const VFTriangleMesh & mesh, const std::vector<IMesh::VertexID> & vVerts, float fDiag, unsigned int nQueries,
+							   std::vector<Wml::Vector3f> & vPoints, std::vector<Wml::Vector3f> & vDirections )
+{
+	vPoints.resize( nQueries );
+	vDirections.resize( nQueries );
+	Wml::Vector3f vVertex;
+	for ( unsigned int i = 0; i < nQueries; ++i ) {
+		mesh.GetVertex( vVerts[ rand() % vVerts.size() ], vVertex );
+		Wml::Vector3f vOffset( (float)rand()/RAND_MAX - 0.5f, (float)rand()/RAND_MAX - 0.5f, (float)rand()/RAND_MAX - 0.5f );
+		vPoints[i] = vVertex + 0.02f * fDiag * vOffset;
+		mesh.GetVertex( vVerts[ rand() % vVerts.size() ], vVertex );
+		vDirections[i] = vVertex - vPoints[i];
+		vDirections[i].Normalize();
+	}
+}
+
+void rms::BenchmarkBVTreeQueries( const VFTriangleMesh & mesh, unsigned int nQueries )
+{
+	VFTriangleMesh vfmesh(mesh);
+	Wml::AxisAlignedBox3f bounds;
+	vfmesh.GetBoundingBox(bounds);
+	float fDiag = Wml::Vector3f( bounds.Max[0]-bounds.Min[0], bounds.Max[1]-bounds.Min[1], bounds.Max[2]-bounds.Min[2] ).Length();
+
+	std::vector<IMesh::VertexID> vVerts;
+	vVerts.reserve( vfmesh.GetVertexCount() );
+	vfmesh.ForEachVertexBlock( IMeshAppendIDsFunc(vVerts) );
+	if ( vVerts.empty() )
+		return;
+
+	srand(31337);
+	std::vector<Wml::Vector3f> vPoints, vDirections;
+	MakeBVTreeQueries( vfmesh, vVerts, fDiag, nQueries, vPoints, vDirections );
+
+	IMeshBVTree lazyTree( &vfmesh );
+	IMeshBVTree flatTree( &vfmesh, IMeshBVTree::FlatSAHBuild );
+	_RMSTUNE_start(10);
+	lazyTree.ExpandAll();
+	_RMSTUNE_end(10);
+	double fLazyBuild = BenchSeconds(10);
+	_RMSTUNE_start(10);
+	flatTree.Build();
+	_RMSTUNE_end(10);
+	unsigned int nBruteQueries = std::min( nQueries, 200u );
+	std::cerr << "[BenchmarkBVTreeQueries] " << vfmesh.GetTriangleCount() << " triangles, " << nQueries 
+			  << " queries (brute force: " << nBruteQueries << ")" << std::endl;
+	std::cerr << "    build: lazy (ExpandAll) " << fLazyBuild << "s   flat SAH " << BenchSeconds(10) << "s" << std::endl;
+
+	std::vector<Wml::Triangle3f> vTriangles;
+	vTriangles.reserve( vfmesh.GetTriangleCount() );
+	VFTriangleMesh::triangle_iterator curt( vfmesh.BeginTriangles() ), endt( vfmesh.EndTriangles() );
+	for ( ; curt != endt; ++curt ) {
+		Wml::Triangle3f tri;
+		vfmesh.GetTriangle( *curt, tri.V );
+		vTriangles.push_back( tri );
+	}
+
+	std::vector<Wml::Vector3f> vNearest( nQueries );
+	std::vector<IMesh::TriangleID> vTris( nQueries );
+	std::vector<float> vRefDist( nQueries ), vDist( nQueries ), vBruteDist( nBruteQueries );
+
+	// flat tree single queries are the reference for the mismatch counts. The first nBruteQueries queries
+	// are also done by brute force over all triangles, and the flat tree single and batched results are
+	// checked against that. (The lazy tree misses some ray hits when the ray origin is inside a node box,
+	// so it can report mismatches.)
+	std::cerr << "  FindNearest" << std::endl;
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nQueries; ++i )
+		flatTree.FindNearest( vPoints[i], vNearest[i], vTris[i], &vRefDist[i] );
+	_RMSTUNE_end(10);
+	PrintRate("flat tree         ", nQueries, 10, 0);
+
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nBruteQueries; ++i )
+		vBruteDist[i] = BruteForceNearestDistance( vTriangles, vPoints[i] );
+	_RMSTUNE_end(10);
+	PrintRate("brute force       ", nBruteQueries, 10, CountSampleMismatches(vRefDist, vBruteDist));
+
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nQueries; ++i )
+		lazyTree.FindNearest( vPoints[i], vNearest[i], vTris[i], &vDist[i] );
+	_RMSTUNE_end(10);
+	PrintRate("lazy tree         ", nQueries, 10, CountMismatches(vDist, vRefDist));
+
+	_RMSTUNE_start(10);
+	flatTree.FindNearest( &vPoints[0], nQueries, &vNearest[0], &vTris[0], &vDist[0] );
+	_RMSTUNE_end(10);
+	PrintRate("flat tree, batched", nQueries, 10, CountMismatches(vDist, vRefDist) + CountSampleMismatches(vDist, vBruteDist));
+
+	// second ray set is a coherent orthographic grid looking down -Z (like camera rays)
+	for ( int nPass = 0; nPass < 2; ++nPass ) {
+		if ( nPass == 1 ) {
+			unsigned int nSide = (unsigned int)sqrt( (double)nQueries );
+			for ( unsigned int i = 0; i < nQueries; ++i ) {
+				float fX = (float)(i % nSide) / (float)nSide,  fY = (float)(i / nSide) / (float)nSide;
+				vPoints[i] = Wml::Vector3f( bounds.Min[0] + fX*(bounds.Max[0]-bounds.Min[0]), 
+					bounds.Min[1] + fY*(bounds.Max[1]-bounds.Min[1]), bounds.Max[2] + 0.1f*fDiag );
+				vDirections[i] = -Wml::Vector3f::UNIT_Z;
+			}
+		}
+		std::cerr << "  FindRayIntersection" << ( (nPass == 0) ? " (incoherent)" : " (coherent)" ) << std::endl;
+
+		// ray results are compared as distance to hit point, -1 for misses
+		Wml::Vector3f vHit;
+		IMesh::TriangleID tHit;
+		_RMSTUNE_start(10);
+		for ( unsigned int i = 0; i < nQueries; ++i )
+			vRefDist[i] = flatTree.FindRayIntersection( vPoints[i], vDirections[i], vHit, tHit ) ? (vHit - vPoints[i]).Length() : -1.0f;
+		_RMSTUNE_end(10);
+		PrintRate("flat tree         ", nQueries, 10, 0);
+
+		_RMSTUNE_start(10);
+		for ( unsigned int i = 0; i < nBruteQueries; ++i )
+			vBruteDist[i] = BruteForceRayDistance( vTriangles, vPoints[i], vDirections[i] );
+		_RMSTUNE_end(10);
+		PrintRate("brute force       ", nBruteQueries, 10, CountSampleMismatches(vRefDist, vBruteDist));
+
+		_RMSTUNE_start(10);
+		for ( unsigned int i = 0; i < nQueries; ++i )
+			vDist[i] = lazyTree.FindRayIntersection( vPoints[i], vDirections[i], vHit, tHit ) ? (vHit - vPoints[i]).Length() : -1.0f;
+		_RMSTUNE_end(10);
+		PrintRate("lazy tree         ", nQueries, 10, CountMismatches(vDist, vRefDist));
+
+		_RMSTUNE_start(10);
+		flatTree.FindRayIntersections( &vPoints[0], &vDirections[0], nQueries, &vNearest[0], &vTris[0] );
+		_RMSTUNE_end(10);
+		for ( unsigned int i = 0; i < nQueries; ++i )
+			vDist[i] = ( vTris[i] != IMesh::InvalidID ) ? (vNearest[i] - vPoints[i]).Length() : -1.0f;
+		PrintRate("flat tree, batched", nQueries, 10, CountMismatches(vDist, vRefDist) + CountSampleMismatches(vDist, vBruteDist));
+	}
+}
+
+
+// nearest-point and ray distances from tree, and number of queries where they differ from refTree
+static unsigned long long CountBVTreeMismatches( IMeshBVTree & tree, IMeshBVTree & refTree, const std::vector<Wml::Vector3f> & vPoints, 
+												 const std::vector<Wml::Vector3f> & vDirections, bool bRays )
+{
+	unsigned int nQueries = (unsigned int)vPoints.size();
+	std::vector<float> vDist( nQueries ), vRefDist( nQueries );
+	Wml::Vector3f vHit;
+	IMesh::TriangleID tHit;
+	for ( unsigned int i = 0; i < nQueries; ++i ) {
+		tree.FindNearest( vPoints[i], vHit, tHit, &vDist[i] );
+		refTree.FindNearest( vPoints[i], vHit, tHit, &vRefDist[i] );
+	}
+	unsigned long long nBad = CountMismatches( vDist, vRefDist );
+	if ( ! bRays )
+		return nBad;
+	for ( unsigned int i = 0; i < nQueries; ++i ) {
+		vDist[i] = tree.FindRayIntersection( vPoints[i], vDirections[i], vHit, tHit ) ? (vHit - vPoints[i]).Length() : -1.0f;
+		vRefDist[i] = refTree.FindRayIntersection( vPoints[i], vDirections[i], vHit, tHit ) ? (vHit - vPoints[i]).Length() : -1.0f;
+	}
+	return nBad + CountMismatches( vDist, vRefDist );
+}
+
+bool rms::BenchmarkBVTreeRefit( const VFTriangleMesh & mesh, unsigned int nSteps, unsigned int nQueries )
+{
+	VFTriangleMesh vfmesh(mesh);
+	Wml::AxisAlignedBox3f bounds;
+	vfmesh.GetBoundingBox(bounds);
+	float fDiag = Wml::Vector3f( bounds.Max[0]-bounds.Min[0], bounds.Max[1]-bounds.Min[1], bounds.Max[2]-bounds.Min[2] ).Length();
+
+	std::vector<IMesh::VertexID> vVerts;
+	vVerts.reserve( vfmesh.GetVertexCount() );
+	vfmesh.ForEachVertexBlock( IMeshAppendIDsFunc(vVerts) );
+	if ( vVerts.empty() )
+		return true;
+
+	IMeshBVTree lazyTree( &vfmesh );
+	IMeshBVTree flatTree( &vfmesh, IMeshBVTree::FlatSAHBuild );
+	lazyTree.Build();
+	flatTree.Build();
+	std::cerr << "[BenchmarkBVTreeRefit] " << vfmesh.GetTriangleCount() << " triangles, " << nSteps << " deformations, " 
+			  << nQueries << " queries each" << std::endl;
+
+	// each step pulls a patch of the surface out by half the bounding box diagonal, so the boxes of the
+	// subtrees under the patch grow far past the rebuild threshold and the flat tree rebuilds them. Refit
+	// trees are compared with a flat tree built from scratch on the deformed mesh. The lazy tree is only
+	// compared on nearest-point queries (it can miss ray hits when the ray origin is inside a node box).
+	srand(31337);
+	std::vector<Wml::Vector3f> vPoints, vDirections;
+	unsigned long long nTotalBad = 0;
+	for ( unsigned int nStep = 0; nStep <= nSteps; ++nStep ) {
+		bool bTopology = ( nStep == nSteps );
+		if ( bTopology ) {
+			// same triangle count, different triangle IDs: add a triangle across the mesh, then remove one
+			IMesh::TriangleID tID = vfmesh.AppendTriangle( vVerts[0], vVerts[vVerts.size()/3], vVerts[2*vVerts.size()/3] );
+			if ( tID == IMesh::InvalidID )
+				continue;
+			vfmesh.RemoveTriangle( *vfmesh.BeginTriangles() );
+		} else {
+			Wml::Vector3f vCenter, vPull( (float)rand()/RAND_MAX - 0.5f, (float)rand()/RAND_MAX - 0.5f, (float)rand()/RAND_MAX - 0.5f );
+			vPull.Normalize();
+			vfmesh.GetVertex( vVerts[ rand() % vVerts.size() ], vCenter );
+			float fRadius = 0.1f * fDiag;
+			for ( unsigned int i = 0; i < vVerts.size(); ++i ) {
+				Wml::Vector3f vVertex;
+				vfmesh.GetVertex( vVerts[i], vVertex );
+				float fT = 1.0f - (vVertex - vCenter).Length() / fRadius;
+				if ( fT > 0 )
+					vfmesh.SetVertex( vVerts[i], vVertex + (fT * fT * 0.5f * fDiag) * vPull );
+			}
+		}
+		MakeBVTreeQueries( vfmesh, vVerts, fDiag, nQueries, vPoints, vDirections );
+
+		_RMSTUNE_start(10);
+		flatTree.Refit();
+		_RMSTUNE_end(10);
+		double fFlatRefit = BenchSeconds(10);
+		_RMSTUNE_start(10);
+		lazyTree.Refit();
+		_RMSTUNE_end(10);
+		double fLazyRefit = BenchSeconds(10);
+		IMeshBVTree freshTree( &vfmesh, IMeshBVTree::FlatSAHBuild );
+		_RMSTUNE_start(10);
+		freshTree.Build();
+		_RMSTUNE_end(10);
+
+		unsigned long long nBad = CountBVTreeMismatches( flatTree, freshTree, vPoints, vDirections, true )
+			+ CountBVTreeMismatches( lazyTree, freshTree, vPoints, vDirections, false );
+		nTotalBad += nBad;
+		std::cerr << ( (bTopology) ? "    topology change " : "    deformation " ) << nStep << "   refit: flat " << fFlatRefit << "s   lazy " 
+				  << fLazyRefit << "s   flat SAH build: " << BenchSeconds(10) << "s   [" << nBad << "]" << std::endl;
+	}
+
+	return nTotalBad == 0;
+}
+
+
+
+// k nearest points using ParticleGrid box iteration, growing the box until the k-th point is inside the search radius
+static float GridKthDistanceSqr( ParticleGrid<unsigned int> & grid, const std::vector<Wml::Vector3f> & vPositions,
+								 const Wml::Vector3f & vPoint, unsigned int k, float fRadius, std::vector<float> & vBuf )
+{
+	while ( true ) {
+		vBuf.resize(0);
+		ParticleGrid<unsigned int>::BoxIterator itr( &grid, vPoint, fRadius );
+		while ( ! itr.Done() ) {
+			vBuf.push_back( (vPositions[*itr] - vPoint).SquaredLength() );
+			++itr;
+		}
+		if ( vBuf.size() >= k ) {
+			std::nth_element( vBuf.begin(), vBuf.begin() + (k-1), vBuf.end() );
+			if ( vBuf[k-1] <= fRadius*fRadius )
+				return vBuf[k-1];
+		}
+		fRadius *= 2.0f;
+	}
+}
+
+void rms::BenchmarkPointQueries( const VFTriangleMesh & mesh, unsigned int nQueries, unsigned int k )
+{
+	VFTriangleMesh vfmesh(mesh);
+
+	// points are the mesh vertices (IDs are indices into vPositions), queries are vertices plus a small offset
+	std::vector<IMesh::VertexID> vVerts;
+	vVerts.reserve( vfmesh.GetVertexCount() );
+	vfmesh.ForEachVertexBlock( IMeshAppendIDsFunc(vVerts) );
+	unsigned int nPoints = (unsigned int)vVerts.size();
+	std::vector<Wml::Vector3f> vPositions( nPoints );
+	if ( nPoints > 0 )
+		vfmesh.GatherVertices( &vVerts[0], nPoints, (float *)&vPositions[0] );
+	if ( nPoints < k )
+		return;
+	float fMinEdge, fMaxEdge, fAvgEdge;
+	vfmesh.GetEdgeLengthStats( fMinEdge, fMaxEdge, fAvgEdge );
+	float fRadius = 2.0f * fAvgEdge;
+
+	srand(31337);
+	std::vector<Wml::Vector3f> vQueries( nQueries );
+	for ( unsigned int i = 0; i < nQueries; ++i ) {
+		Wml::Vector3f vOffset( (float)rand()/RAND_MAX - 0.5f, (float)rand()/RAND_MAX - 0.5f, (float)rand()/RAND_MAX - 0.5f );
+		vQueries[i] = vPositions[ rand() % nPoints ] + fAvgEdge * vOffset;
+	}
+	unsigned int nBruteQueries = std::min( nQueries, 1000u );
+
+	PointKdTree kdtree;
+	_RMSTUNE_start(10);
+	kdtree.Build( &vPositions[0], nPoints );
+	_RMSTUNE_end(10);
+	double fTreeBuild = BenchSeconds(10);
+
+	ParticleGrid<unsigned int> grid;
+	std::vector<unsigned int> vIndices( nPoints );
+	for ( unsigned int i = 0; i < nPoints; ++i )
+		vIndices[i] = i;
+	_RMSTUNE_start(10);
+	grid.Initialize( vPositions[0], fRadius );
+	grid.AddParticles( &vIndices[0], (const float *)&vPositions[0], nPoints );
+	grid.Build();
+	_RMSTUNE_end(10);
+
+	std::cerr << "[BenchmarkPointQueries] " << nPoints << " points, " << nQueries << " queries (brute force: " 
+			  << nBruteQueries << "), k = " << k << ", radius = " << fRadius << std::endl;
+	std::cerr << "    build: kd-tree " << fTreeBuild << "s   ParticleGrid " << BenchSeconds(10) << "s" << std::endl;
+
+	// results are compared as k-th nearest distance / number of points in radius. kd-tree single queries are the reference
+	std::vector<float> vRef( nQueries ), vResult( nQueries ), vBuf;
+	std::vector<unsigned int> vNbrs;
+	std::vector<float> vDistSqr;
+
+	std::cerr << "  KNearest" << std::endl;
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nQueries; ++i ) {
+		kdtree.KNearest( vQueries[i], k, vNbrs, &vDistSqr );
+		vRef[i] = vDistSqr[k-1];
+	}
+	_RMSTUNE_end(10);
+	PrintRate("kd-tree           ", nQueries, 10, 0);
+
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nBruteQueries; ++i ) {
+		vBuf.resize( nPoints );
+		for ( unsigned int j = 0; j < nPoints; ++j )
+			vBuf[j] = (vPositions[j] - vQueries[i]).SquaredLength();
+		std::nth_element( vBuf.begin(), vBuf.begin() + (k-1), vBuf.end() );
+		vResult[i] = vBuf[k-1];
+	}
+	_RMSTUNE_end(10);
+	PrintRate("brute force       ", nBruteQueries, 10, 
+		CountMismatches( std::vector<float>(vResult.begin(), vResult.begin()+nBruteQueries), std::vector<float>(vRef.begin(), vRef.begin()+nBruteQueries) ) );
+
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nQueries; ++i )
+		vResult[i] = GridKthDistanceSqr( grid, vPositions, vQueries[i], k, fRadius, vBuf );
+	_RMSTUNE_end(10);
+	PrintRate("ParticleGrid      ", nQueries, 10, CountMismatches(vResult, vRef));
+
+	std::vector<unsigned int> vBatchIDs( (size_t)nQueries * k );
+	std::vector<float> vBatchDist( (size_t)nQueries * k );
+	_RMSTUNE_start(10);
+	kdtree.KNearest( &vQueries[0], nQueries, k, &vBatchIDs[0], &vBatchDist[0] );
+	_RMSTUNE_end(10);
+	for ( unsigned int i = 0; i < nQueries; ++i )
+		vResult[i] = vBatchDist[(size_t)k*i + k-1];
+	PrintRate("kd-tree, batched  ", nQueries, 10, CountMismatches(vResult, vRef));
+
+	std::cerr << "  RadiusSearch" << std::endl;
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nQueries; ++i ) {
+		vNbrs.resize(0);  vDistSqr.resize(0);
+		vRef[i] = (float)kdtree.RadiusSearch( vQueries[i], fRadius, vNbrs, &vDistSqr );
+	}
+	_RMSTUNE_end(10);
+	PrintRate("kd-tree           ", nQueries, 10, 0);
+
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nBruteQueries; ++i ) {
+		unsigned int nFound = 0;
+		for ( unsigned int j = 0; j < nPoints; ++j ) {
+			if ( (vPositions[j] - vQueries[i]).SquaredLength() <= fRadius*fRadius )
+				++nFound;
+		}
+		vResult[i] = (float)nFound;
+	}
+	_RMSTUNE_end(10);
+	PrintRate("brute force       ", nBruteQueries, 10, 
+		CountMismatches( std::vector<float>(vResult.begin(), vResult.begin()+nBruteQueries), std::vector<float>(vRef.begin(), vRef.begin()+nBruteQueries) ) );
+
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nQueries; ++i ) {
+		unsigned int nFound = 0;
+		ParticleGrid<unsigned int>::BoxIterator itr( &grid, vQueries[i], fRadius );
+		while ( ! itr.Done() ) {
+			if ( (vPositions[*itr] - vQueries[i]).SquaredLength() <= fRadius*fRadius )
+				++nFound;
+			++itr;
+		}
+		vResult[i] = (float)nFound;
+	}
+	_RMSTUNE_end(10);
+	PrintRate("ParticleGrid      ", nQueries, 10, CountMismatches(vResult, vRef));
+
+	std::vector<unsigned int> vOffsets;
+	_RMSTUNE_start(10);
+	kdtree.RadiusSearch( &vQueries[0], nQueries, fRadius, vOffsets, vNbrs );
+	_RMSTUNE_end(10);
+	for ( unsigned int i = 0; i < nQueries; ++i )
+		vResult[i] = (float)(vOffsets[i+1] - vOffsets[i]);
+	PrintRate("kd-tree, batched  ", nQueries, 10, CountMismatches(vResult, vRef));
+}
+
+
+
+void rms::BenchmarkExpMap( const VFTriangleMesh & mesh, unsigned int nExpMaps, unsigned int nMaxCount )
+{
+	VFTriangleMesh vfmesh(mesh);
+	if ( nMaxCount == 0 )
+		nMaxCount = vfmesh.GetVertexCount();
+
+	IMeshBVTree bvTree;
+	bvTree.SetMesh(&vfmesh);
+	ExpMapGenerator expmapgen;
+	expmapgen.SetSurface(&vfmesh, &bvTree);
+
+	// seed vertices
+	srand(31337);
+	std::vector<Frame3f> vSeeds;
+	while ( vSeeds.size() < nExpMaps ) {
+		IMesh::VertexID vID = rand() % vfmesh.GetMaxVertexID();
+		if ( ! vfmesh.IsVertex(vID) )
+			continue;
+		Wml::Vector3f vVertex, vNormal;
+		vfmesh.GetVertex(vID, vVertex, &vNormal);
+		vSeeds.push_back( Frame3f(vVertex, vNormal) );
+	}
+
+	// first expmap initializes neighbour lists
+	_RMSTUNE_start(10);
+	expmapgen.SetSurfaceDistances( vSeeds[0], 0.0f, 1 );
+	_RMSTUNE_end(10);
+	std::cerr << "[BenchmarkExpMap] " << vfmesh.GetVertexCount() << " vertices, " << nExpMaps 
+			  << " expmaps, max count " << nMaxCount << std::endl;
+	std::cerr << "    neighbour precomputation : " << BenchSeconds(10) << "s" << std::endl;
+
+	unsigned int nVertices = vfmesh.GetVertexCount();
+	std::cerr << "    generator memory         : " << (double)expmapgen.GetMemoryUsage() / (double)nVertices 
+			  << " bytes/vertex  (" << sizeof(ExpMapParticle) << " bytes/particle state)" << std::endl;
+
+	// results are compared as per-expmap parameterized vertex count and sum of |u|+|v|
+	std::vector<unsigned int> vIdx;
+	std::vector<float> vU, vV, vSums[2];
+	double fParticles = 0;
+	for ( int nPass = 0; nPass < 2; ++nPass ) {
+		expmapgen.SetUseIndexedQueue( nPass == 1 );
+		vSums[nPass].resize( 2*nExpMaps );
+		fParticles = 0;
+		_RMSTUNE_accum_init(10);
+		for ( unsigned int i = 0; i < nExpMaps; ++i ) {
+			_RMSTUNE_start(10);
+			expmapgen.SetSurfaceDistances( vSeeds[i], 0.0f, nMaxCount );
+			_RMSTUNE_end(10);
+			_RMSTUNE_accum(10);
+
+			vIdx.resize(0); vU.resize(0); vV.resize(0);
+			expmapgen.GetVertexUVs(vIdx, vU, vV);
+			fParticles += (double)vIdx.size();
+			double fSum = 0;
+			for ( unsigned int j = 0; j < vIdx.size(); ++j )
+				fSum += fabs(vU[j]) + fabs(vV[j]);
+			vSums[nPass][2*i] = (float)vIdx.size();
+			vSums[nPass][2*i+1] = (float)fSum;
+		}
+		double fSeconds = BenchAccumSeconds(10);
+		std::cerr << "    " << ((nPass == 0) ? "std::multiset front " : "indexed heap front  ") << " : " << fSeconds << "s  ";
+		if ( fSeconds > 0 )
+			std::cerr << (fParticles / fSeconds) / 1.0e6 << " M particles/s";
+		std::cerr << "   [" << CountMismatches(vSums[nPass], vSums[0]) << "]" << std::endl;
+	}
+
+	// generator memory with positions/normals shared with a CompactVertexStorage mesh. vfmesh is converted
+	// in place, after the timings, so that multi-million vertex meshes are not held twice
+	vfmesh.SetVertexStorageMode( VFTriangleMesh::CompactVertexStorage );
+	IMeshBVTree compactTree;
+	compactTree.SetMesh(&vfmesh);
+	ExpMapGenerator compactgen;
+	compactgen.SetSurface(&vfmesh, &compactTree);
+	compactgen.SetSurfaceDistances( vSeeds[0], 0.0f, 1 );
+	std::cerr << "    generator memory (shared): " << (double)compactgen.GetMemoryUsage() / (double)nVertices 
+			  << " bytes/vertex" << std::endl;
+}
+
+
+
+// per-set parameterized vertex count and sum of |u|+|v|, for comparing expmap results
+static void ExpMapChecksums( const std::vector<unsigned int> & vIdx, const std::vector<float> & vU, const std::vector<float> & vV,
+							 float & fCount, float & fSum )
+{
+	double fTotal = 0;
+	for ( unsigned int j = 0; j < vIdx.size(); ++j )
+		fTotal += fabs(vU[j]) + fabs(vV[j]);
+	fCount = (float)vIdx.size();
+	fSum = (float)fTotal;
+}
+
+void rms::BenchmarkExpMapBatch( const VFTriangleMesh & mesh, unsigned int nSeeds, unsigned int nMaxCount )
+{
+	VFTriangleMesh vfmesh(mesh);
+	IMeshBVTree bvTree;
+	bvTree.SetMesh(&vfmesh);
+	bvTree.SetBuildMode( IMeshBVTree::FlatSAHBuild );
+	bvTree.Build();
+	ExpMapGenerator expmapgen;
+	expmapgen.SetSurface(&vfmesh, &bvTree);
+
+	srand(31337);
+	std::vector<Frame3f> vSeeds;
+	while ( vSeeds.size() < nSeeds ) {
+		IMesh::VertexID vID = rand() % vfmesh.GetMaxVertexID();
+		if ( ! vfmesh.IsVertex(vID) )
+			continue;
+		Wml::Vector3f vVertex, vNormal;
+		vfmesh.GetVertex(vID, vVertex, &vNormal);
+		vSeeds.push_back( Frame3f(vVertex, vNormal) );
+	}
+
+	ExpMapBatch batch;
+	_RMSTUNE_start(10);
+	batch.Initialize(expmapgen);
+	_RMSTUNE_end(10);
+	std::cerr << "[BenchmarkExpMapBatch] " << vfmesh.GetVertexCount() << " vertices, " << nSeeds 
+			  << " seeds, max count " << nMaxCount << std::endl;
+	std::cerr << "    neighbour precomputation + batch init : " << BenchSeconds(10) << "s" << std::endl;
+
+	// (expmaps are too short to time individually)
+	std::vector<float> vRef( 2*nSeeds ), vResult( 2*nSeeds );
+	std::vector<ExpMapUVSet> vResults( nSeeds );
+	_RMSTUNE_start(10);
+	for ( unsigned int i = 0; i < nSeeds; ++i ) {
+		expmapgen.SetSurfaceDistances( vSeeds[i], 0.0f, nMaxCount );
+		expmapgen.GetVertexUVs( vResults[i].vIDs, vResults[i].vU, vResults[i].vV );
+	}
+	_RMSTUNE_end(10);
+	for ( unsigned int i = 0; i < nSeeds; ++i )
+		ExpMapChecksums( vResults[i].vIDs, vResults[i].vU, vResults[i].vV, vRef[2*i], vRef[2*i+1] );
+	double fSeconds = BenchSeconds(10);
+	std::cerr << "    ExpMapGenerator          : " << fSeconds << "s  " 
+			  << ((fSeconds > 0) ? (nSeeds / fSeconds) : 0) << " expmaps/s" << std::endl;
+
+	int nMaxThreads = 1;
+#ifdef _OPENMP
+	nMaxThreads = omp_get_max_threads();
+#endif
+	int vThreadCounts[2] = { 1, nMaxThreads };
+	for ( int t = 0; t < ((nMaxThreads > 1) ? 2 : 1); ++t ) {
+		int nThreads = vThreadCounts[t];
+#ifdef _OPENMP
+		omp_set_num_threads(nThreads);
+#endif
+		_RMSTUNE_start(10);
+		batch.Compute( vSeeds, std::numeric_limits<float>::max(), nMaxCount, vResults );
+		_RMSTUNE_end(10);
+		for ( unsigned int i = 0; i < nSeeds; ++i )
+			ExpMapChecksums( vResults[i].vIDs, vResults[i].vU, vResults[i].vV, vResult[2*i], vResult[2*i+1] );
+		fSeconds = BenchSeconds(10);
+		std::cerr << "    ExpMapBatch, " << nThreads << " thread(s) : " << fSeconds << "s  " 
+				  << ((fSeconds > 0) ? (nSeeds / fSeconds) : 0) << " expmaps/s   [" << CountMismatches(vResult, vRef) << "]" << std::endl;
+	}
+#ifdef _OPENMP
+	omp_set_num_threads(nMaxThreads);
+#endif
+}
+
+
+
+void rms::BenchmarkExpMapEdit( const VFTriangleMesh & mesh, unsigned int nSteps, float fRadiusScale )
+{
+	VFTriangleMesh vfmesh(mesh);
+	IMeshBVTree bvTree;
+	bvTree.SetMesh(&vfmesh);
+	ExpMapGenerator expmapgen;
+	expmapgen.SetSurface(&vfmesh, &bvTree);
+
+	float fMinEdge, fMaxEdge, fAvgEdge;
+	MeshUtils::GetEdgeLengthStats(&vfmesh, fMinEdge, fMaxEdge, fAvgEdge);
+	float fInitRadius = fRadiusScale * fAvgEdge;
+
+	srand(31337);
+	IMesh::VertexID vSeedID;
+	do { 
+		vSeedID = rand() % vfmesh.GetMaxVertexID(); 
+	} while ( ! vfmesh.IsVertex(vSeedID) );
+	Wml::Vector3f vVertex, vNormal;
+	vfmesh.GetVertex(vSeedID, vVertex, &vNormal);
+	Frame3f vInitFrame(vVertex, vNormal);
+
+	// first expmap initializes neighbour lists
+	expmapgen.SetSurfaceDistances( vInitFrame.Origin(), 0.0f, fInitRadius, &vInitFrame );
+	std::cerr << "[BenchmarkExpMapEdit] " << vfmesh.GetVertexCount() << " vertices, " << nSteps 
+			  << " edits, initial radius " << fInitRadius << std::endl;
+
+	// same edit sequence as MeshObject::RotateExpMap / ScaleExpMap. Alternates rotation and
+	// scaling, radius grows for the first half of the steps and shrinks for the second half
+	std::vector<unsigned int> vIdx;
+	std::vector<float> vU, vV, vSums[2];
+	for ( int nPass = 0; nPass < 2; ++nPass ) {
+		expmapgen.SetUseIncrementalUpdate( nPass == 1 );
+		vSums[nPass].resize( 2*nSteps );
+		Frame3f vSeedFrame(vInitFrame);
+		float fRadius = fInitRadius;
+		expmapgen.SetSurfaceDistances( vSeedFrame.Origin(), 0.0f, fRadius, &vSeedFrame );
+
+		_RMSTUNE_start(10);
+		for ( unsigned int i = 0; i < nSteps; ++i ) {
+			if ( i % 2 == 0 ) {
+				Wml::Matrix3f matRotate;
+				matRotate.FromAxisAngle(vSeedFrame.Z(), 0.05f);
+				vSeedFrame.Rotate(matRotate);
+			} else
+				fRadius *= ( i < nSteps/2 ) ? 1.02f : (1.0f / 1.02f);
+			expmapgen.SetSurfaceDistances( vSeedFrame.Origin(), 0.0f, fRadius, &vSeedFrame );
+
+			vIdx.resize(0); vU.resize(0); vV.resize(0);
+			expmapgen.GetVertexUVs(vIdx, vU, vV);
+			ExpMapChecksums( vIdx, vU, vV, vSums[nPass][2*i], vSums[nPass][2*i+1] );
+		}
+		_RMSTUNE_end(10);
+
+		// rotations are applied to the UVs instead of re-propagating from the rotated seed frame, so 
+		// results only agree up to float rounding (and freeze order of particles with equal distances)
+		unsigned int nBad = 0;
+		for ( unsigned int i = 0; i < 2*nSteps; ++i )
+			if ( fabs(vSums[nPass][i] - vSums[0][i]) > 1.0e-4f * (1.0f + vSums[0][i]) )
+				++nBad;
+		double fSeconds = BenchSeconds(10);
+		std::cerr << "    " << ((nPass == 0) ? "full recompute " : "incremental    ") << " : " << fSeconds << "s  " 
+				  << ((fSeconds > 0) ? (nSteps / fSeconds) : 0) << " edits/s   [" << nBad << "]" << std::endl;
+	}
+}
+
+
+
+void rms::BenchmarkExpMapLocalized( const VFTriangleMesh & mesh, unsigned int nQueries, float fRadiusScale )
+{
+	VFTriangleMesh vfmesh(mesh);
+	IMeshBVTree bvTree;
+	bvTree.SetMesh(&vfmesh);
+	bvTree.SetBuildMode( IMeshBVTree::FlatSAHBuild );
+	bvTree.Build();
+
+	float fMinEdge, fMaxEdge, fAvgEdge;
+	MeshUtils::GetEdgeLengthStats(&vfmesh, fMinEdge, fMaxEdge, fAvgEdge);
+	float fRadius = fRadiusScale * fAvgEdge;
+
+	srand(31337);
+	std::vector<Frame3f> vSeeds;
+	while ( vSeeds.size() < nQueries ) {
+		IMesh::VertexID vID = rand() % vfmesh.GetMaxVertexID();
+		if ( ! vfmesh.IsVertex(vID) )
+			continue;
+		Wml::Vector3f vVertex, vNormal;
+		vfmesh.GetVertex(vID, vVertex, &vNormal);
+		vSeeds.push_back( Frame3f(vVertex, vNormal) );
+	}
+	std::cerr << "[BenchmarkExpMapLocalized] " << vfmesh.GetVertexCount() << " vertices, " << nQueries 
+			  << " expmaps, radius " << fRadius << std::endl;
+
+	std::vector<unsigned int> vIdx;
+	std::vector<float> vU, vV, vSums[2];
+	for ( int nPass = 0; nPass < 2; ++nPass ) {
+		ExpMapGenerator expmapgen;
+		expmapgen.SetSurface(&vfmesh, &bvTree);
+		expmapgen.SetUseLocalizedQueries( nPass == 1 );
+		vSums[nPass].resize( 2*nQueries );
+		double fParticles = 0;
+		_RMSTUNE_accum_init(10);
+		for ( unsigned int i = 0; i < nQueries; ++i ) {
+			_RMSTUNE_start(10);
+			expmapgen.SetSurfaceDistances( vSeeds[i].Origin(), 0.0f, fRadius, &vSeeds[i] );
+			_RMSTUNE_end(10);
+			if ( i == 0 )
+				std::cerr << "    " << ((nPass == 0) ? "whole mesh " : "localized  ") << " first query : " << BenchSeconds(10) << "s" << std::endl;
+			else
+				_RMSTUNE_accum(10);
+
+			vIdx.resize(0); vU.resize(0); vV.resize(0);
+			expmapgen.GetVertexUVs(vIdx, vU, vV);
+			fParticles += (double)vIdx.size();
+			ExpMapChecksums( vIdx, vU, vV, vSums[nPass][2*i], vSums[nPass][2*i+1] );
+		}
+		double fSeconds = BenchAccumSeconds(10);
+		std::cerr << "    " << ((nPass == 0) ? "whole mesh " : "localized  ") << " other queries : " << fSeconds << "s  ";
+		if ( fSeconds > 0 )
+			std::cerr << 1.0e6 * fSeconds / (double)(nQueries-1) << " us/query, " << fParticles / (double)nQueries << " particles/query";
+		std::cerr << "   [" << CountMismatches(vSums[nPass], vSums[0]) << "]" << std::endl;
+		std::cerr << "                memory : " << (double)expmapgen.GetMemoryUsage() / (double)vfmesh.GetVertexCount() 
+				  << " bytes/vertex" << std::endl;
+	}
+}
+
+
+
+bool rms::BenchmarkExpMapVectorized( const VFTriangleMesh & mesh, unsigned int nExpMaps, unsigned int nMaxCount,
+									 float fTolerance )
+{
+	VFTriangleMesh vfmesh(mesh);
+	if ( nMaxCount == 0 )
+		nMaxCount = vfmesh.GetVertexCount();
+
+	IMeshBVTree bvTree;
+	bvTree.SetMesh(&vfmesh);
+	ExpMapGenerator expmapgen;
+	expmapgen.SetSurface(&vfmesh, &bvTree);
+	expmapgen.SetUseUpwindAveraging(true);
+
+	srand(31337);
+	std::vector<Frame3f> vSeeds;
+	while ( vSeeds.size() < nExpMaps ) {
+		IMesh::VertexID vID = rand() % vfmesh.GetMaxVertexID();
+		if ( ! vfmesh.IsVertex(vID) )
+			continue;
+		Wml::Vector3f vVertex, vNormal;
+		vfmesh.GetVertex(vID, vVertex, &vNormal);
+		vSeeds.push_back( Frame3f(vVertex, vNormal) );
+	}
+
+	// first expmap initializes neighbour lists
+	expmapgen.SetSurfaceDistances( vSeeds[0], 0.0f, 1 );
+	std::cerr << "[BenchmarkExpMapVectorized] " << vfmesh.GetVertexCount() << " vertices, " << nExpMaps 
+			  << " expmaps, max count " << nMaxCount << ", upwind averaging, " << ExpMapUpwindKernel::GetVectorWidth()
+			  << "-wide kernel" << std::endl;
+
+	// scalar results are kept as per-vertex UVs (indexed by VertexID) for comparison
+	std::vector< std::vector<Wml::Vector2f> > vScalarUVs( nExpMaps );
+	std::vector<float> vRadius( nExpMaps, 0.0f );
+	std::vector<unsigned int> vIdx;
+	std::vector<float> vU, vV;
+	float fMaxError = 0.0f;
+	unsigned int nCountMismatches = 0;
+	for ( int nPass = 0; nPass < 2; ++nPass ) {
+		expmapgen.SetUseVectorizedPropagation( nPass == 1 );
+		double fParticles = 0;
+		_RMSTUNE_accum_init(10);
+		for ( unsigned int i = 0; i < nExpMaps; ++i ) {
+			_RMSTUNE_start(10);
+			expmapgen.SetSurfaceDistances( vSeeds[i], 0.0f, nMaxCount );
+			_RMSTUNE_end(10);
+			_RMSTUNE_accum(10);
+
+			vIdx.resize(0); vU.resize(0); vV.resize(0);
+			expmapgen.GetVertexUVs(vIdx, vU, vV);
+			fParticles += (double)vIdx.size();
+			std::vector<Wml::Vector2f> & vUVs = vScalarUVs[i];
+			if ( nPass == 0 ) {
+				vUVs.resize( vfmesh.GetMaxVertexID(), Wml::Vector2f( std::numeric_limits<float>::max(), 0.0f ) );
+				for ( unsigned int j = 0; j < vIdx.size(); ++j ) {
+					vUVs[ vIdx[j] ] = Wml::Vector2f( vU[j], vV[j] );
+					vRadius[i] = std::max( vRadius[i], vUVs[ vIdx[j] ].Length() );
+				}
+			} else {
+				unsigned int nScalarCount = 0;
+				for ( unsigned int j = 0; j < vUVs.size(); ++j )
+					if ( vUVs[j].X() != std::numeric_limits<float>::max() )
+						++nScalarCount;
+				if ( nScalarCount != vIdx.size() )
+					++nCountMismatches;
+				for ( unsigned int j = 0; j < vIdx.size(); ++j ) {
+					if ( vUVs[ vIdx[j] ].X() == std::numeric_limits<float>::max() ) {
+						++nCountMismatches;
+						continue;
+					}
+					float fError = ( vUVs[ vIdx[j] ] - Wml::Vector2f( vU[j], vV[j] ) ).Length() / vRadius[i];
+					fMaxError = std::max( fMaxError, fError );
+				}
+			}
+		}
+		double fSeconds = BenchAccumSeconds(10);
+		std::cerr << "    " << ((nPass == 0) ? "scalar     " : "vectorized ") << " : " << fSeconds << "s  ";
+		if ( fSeconds > 0 )
+			std::cerr << (fParticles / fSeconds) / 1.0e6 << " M particles/s";
+		std::cerr << std::endl;
+	}
+
+	bool bOK = ( fMaxError <= fTolerance && nCountMismatches == 0 );
+	std::cerr << "    max UV difference : " << fMaxError << " x radius, " << nCountMismatches << " expmaps with different vertices  "
+			  << (bOK ? "[OK]" : "[FAILED]") << std::endl;
+	return bOK;
+}
+
+
+
+bool rms::BenchmarkExpMapVoronoi( const VFTriangleMesh & mesh, unsigned int nMaxSeeds, float fTolerance )
+{
+	VFTriangleMesh vfmesh(mesh);
+	IMeshBVTree bvTree;
+	bvTree.SetMesh(&vfmesh);
+	bvTree.SetBuildMode( IMeshBVTree::FlatSAHBuild );
+	bvTree.Build();
+	ExpMapGenerator expmapgen;
+	expmapgen.SetSurface(&vfmesh, &bvTree);
+	unsigned int nVertices = vfmesh.GetVertexCount();
+	unsigned int nMaxID = vfmesh.GetMaxVertexID();
+
+	srand(31337);
+	std::vector<Frame3f> vAllSeeds;
+	while ( vAllSeeds.size() < nMaxSeeds ) {
+		IMesh::VertexID vID = rand() % nMaxID;
+		if ( ! vfmesh.IsVertex(vID) )
+			continue;
+		Wml::Vector3f vVertex, vNormal;
+		vfmesh.GetVertex(vID, vVertex, &vNormal);
+		vAllSeeds.push_back( Frame3f(vVertex, vNormal) );
+	}
+
+	ExpMapVoronoi voronoi;
+	voronoi.Initialize(expmapgen);
+	std::cerr << "[BenchmarkExpMapVoronoi] " << nVertices << " vertices, up to " << nMaxSeeds << " seeds" << std::endl;
+
+	// reference is one dense expmap per seed, keeping the nearest seed (and its UV) at each vertex. Upwind
+	// averaging is off, so the single-front UVs should match exactly away from distance ties
+	std::vector<float> vDistances, vBestDist, vU, vV;
+	std::vector<unsigned int> vIdx, vBestSeed;
+	std::vector<Wml::Vector2f> vBestUV;
+	std::vector<Frame3f> vSeeds;
+	std::vector<ExpMapUVSet> vUVSets;
+	Segmentation segmentation(&vfmesh);
+	std::vector<Segmentation::SegmentID> vSegmentIDs;
+	float fMaxError = 0.0f;
+	for ( unsigned int nSeeds = 1; nSeeds <= nMaxSeeds; nSeeds *= 4 ) {
+		vSeeds.assign( vAllSeeds.begin(), vAllSeeds.begin() + nSeeds );
+
+		vBestDist.assign( nMaxID, std::numeric_limits<float>::max() );
+		vBestSeed.assign( nMaxID, ExpMapParticle::InvalidIndex );
+		vBestUV.assign( nMaxID, Wml::Vector2f::ZERO );
+		_RMSTUNE_start(10);
+		for ( unsigned int i = 0; i < nSeeds; ++i ) {
+			expmapgen.SetSurfaceDistances( vSeeds[i], 0.0f, nVertices );
+			expmapgen.GetVertexDistances( vDistances );
+			vIdx.resize(0); vU.resize(0); vV.resize(0);
+			expmapgen.GetVertexUVs( vIdx, vU, vV );
+			for ( unsigned int j = 0; j < vIdx.size(); ++j ) {
+				unsigned int vID = vIdx[j];
+				if ( vDistances[vID] < vBestDist[vID] ) {
+					vBestDist[vID] = vDistances[vID];
+					vBestSeed[vID] = i;
+					vBestUV[vID] = Wml::Vector2f( vU[j], vV[j] );
+				}
+			}
+		}
+		_RMSTUNE_end(10);
+		double fRefSeconds = BenchSeconds(10);
+
+		_RMSTUNE_start(10);
+		voronoi.Compute( vSeeds );
+		voronoi.GetSegmentation( segmentation, vSegmentIDs );
+		voronoi.GetSegmentUVs( vUVSets );
+		_RMSTUNE_end(10);
+		double fSeconds = BenchSeconds(10);
+
+		unsigned int nLabelMismatches = 0;
+		for ( unsigned int vID = 0; vID < nMaxID; ++vID ) {
+			if ( voronoi.GetVertexSeed(vID) != vBestSeed[vID] ) {
+				++nLabelMismatches;
+				continue;
+			}
+			if ( vBestSeed[vID] == ExpMapParticle::InvalidIndex )
+				continue;
+			float fError = ( voronoi.GetVertexUV(vID) - vBestUV[vID] ).Length() / ( vBestDist[vID] + 1.0e-6f );
+			fMaxError = std::max( fMaxError, fError );
+		}
+		size_t nCharts = 0, nChartVerts = 0;
+		for ( unsigned int i = 0; i < nSeeds; ++i ) {
+			nCharts += ( segmentation.GetSet( vSegmentIDs[i] ).empty() ) ? 0 : 1;
+			nChartVerts += vUVSets[i].vIDs.size();
+		}
+
+		std::cerr << "    " << nSeeds << " seed(s) : per-seed expmaps " << fRefSeconds << "s,  single front " << fSeconds 
+				  << "s  (" << nCharts << " charts, " << nChartVerts << " chart vertices)   [" << nLabelMismatches << "]" << std::endl;
+	}
+
+	bool bOK = ( fMaxError <= fTolerance );
+	std::cerr << "    max UV difference : " << fMaxError << " x distance  " << (bOK ? "[OK]" : "[FAILED]") << std::endl;
+	return bOK;
+}
+
+
+
+bool rms::BenchmarkExpMapSurfaceCache( const VFTriangleMesh & mesh, unsigned int nGenerators, unsigned int nExpMaps )
+{
+	VFTriangleMesh vfmesh(mesh);
+	IMeshBVTree bvTree;
+	bvTree.SetMesh(&vfmesh);
+	bvTree.SetBuildMode( IMeshBVTree::FlatSAHBuild );
+	bvTree.Build();
+
+	srand(31337);
+	std::vector<Frame3f> vSeeds;
+	while ( vSeeds.size() < nExpMaps ) {
+		IMesh::VertexID vID = rand() % vfmesh.GetMaxVertexID();
+		if ( ! vfmesh.IsVertex(vID) )
+			continue;
+		Wml::Vector3f vVertex, vNormal;
+		vfmesh.GetVertex(vID, vVertex, &vNormal);
+		vSeeds.push_back( Frame3f(vVertex, vNormal) );
+	}
+	std::cerr << "[BenchmarkExpMapSurfaceCache] " << vfmesh.GetVertexCount() << " vertices, " << nGenerators 
+			  << " generators, " << nExpMaps << " expmaps each" << std::endl;
+
+	// same expmaps on every generator. Pass 0 has per-generator neighbour lists, pass 1 one shared cache
+	std::vector<unsigned int> vIdx;
+	std::vector<float> vU, vV, vSums[2];
+	for ( int nPass = 0; nPass < 2; ++nPass ) {
+		vSums[nPass].resize( 2*nGenerators*nExpMaps );
+		std::vector<ExpMapGenerator> vGenerators( nGenerators );
+		ExpMapSurfaceCache * pCache = NULL;
+
+		_RMSTUNE_start(10);
+		if ( nPass == 1 )
+			pCache = ExpMapSurfaceCache::Acquire( &vfmesh );
+		for ( unsigned int i = 0; i < nGenerators; ++i ) {
+			vGenerators[i].SetSurface( &vfmesh, &bvTree );
+			if ( pCache )
+				vGenerators[i].SetSurfaceCache( pCache );
+			vGenerators[i].SetSurfaceDistances( vSeeds[0], 0.0f, 1 );		// builds neighbour lists if necessary
+		}
+		_RMSTUNE_end(10);
+		double fSetupSeconds = BenchSeconds(10);
+
+		// shared cache memory is only counted once
+		size_t nBytes = ( pCache ) ? pCache->GetMemoryUsage() : 0;
+		for ( unsigned int i = 0; i < nGenerators; ++i ) {
+			nBytes += vGenerators[i].GetMemoryUsage();
+			if ( pCache )
+				nBytes -= pCache->GetMemoryUsage();
+		}
+
+		for ( unsigned int i = 0; i < nGenerators; ++i ) {
+			for ( unsigned int j = 0; j < nExpMaps; ++j ) {
+				vGenerators[i].SetSurfaceDistances( vSeeds[j], 0.0f, vfmesh.GetVertexCount() );
+				vIdx.resize(0); vU.resize(0); vV.resize(0);
+				vGenerators[i].GetVertexUVs( vIdx, vU, vV );
+				unsigned int k = i*nExpMaps + j;
+				ExpMapChecksums( vIdx, vU, vV, vSums[nPass][2*k], vSums[nPass][2*k+1] );
+			}
+		}
+		if ( pCache )
+			pCache->Release();
+
+		std::cerr << "    " << ((nPass == 0) ? "per-generator setup " : "shared cache        ") << " : " << fSetupSeconds << "s  " 
+				  << (double)nBytes / (double)vfmesh.GetVertexCount() << " bytes/vertex   [" << CountMismatches(vSums[nPass], vSums[0]) << "]" << std::endl;
+	}
+
+	return CountMismatches(vSums[1], vSums[0]) == 0;
+}
+
+
+
+// resident set size of the process, or 0 where it is not available
+static size_t ResidentBytes()
+{
+#ifdef __linux__
+	FILE * pFile = fopen("/proc/self/statm", "r");
+	if ( pFile == NULL )
+		return 0;
+	unsigned long nSize = 0, nResident = 0;
+	int nRead = fscanf(pFile, "%lu %lu", &nSize, &nResident);
+	fclose(pFile);
+	return ( nRead == 2 ) ? (size_t)nResident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+	return 0;
+#endif
+}
+
+// system rows are the mesh vertices, in iteration order
+static void MakeVertexIndex( VFTriangleMesh & mesh, std::vector<IMesh::VertexID> & vIDs, std::vector<unsigned int> & vIndex )
+{
+	vIDs.resize(0);
+	vIndex.resize( mesh.GetMaxVertexID(), 0 );
+	VFTriangleMesh::vertex_iterator curv(mesh.BeginVertices()), endv(mesh.EndVertices());
+	while ( curv != endv ) {
+		vIndex[*curv] = (unsigned int)vIDs.size();
+		vIDs.push_back(*curv);
+		++curv;
+	}
+}
+
+// RHS = A * (vertex positions), so that the exact solution is the mesh
+static void SetPositionRHS( VFTriangleMesh & mesh, const std::vector<IMesh::VertexID> & vIDs, gsi::SparseLinearSystem & system )
+{
+	unsigned int nRows = (unsigned int)vIDs.size();
+	system.ResizeRHS(3);
+	for ( int k = 0; k < 3; ++k ) {
+		gsi::Vector vPos(nRows), vRHS(nRows);
+		for ( unsigned int i = 0; i < nRows; ++i ) {
+			Wml::Vector3f vVertex;
+			mesh.GetVertex(vIDs[i], vVertex);
+			vPos[i] = vVertex[k];
+		}
+		system.Matrix().Multiply(vPos, vRHS);
+		system.SetRHS(k, vRHS);
+	}
+}
+
+static double MaxPositionError( VFTriangleMesh & mesh, const std::vector<IMesh::VertexID> & vIDs, const gsi::SparseLinearSystem & system )
+{
+	double fMaxErr = 0;
+	for ( unsigned int i = 0; i < (unsigned int)vIDs.size(); ++i ) {
+		Wml::Vector3f vVertex;
+		mesh.GetVertex(vIDs[i], vVertex);
+		for ( int k = 0; k < 3; ++k )
+			fMaxErr = std::max( fMaxErr, fabs(system.GetSolution(i, k) - (double)vVertex[k]) );
+	}
+	return fMaxErr;
+}
+
+// factor + solve and re-solve times of each backend on one system
+static bool CompareSolverBackends( const char * pLabel, VFTriangleMesh & mesh, const std::vector<IMesh::VertexID> & vIDs,
+								   gsi::SparseLinearSystem & system, SparseLinearSolver::Factorization eFactor, unsigned int nSolves )
+{
+	bool bAllOK = true;
+	std::cerr << "  " << pLabel << " (" << system.Matrix().CountNonZeros() << " non-zeros)" << std::endl;
+	// TAUCS, then the Eigen backend with each of its orderings
+	const char * pNames[3] = { "TAUCS/UMFPACK           ", "Eigen, nested dissection", "Eigen, minimum degree   " };
+	for ( int nBackend = 0; nBackend < 3; ++nBackend ) {
+		SparseLinearSolver::Backend eBackend = (nBackend == 0) ? SparseLinearSolver::Backend_TAUCS : SparseLinearSolver::Backend_Eigen;
+		SparseLinearSolver solver(&system);
+		solver.SetBackend(eBackend);
+		solver.SetOrdering( (nBackend == 2) ? SparseLinearSolver::Ordering_MinimumDegree : SparseLinearSolver::Ordering_NestedDissection );
+		solver.SetFactorization(eFactor);
+		solver.SetStoreFactorization(true);
+
+		size_t nResident = ResidentBytes();
+		_RMSTUNE_start(11);
+		bool bOK = solver.Solve();
+		_RMSTUNE_end(11);
+		double fFactorSeconds = BenchSeconds(11);
+		size_t nResidentFactored = ResidentBytes();
+		double fError = MaxPositionError(mesh, vIDs, system);
+
+		_RMSTUNE_start(12);
+		for ( unsigned int k = 0; k < nSolves && bOK; ++k )
+			bOK = solver.Solve();
+		_RMSTUNE_end(12);
+
+		std::cerr << "    " << pNames[nBackend] << "  factor+solve : " << fFactorSeconds << "s   solve : "
+				  << 1000.0 * BenchSeconds(12) / (double)nSolves << "ms   memory : ";
+		if ( nResident > 0 && nResidentFactored >= nResident )
+			std::cerr << (double)(nResidentFactored - nResident) / (1024.0*1024.0) << "MB";
+		else
+			std::cerr << "n/a";
+		if ( eBackend == SparseLinearSolver::Backend_Eigen )
+			std::cerr << " (factors " << (double)solver.GetMemoryUsage() / (1024.0*1024.0) << "MB, " << solver.GetFactorNonZeros() << " non-zeros)";
+		std::cerr << "   max error : " << fError << ( (bOK) ? "" : "   FAILED" ) << std::endl;
+		bAllOK = bAllOK && bOK;
+	}
+	return bAllOK;
+}
+
+
+bool rms::BenchmarkSparseSolvers( const VFTriangleMesh & mesh, unsigned int nSolves, unsigned int nConstraintSpacing )
+{
+	VFTriangleMesh vfmesh(mesh);
+	std::vector<IMesh::VertexID> vIDs;
+	std::vector<unsigned int> vIndex;
+	MakeVertexIndex(vfmesh, vIDs, vIndex);
+	unsigned int nRows = (unsigned int)vIDs.size();
+	std::cerr << "[BenchmarkSparseSolvers] " << nRows << " vertices, constraint at every " << nConstraintSpacing << "th vertex" << std::endl;
+
+	std::vector<IMesh::VertexID> vOneRing;
+	std::vector<float> vWeights;
+	bool bOK = true;
+
+	// LaplacianDeformer-style system: (L^T L + W^2), uniform graph laplacian L and soft constraints
+	{
+		gsi::SparseMatrix L(nRows, nRows);
+		for ( unsigned int i = 0; i < nRows; ++i ) {
+			vfmesh.VertexOneRing(vIDs[i], vOneRing);
+			for ( unsigned int j = 0; j < vOneRing.size(); ++j )
+				L.Set( i, vIndex[vOneRing[j]], -1.0 );
+			L.Set( i, i, (double)vOneRing.size() );
+		}
+		gsi::SparseLinearSystem system(nRows, nRows);
+		L.Multiply(L, system.Matrix());
+		for ( unsigned int i = 0; i < nRows; i += nConstraintSpacing )
+			system.Set( i, i, system.Get(i,i) + 1.0 );
+		SetPositionRHS(vfmesh, vIDs, system);
+		bOK = CompareSolverBackends( "Cholesky, bi-laplacian with soft constraints", vfmesh, vIDs, system, SparseLinearSolver::Factor_Cholesky, nSolves ) && bOK;
+	}
+
+	// MeshVFunctionf-style system: normalized cotangent rows, identity rows at constraints
+	{
+		gsi::SparseLinearSystem system(nRows, nRows);
+		for ( unsigned int i = 0; i < nRows; ++i ) {
+			system.Set( i, i, 1.0 );
+			if ( i % nConstraintSpacing == 0 )
+				continue;
+			vfmesh.VertexOneRing(vIDs[i], vOneRing, true);
+			VertexWeights::Cotangent(vfmesh, vIDs[i], vOneRing, vWeights);
+			for ( unsigned int j = 0; j < vOneRing.size(); ++j )
+				system.Set( i, vIndex[vOneRing[j]], -vWeights[j] );
+		}
+		SetPositionRHS(vfmesh, vIDs, system);
+		bOK = CompareSolverBackends( "LU, cotangent laplacian with fixed vertices", vfmesh, vIDs, system, SparseLinearSolver::Factor_LU, nSolves ) && bOK;
+	}
+
+	return bOK;
+}
+
+
+// row i of the cotangent laplacian: -w_ij at the one-ring vertices and sum(w_ij) on the diagonal
+static void CotangentRow( VFTriangleMesh & mesh, const std::vector<IMesh::VertexID> & vIDs, const std::vector<unsigned int> & vIndex,
+						  unsigned int i, std::vector<IMesh::VertexID> & vOneRing, std::vector<float> & vWeights,
+						  std::vector<unsigned int> & vColumns, std::vector<double> & vValues )
+{
+	vColumns.resize(0);  vValues.resize(0);
+	mesh.VertexOneRing(vIDs[i], vOneRing, true);
+	double dSum = 0;
+	if ( ! vOneRing.empty() ) {
+		VertexWeights::Cotangent(mesh, vIDs[i], vOneRing, vWeights, false);
+		for ( unsigned int j = 0; j < vOneRing.size(); ++j ) {
+			vColumns.push_back( vIndex[vOneRing[j]] );
+			vValues.push_back( -vWeights[j] );
+			dSum += vWeights[j];
+		}
+	}
+	vColumns.push_back(i);
+	vValues.push_back(dSum);
+}
+
+
+bool rms::BenchmarkSparseAssembly( const VFTriangleMesh & mesh, unsigned int nProducts, unsigned int nConstraintSpacing )
+{
+	VFTriangleMesh vfmesh(mesh);
+	vfmesh.FreezeTopology();
+	std::vector<IMesh::VertexID> vIDs;
+	std::vector<unsigned int> vIndex;
+	MakeVertexIndex(vfmesh, vIDs, vIndex);
+	int nVerts = (int)vIDs.size();
+	int nConstraints = (nVerts + nConstraintSpacing - 1) / nConstraintSpacing;
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	std::cerr << "[BenchmarkSparseAssembly] " << nVerts << " vertices, " << nThreads << " threads" << std::endl;
+
+	// A = [L ; W], the cotangent laplacian with a soft constraint row at every nConstraintSpacing'th vertex,
+	// so that A^T A = L^T L + W^2 is the LaplacianDeformer system
+	int nRows = nVerts + nConstraints;
+	std::vector<IMesh::VertexID> vOneRing;
+	std::vector<float> vWeights;
+	std::vector<unsigned int> vColumns;
+	std::vector<double> vValues;
+
+	_RMSTUNE_start(11);
+	gsi::SparseMatrix A(nRows, nVerts);
+	for ( int i = 0; i < nVerts; ++i ) {
+		CotangentRow(vfmesh, vIDs, vIndex, i, vOneRing, vWeights, vColumns, vValues);
+		for ( unsigned int k = 0; k < vColumns.size(); ++k )
+			A.Set( i, vColumns[k], vValues[k] );
+	}
+	for ( int k = 0; k < nConstraints; ++k )
+		A.Set( nVerts + k, k * nConstraintSpacing, 1.0 );
+	_RMSTUNE_end(11);
+	double fGSIAssembly = BenchSeconds(11);
+
+	// one triplet list per thread
+	_RMSTUNE_start(11);
+	std::vector<SparseTripletList> vLists( nThreads, SparseTripletList(nRows, nVerts) );
+	#pragma omp parallel
+	{
+		int nThread = 0;
+#ifdef _OPENMP
+		nThread = omp_get_thread_num();
+#endif
+		SparseTripletList & triplets = vLists[nThread];
+		triplets.Reserve( 8 * (nVerts / nThreads + 1) );
+		std::vector<IMesh::VertexID> vThreadRing;
+		std::vector<float> vThreadWeights;
+		std::vector<unsigned int> vThreadColumns;
+		std::vector<double> vThreadValues;
+		#pragma omp for schedule(dynamic,256)
+		for ( int i = 0; i < nVerts; ++i ) {
+			CotangentRow(vfmesh, vIDs, vIndex, i, vThreadRing, vThreadWeights, vThreadColumns, vThreadValues);
+			for ( unsigned int k = 0; k < vThreadColumns.size(); ++k )
+				triplets.Add( i, vThreadColumns[k], vThreadValues[k] );
+		}
+	}
+	for ( int k = 0; k < nConstraints; ++k )
+		vLists[0].Add( nVerts + k, k * nConstraintSpacing, 1.0 );
+	_RMSTUNE_start(12);
+	CompressedSparseMatrix C;
+	C.Build( vLists );
+	_RMSTUNE_end(12);
+	_RMSTUNE_end(11);
+	double fAssembly = BenchSeconds(11), fCompress = BenchSeconds(12);
+	std::vector<SparseTripletList>().swap(vLists);
+
+	double fMaxErr = 0;
+	for ( int i = 0; i < nRows; ++i ) {
+		for ( unsigned int p = C.GetOffsets()[i]; p < C.GetOffsets()[i+1]; ++p )
+			fMaxErr = std::max( fMaxErr, fabs( C.GetValues()[p] - A.Get(i, C.GetIndices()[p]) ) );
+	}
+	bool bOK = ( C.NonZeros() == A.CountNonZeros() );
+
+	// A^T A (entries compared relative to their size)
+	_RMSTUNE_start(11);
+	gsi::SparseMatrix At, AtA;
+	A.Transpose(At);
+	At.Multiply(A, AtA);
+	_RMSTUNE_end(11);
+	double fGSINormal = BenchSeconds(11);
+
+	_RMSTUNE_start(11);
+	CompressedSparseMatrix CtC;
+	C.TransposeTimesSelf(CtC, true);
+	_RMSTUNE_end(11);
+	double fNormal = BenchSeconds(11);
+
+	for ( int i = 0; i < nVerts; ++i ) {
+		for ( unsigned int p = CtC.GetOffsets()[i]; p < CtC.GetOffsets()[i+1]; ++p ) {
+			fMaxErr = std::max( fMaxErr, fabs( CtC.GetValues()[p] - AtA.Get(i, CtC.GetIndices()[p]) ) / std::max(fabs(CtC.GetValues()[p]), 1.0) );
+		}
+	}
+
+	// A * x, with x the vertex x coordinates
+	gsi::Vector vX(nVerts), vY(nRows);
+	std::vector<double> vY2(nRows);
+	for ( int i = 0; i < nVerts; ++i ) {
+		Wml::Vector3f vVertex;
+		vfmesh.GetVertex(vIDs[i], vVertex);
+		vX[i] = vVertex.X();
+	}
+	_RMSTUNE_start(11);
+	for ( unsigned int k = 0; k < nProducts; ++k )
+		A.Multiply(vX, vY);
+	_RMSTUNE_end(11);
+	double fGSIProduct = BenchSeconds(11) / (double)nProducts;
+	_RMSTUNE_start(11);
+	for ( unsigned int k = 0; k < nProducts; ++k )
+		C.Multiply(vX.GetValues(), &vY2[0]);
+	_RMSTUNE_end(11);
+	double fProduct = BenchSeconds(11) / (double)nProducts;
+	for ( int i = 0; i < nRows; ++i )
+		fMaxErr = std::max( fMaxErr, fabs(vY[i] - vY2[i]) );
+
+	std::cerr << "  A = [cotangent laplacian ; constraints], " << C.NonZeros() << " non-zeros, A^T A lower triangle " << CtC.NonZeros() << " non-zeros" << std::endl;
+	std::cerr << "    gsi::SparseMatrix        assembly : " << fGSIAssembly << "s   A^T A : " << fGSINormal << "s   A*x : "
+			  << 1000.0 * fGSIProduct << "ms" << std::endl;
+	std::cerr << "    CompressedSparseMatrix   assembly : " << fAssembly << "s (compress " << fCompress << "s)   A^T A : " << fNormal << "s   A*x : "
+			  << 1000.0 * fProduct << "ms   memory : " << (double)(C.GetMemoryUsage() + CtC.GetMemoryUsage()) / (1024.0*1024.0) << "MB" << std::endl;
+	std::cerr << "    max difference : " << fMaxErr << ( (bOK && fMaxErr < 1.0e-6) ? "" : "   FAILED" ) << std::endl;
+	bOK = bOK && fMaxErr < 1.0e-6;
+
+	// factor+solve of A^T A from each matrix. The gsi::SparseMatrix is converted by the solver
+	gsi::SparseLinearSystem system(nVerts, nVerts);
+	system.SetMatrix(AtA);
+	SetPositionRHS(vfmesh, vIDs, system);
+	SparseLinearSolver gsiSolver(&system);
+	gsiSolver.SetBackend( SparseLinearSolver::Backend_Eigen );
+	_RMSTUNE_start(11);
+	bool bSolved = gsiSolver.Solve();
+	_RMSTUNE_end(11);
+	double fGSISolve = BenchSeconds(11);
+	double fGSIError = MaxPositionError(vfmesh, vIDs, system);
+
+	std::vector<double> vRHS(3*nVerts), vSolution(3*nVerts);
+	for ( int k = 0; k < 3; ++k )
+		std::copy( system.GetRHS(k).GetValues(), system.GetRHS(k).GetValues() + nVerts, vRHS.begin() + k*nVerts );
+	SparseLinearSolver solver(&CtC);
+	solver.SetBackend( SparseLinearSolver::Backend_Eigen );
+	_RMSTUNE_start(11);
+	bSolved = solver.Solve( &vRHS[0], &vSolution[0], 3 ) && bSolved;
+	_RMSTUNE_end(11);
+	double fSolve = BenchSeconds(11);
+	double fError = 0;
+	for ( int i = 0; i < nVerts; ++i ) {
+		for ( int k = 0; k < 3; ++k )
+			fError = std::max( fError, fabs(vSolution[k*nVerts + i] - system.GetSolution(i, k)) );
+	}
+	std::cerr << "    Eigen factor+solve of A^T A   from gsi::SparseMatrix : " << fGSISolve << "s   from CompressedSparseMatrix : " << fSolve
+			  << "s   max error : " << fGSIError << "   difference : " << fError << ( (bSolved) ? "" : "   FAILED" ) << std::endl;
+
+	return bOK && bSolved;
+}
+
+
+
+// cotangent laplacian of the mesh as triplets, and the vertex positions as three right-hand sides
+static void CotangentSystem( VFTriangleMesh & mesh, const std::vector<IMesh::VertexID> & vIDs, const std::vector<unsigned int> & vIndex,
+							 SparseTripletList & laplacian, std::vector<double> & vRHS )
+{
+	int nVerts = (int)vIDs.size();
+	laplacian.Resize(nVerts, nVerts);
+	laplacian.Clear();
+	std::vector<IMesh::VertexID> vOneRing;
+	std::vector<float> vWeights;
+	std::vector<unsigned int> vColumns;
+	std::vector<double> vValues;
+	for ( int i = 0; i < nVerts; ++i ) {
+		CotangentRow(mesh, vIDs, vIndex, i, vOneRing, vWeights, vColumns, vValues);
+		for ( unsigned int k = 0; k < vColumns.size(); ++k )
+			laplacian.Add( i, vColumns[k], vValues[k] );
+	}
+
+	vRHS.resize(3*nVerts);
+	for ( int i = 0; i < nVerts; ++i ) {
+		Wml::Vector3f vVertex;
+		mesh.GetVertex(vIDs[i], vVertex);
+		for ( int k = 0; k < 3; ++k )
+			vRHS[k*nVerts + i] = vVertex[k];
+	}
+}
+
+// lower triangle of L^T L + W^2, where W has a row for each vertex with non-zero vConstraintWeights[i]
+static void ConstrainedNormalMatrix( const SparseTripletList & laplacian, const std::vector<double> & vConstraintWeights,
+									 CompressedSparseMatrix & M )
+{
+	unsigned int nVerts = laplacian.Columns();
+	SparseTripletList triplets(laplacian);
+	unsigned int nRows = nVerts;
+	for ( unsigned int i = 0; i < nVerts; ++i ) {
+		if ( vConstraintWeights[i] != 0 )
+			triplets.Add( nRows++, i, vConstraintWeights[i] );
+	}
+	triplets.Resize( nRows, nVerts );
+	CompressedSparseMatrix A;
+	A.Build(triplets);
+	A.TransposeTimesSelf(M, true);
+}
+
+
+bool rms::BenchmarkSparseRefactor( const VFTriangleMesh & mesh, unsigned int nWeightChanges, unsigned int nConstraintSpacing )
+{
+	VFTriangleMesh vfmesh(mesh);
+	vfmesh.FreezeTopology();
+	std::vector<IMesh::VertexID> vIDs;
+	std::vector<unsigned int> vIndex;
+	MakeVertexIndex(vfmesh, vIDs, vIndex);
+	int nVerts = (int)vIDs.size();
+	int nConstraints = (nVerts + nConstraintSpacing - 1) / nConstraintSpacing;
+	std::cerr << "[BenchmarkSparseRefactor] " << nVerts << " vertices, " << nConstraints << " constraints" << std::endl;
+
+	SparseTripletList laplacian;
+	std::vector<double> vRHS, vSolution(3*nVerts), vFullSolution(3*nVerts);
+	CotangentSystem(vfmesh, vIDs, vIndex, laplacian, vRHS);
+
+	// the system matrix of each weight change is rebuilt before the timers start
+	CompressedSparseMatrix M;
+	SparseLinearSolver solver(&M);
+	solver.SetBackend( SparseLinearSolver::Backend_Eigen );
+	solver.SetStoreFactorization(true);
+	double fFirst = 0, fFull = 0, fNumeric = 0, fMaxDiff = 0;
+	bool bOK = true;
+	std::vector<double> vConstraintWeights(nVerts, 0.0);
+	for ( unsigned int nChange = 0; nChange <= nWeightChanges; ++nChange ) {
+		for ( int k = 0; k < nConstraints; ++k )
+			vConstraintWeights[k * nConstraintSpacing] = 1.0 + 0.5 * (double)((k + nChange) % 4);
+		ConstrainedNormalMatrix(laplacian, vConstraintWeights, M);
+
+		_RMSTUNE_start(11);
+		solver.OnMatrixChanged();
+		bOK = solver.Solve( &vRHS[0], &vSolution[0], 3 ) && bOK;
+		_RMSTUNE_end(11);
+		if ( nChange == 0 ) {
+			fFirst = BenchSeconds(11);
+			continue;
+		}
+		fNumeric += BenchSeconds(11);
+		bOK = bOK && solver.HasSymbolicFactorization();
+
+		_RMSTUNE_start(11);
+		SparseLinearSolver fullSolver(&M);
+		fullSolver.SetBackend( SparseLinearSolver::Backend_Eigen );
+		bOK = fullSolver.Solve( &vRHS[0], &vFullSolution[0], 3 ) && bOK;
+		_RMSTUNE_end(11);
+		fFull += BenchSeconds(11);
+
+		for ( int i = 0; i < 3*nVerts; ++i )
+			fMaxDiff = std::max( fMaxDiff, fabs(vSolution[i] - vFullSolution[i]) );
+	}
+	double fScale = (nWeightChanges > 0) ? 1.0 / (double)nWeightChanges : 0.0;
+	bOK = bOK && fMaxDiff < 1.0e-6;
+
+	std::cerr << "  L^T L + W^2, " << M.NonZeros() << " non-zeros in lower triangle, " << solver.GetFactorNonZeros() << " in L" << std::endl;
+	std::cerr << "    first factor+solve : " << fFirst << "s" << std::endl;
+	std::cerr << "    after a weight change    full refactor+solve : " << fFull * fScale << "s   numeric refactor+solve : "
+			  << fNumeric * fScale << "s   max difference : " << fMaxDiff << ( (bOK) ? "" : "   FAILED" ) << std::endl;
+
+	return bOK;
+}
+
+
+
+bool rms::BenchmarkSparseUpdate( const VFTriangleMesh & mesh, unsigned int nChanges, unsigned int nConstraintSpacing )
+{
+	VFTriangleMesh vfmesh(mesh);
+	vfmesh.FreezeTopology();
+	std::vector<IMesh::VertexID> vIDs;
+	std::vector<unsigned int> vIndex;
+	MakeVertexIndex(vfmesh, vIDs, vIndex);
+	int nVerts = (int)vIDs.size();
+	std::cerr << "[BenchmarkSparseUpdate] " << nVerts << " vertices" << std::endl;
+
+	SparseTripletList laplacian;
+	std::vector<double> vRHS, vSolution(3*nVerts), vUpdateSolution(3*nVerts);
+	CotangentSystem(vfmesh, vIDs, vIndex, laplacian, vRHS);
+
+	std::vector<double> vConstraintWeights(nVerts, 0.0);
+	for ( int i = 0; i < nVerts; i += nConstraintSpacing )
+		vConstraintWeights[i] = 1.0;
+	CompressedSparseMatrix M;
+	ConstrainedNormalMatrix(laplacian, vConstraintWeights, M);
+
+	// both solvers keep their symbolic factorization, refactor only repeats the numeric phase
+	SparseLinearSolver refactor(&M), update(&M);
+	refactor.SetBackend( SparseLinearSolver::Backend_Eigen );
+	refactor.SetStoreFactorization(true);
+	update.SetBackend( SparseLinearSolver::Backend_Eigen );
+	update.SetStoreFactorization(true);
+	bool bOK = refactor.Solve( &vRHS[0], &vSolution[0], 3 );
+	bOK = update.Solve( &vRHS[0], &vUpdateSolution[0], 3 ) && bOK;
+
+	// toggle a constraint, alternately at a spread-out vertex and at one of the initially constrained vertices
+	double fRefactor = 0, fUpdate = 0, fMaxDiff = 0;
+	unsigned int nInPlace = 0;
+	for ( unsigned int nChange = 0; nChange < nChanges; ++nChange ) {
+		unsigned int i = ( nChange % 2 == 0 ) ? (nChange * 7919 + 1) % nVerts : ((nChange * 7919) % nVerts / nConstraintSpacing) * nConstraintSpacing;
+		double fNewWeight = ( vConstraintWeights[i] == 0 ) ? 2.0 : 0.0;
+		double dDelta = fNewWeight*fNewWeight - vConstraintWeights[i]*vConstraintWeights[i];
+		vConstraintWeights[i] = fNewWeight;
+		ConstrainedNormalMatrix(laplacian, vConstraintWeights, M);
+
+		_RMSTUNE_start(11);
+		refactor.OnMatrixChanged();
+		bOK = refactor.Solve( &vRHS[0], &vSolution[0], 3 ) && bOK;
+		_RMSTUNE_end(11);
+		fRefactor += BenchSeconds(11);
+
+		_RMSTUNE_start(11);
+		if ( update.UpdateDiagonal( 1, &i, &dDelta ) )
+			++nInPlace;
+		bOK = update.Solve( &vRHS[0], &vUpdateSolution[0], 3 ) && bOK;
+		_RMSTUNE_end(11);
+		fUpdate += BenchSeconds(11);
+
+		for ( int k = 0; k < 3*nVerts; ++k )
+			fMaxDiff = std::max( fMaxDiff, fabs(vSolution[k] - vUpdateSolution[k]) );
+	}
+	double fScale = (nChanges > 0) ? 1.0 / (double)nChanges : 0.0;
+	bOK = bOK && fMaxDiff < 1.0e-6;
+
+	std::cerr << "  L^T L + W^2, " << M.NonZeros() << " non-zeros in lower triangle, " << update.GetFactorNonZeros() << " in L, "
+			  << nInPlace << "/" << nChanges << " changes updated in place" << std::endl;
+	std::cerr << "    add/remove a constraint    numeric refactor+solve : " << fRefactor * fScale << "s   rank-1 update+solve : "
+			  << fUpdate * fScale << "s   max difference : " << fMaxDiff << ( (bOK) ? "" : "   FAILED" ) << std::endl;
+
+	return bOK;
+}
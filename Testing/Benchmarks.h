@@ -0,0 +1,83 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+#ifndef __RMS_BENCHMARKS_H__
+#define __RMS_BENCHMARKS_H__
+
+#include "VFTriangleMesh.h"
+
+namespace rms {
+
+/*
+ * Performance comparisons between alternate implementations. Results are printed to std::cerr.
+ */
+
+//! throughput of FindNeighbours, ordered one-rings, vertex-triangle iteration and boundary tests,
+//! for VFTriangleMesh (with and without frozen topology) and DirectedEdgeMesh
+void BenchmarkMeshNeighbourQueries( const VFTriangleMesh & mesh, int nRounds = 200 );
+
+//! throughput of IMeshBVTree FindNearest and FindRayIntersection. Compares the lazy tree, single queries
+//! on the flat SAH tree, and the batched (Morton-sorted, packet, multi-threaded) queries. Flat tree results
+//! are also checked against brute force over all triangles for a sample of the queries
+void BenchmarkBVTreeQueries( const VFTriangleMesh & mesh, unsigned int nQueries = 200000 );
+
+//! IMeshBVTree::Refit after large local deformations (which make the flat tree rebuild degraded subtrees)
+//! and after a topology change, vs building a new flat tree. Returns false if nearest-point or ray results
+//! of the refit trees differ from the new tree
+bool BenchmarkBVTreeRefit( const VFTriangleMesh & mesh, unsigned int nSteps = 10, unsigned int nQueries = 20000 );
+
+//! throughput of PointKdTree KNearest and RadiusSearch over the mesh vertices, compared to
+//! brute force (on a subset of the queries) and to ParticleGrid box iteration
+void BenchmarkPointQueries( const VFTriangleMesh & mesh, unsigned int nQueries = 100000, unsigned int k = 15 );
+
+//! dense expmap throughput (particles/sec) of ExpMapGenerator with the original std::multiset front 
+//! and with the indexed heap. nMaxCount = 0 propagates over the whole mesh
+void BenchmarkExpMap( const VFTriangleMesh & mesh, unsigned int nExpMaps = 10, unsigned int nMaxCount = 0 );
+
+//! many small expmaps (decal-sized), one at a time with ExpMapGenerator and in parallel with ExpMapBatch
+//! (single thread and all threads)
+void BenchmarkExpMapBatch( const VFTriangleMesh & mesh, unsigned int nSeeds = 5000, unsigned int nMaxCount = 2000 );
+
+//! interactive decal editing: a sequence of small rotations and radius changes of one expmap (radius
+//! fRadiusScale times the average edge length), recomputed each time vs updated incrementally
+void BenchmarkExpMapEdit( const VFTriangleMesh & mesh, unsigned int nSteps = 200, float fRadiusScale = 30.0f );
+
+//! small expmaps (radius fRadiusScale times the average edge length) on a freshly initialized generator, 
+//! with whole-mesh precomputation vs localized queries. Reports the first query (which includes any
+//! precomputation) separately from the rest
+void BenchmarkExpMapLocalized( const VFTriangleMesh & mesh, unsigned int nQueries = 1000, float fRadiusScale = 5.0f );
+
+//! dense expmaps with upwind averaging, scalar propagation vs ExpMapUpwindKernel (SSE/AVX). Also a regression
+//! test: prints FAILED (and returns false) if any UV differs by more than fTolerance times the expmap radius
+bool BenchmarkExpMapVectorized( const VFTriangleMesh & mesh, unsigned int nExpMaps = 10, unsigned int nMaxCount = 0,
+								float fTolerance = 1.0e-4f );
+
+//! geodesic Voronoi charts for 1, 4, 16... nMaxSeeds seeds: one dense expmap per seed (keeping the nearest
+//! seed at each vertex) vs a single ExpMapVoronoi front. Prints FAILED (and returns false) if the UV of a 
+//! vertex with the same nearest seed differs by more than fTolerance times its distance
+bool BenchmarkExpMapVoronoi( const VFTriangleMesh & mesh, unsigned int nMaxSeeds = 64, float fTolerance = 1.0e-4f );
+
+//! setup time and memory of nGenerators expmap generators over one mesh, each computing its own neighbour
+//! lists vs all attached to one ExpMapSurfaceCache. Returns false if their expmaps differ
+bool BenchmarkExpMapSurfaceCache( const VFTriangleMesh & mesh, unsigned int nGenerators = 8, unsigned int nExpMaps = 4 );
+
+//! factor+solve time, re-solve time and memory of the TAUCS/UMFPACK and Eigen SparseLinearSolver backends (the latter
+//! with both of its orderings), on a bi-laplacian (Cholesky) and a cotangent laplacian (LU) system whose solution is
+//! the mesh. Returns false if a solve fails
+bool BenchmarkSparseSolvers( const VFTriangleMesh & mesh, unsigned int nSolves = 10, unsigned int nConstraintSpacing = 50 );
+
+//! cotangent laplacian L assembly, L^T L and L*x with gsi::SparseMatrix vs (parallel) SparseTripletList and CompressedSparseMatrix,
+//! and Eigen-backend factor+solve of L^T L + W^2 from each. Returns false if the results differ
+bool BenchmarkSparseAssembly( const VFTriangleMesh & mesh, unsigned int nProducts = 10, unsigned int nConstraintSpacing = 50 );
+
+//! Eigen-backend refactorization of L^T L + W^2 after nWeightChanges changes of the constraint weights W, with a new
+//! solver each time (full analysis) vs one solver that keeps its symbolic factorization. Returns false if the solutions differ
+bool BenchmarkSparseRefactor( const VFTriangleMesh & mesh, unsigned int nWeightChanges = 5, unsigned int nConstraintSpacing = 50 );
+
+//! adding or removing one constraint of L^T L + W^2 nChanges times, Eigen-backend numeric refactorization vs rank-1
+//! update of the stored factorization (SparseLinearSolver::UpdateDiagonal). Returns false if the solutions differ
+bool BenchmarkSparseUpdate( const VFTriangleMesh & mesh, unsigned int nChanges = 10, unsigned int nConstraintSpacing = 50 );
+
+}  // end namespace rms
+
+#endif // __RMS_BENCHMARKS_H__
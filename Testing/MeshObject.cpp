@@ -100,6 +100,12 @@ void MeshObject::NotifyMeshModified()
 	m_bExpMapValid = false;
 }
 
+void MeshObject::NotifyMeshDeformed()
+{
+	m_expmapgen.NotifySurfaceDeformed();		// also refits m_bvTree
+	m_bExpMapValid = false;
+}
+
 
 
 bool MeshObject::FindIntersection( Wml::Ray3f & vRay, Wml::Vector3f & vHit, Wml::Vector3f & vHitNormal )
@@ -353,6 +359,7 @@ void MeshObject::AddNoise(float fConstant)
 		float fDelta = (vVertex - vNoisyVertex).Length();
                 _RMSInfo("Noise Delta %d: %f  %f\n", vID, fDelta, fNoise);
 	}
+	NotifyMeshDeformed();
 }
 
 
@@ -438,7 +445,7 @@ void MeshObject::Smooth()
         _RMSInfo("Final Deltas: %f %f\n", fErrSum, fRealErrSum);
   printf("Final Deltas: %f %f\n", fErrSum, fRealErrSum);
 
-	m_bExpMapValid = false;
+	NotifyMeshDeformed();
 
 }
 
@@ -475,6 +482,7 @@ void MeshObject::RestoreOriginal()
 			m_vOrigVerts[vID] = vCur;
 		}
 	}
+	NotifyMeshDeformed();
 }
 
 
@@ -21,6 +21,7 @@ public:
 	void ReadMeshOBJ( const char * pFilename );
 	void SetMesh( rms::VFTriangleMesh & mesh );
 	void NotifyMeshModified();
+	void NotifyMeshDeformed();		// vertices moved, topology unchanged (refits instead of rebuilding)
 
 	void Render(bool bWireframe = false, bool bFlatShading = false, 
 				bool bUseScalarColors = false, 
@@ -7,6 +7,7 @@
 
 #include "MeshObject.h"
 #include "ExtendedWmlCamera.h"
+#include "Benchmarks.h"
 #include <rmsprofile.h>
 
 #ifdef WIN_32
@@ -323,7 +324,78 @@ void print_usage()
 		      << "expmapCL [filename] [nbrtype] [nbrsize1] [nbrsize2]" << std::endl
 		      << "[nbrtype] = \'g\'   -->  [nbrsize1] = geodesic radius" << std::endl
 		      << "[nbrtype] = \'k\'   -->  [nbrsize1] = number of nbrs" << std::endl
-		      << "[nbrtype] = \'h\'   -->  [nbrsize1] = geo radius, [nbrsize2] = knbrs" << std::endl;
+		      << "[nbrtype] = \'h\'   -->  [nbrsize1] = geo radius, [nbrsize2] = knbrs" << std::endl
+		      << "expmapCL -bench [benchmark] [filename]" << std::endl
+		      << "[benchmark] = mesh     -->  mesh neighbour queries, VFTriangleMesh vs DirectedEdgeMesh" << std::endl
+		      << "              bvtree   -->  IMeshBVTree nearest-point and ray queries, single vs batched" << std::endl
+		      << "              refit    -->  IMeshBVTree refit after deformation vs rebuild (fails if query results differ)" << std::endl
+		      << "              points   -->  PointKdTree k-nearest and radius queries vs brute force and ParticleGrid" << std::endl
+		      << "              expmap   -->  dense ExpMapGenerator throughput, std::multiset front vs indexed heap" << std::endl
+		      << "              batch    -->  many small expmaps, ExpMapGenerator vs parallel ExpMapBatch" << std::endl
+		      << "              edit     -->  expmap rotate/scale edits, full recompute vs incremental update" << std::endl
+		      << "              local    -->  small expmaps, whole-mesh precomputation vs localized queries" << std::endl
+		      << "              simd     -->  upwind-averaged expmaps, scalar vs SSE/AVX propagation (fails if results differ)" << std::endl
+		      << "              voronoi  -->  geodesic Voronoi charts, one expmap per seed vs single multi-seed front" << std::endl
+		      << "              cache    -->  many generators on one mesh, own neighbour lists vs shared ExpMapSurfaceCache" << std::endl
+		      << "              solver   -->  sparse direct solves, TAUCS/UMFPACK vs in-tree Eigen backend" << std::endl
+		      << "              assembly -->  cotangent laplacian assembly and products, gsi::SparseMatrix vs CompressedSparseMatrix" << std::endl
+		      << "              refactor -->  constraint weight changes, full refactorization vs reused symbolic factorization" << std::endl
+		      << "              update   -->  constraint add/remove, numeric refactorization vs rank-1 factorization update" << std::endl;
+}
+
+
+int run_benchmark( const char * pBenchmark, const char * pFilename )
+{
+	rms::VFTriangleMesh mesh;
+	std::string err;
+	if ( ! mesh.ReadOBJ(pFilename, err) ) {
+		std::cerr << "[expmapCL] error: could not read OBJ file " << pFilename << std::endl;
+		return -1;
+	}
+
+	if ( strcmp(pBenchmark, "mesh") == 0 ) {
+		rms::BenchmarkMeshNeighbourQueries(mesh);
+	} else if ( strcmp(pBenchmark, "bvtree") == 0 ) {
+		rms::BenchmarkBVTreeQueries(mesh);
+	} else if ( strcmp(pBenchmark, "refit") == 0 ) {
+		if ( ! rms::BenchmarkBVTreeRefit(mesh) )
+			return -1;
+	} else if ( strcmp(pBenchmark, "points") == 0 ) {
+		rms::BenchmarkPointQueries(mesh);
+	} else if ( strcmp(pBenchmark, "expmap") == 0 ) {
+		rms::BenchmarkExpMap(mesh);
+	} else if ( strcmp(pBenchmark, "batch") == 0 ) {
+		rms::BenchmarkExpMapBatch(mesh);
+	} else if ( strcmp(pBenchmark, "edit") == 0 ) {
+		rms::BenchmarkExpMapEdit(mesh);
+	} else if ( strcmp(pBenchmark, "local") == 0 ) {
+		rms::BenchmarkExpMapLocalized(mesh);
+	} else if ( strcmp(pBenchmark, "simd") == 0 ) {
+		if ( ! rms::BenchmarkExpMapVectorized(mesh) )
+			return -1;
+	} else if ( strcmp(pBenchmark, "voronoi") == 0 ) {
+		if ( ! rms::BenchmarkExpMapVoronoi(mesh) )
+			return -1;
+	} else if ( strcmp(pBenchmark, "cache") == 0 ) {
+		if ( ! rms::BenchmarkExpMapSurfaceCache(mesh) )
+			return -1;
+	} else if ( strcmp(pBenchmark, "solver") == 0 ) {
+		if ( ! rms::BenchmarkSparseSolvers(mesh) )
+			return -1;
+	} else if ( strcmp(pBenchmark, "assembly") == 0 ) {
+		if ( ! rms::BenchmarkSparseAssembly(mesh) )
+			return -1;
+	} else if ( strcmp(pBenchmark, "refactor") == 0 ) {
+		if ( ! rms::BenchmarkSparseRefactor(mesh) )
+			return -1;
+	} else if ( strcmp(pBenchmark, "update") == 0 ) {
+		if ( ! rms::BenchmarkSparseUpdate(mesh) )
+			return -1;
+	} else {
+		print_usage();
+		return -1;
+	}
+	return 0;
 }
 
 
@@ -335,6 +407,8 @@ enum EXPMAP_NBR_MODE {
 
 int main(int argc, char ** argv)
 {
+	if ( argc > 3 && strcmp(argv[1], "-bench") == 0 )
+		return run_benchmark(argv[2], argv[3]);
 
 	bool bInteractive = true;
 	if ( bInteractive ) {
@@ -0,0 +1,155 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+#ifndef _RMS_ALIGNED_VECTOR_H
+#define _RMS_ALIGNED_VECTOR_H
+
+#include <cstddef> // 'size_t'
+#include <cstdlib>
+#include <cstring>
+#include "config.h"
+
+#ifdef WIN32
+#include <malloc.h>
+#endif
+
+namespace rms
+{
+
+/*
+ * Growable array whose storage starts on an nAlign-byte boundary (default is one cache line).
+ * Elements are moved with memcpy and are not constructed/destructed, so Type must be a POD struct.
+ */
+template<class Type, size_t nAlign = 64>
+class AlignedVector
+{
+public:
+	AlignedVector() { m_pData = NULL; m_nSize = m_nCapacity = 0; }
+	AlignedVector( const AlignedVector & copy );
+	~AlignedVector() { free_aligned(m_pData); }
+
+	const AlignedVector & operator=( const AlignedVector & copy );
+
+	void clear( bool bFreeMem = false );
+	void reserve( size_t nCount );
+	void resize( size_t nCount );
+	void push_back( const Type & data );
+	void swap( AlignedVector & other );
+
+	size_t size() const { return m_nSize; }
+	bool empty() const { return m_nSize == 0; }
+
+	Type & operator[]( size_t nIndex ) { return m_pData[nIndex]; }
+	const Type & operator[]( size_t nIndex ) const { return m_pData[nIndex]; }
+
+	Type * data() { return m_pData; }
+	const Type * data() const { return m_pData; }
+
+protected:
+	Type * m_pData;
+	size_t m_nSize;
+	size_t m_nCapacity;
+
+	static Type * allocate_aligned( size_t nCount );
+	static void free_aligned( Type * pData );
+};
+
+
+
+template<class Type, size_t nAlign>
+Type * AlignedVector<Type,nAlign>::allocate_aligned( size_t nCount )
+{
+#ifdef WIN32
+	return (Type *)_aligned_malloc( nCount * sizeof(Type), nAlign );
+#else
+	void * pMem = NULL;
+	if ( posix_memalign( &pMem, nAlign, nCount * sizeof(Type) ) != 0 )
+		return NULL;
+	return (Type *)pMem;
+#endif
+}
+
+template<class Type, size_t nAlign>
+void AlignedVector<Type,nAlign>::free_aligned( Type * pData )
+{
+	if ( pData == NULL )
+		return;
+#ifdef WIN32
+	_aligned_free( pData );
+#else
+	free( pData );
+#endif
+}
+
+
+template<class Type, size_t nAlign>
+AlignedVector<Type,nAlign>::AlignedVector( const AlignedVector & copy )
+{
+	m_pData = NULL; m_nSize = m_nCapacity = 0;
+	*this = copy;
+}
+
+template<class Type, size_t nAlign>
+const AlignedVector<Type,nAlign> & AlignedVector<Type,nAlign>::operator=( const AlignedVector & copy )
+{
+	if ( this == &copy )
+		return *this;
+	resize( copy.m_nSize );
+	if ( m_nSize > 0 )
+		memcpy( m_pData, copy.m_pData, m_nSize * sizeof(Type) );
+	return *this;
+}
+
+template<class Type, size_t nAlign>
+void AlignedVector<Type,nAlign>::clear( bool bFreeMem )
+{
+	m_nSize = 0;
+	if ( bFreeMem ) {
+		free_aligned(m_pData);
+		m_pData = NULL;
+		m_nCapacity = 0;
+	}
+}
+
+template<class Type, size_t nAlign>
+void AlignedVector<Type,nAlign>::reserve( size_t nCount )
+{
+	if ( nCount <= m_nCapacity )
+		return;
+	Type * pNew = allocate_aligned( nCount );
+	if ( m_nSize > 0 )
+		memcpy( pNew, m_pData, m_nSize * sizeof(Type) );
+	free_aligned( m_pData );
+	m_pData = pNew;
+	m_nCapacity = nCount;
+}
+
+template<class Type, size_t nAlign>
+void AlignedVector<Type,nAlign>::resize( size_t nCount )
+{
+	if ( nCount > m_nCapacity )
+		reserve( nCount );
+	m_nSize = nCount;
+}
+
+template<class Type, size_t nAlign>
+void AlignedVector<Type,nAlign>::push_back( const Type & data )
+{
+	if ( m_nSize == m_nCapacity )
+		reserve( (m_nCapacity < 16) ? 16 : 2*m_nCapacity );
+	m_pData[m_nSize++] = data;
+}
+
+template<class Type, size_t nAlign>
+void AlignedVector<Type,nAlign>::swap( AlignedVector & other )
+{
+	Type * pData = m_pData;  m_pData = other.m_pData;  other.m_pData = pData;
+	size_t nSize = m_nSize;  m_nSize = other.m_nSize;  other.m_nSize = nSize;
+	size_t nCapacity = m_nCapacity;  m_nCapacity = other.m_nCapacity;  other.m_nCapacity = nCapacity;
+}
+
+
+}  // end namespace rms
+
+
+#endif  // _RMS_ALIGNED_VECTOR_H
@@ -9,6 +9,8 @@
 
 #include "config.h"
 #include <vector>
+#include <limits>
+#include <climits>
 #include <string>
 #include <strstream>
 
@@ -18,275 +20,329 @@ namespace rms {
 
 #define INVALID_REFCOUNT std::numeric_limits<int>::max()
 
-template<class Type>
-class RefCountedVector
+/*
+ * RefCountedIndexSet keeps the reference counts and free-list for a set of
+ * integer indices in a single contiguous int array. Per-index payload is stored
+ * by the caller (see RefCountedVector), so passes that only touch the payload
+ * do not have to pull the refcounts through the cache, and vice versa.
+ *
+ * A slot with refcount > 0 is in use. Free slots hold a negative value that
+ * encodes the next free slot: -(nNext+1), or FREE_LIST_END for the last one.
+ */
+class RefCountedIndexSet
 {
 public:
-	RefCountedVector() 	
+	RefCountedIndexSet()
 		{ clear(); }
-	virtual ~RefCountedVector()
-		{}
 
 	inline bool isValid( int nIndex ) const {
-		return ( nIndex < (int)m_vData.size() && m_vData[nIndex].nRefCount > 0 && m_vData[nIndex].nRefCount != INVALID_REFCOUNT );
+		return ( nIndex >= 0 && nIndex < (int)m_vRefCounts.size() && m_vRefCounts[nIndex] > 0 );
 	}
 
 	inline int refCount( int nIndex ) const {
 		lgASSERT( isValid(nIndex)  );
-		return ( m_vData[nIndex].nRefCount > 0 && m_vData[nIndex].nRefCount != INVALID_REFCOUNT )
-			? m_vData[nIndex].nRefCount : 0;
+		return ( m_vRefCounts[nIndex] > 0 ) ? m_vRefCounts[nIndex] : 0;
 	}
 
 	inline int increment( int nIndex ) {
 		lgASSERT( isValid(nIndex)  );
-		return ++m_vData[nIndex].nRefCount;
+		return ++m_vRefCounts[nIndex];
 	}
 
 	inline void decrement( int nIndex ) {
 		lgASSERT( isValid(nIndex) );
-		--m_vData[nIndex].nRefCount;
-		lgASSERT( m_vData[nIndex].nRefCount >= 0 );
-		if ( m_vData[nIndex].nRefCount == 0 ) {			// add to empty list
-			if ( m_nFirstFree == INVALID_REFCOUNT ) {
-				m_vData[nIndex].nRefCount = INVALID_REFCOUNT;
-				m_nFirstFree = nIndex;
-			} else {
-				m_vData[nIndex].nRefCount = -(m_nFirstFree+1);
-				m_nFirstFree = nIndex;
-			}
-			m_nUsedCount--;
-		}
+		--m_vRefCounts[nIndex];
+		lgASSERT( m_vRefCounts[nIndex] >= 0 );
+		if ( m_vRefCounts[nIndex] == 0 )			// add to empty list
+			push_free(nIndex);
 	}
 
-	inline int insert( const Type & t ) {
+	//! returns index of new slot with refcount 1. If the return value is == max_index()-1 
+	//! and was not previously in use, the slot was appended (caller may need to grow payload)
+	inline int insert() {
 		m_nUsedCount++;
 		if ( m_nFirstFree == INVALID_REFCOUNT ) {
-			RefEntry r;
-			r.nRefCount = 1;
-			r.vecData = t;
-			m_vData.push_back(r);
-			return (int)(m_vData.size() - 1);
+			m_vRefCounts.push_back(1);
+			return (int)(m_vRefCounts.size() - 1);
 		} else {
 			int nFree = m_nFirstFree;
-			lgASSERT(nFree >= 0 && nFree < (int)m_vData.size());
-			int nNextFree = m_vData[ nFree ].nRefCount;
-			m_vData[nFree].nRefCount = 1;
-			m_vData[nFree].vecData = t;
-			if ( nNextFree < 0 )
-				m_nFirstFree = -(nNextFree+1);
-			else {
-				lgASSERT( nNextFree == INVALID_REFCOUNT );
-				m_nFirstFree = nNextFree;
-			}
+			lgASSERT(nFree >= 0 && nFree < (int)m_vRefCounts.size());
+			int nNextFree = m_vRefCounts[ nFree ];
+			lgASSERT( nNextFree < 0 );
+			m_vRefCounts[nFree] = 1;
+			m_nFirstFree = ( nNextFree == FREE_LIST_END ) ? INVALID_REFCOUNT : -(nNextFree+1);
 			return nFree;
 		}
 	}
 
 	inline void remove( int nIndex ) {		// force remove
-		lgASSERT( (unsigned int)nIndex < m_vData.size() );
-		if ( m_vData[nIndex].nRefCount < 0 || m_vData[nIndex].nRefCount == INVALID_REFCOUNT )
+		lgASSERT( (unsigned int)nIndex < m_vRefCounts.size() );
+		if ( m_vRefCounts[nIndex] <= 0 )
 			return;			// already removed
-		if ( m_nFirstFree == INVALID_REFCOUNT ) {
-			m_vData[nIndex].nRefCount = INVALID_REFCOUNT;
-			m_nFirstFree = nIndex;
-		} else {
-			m_vData[nIndex].nRefCount = -(m_nFirstFree+1);
-			m_nFirstFree = nIndex;
-		}
-		m_nUsedCount--;
+		push_free(nIndex);
 	}
-		
 
 	inline void clear( bool bFreeMem = false ) {
 		if ( bFreeMem )
-			m_vData.clear();
+			std::vector<int>().swap(m_vRefCounts);
 		else
-			m_vData.resize(0);
+			m_vRefCounts.resize(0);
 		m_nFirstFree = INVALID_REFCOUNT;
 		m_nUsedCount = 0;
 	}
 
+	inline void reserve( unsigned int nCount )
+		{ m_vRefCounts.reserve(nCount); }
 
 	inline unsigned int size() const { return m_nUsedCount; }
-	inline unsigned int max_index() const { return (unsigned int)m_vData.size(); }
-
-	inline Type & operator[]( int nIndex ) {
-		lgASSERT( nIndex < (int)m_vData.size() && m_vData[nIndex].nRefCount > 0 && m_vData[nIndex].nRefCount != INVALID_REFCOUNT  );
-		return m_vData[nIndex].vecData;
-	}
-	inline const Type & operator[]( int nIndex ) const {
-		lgASSERT( nIndex < (int)m_vData.size() && m_vData[nIndex].nRefCount > 0 && m_vData[nIndex].nRefCount != INVALID_REFCOUNT  );
-		return m_vData[nIndex].vecData;
+	inline unsigned int max_index() const { return (unsigned int)m_vRefCounts.size(); }
+
+	//! write up to nCount in-use indices >= nBegin to pIndices, in increasing order. Returns number written
+	inline unsigned int get_indexes( unsigned int nBegin, unsigned int nCount, unsigned int * pIndices ) const {
+		unsigned int nMax = (unsigned int)m_vRefCounts.size(), n = 0;
+		for ( unsigned int i = nBegin; i < nMax && n < nCount; ++i ) {
+			if ( m_vRefCounts[i] > 0 )
+				pIndices[n++] = i;
+		}
+		return n;
 	}
 
+	//! raw refcount array, max_index() entries. Slot is in use if value is > 0
+	inline const int * refcounts() const
+		{ return m_vRefCounts.empty() ? NULL : &m_vRefCounts[0]; }
+
 	std::string printData() const {
 		std::ostrstream out;
 		out << "[ F: ";
 		if ( m_nFirstFree == INVALID_REFCOUNT )
-			out << "X" << " VS: " <<  (int)m_vData.size() << " RS: " << m_nUsedCount << " ]" << std::endl;
+			out << "X" << " VS: " <<  (int)m_vRefCounts.size() << " RS: " << m_nUsedCount << " ]" << std::endl;
 		else
-			out << m_nFirstFree << " VS: " <<  (int)m_vData.size() << " RS: " << m_nUsedCount << " ]" << std::endl;
+			out << m_nFirstFree << " VS: " <<  (int)m_vRefCounts.size() << " RS: " << m_nUsedCount << " ]" << std::endl;
 
-		size_t nCount = m_vData.size();
+		size_t nCount = m_vRefCounts.size();
 		for ( unsigned int i = 0; i  < nCount; ++i ) {
-			out << "  " << i << "[ " << *((int *)&m_vData[i].vecData) << "/" ;
-			if  ( m_vData[i].nRefCount == INVALID_REFCOUNT )
+			out << "  " << i << "[ ";
+			if  ( m_vRefCounts[i] <= 0 )
 				out << "X ]";
 			else
-				out << m_vData[i].nRefCount << " ]";
+				out << m_vRefCounts[i] << " ]";
 		}
 		out << std::endl << '\0';
 		return out.str();
 	}
 
 protected:
-	struct RefEntry {
-		int nRefCount;
-		Type vecData;
-	};
-	std::vector< RefEntry > m_vData;
+	std::vector<int> m_vRefCounts;
 
 	unsigned int m_nUsedCount;
 	int m_nFirstFree;
 
+	enum { FREE_LIST_END = INT_MIN };
+
+	inline void push_free( int nIndex ) {
+		m_vRefCounts[nIndex] = ( m_nFirstFree == INVALID_REFCOUNT ) ? (int)FREE_LIST_END : -(m_nFirstFree+1);
+		m_nFirstFree = nIndex;
+		m_nUsedCount--;
+	}
+
 public:
-	class item_iterator
+	class index_iterator
 	{
 	public:
-		inline item_iterator() { m_pCurrent = NULL; m_pLast = NULL;}
+		inline index_iterator() { m_nIndex = 0; m_pCurrent = NULL; m_pLast = NULL;}
 
-		inline item_iterator( item_iterator & copy ) {
-			m_pCurrent = copy.m_pCurrent;
-			m_pLast = copy.m_pLast;
-		}
-		
-		inline item_iterator(const item_iterator & copy ) {
+		inline index_iterator( const index_iterator & copy ) {
+			m_nIndex = copy.m_nIndex;
 			m_pCurrent = copy.m_pCurrent;
 			m_pLast = copy.m_pLast;
 		}
 
-		inline RefEntry & operator*() { 
-			return *m_pCurrent;
+		inline int operator*() const { 
+			return m_nIndex;
 		}
 
-		inline item_iterator & operator++() {		// prefix
+		inline index_iterator & operator++() {			// prefix
 			goto_next();
 			return *this;
 		}
-		inline item_iterator operator++(int) {		// postfix
-			item_iterator copy(*this);
+		inline index_iterator operator++(int) {		// postfix
+			index_iterator copy(*this);
 			goto_next();
 			return copy;
 		}
 
-		inline bool operator==( item_iterator & r2 ) {
+		inline bool operator==( const index_iterator & r2 ) const {
 			return m_pCurrent == r2.m_pCurrent;
 		}
-		inline bool operator!=( item_iterator & r2 ) {
+		inline bool operator!=( const index_iterator & r2 ) const {
 			return m_pCurrent != r2.m_pCurrent;
 		}
 
 	protected:
 		inline void goto_next() {
-			if ( m_pCurrent != m_pLast )
+			if ( m_pCurrent != m_pLast ) {
 				m_pCurrent++;
-			while ( (m_pCurrent->nRefCount <= 0 || m_pCurrent->nRefCount == INVALID_REFCOUNT) && m_pCurrent != m_pLast )
+				m_nIndex++;
+			}
+			while ( m_pCurrent != m_pLast && *m_pCurrent <= 0 ) {
 				m_pCurrent++;
+				m_nIndex++;
+			}
 		}
 
-		inline item_iterator( RefEntry * pCurrent, RefEntry * pLast )
+		inline index_iterator( int nIndex, const int * pCurrent, const int * pLast )
 		{
+			m_nIndex = nIndex;
 			m_pCurrent = pCurrent;
 			m_pLast = pLast;
-			if ( (m_pCurrent->nRefCount <= 0 || m_pCurrent->nRefCount == INVALID_REFCOUNT) )
+			if ( m_pCurrent == m_pLast )
+				;		// do nothing - finished!
+			else if ( *m_pCurrent <= 0 )
 				goto_next();		// initialize
 		}
-		RefEntry * m_pCurrent;
-		RefEntry * m_pLast;
-		friend class RefCountedVector;
+		int m_nIndex;
+		const int * m_pCurrent;
+		const int * m_pLast;
+		friend class RefCountedIndexSet;
 	};
 
-	inline item_iterator begin_items() {
-		return item_iterator( &m_vData.front(), &m_vData.back() + 1 );
+	inline index_iterator begin_indexes() const {
+		if ( m_vRefCounts.empty() )
+			return end_indexes();
+		else
+			return index_iterator( (int)0, &m_vRefCounts.front(), &m_vRefCounts.back() + 1 );
 	}
-	inline item_iterator end_items() {
-		return item_iterator( &m_vData.back() + 1, &m_vData.back() + 1 );
+	inline index_iterator end_indexes() const {
+		if ( m_vRefCounts.empty() ) 
+			return index_iterator( 0, NULL, NULL );
+		else
+			return index_iterator( (int)m_vRefCounts.size(), &m_vRefCounts.back() + 1, &m_vRefCounts.back() + 1 );
 	}
+};
 
 
 
-	class index_iterator
+/*
+ * RefCountedVector is a RefCountedIndexSet plus a parallel std::vector of
+ * payload elements. Slots of removed elements are re-used by insert().
+ */
+template<class Type>
+class RefCountedVector
+{
+public:
+	RefCountedVector() 	
+		{ clear(); }
+	virtual ~RefCountedVector()
+		{}
+
+	inline bool isValid( int nIndex ) const 
+		{ return m_vRefs.isValid(nIndex); }
+
+	inline int refCount( int nIndex ) const 
+		{ return m_vRefs.refCount(nIndex); }
+
+	inline int increment( int nIndex ) 
+		{ return m_vRefs.increment(nIndex); }
+
+	inline void decrement( int nIndex ) 
+		{ m_vRefs.decrement(nIndex); }
+
+	inline int insert( const Type & t ) {
+		int nIndex = m_vRefs.insert();
+		if ( nIndex == (int)m_vData.size() )
+			m_vData.push_back(t);
+		else
+			m_vData[nIndex] = t;
+		return nIndex;
+	}
+
+	inline void remove( int nIndex )		// force remove
+		{ m_vRefs.remove(nIndex); }
+		
+	inline void clear( bool bFreeMem = false ) {
+		if ( bFreeMem )
+			std::vector<Type>().swap(m_vData);
+		else
+			m_vData.resize(0);
+		m_vRefs.clear(bFreeMem);
+	}
+
+	inline unsigned int size() const { return m_vRefs.size(); }
+	inline unsigned int max_index() const { return m_vRefs.max_index(); }
+
+	inline Type & operator[]( int nIndex ) {
+		lgASSERT( m_vRefs.isValid(nIndex) );
+		return m_vData[nIndex];
+	}
+	inline const Type & operator[]( int nIndex ) const {
+		lgASSERT( m_vRefs.isValid(nIndex) );
+		return m_vData[nIndex];
+	}
+
+	const RefCountedIndexSet & refs() const { return m_vRefs; }
+
+	std::string printData() const 
+		{ return m_vRefs.printData(); }
+
+protected:
+	RefCountedIndexSet m_vRefs;
+	std::vector< Type > m_vData;
+
+public:
+	class item_iterator
 	{
 	public:
-		inline index_iterator() { m_nIndex = 0; m_pCurrent = NULL; m_pLast = NULL;}
+		inline item_iterator() { m_pData = NULL; }
 
-		inline index_iterator( const index_iterator & copy ) {
-			m_nIndex = copy.m_nIndex;
-			m_pCurrent = copy.m_pCurrent;
-			m_pLast = copy.m_pLast;
+		inline item_iterator(const item_iterator & copy ) {
+			m_pData = copy.m_pData;
+			m_index = copy.m_index;
 		}
 
-		inline int operator*() { 
-			return m_nIndex;
+		inline Type & operator*() { 
+			return m_pData[*m_index];
 		}
 
-		inline index_iterator & operator++() {			// prefix
-			goto_next();
+		inline item_iterator & operator++() {		// prefix
+			++m_index;
 			return *this;
 		}
-		inline index_iterator operator++(int) {		// postfix
-			index_iterator copy(*this);
-			goto_next();
+		inline item_iterator operator++(int) {		// postfix
+			item_iterator copy(*this);
+			++m_index;
 			return copy;
 		}
 
-		inline bool operator==( index_iterator & r2 ) {
-			return m_pCurrent == r2.m_pCurrent;
+		inline bool operator==( const item_iterator & r2 ) const {
+			return m_index == r2.m_index;
 		}
-		inline bool operator!=( index_iterator & r2 ) {
-			return m_pCurrent != r2.m_pCurrent;
+		inline bool operator!=( const item_iterator & r2 ) const {
+			return m_index != r2.m_index;
 		}
 
 	protected:
-		inline void goto_next() {
-			if ( m_pCurrent != m_pLast ) {
-				m_pCurrent++;
-				m_nIndex++;
-			}
-			while ( (m_pCurrent->nRefCount <= 0 || m_pCurrent->nRefCount == INVALID_REFCOUNT) && m_pCurrent != m_pLast ) {
-				m_pCurrent++;
-				m_nIndex++;
-			}
-		}
-
-		inline index_iterator( int nIndex, const RefEntry * pCurrent, const RefEntry * pLast )
-		{
-			m_nIndex = nIndex;
-			m_pCurrent = pCurrent;
-			m_pLast = pLast;
-			if ( m_pCurrent == m_pLast )
-				;		// do nothing - finished!
-			else if ( (m_pCurrent->nRefCount <= 0 || m_pCurrent->nRefCount == INVALID_REFCOUNT) )
-				goto_next();		// initialize
-		}
-		int m_nIndex;
-		const RefEntry * m_pCurrent;
-		const RefEntry * m_pLast;
+		inline item_iterator( Type * pData, const RefCountedIndexSet::index_iterator & index )
+			: m_pData(pData), m_index(index) {}
+		Type * m_pData;
+		RefCountedIndexSet::index_iterator m_index;
 		friend class RefCountedVector;
 	};
 
+	inline item_iterator begin_items() {
+		return item_iterator( m_vData.empty() ? NULL : &m_vData[0], m_vRefs.begin_indexes() );
+	}
+	inline item_iterator end_items() {
+		return item_iterator( m_vData.empty() ? NULL : &m_vData[0], m_vRefs.end_indexes() );
+	}
+
+
+	typedef RefCountedIndexSet::index_iterator index_iterator;
+
 	inline index_iterator begin_indexes() const {
-		if ( m_vData.empty() )
-			return end_indexes();
-		else
-			return index_iterator( (int)0, &m_vData.front(), &m_vData.back() + 1 );
+		return m_vRefs.begin_indexes();
 	}
 	inline index_iterator end_indexes() const {
-		if ( m_vData.size() == 0 ) 
-			return index_iterator( 0, NULL, NULL );
-		else
-			return index_iterator( (int)m_vData.size(), &m_vData.back() + 1, &m_vData.back() + 1 );
-//			return index_iterator( (int)m_vData.size(), &m_vData.back() + 1, &m_vData.back() + 1 );
+		return m_vRefs.end_indexes();
 	}
 };
 
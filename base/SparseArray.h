@@ -109,6 +109,17 @@ public:
 		//return (*cur).val;
 	}
 
+	//! write up to nCount indices >= i to pIndices (offset by nBase), in increasing order. Returns number written
+	inline unsigned int get_indexes( Index i, unsigned int nCount, Index nBase, Index * pIndices ) const {
+		EntryType e; e.i = i;
+		unsigned int n = 0;
+		typename std::set<EntryType>::const_iterator cur( m_vData.lower_bound(e) ), end( m_vData.end() );
+		while ( cur != end && n < nCount ) {
+			pIndices[n++] = nBase + (*cur).i;  ++cur;
+		}
+		return n;
+	}
+
 	typedef typename std::set<EntryType>::iterator iterator;
 
 	inline iterator begin() { return m_vData.begin(); }
@@ -184,6 +195,18 @@ public:
 			return m_vBuckets[ BUCKET_INDEX(i) ].get( BUCKET_MASK(i) ); }
 
 
+	//! write up to nCount set indices >= nBegin to pIndices, in increasing order. Returns number written
+	inline unsigned int get_indexes( Index nBegin, unsigned int nCount, Index * pIndices ) const {
+		unsigned int n = 0;
+		Index nBucket = BUCKET_INDEX(nBegin), nStart = BUCKET_MASK(nBegin);
+		while ( n < nCount && nBucket < m_vBuckets.size() ) {
+			n += m_vBuckets[nBucket].get_indexes( nStart, nCount-n, nBucket * BUCKET_SIZE, pIndices+n );
+			++nBucket;  nStart = 0;
+		}
+		return n;
+	}
+
+
 	/*
 	 * iterators
 	 */
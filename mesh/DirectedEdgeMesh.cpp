@@ -0,0 +1,542 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+#include "DirectedEdgeMesh.h"
+
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include "VectorUtil.h"
+#include "rmsdebug.h"
+
+using namespace rms;
+
+// iteration over the triangles of a non-manifold vertex is flagged in VtxNbrItr::nData[1]
+static const unsigned long long NONMANIFOLD_ITR_BIT = 1ull << 63;
+
+
+DirectedEdgeMesh::DirectedEdgeMesh()
+{
+	m_nVertexCount = 0;
+	m_nTriangleCount = 0;
+	m_bTopologyValid = true;
+}
+
+DirectedEdgeMesh::DirectedEdgeMesh( const IMesh & mesh )
+{
+	m_nVertexCount = 0;
+	m_nTriangleCount = 0;
+	m_bTopologyValid = true;
+	Copy(mesh);
+}
+
+DirectedEdgeMesh::~DirectedEdgeMesh()
+{
+}
+
+
+// IMesh::ForEachVertexBlock functor for DirectedEdgeMesh::Copy, gathers positions and normals and sets vertex flags
+struct CopyVerticesFunc {
+	IMeshGatherByIDFunc gather;
+	unsigned char * pFlags;
+	unsigned char nValidFlag;
+	unsigned int nCount;
+
+	CopyVerticesFunc( const IMesh * pMesh, Wml::Vector3f * pPositions, Wml::Vector3f * pNormals, unsigned char * pUseFlags, unsigned char nValid )
+		: gather(pMesh, (float *)pPositions, (float *)pNormals), pFlags(pUseFlags), nValidFlag(nValid), nCount(0) {}
+
+	inline void operator()( const IMesh::VertexID * pIDs, unsigned int nBlock ) {
+		gather(pIDs, nBlock);
+		for ( unsigned int k = 0; k < nBlock; ++k )
+			pFlags[ pIDs[k] ] = nValidFlag;
+		nCount += nBlock;
+	}
+};
+
+// IMesh::ForEachTriangleBlock functor for DirectedEdgeMesh::Copy. Blocks of consecutive IDs are gathered directly
+struct CopyTrianglesFunc {
+	const IMesh * pMesh;
+	IMesh::VertexID * pTriangles;
+	unsigned int nCount;
+
+	CopyTrianglesFunc( const IMesh * pUseMesh, IMesh::VertexID * pUseTriangles ) : pMesh(pUseMesh), pTriangles(pUseTriangles), nCount(0) {}
+
+	inline void operator()( const IMesh::TriangleID * pIDs, unsigned int nBlock ) {
+		if ( pIDs[nBlock-1] - pIDs[0] == nBlock-1 )
+			pMesh->GatherTriangles( pIDs, nBlock, & pTriangles[3*pIDs[0]] );
+		else {
+			for ( unsigned int k = 0; k < nBlock; ++k )
+				pMesh->GetTriangle( pIDs[k], & pTriangles[3*pIDs[k]] );
+		}
+		nCount += nBlock;
+	}
+};
+
+void DirectedEdgeMesh::Copy( const IMesh & mesh )
+{
+	Clear(false);
+
+	unsigned int nMaxVtx = mesh.GetMaxVertexID();
+	m_vPositions.resize( nMaxVtx, Wml::Vector3f::ZERO );
+	m_vNormals.resize( nMaxVtx, Wml::Vector3f::UNIT_Z );
+	m_vVertexFlags.resize( nMaxVtx, 0 );
+	if ( nMaxVtx > 0 )
+		m_nVertexCount += mesh.ForEachVertexBlock( CopyVerticesFunc(&mesh, &m_vPositions[0], &m_vNormals[0], &m_vVertexFlags[0], ValidVertex) ).nCount;
+
+	m_vTriangles.resize( 3*mesh.GetMaxTriangleID(), InvalidID );
+	if ( ! m_vTriangles.empty() )
+		m_nTriangleCount += mesh.ForEachTriangleBlock( CopyTrianglesFunc(&mesh, &m_vTriangles[0]) ).nCount;
+
+	BuildTopology();
+}
+
+
+void DirectedEdgeMesh::Clear( bool bFreeMem )
+{
+	IMesh::Clear(bFreeMem);
+
+	if ( bFreeMem ) {
+		std::vector<Wml::Vector3f>().swap(m_vPositions);
+		std::vector<Wml::Vector3f>().swap(m_vNormals);
+		std::vector<unsigned char>().swap(m_vVertexFlags);
+		std::vector<VertexID>().swap(m_vTriangles);
+		std::vector<HalfEdgeID>().swap(m_vOpposite);
+		std::vector<HalfEdgeID>().swap(m_vVertexEdge);
+	} else {
+		m_vPositions.resize(0);
+		m_vNormals.resize(0);
+		m_vVertexFlags.resize(0);
+		m_vTriangles.resize(0);
+		m_vOpposite.resize(0);
+		m_vVertexEdge.resize(0);
+	}
+	m_vNonManifoldTris.clear();
+	m_nVertexCount = 0;
+	m_nTriangleCount = 0;
+	m_bTopologyValid = true;
+}
+
+
+
+void DirectedEdgeMesh::GetVertex( VertexID vID, Wml::Vector3f & vVertex, Wml::Vector3f * pNormal ) const
+{
+	lgASSERT( IsVertex(vID) );
+	vVertex = m_vPositions[vID];
+	if ( pNormal )
+		*pNormal = m_vNormals[vID];
+}
+
+void DirectedEdgeMesh::GetNormal( VertexID vID, Wml::Vector3f & vNormal ) const
+{
+	lgASSERT( IsVertex(vID) );
+	vNormal = m_vNormals[vID];
+}
+
+void DirectedEdgeMesh::SetVertex( VertexID vID, const Wml::Vector3f & vVertex, const Wml::Vector3f * pNormal )
+{
+	lgASSERT( IsVertex(vID) );
+	m_vPositions[vID] = vVertex;
+	if ( pNormal )
+		m_vNormals[vID] = *pNormal;
+}
+
+void DirectedEdgeMesh::SetNormal( VertexID vID, const Wml::Vector3f & vNormal )
+{
+	lgASSERT( IsVertex(vID) );
+	m_vNormals[vID] = vNormal;
+}
+
+void DirectedEdgeMesh::GetTriangle( TriangleID tID, VertexID vTriangle[3]  ) const
+{
+	lgASSERT( IsTriangle(tID) );
+	const VertexID * pTri = & m_vTriangles[3*tID];
+	vTriangle[0] = pTri[0];  vTriangle[1] = pTri[1];  vTriangle[2] = pTri[2];
+}
+
+void DirectedEdgeMesh::GetTriangle( TriangleID tID, Wml::Vector3f vTriangle[3], Wml::Vector3f * pNormals ) const
+{
+	lgASSERT( IsTriangle(tID) );
+	const VertexID * pTri = & m_vTriangles[3*tID];
+	for ( int j = 0; j < 3; ++j ) {
+		vTriangle[j] = m_vPositions[ pTri[j] ];
+		if ( pNormals )
+			pNormals[j] = m_vNormals[ pTri[j] ];
+	}
+}
+
+
+void DirectedEdgeMesh::GatherVertices( const VertexID * pIDs, unsigned int nCount, float * pXYZ, float * pNormals ) const
+{
+	for ( unsigned int k = 0; k < nCount; ++k ) {
+		lgASSERT( IsVertex(pIDs[k]) );
+		memcpy( pXYZ + 3*k, (const float *)m_vPositions[pIDs[k]], 3*sizeof(float) );
+		if ( pNormals )
+			memcpy( pNormals + 3*k, (const float *)m_vNormals[pIDs[k]], 3*sizeof(float) );
+	}
+}
+
+void DirectedEdgeMesh::GatherTriangles( const TriangleID * pIDs, unsigned int nCount, VertexID * pTriangles ) const
+{
+	for ( unsigned int k = 0; k < nCount; ++k ) {
+		lgASSERT( IsTriangle(pIDs[k]) );
+		memcpy( pTriangles + 3*k, & m_vTriangles[3*pIDs[k]], 3*sizeof(VertexID) );
+	}
+}
+
+bool DirectedEdgeMesh::ScatterVertices( const VertexID * pIDs, unsigned int nCount, const float * pXYZ, const float * pNormals )
+{
+	for ( unsigned int k = 0; k < nCount; ++k ) {
+		lgASSERT( IsVertex(pIDs[k]) );
+		m_vPositions[pIDs[k]] = Wml::Vector3f( pXYZ + 3*k );
+		if ( pNormals )
+			m_vNormals[pIDs[k]] = Wml::Vector3f( pNormals + 3*k );
+	}
+	return true;
+}
+
+
+unsigned int DirectedEdgeMesh::GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const
+{
+	unsigned int nMaxID = (unsigned int)m_vVertexFlags.size(), n = 0;
+	for ( VertexID vID = nBegin; vID < nMaxID && n < nCount; ++vID ) {
+		if ( m_vVertexFlags[vID] & ValidVertex )
+			pIDs[n++] = vID;
+	}
+	return n;
+}
+
+unsigned int DirectedEdgeMesh::GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const
+{
+	unsigned int nMaxID = (unsigned int)m_vTriangles.size() / 3, n = 0;
+	for ( TriangleID tID = nBegin; tID < nMaxID && n < nCount; ++tID ) {
+		if ( m_vTriangles[3*tID] != InvalidID )
+			pIDs[n++] = tID;
+	}
+	return n;
+}
+
+
+void DirectedEdgeMesh::GetBoundingBox( Wml::AxisAlignedBox3f & bounds ) const
+{
+	bounds.Min[0] = std::numeric_limits<float>::max();
+
+	vertex_iterator curv( BeginVertices() ), endv( EndVertices() );
+	while ( curv != endv ) {
+		VertexID vID = *curv;  ++curv;
+		const Wml::Vector3f & vVertex = m_vPositions[vID];
+		if ( bounds.Min[0] == std::numeric_limits<float>::max() )
+			bounds = Wml::AxisAlignedBox3f( vVertex.X(), vVertex.X(), vVertex.Y(), vVertex.Y(), vVertex.Z(), vVertex.Z() );
+		else
+			Union( bounds, vVertex);
+	}
+}
+
+
+
+IMesh::VertexID DirectedEdgeMesh::AppendVertex( const Wml::Vector3f & vVertex, const Wml::Vector3f * pNormal )
+{
+	VertexID vNewID = (VertexID)m_vPositions.size();
+	m_vPositions.push_back( vVertex );
+	m_vNormals.push_back( (pNormal) ? *pNormal : Wml::Vector3f::UNIT_Z );
+	m_vVertexFlags.push_back( ValidVertex );
+	++m_nVertexCount;
+	if ( m_bTopologyValid )
+		m_vVertexEdge.push_back( InvalidID );		// isolated vertex does not change topology
+	return vNewID;
+}
+
+
+IMesh::TriangleID DirectedEdgeMesh::AppendTriangle( VertexID v1, VertexID v2, VertexID v3 )
+{
+	if ( ! IsVertex(v1) || ! IsVertex(v2) || ! IsVertex(v3) || v1 == v2 || v1 == v3 || v2 == v3 ) {
+		lgASSERT( IsVertex(v1) && IsVertex(v2) && IsVertex(v3) );
+		return InvalidID;
+	}
+	TriangleID tNewID = (TriangleID)m_vTriangles.size() / 3;
+	m_vTriangles.push_back(v1);
+	m_vTriangles.push_back(v2);
+	m_vTriangles.push_back(v3);
+	++m_nTriangleCount;
+	InvalidateTopology();
+	return tNewID;
+}
+
+
+bool DirectedEdgeMesh::SetTriangle( TriangleID tID, VertexID v1, VertexID v2, VertexID v3 )
+{
+	if ( ! IsVertex(v1) || ! IsVertex(v2) || ! IsVertex(v3) || v1 == v2 || v1 == v3 || v2 == v3 ) {
+		lgASSERT( IsVertex(v1) && IsVertex(v2) && IsVertex(v3) );
+		return false;
+	}
+	if ( tID >= m_vTriangles.size()/3 )
+		m_vTriangles.resize( 3*(tID+1), InvalidID );
+	if ( m_vTriangles[3*tID] == InvalidID )
+		++m_nTriangleCount;
+	m_vTriangles[3*tID] = v1;
+	m_vTriangles[3*tID+1] = v2;
+	m_vTriangles[3*tID+2] = v3;
+	InvalidateTopology();
+	return true;
+}
+
+
+
+
+void DirectedEdgeMesh::BuildTopology()
+{
+	unsigned int nMaxVtx = (unsigned int)m_vPositions.size();
+	unsigned int nHalfEdges = (unsigned int)m_vTriangles.size();
+
+	m_vOpposite.resize(0);
+	m_vOpposite.resize(nHalfEdges, InvalidID);
+	m_vVertexEdge.resize(0);
+	m_vVertexEdge.resize(nMaxVtx, InvalidID);
+	m_vNonManifoldTris.clear();
+	for ( unsigned int vID = 0; vID < nMaxVtx; ++vID )
+		m_vVertexFlags[vID] &= ~NonManifoldVertex;
+
+	// bucket outgoing half-edges by start vertex (counting sort, so each bucket is in increasing order)
+	std::vector<unsigned int> vOutStart( nMaxVtx+1, 0 );
+	for ( HalfEdgeID hID = 0; hID < nHalfEdges; ++hID ) {
+		if ( m_vTriangles[hID - hID%3] != InvalidID )
+			vOutStart[ m_vTriangles[hID]+1 ]++;
+	}
+	for ( unsigned int vID = 0; vID < nMaxVtx; ++vID )
+		vOutStart[vID+1] += vOutStart[vID];
+	std::vector<HalfEdgeID> vOut( vOutStart[nMaxVtx] );
+	std::vector<unsigned int> vFill( vOutStart.begin(), vOutStart.end()-1 );
+	for ( HalfEdgeID hID = 0; hID < nHalfEdges; ++hID ) {
+		if ( m_vTriangles[hID - hID%3] != InvalidID )
+			vOut[ vFill[ m_vTriangles[hID] ]++ ] = hID;
+	}
+
+	// pair each half-edge a->b with the unique half-edge b->a. If either direction appears
+	// more than once the edge is non-manifold (or badly oriented) and is left unpaired
+	for ( HalfEdgeID hID = 0; hID < nHalfEdges; ++hID ) {
+		if ( m_vTriangles[hID - hID%3] == InvalidID || m_vOpposite[hID] != InvalidID )
+			continue;
+		VertexID a = GetStartVertex(hID), b = GetEndVertex(hID);
+
+		HalfEdgeID hOpp = InvalidID;
+		int nOpp = 0, nSame = 0;
+		for ( unsigned int k = vOutStart[b]; k < vOutStart[b+1]; ++k ) {
+			if ( GetEndVertex(vOut[k]) == a ) {
+				hOpp = vOut[k];  ++nOpp;
+			}
+		}
+		if ( nOpp != 1 )
+			continue;
+		for ( unsigned int k = vOutStart[a]; k < vOutStart[a+1]; ++k ) {
+			if ( GetEndVertex(vOut[k]) == b )
+				++nSame;
+		}
+		if ( nSame != 1 )
+			continue;
+
+		m_vOpposite[hID] = hOpp;
+		m_vOpposite[hOpp] = hID;
+	}
+
+	// pick vertex half-edges (boundary half-edge if there is one), and check that a
+	// single fan walk reaches all the outgoing half-edges
+	for ( unsigned int vID = 0; vID < nMaxVtx; ++vID ) {
+		unsigned int nOut = vOutStart[vID+1] - vOutStart[vID];
+		if ( nOut == 0 )
+			continue;
+
+		HalfEdgeID hStart = vOut[ vOutStart[vID] ];
+		for ( unsigned int k = vOutStart[vID]; k < vOutStart[vID+1]; ++k ) {
+			if ( m_vOpposite[ vOut[k] ] == InvalidID ) {
+				hStart = vOut[k];
+				break;
+			}
+		}
+		m_vVertexEdge[vID] = hStart;
+
+		unsigned int nVisited = 1;
+		HalfEdgeID hCur = RotateCCW(hStart, hStart);
+		while ( hCur != InvalidID && nVisited <= nOut ) {
+			++nVisited;
+			hCur = RotateCCW(hCur, hStart);
+		}
+		if ( nVisited != nOut ) {
+			m_vVertexFlags[vID] |= NonManifoldVertex;
+			std::vector<TriangleID> & vTris = m_vNonManifoldTris[vID];
+			for ( unsigned int k = vOutStart[vID]; k < vOutStart[vID+1]; ++k )
+				vTris.push_back( GetHalfEdgeTriangle(vOut[k]) );
+		}
+	}
+
+	m_bTopologyValid = true;
+}
+
+
+
+void DirectedEdgeMesh::FindNeighbours( TriangleID tID, TriangleID vNbrs[3] ) const
+{
+	lgASSERT( IsTriangle(tID) );
+	ValidateTopology();
+	for ( int k = 0; k < 3; ++k ) {
+		HalfEdgeID hOpp = m_vOpposite[3*tID+k];
+		vNbrs[k] = ( hOpp == InvalidID ) ? InvalidID : GetHalfEdgeTriangle(hOpp);
+	}
+}
+
+
+bool DirectedEdgeMesh::IsManifoldVertex( VertexID vID ) const
+{
+	ValidateTopology();
+	return ( m_vVertexFlags[vID] & NonManifoldVertex ) == 0;
+}
+
+
+bool DirectedEdgeMesh::IsBoundaryVertex( VertexID vID ) const
+{
+	ValidateTopology();
+	HalfEdgeID hID = m_vVertexEdge[vID];
+	if ( hID == InvalidID || (m_vVertexFlags[vID] & NonManifoldVertex) )
+		return true;
+	return m_vOpposite[hID] == InvalidID;
+}
+
+
+bool DirectedEdgeMesh::IsBoundaryEdge( VertexID v1, VertexID v2 ) const
+{
+	HalfEdgeID hID = FindHalfEdge(v1, v2);
+	if ( hID == InvalidID )
+		hID = FindHalfEdge(v2, v1);
+	if ( hID == InvalidID ) {
+		lgASSERT( hID != InvalidID );
+		return false;
+	}
+	return m_vOpposite[hID] == InvalidID;
+}
+
+
+bool DirectedEdgeMesh::IsBoundaryTriangle( TriangleID tID ) const
+{
+	lgASSERT( IsTriangle(tID) );
+	ValidateTopology();
+	return m_vOpposite[3*tID] == InvalidID || m_vOpposite[3*tID+1] == InvalidID || m_vOpposite[3*tID+2] == InvalidID;
+}
+
+
+DirectedEdgeMesh::HalfEdgeID DirectedEdgeMesh::FindHalfEdge( VertexID v1, VertexID v2 ) const
+{
+	ValidateTopology();
+	if ( m_vVertexFlags[v1] & NonManifoldVertex ) {
+		const std::vector<TriangleID> & vTris = m_vNonManifoldTris.find(v1)->second;
+		for ( unsigned int k = 0; k < vTris.size(); ++k ) {
+			for ( int j = 0; j < 3; ++j ) {
+				HalfEdgeID hID = 3*vTris[k] + j;
+				if ( GetStartVertex(hID) == v1 && GetEndVertex(hID) == v2 )
+					return hID;
+			}
+		}
+		return InvalidID;
+	}
+
+	HalfEdgeID hStart = m_vVertexEdge[v1];
+	HalfEdgeID hCur = hStart;
+	while ( hCur != InvalidID ) {
+		if ( GetEndVertex(hCur) == v2 )
+			return hCur;
+		hCur = RotateCCW(hCur, hStart);
+	}
+	return InvalidID;
+}
+
+
+
+bool DirectedEdgeMesh::VertexOneRing( VertexID vID, std::vector<VertexID> & vOneRing, bool * bClosed ) const
+{
+	ValidateTopology();
+	vOneRing.resize(0);
+
+	if ( m_vVertexFlags[vID] & NonManifoldVertex ) {
+		const std::vector<TriangleID> & vTris = m_vNonManifoldTris.find(vID)->second;
+		for ( unsigned int k = 0; k < vTris.size(); ++k ) {
+			const VertexID * pTri = & m_vTriangles[ 3*vTris[k] ];
+			for ( int j = 0; j < 3; ++j ) {
+				if ( pTri[j] != vID && std::find(vOneRing.begin(), vOneRing.end(), pTri[j]) == vOneRing.end() )
+					vOneRing.push_back( pTri[j] );
+			}
+		}
+		if ( bClosed )
+			*bClosed = false;
+		return false;
+	}
+
+	HalfEdgeID hStart = m_vVertexEdge[vID];
+	if ( hStart == InvalidID ) {
+		if ( bClosed )
+			*bClosed = false;
+		return true;
+	}
+	HalfEdgeID hCur = hStart, hLast = hStart;
+	while ( hCur != InvalidID ) {
+		vOneRing.push_back( GetEndVertex(hCur) );
+		hLast = hCur;
+		hCur = RotateCCW(hCur, hStart);
+	}
+
+	// open fan - last vertex is only reachable through incoming boundary half-edge
+	bool bIsClosed = ( m_vOpposite[hStart] != InvalidID );
+	if ( ! bIsClosed )
+		vOneRing.push_back( GetStartVertex( GetPrevHalfEdge(hLast) ) );
+	if ( bClosed )
+		*bClosed = bIsClosed;
+	return true;
+}
+
+
+bool DirectedEdgeMesh::TriangleOneRing( VertexID vID, std::vector<TriangleID> & vOneRing, bool * bClosed ) const
+{
+	ValidateTopology();
+	vOneRing.resize(0);
+
+	if ( m_vVertexFlags[vID] & NonManifoldVertex ) {
+		vOneRing = m_vNonManifoldTris.find(vID)->second;
+		if ( bClosed )
+			*bClosed = false;
+		return false;
+	}
+
+	HalfEdgeID hStart = m_vVertexEdge[vID];
+	HalfEdgeID hCur = hStart;
+	while ( hCur != InvalidID ) {
+		vOneRing.push_back( GetHalfEdgeTriangle(hCur) );
+		hCur = RotateCCW(hCur, hStart);
+	}
+	if ( bClosed )
+		*bClosed = ( hStart != InvalidID && m_vOpposite[hStart] != InvalidID );
+	return true;
+}
+
+
+
+void DirectedEdgeMesh::BeginVtxTriangles( VtxNbrItr & v ) const
+{
+	ValidateTopology();
+	if ( m_vVertexFlags[v.vID] & NonManifoldVertex ) {
+		v.nData[0] = 0;
+		v.nData[1] = NONMANIFOLD_ITR_BIT;
+	} else {
+		v.nData[0] = m_vVertexEdge[v.vID];
+		v.nData[1] = m_vVertexEdge[v.vID];
+	}
+}
+
+IMesh::TriangleID DirectedEdgeMesh::GetNextVtxTriangle( VtxNbrItr & v ) const
+{
+	if ( v.nData[1] & NONMANIFOLD_ITR_BIT ) {
+		const std::vector<TriangleID> & vTris = m_vNonManifoldTris.find(v.vID)->second;
+		return ( v.nData[0] < vTris.size() ) ? vTris[ (size_t)v.nData[0]++ ] : InvalidID;
+	}
+
+	HalfEdgeID hCur = (HalfEdgeID)v.nData[0];
+	if ( hCur == InvalidID )
+		return InvalidID;
+	v.nData[0] = RotateCCW( hCur, (HalfEdgeID)v.nData[1] );
+	return GetHalfEdgeTriangle(hCur);
+}
@@ -0,0 +1,276 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+#ifndef __RMS_DIRECTED_EDGE_MESH_H__
+#define __RMS_DIRECTED_EDGE_MESH_H__
+#include "config.h"
+#include <Wm4Vector3.h>
+#include <Wm4AxisAlignedBox3.h>
+#include <vector>
+#include <map>
+
+#include "IMesh.h"
+
+
+namespace rms {
+
+/*
+ * DirectedEdgeMesh is an index-based IMesh implementation (Campagna et al, "Directed Edges -
+ * A Scalable Representation for Triangle Meshes"). Triangle tID owns the three half-edges
+ * 3*tID+k, where half-edge 3*tID+k goes from vertex k to vertex (k+1)%3 of the triangle.
+ * Topology is a single opposite-half-edge array plus one outgoing half-edge per vertex, so
+ * FindNeighbours() and IsBoundaryVertex() are O(1), and ordered one-rings are O(valence).
+ *
+ * VertexIDs and TriangleIDs are preserved by Copy(), so a DirectedEdgeMesh built from a
+ * VFTriangleMesh can be used in its place by any IMesh client (IMeshBVTree, ExpMapGenerator,
+ * IMeshRenderer, ...).
+ *
+ * Topology is rebuilt lazily after AppendTriangle()/SetTriangle(). The rebuild is not
+ * thread-safe, so call BuildTopology() explicitly before sharing the mesh between threads.
+ *
+ * Non-manifold vertices (more than one triangle fan) are supported for iteration, but
+ * have no ordered one-ring. Non-manifold edges (more than two triangles) and edges between
+ * inconsistently-oriented triangles are left unpaired, ie treated as boundary edges.
+ */
+class DirectedEdgeMesh : public IMesh
+{
+public:
+	typedef unsigned int HalfEdgeID;
+
+	DirectedEdgeMesh();
+	DirectedEdgeMesh( const IMesh & mesh );
+	~DirectedEdgeMesh();
+
+	//! copy vertices and triangles from any IMesh (eg VFTriangleMesh), preserving IDs, and build topology
+	void Copy( const IMesh & mesh );
+
+	void SetVertex( VertexID vID, const Wml::Vector3f & vVertex, const Wml::Vector3f * pNormal = NULL );
+	void SetNormal( VertexID vID, const Wml::Vector3f & vNormal );
+
+	void GetBoundingBox( Wml::AxisAlignedBox3f & bounds ) const;
+
+/*
+ * IMesh read interface (mandatory)
+ */
+	virtual void GetVertex( VertexID vID, Wml::Vector3f & vVertex, Wml::Vector3f * pNormal = NULL ) const;
+	virtual void GetNormal( VertexID vID, Wml::Vector3f & vNormal ) const;
+	virtual unsigned int GetVertexCount() const
+		{ return m_nVertexCount; }
+	virtual unsigned int GetMaxVertexID() const
+		{ return (unsigned int)m_vPositions.size(); }
+	virtual bool IsVertex( VertexID vID ) const
+		{ return vID < m_vVertexFlags.size() && (m_vVertexFlags[vID] & ValidVertex) != 0; }
+
+	virtual void GetTriangle( TriangleID tID, VertexID vTriangle[3]  ) const;
+	virtual void GetTriangle( TriangleID tID, Wml::Vector3f vTriangle[3], Wml::Vector3f * pNormals = NULL ) const;
+	virtual unsigned int GetTriangleCount() const
+		{ return m_nTriangleCount; }
+	virtual unsigned int GetMaxTriangleID() const
+		{ return (unsigned int)m_vTriangles.size() / 3; }
+	virtual bool IsTriangle( TriangleID tID ) const
+		{ return tID < m_vTriangles.size()/3 && m_vTriangles[3*tID] != InvalidID; }
+
+	virtual unsigned int GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const;
+	virtual unsigned int GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const;
+
+	virtual void GatherVertices( const VertexID * pIDs, unsigned int nCount, float * pXYZ, float * pNormals = NULL ) const;
+	virtual void GatherTriangles( const TriangleID * pIDs, unsigned int nCount, VertexID * pTriangles ) const;
+	virtual bool ScatterVertices( const VertexID * pIDs, unsigned int nCount, const float * pXYZ, const float * pNormals = NULL );
+
+	//! O(1) lookup in the opposite-edge array
+	virtual void FindNeighbours( TriangleID tID, TriangleID vNbrs[3] ) const;
+
+/*
+ *  IMesh write interface
+ */
+	virtual VertexID AppendVertex( const Wml::Vector3f & vVertex, const Wml::Vector3f * pNormal = NULL );
+	virtual TriangleID AppendTriangle( VertexID v1, VertexID v2, VertexID v3 );
+	virtual bool SetTriangle( TriangleID tID, VertexID v1, VertexID v2, VertexID v3 );
+
+	virtual void Clear( bool bFreeMem = false );
+
+/*
+ * IMesh mesh info interface
+ */
+	//! iteration walks the triangle fan of the vertex (in CCW order, if vertex is manifold)
+	virtual void BeginVtxTriangles( VtxNbrItr & v ) const;
+	virtual TriangleID GetNextVtxTriangle( VtxNbrItr & v ) const;
+
+	//! O(1) - vertex is boundary if its outgoing half-edge has no opposite (isolated and non-manifold vertices are boundary)
+	virtual bool IsBoundaryVertex( VertexID vID ) const;
+
+/*
+ * topology
+ */
+	//! rebuild opposite and vertex half-edge arrays. Called lazily by topology queries.
+	void BuildTopology();
+	bool IsTopologyValid() const
+		{ return m_bTopologyValid; }
+
+	bool IsManifoldVertex( VertexID vID ) const;
+	bool IsBoundaryEdge( VertexID v1, VertexID v2 ) const;
+	bool IsBoundaryTriangle( TriangleID tID ) const;
+
+	//! ordered (CCW) one-ring. For boundary vertices the ring starts at the boundary edge that leaves vID.
+	//! Returns false (and an un-ordered ring) if vertex is non-manifold
+	bool VertexOneRing( VertexID vID, std::vector<VertexID> & vOneRing, bool * bClosed = NULL ) const;
+	bool TriangleOneRing( VertexID vID, std::vector<TriangleID> & vOneRing, bool * bClosed = NULL ) const;
+
+/*
+ * half-edge access
+ */
+	inline HalfEdgeID GetHalfEdge( TriangleID tID, int k ) const
+		{ return 3*tID + k; }
+	inline TriangleID GetHalfEdgeTriangle( HalfEdgeID hID ) const
+		{ return hID / 3; }
+	inline HalfEdgeID GetNextHalfEdge( HalfEdgeID hID ) const
+		{ return ( hID % 3 == 2 ) ? hID - 2 : hID + 1; }
+	inline HalfEdgeID GetPrevHalfEdge( HalfEdgeID hID ) const
+		{ return ( hID % 3 == 0 ) ? hID + 2 : hID - 1; }
+	inline VertexID GetStartVertex( HalfEdgeID hID ) const
+		{ return m_vTriangles[hID]; }
+	inline VertexID GetEndVertex( HalfEdgeID hID ) const
+		{ return m_vTriangles[ GetNextHalfEdge(hID) ]; }
+
+	//! InvalidID if hID is a boundary half-edge
+	inline HalfEdgeID GetOppositeHalfEdge( HalfEdgeID hID ) const
+		{ ValidateTopology(); return m_vOpposite[hID]; }
+
+	//! outgoing half-edge of vID. For boundary vertices this is the boundary half-edge, so that
+	//! rotating CCW with GetOppositeHalfEdge(GetPrevHalfEdge(h)) visits the entire fan
+	inline HalfEdgeID GetVertexHalfEdge( VertexID vID ) const
+		{ ValidateTopology(); return m_vVertexEdge[vID]; }
+
+	//! find half-edge from v1 to v2. Returns InvalidID if there is none (note v2->v1 may still exist)
+	HalfEdgeID FindHalfEdge( VertexID v1, VertexID v2 ) const;
+
+
+/*
+ * iterators
+ */
+	class index_iterator {
+	public:
+		inline index_iterator( const index_iterator & i2 )
+			: m_pMesh(i2.m_pMesh), m_nIndex(i2.m_nIndex), m_bTriangles(i2.m_bTriangles) {}
+		inline const index_iterator & operator=( const index_iterator & i2 )
+			{ m_pMesh = i2.m_pMesh; m_nIndex = i2.m_nIndex; m_bTriangles = i2.m_bTriangles; return *this; }
+
+		inline MeshEntityID operator*() const
+			{ return m_nIndex; }
+
+		inline void operator++(int)	// postfix
+			{ goto_next(); }
+		inline index_iterator & operator++() // prefix
+			{ goto_next(); return *this; }
+
+		inline bool operator==( const index_iterator & i2 ) const
+			{ return m_nIndex == i2.m_nIndex; }
+		inline bool operator!=( const index_iterator & i2 ) const
+			{ return m_nIndex != i2.m_nIndex; }
+
+	protected:
+		const DirectedEdgeMesh * m_pMesh;
+		unsigned int m_nIndex;
+		bool m_bTriangles;
+
+		inline bool valid() const
+			{ return (m_bTriangles) ? m_pMesh->IsTriangle(m_nIndex) : m_pMesh->IsVertex(m_nIndex); }
+		inline unsigned int end() const
+			{ return (m_bTriangles) ? m_pMesh->GetMaxTriangleID() : m_pMesh->GetMaxVertexID(); }
+		inline void goto_next()
+			{ unsigned int nEnd = end();
+			  do { ++m_nIndex; } while ( m_nIndex < nEnd && ! valid() ); }
+
+		inline index_iterator( const DirectedEdgeMesh * pMesh, bool bTriangles, bool bStart )
+			: m_pMesh(pMesh), m_bTriangles(bTriangles)
+			{ m_nIndex = (bStart) ? 0 : end();
+			  if ( m_nIndex < end() && ! valid() ) goto_next(); }
+
+		friend class DirectedEdgeMesh;
+	};
+	typedef index_iterator vertex_iterator;
+	typedef index_iterator triangle_iterator;
+
+	vertex_iterator BeginVertices() const
+		{ return index_iterator(this, false, true); }
+	vertex_iterator EndVertices() const
+		{ return index_iterator(this, false, false); }
+
+	triangle_iterator BeginTriangles() const
+		{ return index_iterator(this, true, true); }
+	triangle_iterator EndTriangles() const
+		{ return index_iterator(this, true, false); }
+
+
+protected:
+	enum VertexFlags {
+		ValidVertex = 1,
+		NonManifoldVertex = 2
+	};
+
+	std::vector<Wml::Vector3f> m_vPositions;
+	std::vector<Wml::Vector3f> m_vNormals;
+	std::vector<unsigned char> m_vVertexFlags;
+	unsigned int m_nVertexCount;
+
+	//! 3 VertexIDs per triangle, first is InvalidID if triangle slot is unused
+	std::vector<VertexID> m_vTriangles;
+	unsigned int m_nTriangleCount;
+
+	// topology
+	bool m_bTopologyValid;
+	std::vector<HalfEdgeID> m_vOpposite;
+	std::vector<HalfEdgeID> m_vVertexEdge;
+
+	//! triangles of non-manifold vertices (which cannot be found by walking a single fan)
+	std::map<VertexID, std::vector<TriangleID> > m_vNonManifoldTris;
+
+	inline void ValidateTopology() const
+		{ if ( ! m_bTopologyValid ) const_cast<DirectedEdgeMesh *>(this)->BuildTopology(); }
+	inline void InvalidateTopology()
+		{ m_bTopologyValid = false; }
+
+	//! returns next outgoing half-edge of a manifold vertex in CCW order, or InvalidID at end of fan
+	inline HalfEdgeID RotateCCW( HalfEdgeID hID, HalfEdgeID hStart ) const
+		{ HalfEdgeID hNext = m_vOpposite[ GetPrevHalfEdge(hID) ];
+		  return ( hNext == hStart ) ? InvalidID : hNext; }
+
+/*
+ * IMesh iterator interface
+ */
+	inline virtual void * ivtx_make_iterator(bool bStart) const
+		{ return new index_iterator( (bStart) ? BeginVertices() : EndVertices() ); }
+	inline virtual void * ivtx_make_iterator( void * pFromItr ) const
+		{ return new index_iterator( * ((index_iterator *)pFromItr) ); }
+	inline virtual void ivtx_free_iterator( void * pItr ) const
+		{ delete (index_iterator *)pItr; }
+	inline virtual void ivtx_set( void * pItr, void * pTo ) const
+		{ *((index_iterator *)pItr) = *((index_iterator *)pTo); }
+	inline virtual void ivtx_goto_next( void * pItr ) const
+		{ ++(*((index_iterator *)pItr)); }
+	inline virtual bool ivtx_equal( void * pItr1, void * pItr2 ) const
+		{ return *((index_iterator *)pItr1) == *((index_iterator *)pItr2); }
+	inline virtual VertexID ivtx_value( void * pItr ) const
+		{ return **((index_iterator *)pItr); }
+
+	inline virtual void * itri_make_iterator(bool bStart) const
+		{ return new index_iterator( (bStart) ? BeginTriangles() : EndTriangles() ); }
+	inline virtual void * itri_make_iterator( void * pFromItr ) const
+		{ return new index_iterator( * ((index_iterator *)pFromItr) ); }
+	inline virtual void itri_free_iterator( void * pItr )  const
+		{ delete (index_iterator *)pItr; }
+	inline virtual void itri_set( void * pItr, void * pTo ) const
+		{ *((index_iterator *)pItr) = *((index_iterator *)pTo); }
+	inline virtual void itri_goto_next( void * pItr ) const
+		{ ++(*((index_iterator *)pItr)); }
+	inline virtual bool itri_equal( void * pItr1, void * pItr2 ) const
+		{ return *((index_iterator *)pItr1) == *((index_iterator *)pItr2); }
+	inline virtual TriangleID itri_value( void * pItr ) const
+		{ return **((index_iterator *)pItr); }
+};
+
+
+
+}  // end namespace rms
+
+#endif // __RMS_DIRECTED_EDGE_MESH_H__
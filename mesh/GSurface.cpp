@@ -25,6 +25,7 @@ GSurface::GSurface()
 	m_pMesh = new VFTriangleMesh();
 	m_pPolygons = new MeshPolygons();
 	m_bvTree.SetMesh( m_pMesh );
+	m_bGeometryChanged = false;
 	m_bOwnsData = true;
 }
 GSurface::GSurface(const GSurface & copy)
@@ -32,6 +33,7 @@ GSurface::GSurface(const GSurface & copy)
 	m_pMesh = new VFTriangleMesh();
 	m_pPolygons = new MeshPolygons();
 	m_bvTree.SetMesh( m_pMesh );
+	m_bGeometryChanged = false;
 	m_bOwnsData = true;
 
 	*this = copy;
@@ -41,6 +43,7 @@ GSurface::GSurface(VFTriangleMesh * pMesh, MeshPolygons * pPolygons, bool bOwnsD
 	m_pMesh = pMesh;
 	m_pPolygons = pPolygons;
 	m_bvTree.SetMesh( m_pMesh );
+	m_bGeometryChanged = false;
 	m_bOwnsData = bOwnsData;
 }
 
@@ -62,6 +65,7 @@ const GSurface & GSurface::operator=(const GSurface & copy)
 		MeshUtils::CopyUVs(*copy.m_pMesh, *m_pMesh, 0, 0, VMap);
 	m_pPolygons->Initialize(*m_pMesh, *copy.m_pPolygons, TMap, &VMap); 
 	m_bvTree.SetMesh( m_pMesh );
+	m_bGeometryChanged = false;
 
 	m_vUVs = copy.m_vUVs;
 	m_vNormals = copy.m_vNormals;
@@ -78,10 +82,21 @@ void GSurface::Copy( const VFTriangleMesh & mesh, const MeshPolygons & polygons)
 	if ( mesh.HasUVSet(0) )
 		MeshUtils::CopyUVs(mesh, *m_pMesh, 0, 0, VMap);
 	m_bvTree.SetMesh( m_pMesh );
+	m_bGeometryChanged = false;
 	m_pPolygons->Initialize(*m_pMesh, polygons, TMap, &VMap); 
 }
 
 
+IMeshBVTree & GSurface::BVTree()
+{
+	if ( m_bGeometryChanged ) {
+		m_bvTree.Refit();
+		m_bGeometryChanged = false;
+	}
+	return m_bvTree;
+}
+
+
 void GSurface::ResetToOwnedData()
 {
 	if ( ! m_bOwnsData ) {
@@ -106,6 +121,7 @@ void GSurface::Compact()
 		m_pMesh = new VFTriangleMesh();
 		m_pPolygons = new MeshPolygons();
 		m_bvTree.SetMesh( m_pMesh );
+		m_bGeometryChanged = false;
 	}
 
 	rms::VertexMap vMap;		rms::TriangleMap tMap;
@@ -49,9 +49,13 @@ public:
 	MeshPolygons & Polygons() { return *m_pPolygons; }
 	const MeshPolygons & Polygons() const { return *m_pPolygons; }
 
-	IMeshBVTree & BVTree() { return m_bvTree; }
+	//! non-const access refits the tree first if NotifyGeometryChanged() has been called
+	IMeshBVTree & BVTree();
 	const IMeshBVTree & BVTree() const { return m_bvTree; }
 
+	//! call after moving mesh vertices (topology unchanged), so that BVTree() refits instead of rebuilding
+	void NotifyGeometryChanged() { m_bGeometryChanged = true; }
+
 	UVList & UV() { return m_vUVs; }
 	const UVList & UV() const { return m_vUVs; }
 
@@ -66,6 +70,7 @@ protected:
 	MeshPolygons * m_pPolygons;
 
 	IMeshBVTree m_bvTree;
+	bool m_bGeometryChanged;
 
 	UVList m_vUVs;
 	NormalList m_vNormals;
@@ -5,6 +5,7 @@
 #include "IMesh.h"
 
 #include <limits>
+#include <cstring>
 
 using namespace rms;
 
@@ -105,6 +106,45 @@ bool IMesh::IsBoundaryVertex( VertexID vID ) const
 }
 
 
+unsigned int IMesh::GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const
+{
+	unsigned int nMaxID = GetMaxVertexID(), n = 0;
+	for ( VertexID vID = nBegin; vID < nMaxID && n < nCount; ++vID ) {
+		if ( IsVertex(vID) )
+			pIDs[n++] = vID;
+	}
+	return n;
+}
+
+unsigned int IMesh::GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const
+{
+	unsigned int nMaxID = GetMaxTriangleID(), n = 0;
+	for ( TriangleID tID = nBegin; tID < nMaxID && n < nCount; ++tID ) {
+		if ( IsTriangle(tID) )
+			pIDs[n++] = tID;
+	}
+	return n;
+}
+
+
+void IMesh::GatherVertices( const VertexID * pIDs, unsigned int nCount, float * pXYZ, float * pNormals ) const
+{
+	Wml::Vector3f vVertex, vNormal;
+	for ( unsigned int k = 0; k < nCount; ++k ) {
+		GetVertex( pIDs[k], vVertex, (pNormals) ? &vNormal : NULL );
+		memcpy( pXYZ + 3*k, (const float *)vVertex, 3*sizeof(float) );
+		if ( pNormals )
+			memcpy( pNormals + 3*k, (const float *)vNormal, 3*sizeof(float) );
+	}
+}
+
+void IMesh::GatherTriangles( const TriangleID * pIDs, unsigned int nCount, VertexID * pTriangles ) const
+{
+	for ( unsigned int k = 0; k < nCount; ++k )
+		GetTriangle( pIDs[k], pTriangles + 3*k );
+}
+
+
 void IMesh::NeighbourIteration( VertexID vID, IMesh::NeighborTriCallback * pCallback )
 {
 	IMesh::VtxNbrItr itr(vID);
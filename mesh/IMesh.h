@@ -14,6 +14,9 @@
 // useful elsewhere
 #define IMESH_INVALID_ID std::numeric_limits<unsigned int>::max()
 
+// block size used by IMesh::ForEachVertexBlock/ForEachTriangleBlock
+#define IMESH_ID_BLOCK_SIZE 256
+
 
 namespace rms
 {
@@ -52,6 +55,35 @@ public:
 	//! neighbour tris are listed in order for edges [0,1],  [1,2],  [2,0]. Maybe be invalid, if no nbr
 	virtual void FindNeighbours( TriangleID tID, TriangleID vNbrs[3] ) const;
 
+/*
+ * IMesh batched ID iteration - has default implementation (depends on IsVertex/IsTriangle)
+ *   Writes up to nCount IDs >= nBegin to pIDs, in increasing order, and returns the number written.
+ *   Continue from pIDs[n-1]+1, until 0 is returned. Unlike IVtxIterator/ITriIterator this does
+ *   not allocate, and costs one virtual call per block instead of several per element.
+ */
+	virtual unsigned int GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const;
+	virtual unsigned int GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const;
+
+/*
+ * IMesh batch geometry interface - has default implementation (one GetVertex/GetTriangle per element)
+ *   pXYZ/pNormals hold 3 floats per vertex, pTriangles holds 3 VertexIDs per triangle.
+ *   ScatterVertices returns false if the mesh does not support writing vertices.
+ */
+	virtual void GatherVertices( const VertexID * pIDs, unsigned int nCount, float * pXYZ, float * pNormals = NULL ) const;
+	virtual void GatherTriangles( const TriangleID * pIDs, unsigned int nCount, VertexID * pTriangles ) const;
+	virtual bool ScatterVertices( const VertexID * /*pIDs*/, unsigned int /*nCount*/, const float * /*pXYZ*/, const float * /*pNormals*/ = NULL )
+		{ return false; }
+
+	//! calls f(pIDs, nCount) for each block of up to IMESH_ID_BLOCK_SIZE vertex IDs from GetVertexIDs, and returns f
+	template<class Func> Func ForEachVertexBlock( Func f ) const;
+	//! calls f(pIDs, nCount) for each block of up to IMESH_ID_BLOCK_SIZE triangle IDs from GetTriangleIDs, and returns f
+	template<class Func> Func ForEachTriangleBlock( Func f ) const;
+
+	//! calls f(vID) for each vertex and returns f (like std::for_each)
+	template<class Func> Func ForEachVertex( Func f ) const;
+	//! calls f(tID) for each triangle and returns f (like std::for_each)
+	template<class Func> Func ForEachTriangle( Func f ) const;
+
 /*
  *  IMesh write interface (optional)
  */
@@ -347,6 +379,86 @@ protected:
 
 
 
+template<class Func>
+Func IMesh::ForEachVertexBlock( Func f ) const
+{
+	VertexID vIDs[IMESH_ID_BLOCK_SIZE];
+	VertexID nNext = 0;
+	unsigned int nCount;
+	while ( (nCount = GetVertexIDs(nNext, IMESH_ID_BLOCK_SIZE, vIDs)) > 0 ) {
+		f( (const VertexID *)vIDs, nCount );
+		nNext = vIDs[nCount-1] + 1;
+	}
+	return f;
+}
+
+template<class Func>
+Func IMesh::ForEachTriangleBlock( Func f ) const
+{
+	TriangleID tIDs[IMESH_ID_BLOCK_SIZE];
+	TriangleID nNext = 0;
+	unsigned int nCount;
+	while ( (nCount = GetTriangleIDs(nNext, IMESH_ID_BLOCK_SIZE, tIDs)) > 0 ) {
+		f( (const TriangleID *)tIDs, nCount );
+		nNext = tIDs[nCount-1] + 1;
+	}
+	return f;
+}
+
+// adapts a per-ID functor for ForEachVertexBlock/ForEachTriangleBlock
+template<class Func>
+struct IMeshIDBlockFunc {
+	Func f;
+	IMeshIDBlockFunc( const Func & fUse ) : f(fUse) {}
+	inline void operator()( const IMesh::MeshEntityID * pIDs, unsigned int nCount ) {
+		for ( unsigned int k = 0; k < nCount; ++k )
+			f( pIDs[k] );
+	}
+};
+
+template<class Func>
+Func IMesh::ForEachVertex( Func f ) const
+{
+	return ForEachVertexBlock( IMeshIDBlockFunc<Func>(f) ).f;
+}
+
+template<class Func>
+Func IMesh::ForEachTriangle( Func f ) const
+{
+	return ForEachTriangleBlock( IMeshIDBlockFunc<Func>(f) ).f;
+}
+
+// ForEachVertexBlock/ForEachTriangleBlock functor that appends the IDs to a vector
+struct IMeshAppendIDsFunc {
+	std::vector<IMesh::MeshEntityID> * pIDs;
+	IMeshAppendIDsFunc( std::vector<IMesh::MeshEntityID> & vIDs ) : pIDs(&vIDs) {}
+	inline void operator()( const IMesh::MeshEntityID * pBlock, unsigned int nCount ) {
+		pIDs->insert( pIDs->end(), pBlock, pBlock + nCount );
+	}
+};
+
+// ForEachVertexBlock functor that gathers positions (and normals, if pNormals is not NULL) into arrays indexed
+// by VertexID, with 3 floats per vertex. Either array may be NULL
+struct IMeshGatherByIDFunc {
+	const IMesh * pMesh;
+	float * pXYZ;
+	float * pNormals;
+	IMeshGatherByIDFunc( const IMesh * pUseMesh, float * pUseXYZ, float * pUseNormals = NULL )
+		: pMesh(pUseMesh), pXYZ(pUseXYZ), pNormals(pUseNormals) {}
+	inline void operator()( const IMesh::VertexID * pIDs, unsigned int nCount ) {
+		float vXYZ[3*IMESH_ID_BLOCK_SIZE], vNormals[3*IMESH_ID_BLOCK_SIZE];
+		pMesh->GatherVertices( pIDs, nCount, vXYZ, (pNormals) ? vNormals : NULL );
+		for ( unsigned int k = 0; k < nCount; ++k ) {
+			for ( int j = 0; j < 3; ++j ) {
+				if ( pXYZ )
+					pXYZ[ 3*pIDs[k] + j ] = vXYZ[3*k+j];
+				if ( pNormals )
+					pNormals[ 3*pIDs[k] + j ] = vNormals[3*k+j];
+			}
+		}
+	}
+};
+
 
 
 /*
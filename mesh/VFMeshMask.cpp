@@ -93,33 +93,40 @@ void VFMeshMask::SetMesh( IMesh * pMesh )
 }
 
 
-void VFMeshMask::InitializeUVMask( IMesh * pMesh, IMesh::UVSetID nUVSetID )
-{
-	if ( nUVSetID != 0 ) 
-		lgBreakToDebugger();
+// IMesh::ForEachTriangle functor for InitializeUVMask
+struct UVMaskFunc {
+	VFMeshMask * pMask;
+	IMesh * pMesh;
+	IMesh::UVSetID nUVSetID;
 
-	SetMesh(pMesh);
-	InitializeUVSet(nUVSetID);
-
-	Wml::Vector2f vUV[3];
-	VertexID nTri[3];
-	IMesh::ITriIterator
-		curt( pMesh->BeginITriangles() ), endt( pMesh->EndITriangles() );
-	while ( curt != endt ) {
-		TriangleID tID = *curt;  curt++;
+	UVMaskFunc( VFMeshMask * pUseMask, IMesh * pUseMesh, IMesh::UVSetID nSetID ) : pMask(pUseMask), pMesh(pUseMesh), nUVSetID(nSetID) {}
 
+	inline void operator()( IMesh::TriangleID tID ) {
+		Wml::Vector2f vUV[3];
 		if ( pMesh->GetTriangleUV(tID, nUVSetID, vUV ) ) {
-			SetCutTri(tID);
+			pMask->SetCutTri(tID);
+			IMesh::VertexID nTri[3];
 			pMesh->GetTriangle(tID, nTri);
 			for ( int j = 0; j < 3; ++j ) {
-				SetCutVtx( nTri[j] );
+				pMask->SetCutVtx( nTri[j] );
 
 				// Each UV is set multiple times...is this worth it, or would
 				// it be better to do a vertex-iterate afterwards??
-				SetUV( nTri[j], nUVSetID, vUV[j] );
+				pMask->SetUV( nTri[j], nUVSetID, vUV[j] );
 			}
 		}
 	}
+};
+
+void VFMeshMask::InitializeUVMask( IMesh * pMesh, IMesh::UVSetID nUVSetID )
+{
+	if ( nUVSetID != 0 ) 
+		lgBreakToDebugger();
+
+	SetMesh(pMesh);
+	InitializeUVSet(nUVSetID);
+
+	pMesh->ForEachTriangle( UVMaskFunc(this, pMesh, nUVSetID) );
 }
 
 
@@ -357,6 +364,50 @@ Wml::Vector2f VFMeshMask::Project2D( const Wml::Vector3f & vPoint, bool * bStatu
 
 
 
+unsigned int VFMeshMask::GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const
+{
+	if ( m_eMaskMode == Intersection )
+		return m_vCutVertices.get_indexes( nBegin, nCount, pIDs );
+
+	// fetch blocks from base mesh and filter in-place. Same test as vertex_iterator, 
+	// ie cut vertices on the cut boundary are kept
+	unsigned int n = 0;
+	while ( n < nCount ) {
+		unsigned int nBlock = m_pMesh->GetVertexIDs( nBegin, nCount - n, pIDs + n );
+		if ( nBlock == 0 )
+			break;
+		nBegin = pIDs[n + nBlock - 1] + 1;
+		unsigned int nEnd = n + nBlock;
+		for ( unsigned int k = n; k < nEnd; ++k ) {
+			if ( ! IsCutVtx(pIDs[k]) || IsBoundaryVertex(pIDs[k]) )
+				pIDs[n++] = pIDs[k];
+		}
+	}
+	return n;
+}
+
+unsigned int VFMeshMask::GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const
+{
+	if ( m_eMaskMode == Intersection )
+		return m_vCutTriangles.get_indexes( nBegin, nCount, pIDs );
+
+	unsigned int n = 0;
+	while ( n < nCount ) {
+		unsigned int nBlock = m_pMesh->GetTriangleIDs( nBegin, nCount - n, pIDs + n );
+		if ( nBlock == 0 )
+			break;
+		nBegin = pIDs[n + nBlock - 1] + 1;
+		unsigned int nEnd = n + nBlock;
+		for ( unsigned int k = n; k < nEnd; ++k ) {
+			if ( ! IsCutTri(pIDs[k]) )
+				pIDs[n++] = pIDs[k];
+		}
+	}
+	return n;
+}
+
+
+
 //! initialize vertex neighbour iteration
 void VFMeshMask::BeginVtxTriangles( VtxNbrItr & v ) const
 {
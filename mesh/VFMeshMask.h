@@ -102,6 +102,18 @@ public:
 	virtual bool IsTriangle( TriangleID tID ) const
 		{ return m_pMesh->IsTriangle(tID) && ( (m_eMaskMode == Intersection) ?  IsCutTri(tID) : !IsCutTri(tID) ); }
 
+	//! batched ID iteration (see IMesh). Returns the same IDs as vertex_iterator/triangle_iterator
+	virtual unsigned int GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const;
+	virtual unsigned int GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const;
+
+	//! batch geometry access is passed straight through to the base mesh
+	virtual void GatherVertices( const VertexID * pIDs, unsigned int nCount, float * pXYZ, float * pNormals = NULL ) const
+		{ m_pMesh->GatherVertices(pIDs, nCount, pXYZ, pNormals); }
+	virtual void GatherTriangles( const TriangleID * pIDs, unsigned int nCount, VertexID * pTriangles ) const
+		{ m_pMesh->GatherTriangles(pIDs, nCount, pTriangles); }
+	virtual bool ScatterVertices( const VertexID * pIDs, unsigned int nCount, const float * pXYZ, const float * pNormals = NULL )
+		{ return m_pMesh->ScatterVertices(pIDs, nCount, pXYZ, pNormals); }
+
 
 /*
  * IMesh mesh info interface - has default implementation
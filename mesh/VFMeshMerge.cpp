@@ -54,6 +54,116 @@ void VFMeshMerge::UpdateMaxIDs()
 }
 
 
+unsigned int VFMeshMerge::GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const
+{
+	unsigned int n = 0;
+	if ( m_pBaseMesh && nBegin < m_nMaxBaseVID ) {
+		n = m_pBaseMesh->GetVertexIDs( nBegin, nCount, pIDs );
+		if ( n == nCount )
+			return n;
+	}
+	if ( m_pMergeMesh ) {
+		VertexID nMergeBegin = ( nBegin < m_nMaxBaseVID ) ? 0 : ToMergeVID(nBegin);
+		unsigned int nMerge = m_pMergeMesh->GetVertexIDs( nMergeBegin, nCount - n, pIDs + n );
+		for ( unsigned int k = n; k < n + nMerge; ++k )
+			pIDs[k] = FromMergeVID( pIDs[k] );
+		n += nMerge;
+	}
+	return n;
+}
+
+unsigned int VFMeshMerge::GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const
+{
+	// base triangles come from the mask (see triangle_iterator)
+	unsigned int n = 0;
+	if ( m_pBaseMask && nBegin < m_nMaxBaseTID ) {
+		n = m_pBaseMask->GetTriangleIDs( nBegin, nCount, pIDs );
+		if ( n == nCount )
+			return n;
+	}
+	if ( m_pMergeMesh ) {
+		TriangleID nMergeBegin = ( nBegin < m_nMaxBaseTID ) ? 0 : ToMergeTID(nBegin);
+		unsigned int nMerge = m_pMergeMesh->GetTriangleIDs( nMergeBegin, nCount - n, pIDs + n );
+		for ( unsigned int k = n; k < n + nMerge; ++k )
+			pIDs[k] = FromMergeTID( pIDs[k] );
+		n += nMerge;
+	}
+	return n;
+}
+
+
+void VFMeshMerge::GatherVertices( const VertexID * pIDs, unsigned int nCount, float * pXYZ, float * pNormals ) const
+{
+	VertexID vBlock[IMESH_ID_BLOCK_SIZE];
+	unsigned int i = 0;
+	while ( i < nCount ) {
+		unsigned int n = 0;
+		if ( IsMergeVID(pIDs[i]) ) {
+			while ( i+n < nCount && n < IMESH_ID_BLOCK_SIZE && IsMergeVID(pIDs[i+n]) ) {
+				vBlock[n] = ToMergeVID(pIDs[i+n]);  ++n;
+			}
+			m_pMergeMesh->GatherVertices( vBlock, n, pXYZ + 3*i, (pNormals) ? pNormals + 3*i : NULL );
+		} else {
+			while ( i+n < nCount && ! IsMergeVID(pIDs[i+n]) )
+				++n;
+			m_pBaseMesh->GatherVertices( pIDs + i, n, pXYZ + 3*i, (pNormals) ? pNormals + 3*i : NULL );
+		}
+		i += n;
+	}
+}
+
+bool VFMeshMerge::ScatterVertices( const VertexID * pIDs, unsigned int nCount, const float * pXYZ, const float * pNormals )
+{
+	bool bOK = true;
+	VertexID vBlock[IMESH_ID_BLOCK_SIZE];
+	unsigned int i = 0;
+	while ( i < nCount ) {
+		unsigned int n = 0;
+		if ( IsMergeVID(pIDs[i]) ) {
+			while ( i+n < nCount && n < IMESH_ID_BLOCK_SIZE && IsMergeVID(pIDs[i+n]) ) {
+				vBlock[n] = ToMergeVID(pIDs[i+n]);  ++n;
+			}
+			bOK = m_pMergeMesh->ScatterVertices( vBlock, n, pXYZ + 3*i, (pNormals) ? pNormals + 3*i : NULL ) && bOK;
+		} else {
+			while ( i+n < nCount && ! IsMergeVID(pIDs[i+n]) )
+				++n;
+			bOK = m_pBaseMesh->ScatterVertices( pIDs + i, n, pXYZ + 3*i, (pNormals) ? pNormals + 3*i : NULL ) && bOK;
+		}
+		i += n;
+	}
+	return bOK;
+}
+
+void VFMeshMerge::GatherTriangles( const TriangleID * pIDs, unsigned int nCount, VertexID * pTriangles ) const
+{
+	TriangleID tBlock[IMESH_ID_BLOCK_SIZE];
+	unsigned int i = 0;
+	while ( i < nCount ) {
+		unsigned int n = 0;
+		if ( IsMergeTID(pIDs[i]) ) {
+			while ( i+n < nCount && n < IMESH_ID_BLOCK_SIZE && IsMergeTID(pIDs[i+n]) ) {
+				tBlock[n] = ToMergeTID(pIDs[i+n]);  ++n;
+			}
+			VertexID * pTris = pTriangles + 3*i;
+			m_pMergeMesh->GatherTriangles( tBlock, n, pTris );
+
+			// re-write boundary vertices (same as GetTriangle)
+			for ( unsigned int j = 0; j < 3*n; ++j ) {
+				if ( m_vMergeToBase.has( pTris[j] ) )
+					pTris[j] = m_vMergeToBase.get( pTris[j] );
+				else
+					pTris[j] = FromMergeVID( pTris[j] );
+			}
+		} else {
+			while ( i+n < nCount && ! IsMergeTID(pIDs[i+n]) )
+				++n;
+			m_pBaseMesh->GatherTriangles( pIDs + i, n, pTriangles + 3*i );
+		}
+		i += n;
+	}
+}
+
+
 void VFMeshMerge::GetVertex( VertexID vID, Wml::Vector3f & vVertex, Wml::Vector3f * pNormal ) const 
 { 
 	if ( IsMergeVID(vID) ) {
@@ -59,6 +59,15 @@ public:
 	virtual bool IsTriangle( TriangleID tID ) const
 		{ lgBreakToDebugger(); return false; }
 
+	//! batched ID iteration (see IMesh). Base mesh IDs, then merge mesh IDs (shifted by FromMergeVID/FromMergeTID)
+	virtual unsigned int GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const;
+	virtual unsigned int GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const;
+
+	//! batch geometry access. Runs of base or merge IDs are forwarded to the respective mesh in blocks
+	virtual void GatherVertices( const VertexID * pIDs, unsigned int nCount, float * pXYZ, float * pNormals = NULL ) const;
+	virtual void GatherTriangles( const TriangleID * pIDs, unsigned int nCount, VertexID * pTriangles ) const;
+	virtual bool ScatterVertices( const VertexID * pIDs, unsigned int nCount, const float * pXYZ, const float * pNormals = NULL );
+
 /*
  * IMesh mesh info interface - has default implementation
  */
@@ -8,6 +8,7 @@
 using namespace rms;
 
 #include "rmsdebug.h"
+#include <cstring>
 
 // this generates a log of all mesh actions
 //#define PRINT_DEBUG_LOG
@@ -18,6 +19,7 @@ using namespace rms;
 
 
 VFTriangleMesh::VFTriangleMesh(void)
+	: m_eVertexStorage(InterleavedVertexStorage), m_bTopologyFrozen(false)
 {
 }
 
@@ -26,10 +28,12 @@ VFTriangleMesh::~VFTriangleMesh(void)
 }
 
 VFTriangleMesh::VFTriangleMesh( const VFTriangleMesh & copy, VertexMap & vMap, TriangleMap * tMap, bool bCompact )
+	: m_eVertexStorage(InterleavedVertexStorage), m_bTopologyFrozen(false)
 {
 	Copy(copy, vMap, tMap, bCompact);
 }
 VFTriangleMesh::VFTriangleMesh( const VFTriangleMesh & copy, bool bCompact )
+	: m_eVertexStorage(InterleavedVertexStorage), m_bTopologyFrozen(false)
 {
 	Copy(copy, bCompact);
 }
@@ -60,6 +64,7 @@ void VFTriangleMesh::Copy( const VFTriangleMesh & mCopy, VertexMap & vMap, Trian
 		tMap->Resize( nMaxTID, nMaxTID );
 
 	Clear(true);
+	m_eVertexStorage = mCopy.m_eVertexStorage;
 
 	Wml::Vector3f vVertex, vNormal;
 	vertex_iterator curv(mCopy_nonconst.BeginVertices()), endv(mCopy_nonconst.EndVertices());
@@ -187,20 +192,20 @@ bool VFTriangleMesh::Append( VFTriangleMesh & mAppend, VertexMap & vMap, Triangl
 
 IMesh::VertexID VFTriangleMesh::AppendVertex( const Wml::Vector3f & vVertex, const Wml::Vector3f * pNormal )
 { 
-	VertexID vNewID = 
-		(VertexID)m_vVertices.insert( Vertex(vVertex, (pNormal) ? *pNormal : Wml::Vector3f::UNIT_Z ) );
+	InvalidateTopology();
+	VertexID vNewID = InsertVertex( vVertex, (pNormal) ? *pNormal : Wml::Vector3f::UNIT_Z );
 #ifdef PRINT_DEBUG_LOG
 	_RMSInfo("[VFMesh::AppendVertex      ] - adding vertex %6d\n", vNewID);
 #endif
 
-	if ( m_vVertices[vNewID].pData == NULL ) {
-		m_vVertices[vNewID].pData = m_VertDataMemPool.Allocate();
-		m_vVertices[vNewID].pData->vTriangles = m_VertListPool.GetList();
-		m_vVertices[vNewID].pData->vEdges = m_VertListPool.GetList();
+	if ( VtxData(vNewID) == NULL ) {
+		VtxData(vNewID) = m_VertDataMemPool.Allocate();
+		VtxData(vNewID)->vTriangles = m_VertListPool.GetList();
+		VtxData(vNewID)->vEdges = m_VertListPool.GetList();
 	}
 
 	// clear lists...
-	VertexData & v = * m_vVertices[vNewID].pData;
+	VertexData & v = * VtxData(vNewID);
 	m_VertListPool.Clear( v.vTriangles );
 	m_VertListPool.Clear( v.vEdges );
 
@@ -208,6 +213,147 @@ IMesh::VertexID VFTriangleMesh::AppendVertex( const Wml::Vector3f & vVertex, con
 }
 
 
+IMesh::VertexID VFTriangleMesh::InsertVertex( const Wml::Vector3f & vVertex, const Wml::Vector3f & vNormal )
+{
+	VertexID vNewID = (VertexID)m_vVertexRefs.insert();
+
+	if ( m_eVertexStorage == CompactVertexStorage ) {
+		if ( vNewID == m_vPositions.size() ) {
+			m_vPositions.push_back(vVertex);
+			m_vNormals.push_back(vNormal);
+			m_vColors.push_back(Wml::ColorRGBA::WHITE);
+			m_vBits.push_back(0);
+			m_vVertexData.push_back(NULL);
+		} else {
+			m_vPositions[vNewID] = vVertex;
+			m_vNormals[vNewID] = vNormal;
+			m_vColors[vNewID] = Wml::ColorRGBA::WHITE;
+			m_vBits[vNewID] = 0;
+			m_vVertexData[vNewID] = NULL;
+		}
+	} else {
+		if ( vNewID == m_vVertexRecords.size() )
+			m_vVertexRecords.push_back( Vertex(vVertex, vNormal) );
+		else
+			m_vVertexRecords[vNewID] = Vertex(vVertex, vNormal);
+	}
+	return vNewID;
+}
+
+
+// length of run of consecutive IDs starting at pIDs[0]
+static inline unsigned int ConsecutiveRun( const IMesh::VertexID * pIDs, unsigned int nCount )
+{
+	unsigned int n = 1;
+	while ( n < nCount && pIDs[n] == pIDs[0] + n )
+		++n;
+	return n;
+}
+
+void VFTriangleMesh::GatherVertices( const VertexID * pIDs, unsigned int nCount, float * pXYZ, float * pNormals ) const
+{
+	if ( m_eVertexStorage == CompactVertexStorage ) {
+		const float * pPosBuf = GetPositionBuffer();
+		const float * pNormalBuf = GetNormalBuffer();
+		unsigned int i = 0;
+		while ( i < nCount ) {
+			unsigned int n = ConsecutiveRun( pIDs + i, nCount - i );
+			lgASSERT( IsVertex(pIDs[i]) && IsVertex(pIDs[i+n-1]) );
+			memcpy( pXYZ + 3*i, pPosBuf + 3*pIDs[i], 3*n*sizeof(float) );
+			if ( pNormals )
+				memcpy( pNormals + 3*i, pNormalBuf + 3*pIDs[i], 3*n*sizeof(float) );
+			i += n;
+		}
+	} else {
+		for ( unsigned int k = 0; k < nCount; ++k ) {
+			lgASSERT( IsVertex(pIDs[k]) );
+			const Vertex & v = m_vVertexRecords[ pIDs[k] ];
+			memcpy( pXYZ + 3*k, (const float *)v.vVertex, 3*sizeof(float) );
+			if ( pNormals )
+				memcpy( pNormals + 3*k, (const float *)v.vNormal, 3*sizeof(float) );
+		}
+	}
+}
+
+void VFTriangleMesh::GatherTriangles( const TriangleID * pIDs, unsigned int nCount, VertexID * pTriangles ) const
+{
+	for ( unsigned int k = 0; k < nCount; ++k )
+		memcpy( pTriangles + 3*k, m_vTriangles[ pIDs[k] ].nVertices, 3*sizeof(VertexID) );
+}
+
+bool VFTriangleMesh::ScatterVertices( const VertexID * pIDs, unsigned int nCount, const float * pXYZ, const float * pNormals )
+{
+	if ( m_eVertexStorage == CompactVertexStorage ) {
+		float * pPosBuf = GetPositionBuffer();
+		float * pNormalBuf = GetNormalBuffer();
+		unsigned int i = 0;
+		while ( i < nCount ) {
+			unsigned int n = ConsecutiveRun( pIDs + i, nCount - i );
+			lgASSERT( IsVertex(pIDs[i]) && IsVertex(pIDs[i+n-1]) );
+			memcpy( pPosBuf + 3*pIDs[i], pXYZ + 3*i, 3*n*sizeof(float) );
+			if ( pNormals )
+				memcpy( pNormalBuf + 3*pIDs[i], pNormals + 3*i, 3*n*sizeof(float) );
+			i += n;
+		}
+	} else {
+		for ( unsigned int k = 0; k < nCount; ++k ) {
+			lgASSERT( IsVertex(pIDs[k]) );
+			Vertex & v = m_vVertexRecords[ pIDs[k] ];
+			v.vVertex = Wml::Vector3f( pXYZ + 3*k );
+			if ( pNormals )
+				v.vNormal = Wml::Vector3f( pNormals + 3*k );
+		}
+	}
+	return true;
+}
+
+
+void VFTriangleMesh::SetVertexStorageMode( VertexStorageMode eMode )
+{
+	if ( eMode == m_eVertexStorage )
+		return;
+
+	// entries for free VertexIDs are copied too, so that the free-list stays valid
+	size_t nCount = m_vVertexRefs.max_index();
+	if ( eMode == CompactVertexStorage ) {
+		m_vPositions.resize(nCount);
+		m_vNormals.resize(nCount);
+		m_vColors.resize(nCount, Wml::ColorRGBA::WHITE);
+		m_vBits.resize(nCount);
+		m_vVertexData.resize(nCount);
+		for ( unsigned int i = 0; i < nCount; ++i ) {
+			const Vertex & v = m_vVertexRecords[i];
+			m_vPositions[i] = v.vVertex;
+			m_vNormals[i] = v.vNormal;
+			m_vBits[i] = v.nBits;
+			m_vVertexData[i] = v.pData;
+			if ( v.pData )
+				m_vColors[i] = v.pData->vColor;
+		}
+		std::vector<Vertex>().swap(m_vVertexRecords);
+
+	} else {
+		m_vVertexRecords.resize(nCount);
+		for ( unsigned int i = 0; i < nCount; ++i ) {
+			Vertex & v = m_vVertexRecords[i];
+			v.vVertex = m_vPositions[i];
+			v.vNormal = m_vNormals[i];
+			v.nBits = m_vBits[i];
+			v.pData = m_vVertexData[i];
+			if ( v.pData )
+				v.pData->vColor = m_vColors[i];
+		}
+		std::vector<Wml::Vector3f>().swap(m_vPositions);
+		std::vector<Wml::Vector3f>().swap(m_vNormals);
+		std::vector<Wml::ColorRGBA>().swap(m_vColors);
+		std::vector<unsigned int>().swap(m_vBits);
+		std::vector<VertexData *>().swap(m_vVertexData);
+	}
+
+	m_eVertexStorage = eMode;
+}
+
+
 int int_compare(const void * a, const void * b) 
 {
 	return *(const int *)a < *(const int *)b;
@@ -215,7 +361,7 @@ int int_compare(const void * a, const void * b)
 
 IMesh::TriangleID VFTriangleMesh::AppendTriangle( IMesh::VertexID v1, IMesh::VertexID v2, IMesh::VertexID v3 )
 { 
-	lgASSERT( m_vVertices.isValid(v1) && m_vVertices.isValid(v2) && m_vVertices.isValid(v3) );
+	lgASSERT( m_vVertexRefs.isValid(v1) && m_vVertexRefs.isValid(v2) && m_vVertexRefs.isValid(v3) );
 
 	// insert new triangle
 	TriangleID tID = (TriangleID)m_vTriangles.insert( Triangle(v1,v2,v3) ); 
@@ -224,9 +370,9 @@ IMesh::TriangleID VFTriangleMesh::AppendTriangle( IMesh::VertexID v1, IMesh::Ver
 #endif
 
 	// increment reference counts
-	m_vVertices.increment( v1 );
-	m_vVertices.increment( v2 );
-	m_vVertices.increment( v3 );
+	m_vVertexRefs.increment( v1 );
+	m_vVertexRefs.increment( v2 );
+	m_vVertexRefs.increment( v3 );
 
 	// add to triangle lists
 	AddTriEntry( tID, v1 );
@@ -262,13 +408,13 @@ bool VFTriangleMesh::SetTriangle( IMesh::TriangleID tID, IMesh::VertexID v1, IMe
 		RemoveTriangleEdge(tID, t.nVertices[2], t.nVertices[0]);
 
 		// decrement existing reference counts
-		lgASSERT( m_vVertices.isValid(t.nVertices[0]) && m_vVertices.isValid(t.nVertices[1]) && m_vVertices.isValid(t.nVertices[2]) );
+		lgASSERT( m_vVertexRefs.isValid(t.nVertices[0]) && m_vVertexRefs.isValid(t.nVertices[1]) && m_vVertexRefs.isValid(t.nVertices[2]) );
 		RemoveTriEntry( tID, t.nVertices[0] );
 		RemoveTriEntry( tID, t.nVertices[1] );
 		RemoveTriEntry( tID, t.nVertices[2] );
-		m_vVertices.decrement(t.nVertices[0]);
-		m_vVertices.decrement(t.nVertices[1]);
-		m_vVertices.decrement(t.nVertices[2]);
+		m_vVertexRefs.decrement(t.nVertices[0]);
+		m_vVertexRefs.decrement(t.nVertices[1]);
+		m_vVertexRefs.decrement(t.nVertices[2]);
 
 		// set new IDs
 		t.nVertices[0] = v1;
@@ -276,10 +422,10 @@ bool VFTriangleMesh::SetTriangle( IMesh::TriangleID tID, IMesh::VertexID v1, IMe
 		t.nVertices[2] = v3;
 
 		// increment new reference counts
-		lgASSERT( m_vVertices.isValid(v1) && m_vVertices.isValid(v2) && m_vVertices.isValid(v3) );
-		m_vVertices.increment(v1);
-		m_vVertices.increment(v2);
-		m_vVertices.increment(v3);
+		lgASSERT( m_vVertexRefs.isValid(v1) && m_vVertexRefs.isValid(v2) && m_vVertexRefs.isValid(v3) );
+		m_vVertexRefs.increment(v1);
+		m_vVertexRefs.increment(v2);
+		m_vVertexRefs.increment(v3);
 		AddTriEntry( tID, v1 );
 		AddTriEntry( tID, v2 );
 		AddTriEntry( tID, v3 );
@@ -301,9 +447,25 @@ bool VFTriangleMesh::SetTriangle( IMesh::TriangleID tID, IMesh::VertexID v1, IMe
 void VFTriangleMesh::Clear( bool bFreeMem )
 {
 	IMesh::Clear(bFreeMem);
-	m_vVertices.clear( bFreeMem );
+	m_vVertexRefs.clear( bFreeMem );
+	if ( bFreeMem ) {
+		std::vector<Vertex>().swap(m_vVertexRecords);
+		std::vector<Wml::Vector3f>().swap(m_vPositions);
+		std::vector<Wml::Vector3f>().swap(m_vNormals);
+		std::vector<Wml::ColorRGBA>().swap(m_vColors);
+		std::vector<unsigned int>().swap(m_vBits);
+		std::vector<VertexData *>().swap(m_vVertexData);
+	} else {
+		m_vVertexRecords.resize(0);
+		m_vPositions.resize(0);
+		m_vNormals.resize(0);
+		m_vColors.resize(0);
+		m_vBits.resize(0);
+		m_vVertexData.resize(0);
+	}
 	m_vEdges.clear( bFreeMem );
 	m_vTriangles.clear( bFreeMem );
+	ReleaseTopology();
 	m_VertDataMemPool.ClearAll();
 	m_VertListPool.Clear(bFreeMem);
 	m_vNonManifoldEdges.clear();
@@ -339,18 +501,19 @@ IMesh::EdgeID VFTriangleMesh::AddTriangleEdge( TriangleID tID, VertexID v1, Vert
 
 void VFTriangleMesh::HACK_ManuallyIncrementReferenceCount( VertexID vID )
 {
-	lgASSERT( m_vVertices.isValid(vID) );
-	m_vVertices.increment(vID);
+	lgASSERT( m_vVertexRefs.isValid(vID) );
+	m_vVertexRefs.increment(vID);
 }
 void VFTriangleMesh::HACK_ManuallyDecrementReferenceCount( VertexID vID )
 {
-	lgASSERT( m_vVertices.isValid(vID) );
-	m_vVertices.decrement(vID);
-	if ( m_vVertices.refCount( vID ) == 1 ) {
+	lgASSERT( m_vVertexRefs.isValid(vID) );
+	m_vVertexRefs.decrement(vID);
+	if ( m_vVertexRefs.refCount( vID ) == 1 ) {
+		InvalidateTopology();
 #ifdef PRINT_DEBUG_LOG
 		_RMSInfo("[VFMesh::HACK_ManuallyDecrementReferenceCount] - removing vertex %6d\n", vID);
 #endif
-		m_vVertices.remove( vID );
+		m_vVertexRefs.remove( vID );
 	}
 }
 
@@ -382,30 +545,31 @@ bool VFTriangleMesh::RemoveTriangleEdge( TriangleID tID, VertexID v1, VertexID v
 
 void VFTriangleMesh::RemoveVertex( VertexID vID )
 {
-	if ( ! m_vVertices.isValid( vID ) )
+	if ( ! m_vVertexRefs.isValid( vID ) )
 		return;
 #ifdef PRINT_DEBUG_LOG
 	_RMSInfo("[VFMesh::RemoveVertex      ] - removing vertex %6d\n", vID);
 #endif
 
-	VFTriangleMesh::Vertex & v = m_vVertices[vID];
+	InvalidateTopology();
+	VertexData * pData = VtxData(vID);
 
 	// [RMS] HACK! This case shouldn't happen, but it does in ::Weld() because
 	//  SetTriangle() doesn't remove un-referenced vertices (which it really
 	//   shouldn't, since we might be performing mesh surgery stuff....
-	if ( v.pData->vTriangles.pFirst == NULL ) {
-		if ( m_vVertices.refCount( vID ) == 1 )
-			m_vVertices.remove( vID );
+	if ( pData->vTriangles.pFirst == NULL ) {
+		if ( m_vVertexRefs.refCount( vID ) == 1 )
+			m_vVertexRefs.remove( vID );
 		else
 			lgBreakToDebugger();
 	} else { 
 		// remove each attached face
-		while ( m_vVertices.isValid( vID ) && v.pData->vTriangles.pFirst != NULL )
-			RemoveTriangle(v.pData->vTriangles.pFirst->data );
+		while ( m_vVertexRefs.isValid( vID ) && pData->vTriangles.pFirst != NULL )
+			RemoveTriangle(pData->vTriangles.pFirst->data );
 	}
 
 	// vertex should be gone now because no attached faces remain! 
-	lgASSERT( ! m_vVertices.isValid( vID ) );
+	lgASSERT( ! m_vVertexRefs.isValid( vID ) );
 }
 
 
@@ -419,10 +583,10 @@ void VFTriangleMesh::RemoveTriangle( TriangleID tID )
 #endif
 
 	// decrement existing reference counts
-	lgASSERT( m_vVertices.isValid(t.nVertices[0]) && m_vVertices.isValid(t.nVertices[1]) && m_vVertices.isValid(t.nVertices[2]) );
+	lgASSERT( m_vVertexRefs.isValid(t.nVertices[0]) && m_vVertexRefs.isValid(t.nVertices[1]) && m_vVertexRefs.isValid(t.nVertices[2]) );
 	for ( int i = 0; i < 3; ++i ) {
 		RemoveTriEntry( tID, t.nVertices[i] );
-		m_vVertices.decrement(t.nVertices[i]);
+		m_vVertexRefs.decrement(t.nVertices[i]);
 	}
 
 	// remove edges
@@ -432,8 +596,8 @@ void VFTriangleMesh::RemoveTriangle( TriangleID tID )
 
 	// remove vertex if refcount == 1  (means that it is only referenced by self, so is safe to delete)
 	for ( int i = 0; i < 3; ++i ) {
-		if ( m_vVertices.refCount( t.nVertices[i] ) == 1 )
-			m_vVertices.remove( t.nVertices[i]  );
+		if ( m_vVertexRefs.refCount( t.nVertices[i] ) == 1 )
+			m_vVertexRefs.remove( t.nVertices[i]  );
 	}
 
 	// remove triangle
@@ -446,21 +610,35 @@ void VFTriangleMesh::RemoveUnreferencedGeometry()
 }
 
 
+// VtxNbrItr::nData[1] is flagged with this bit when iterating over the TopologySnapshot.
+// In that case nData[0] is the current index into the CSR array and nData[1] the end index.
+static const unsigned long long FROZEN_ITR_BIT = 1ull << 63;
+
 //! initialize vertex neighbour iteration
 void VFTriangleMesh::BeginVtxTriangles( VtxNbrItr & v ) const
 {
-	lgASSERT( m_vVertices.isValid(v.vID) );
-	const VFTriangleMesh::Vertex & vtx = m_vVertices[v.vID];
-	if ( vtx.pData == NULL || vtx.pData->vTriangles.pFirst == NULL )
+	lgASSERT( m_vVertexRefs.isValid(v.vID) );
+	if ( m_bTopologyFrozen ) {
+		v.nData[0] = m_topology.vTriStart[v.vID];
+		v.nData[1] = FROZEN_ITR_BIT | m_topology.vTriStart[v.vID+1];
+		return;
+	}
+	const VertexData * pData = VtxData(v.vID);
+	if ( pData == NULL || pData->vTriangles.pFirst == NULL )
 		v.nData[0] = IMesh::InvalidID;
 	else
-		v.nData[0] = (unsigned long long)(vtx.pData->vTriangles.pFirst);
+		v.nData[0] = (unsigned long long)(pData->vTriangles.pFirst);
 	v.nData[1] = 1234567890;
 }
 
 //! (possibly) un-ordered iteration around one-ring of a vertex. Returns InvalidID when done
 IMesh::TriangleID VFTriangleMesh::GetNextVtxTriangle( VtxNbrItr & v ) const
 {
+	if ( v.nData[1] & FROZEN_ITR_BIT ) {
+		if ( v.nData[0] == (v.nData[1] & ~FROZEN_ITR_BIT) )
+			return IMesh::InvalidID;
+		return m_topology.vTriangles[ (size_t)v.nData[0]++ ];
+	}
 	if ( v.nData[0] == IMesh::InvalidID )
 		return IMesh::InvalidID;
 	
@@ -480,18 +658,28 @@ IMesh::TriangleID VFTriangleMesh::GetNextVtxTriangle( VtxNbrItr & v ) const
 //! initialize vertex neighbour iteration
 void VFTriangleMesh::BeginVtxEdges( VtxNbrItr & v ) const
 {
-	lgASSERT( m_vVertices.isValid(v.vID) );
-	const VFTriangleMesh::Vertex & vtx = m_vVertices[v.vID];
-	if ( vtx.pData == NULL || vtx.pData->vEdges.pFirst == NULL  )
+	lgASSERT( m_vVertexRefs.isValid(v.vID) );
+	if ( m_bTopologyFrozen ) {
+		v.nData[0] = m_topology.vEdgeStart[v.vID];
+		v.nData[1] = FROZEN_ITR_BIT | m_topology.vEdgeStart[v.vID+1];
+		return;
+	}
+	const VertexData * pData = VtxData(v.vID);
+	if ( pData == NULL || pData->vEdges.pFirst == NULL  )
 		v.nData[0] = IMesh::InvalidID;
 	else
-		v.nData[0] = (unsigned long long)(vtx.pData->vEdges.pFirst);
+		v.nData[0] = (unsigned long long)(pData->vEdges.pFirst);
 	v.nData[1] = 1234567890;
 }
 
 //! (possibly) un-ordered iteration around one-ring of a vertex. Returns InvalidID when done
 IMesh::EdgeID VFTriangleMesh::GetNextVtxEdges( VtxNbrItr & v ) const
 {
+	if ( v.nData[1] & FROZEN_ITR_BIT ) {
+		if ( v.nData[0] == (v.nData[1] & ~FROZEN_ITR_BIT) )
+			return IMesh::InvalidID;
+		return m_topology.vEdges[ (size_t)v.nData[0]++ ];
+	}
 	if ( v.nData[0] == IMesh::InvalidID )
 		return IMesh::InvalidID;
 	
@@ -531,6 +719,26 @@ void VFTriangleMesh::EdgeIteration( VertexID vID, VFTriangleMesh::NeighborEdgeCa
 bool VFTriangleMesh::VertexOneRing( VertexID vID, std::vector<VertexID> & vOneRing, 
 									bool bOrdered, bool * bClosed )
 {
+	if ( m_bTopologyFrozen ) {
+		if ( ! bOrdered ) {
+			unsigned int nCount = m_topology.EdgeCount(vID);
+			const EdgeID * pEdges = m_topology.Edges(vID);
+			vOneRing.resize(nCount);
+			for ( unsigned int k = 0; k < nCount; ++k ) {
+				const Edge & e = m_vEdges[ pEdges[k] ];
+				vOneRing[k] = (e.nVertices[0] == vID) ? e.nVertices[1] : e.nVertices[0];
+			}
+		} else {
+			if ( ! m_topology.HasFlag(vID, TopologySnapshot::OneRingValid) )
+				return false;
+			const VertexID * pRing = m_topology.OneRing(vID);
+			vOneRing.assign( pRing, pRing + m_topology.OneRingSize(vID) );
+			if ( bClosed )
+				*bClosed = m_topology.HasFlag(vID, TopologySnapshot::OneRingClosed);
+		}
+		return true;
+	}
+
 	if ( ! bOrdered ) {
 		vOneRing.resize(0);
 		VtxNbrItr itr(vID);
@@ -629,6 +837,11 @@ bool VFTriangleMesh::TriangleOneRing( VertexID vID, std::vector<TriangleID> & vO
 									   bool bOrdered, bool * bClosed )
 {
 	if ( ! bOrdered ) {
+		if ( m_bTopologyFrozen ) {
+			const TriangleID * pTris = m_topology.Triangles(vID);
+			vOneRing.assign( pTris, pTris + m_topology.TriangleCount(vID) );
+			return true;
+		}
 		vOneRing.resize(0);
 		VtxNbrItr itr(vID);
 		BeginVtxTriangles(itr);
@@ -646,6 +859,178 @@ bool VFTriangleMesh::TriangleOneRing( VertexID vID, std::vector<TriangleID> & vO
 
 
 
+const VFTriangleMesh::TopologySnapshot & VFTriangleMesh::FreezeTopology()
+{
+	if ( m_bTopologyFrozen )
+		return m_topology;
+
+	TopologySnapshot & t = m_topology;
+	unsigned int nMaxVID = GetMaxVertexID();
+
+	// counting sort of triangles into per-vertex buckets
+	t.vTriStart.resize(0);  t.vTriStart.resize(nMaxVID+1, 0);
+	triangle_iterator curt(BeginTriangles()), endt(EndTriangles());
+	while ( curt != endt ) {
+		const Triangle & tri = m_vTriangles[*curt];  ++curt;
+		for ( int j = 0; j < 3; ++j )
+			t.vTriStart[ tri.nVertices[j]+1 ]++;
+	}
+	for ( unsigned int i = 0; i < nMaxVID; ++i )
+		t.vTriStart[i+1] += t.vTriStart[i];
+	t.vTriangles.resize( t.vTriStart[nMaxVID] );
+	std::vector<unsigned int> vInsert( t.vTriStart.begin(), t.vTriStart.end()-1 );
+	triangle_iterator curt2(BeginTriangles());
+	while ( curt2 != endt ) {
+		TriangleID tID = *curt2;  ++curt2;
+		const Triangle & tri = m_vTriangles[tID];
+		for ( int j = 0; j < 3; ++j )
+			t.vTriangles[ vInsert[tri.nVertices[j]]++ ] = tID;
+	}
+
+	// same for edges
+	t.vEdgeStart.resize(0);  t.vEdgeStart.resize(nMaxVID+1, 0);
+	edge_iterator cure(BeginEdges()), ende(EndEdges());
+	while ( cure != ende ) {
+		const Edge & e = m_vEdges[*cure];  ++cure;
+		t.vEdgeStart[ e.nVertices[0]+1 ]++;
+		t.vEdgeStart[ e.nVertices[1]+1 ]++;
+	}
+	for ( unsigned int i = 0; i < nMaxVID; ++i )
+		t.vEdgeStart[i+1] += t.vEdgeStart[i];
+	t.vEdges.resize( t.vEdgeStart[nMaxVID] );
+	vInsert.assign( t.vEdgeStart.begin(), t.vEdgeStart.end()-1 );
+	edge_iterator cure2(BeginEdges());
+	while ( cure2 != ende ) {
+		EdgeID eID = *cure2;  ++cure2;
+		const Edge & e = m_vEdges[eID];
+		t.vEdges[ vInsert[e.nVertices[0]]++ ] = eID;
+		t.vEdges[ vInsert[e.nVertices[1]]++ ] = eID;
+	}
+
+	// ordered one-rings and boundary flags
+	t.vFlags.resize(0);  t.vFlags.resize(nMaxVID, 0);
+	t.vRingStart.resize(nMaxVID+1);
+	t.vOneRings.resize(0);
+	t.vOneRings.reserve( t.vEdges.size() );
+	for ( unsigned int vID = 0; vID < nMaxVID; ++vID ) {
+		t.vRingStart[vID] = (unsigned int)t.vOneRings.size();
+		if ( ! m_vVertexRefs.isValid(vID) )
+			continue;
+
+		const EdgeID * pEdges = t.Edges(vID);
+		unsigned int nEdges = t.EdgeCount(vID);
+		for ( unsigned int k = 0; k < nEdges; ++k ) {
+			const Edge & e = m_vEdges[pEdges[k]];
+			if ( e.nTriangles[0] == InvalidID || e.nTriangles[1] == InvalidID ) {
+				t.vFlags[vID] |= TopologySnapshot::BoundaryVertex;
+				break;
+			}
+		}
+
+		bool bClosed = false;
+		if ( AppendOrderedOneRing( vID, t.vOneRings, bClosed ) ) {
+			t.vFlags[vID] |= TopologySnapshot::OneRingValid;
+			if ( bClosed )
+				t.vFlags[vID] |= TopologySnapshot::OneRingClosed;
+		}
+	}
+	t.vRingStart[nMaxVID] = (unsigned int)t.vOneRings.size();
+
+	m_bTopologyFrozen = true;
+	return m_topology;
+}
+
+
+void VFTriangleMesh::ReleaseTopology()
+{
+	m_bTopologyFrozen = false;
+	std::vector<unsigned int>().swap(m_topology.vTriStart);
+	std::vector<TriangleID>().swap(m_topology.vTriangles);
+	std::vector<unsigned int>().swap(m_topology.vEdgeStart);
+	std::vector<EdgeID>().swap(m_topology.vEdges);
+	std::vector<unsigned int>().swap(m_topology.vRingStart);
+	std::vector<VertexID>().swap(m_topology.vOneRings);
+	std::vector<unsigned char>().swap(m_topology.vFlags);
+}
+
+
+// Same walk as the ordered case of VertexOneRing(), but using the edge ranges of the
+// (partially-built) snapshot instead of the linked lists. Appends to vRing, which is
+// left unmodified if the vertex does not have a proper one-ring.
+bool VFTriangleMesh::AppendOrderedOneRing( VertexID vID, std::vector<VertexID> & vRing, bool & bClosed ) const
+{
+	const EdgeID * pEdges = m_topology.Edges(vID);
+	unsigned int nEdges = m_topology.EdgeCount(vID);
+	if ( nEdges == 0 )
+		return false;
+
+	// start at lowest-ID boundary edge, if there is one
+	EdgeID eFirst = InvalidID, eFirstBoundary = InvalidID;
+	unsigned int nBoundary = 0;
+	for ( unsigned int k = 0; k < nEdges; ++k ) {
+		const Edge & e = m_vEdges[pEdges[k]];
+		if ( e.nTriangles[0] == InvalidID || e.nTriangles[1] == InvalidID ) {
+			++nBoundary;
+			eFirstBoundary = std::min(eFirstBoundary, pEdges[k]);
+		}
+		eFirst = std::min(eFirst, pEdges[k]);
+	}
+	if ( nBoundary != 0 && nBoundary != 2 )
+		return false;
+	bClosed = (nBoundary == 0);
+
+	size_t nStart = vRing.size();
+	const Edge * pEdge = & m_vEdges[ (nBoundary > 0) ? eFirstBoundary : eFirst ];
+	vRing.push_back( (pEdge->nVertices[0] == vID) ? pEdge->nVertices[1] : pEdge->nVertices[0] );
+
+	unsigned int nVisited = 1;
+	while ( true ) {
+
+		// find verts that are before and after current edge
+		VertexID vOther[2] = { InvalidID, InvalidID };
+		for ( int j = 0; j < 2; ++j ) {
+			if ( pEdge->nTriangles[j] == InvalidID )
+				continue;
+			const VertexID * nTri = m_vTriangles[ pEdge->nTriangles[j] ].nVertices;
+			for ( int k = 0; k < 3; ++k )
+				if ( nTri[k] != pEdge->nVertices[0] && nTri[k] != pEdge->nVertices[1] ) vOther[j] = nTri[k];
+		}
+
+		// figure out which is which
+		VertexID vPrev = (vRing.size() - nStart == 1) ? vRing.back() : vRing[ vRing.size()-2 ];
+		VertexID vNext = InvalidID;
+		if ( vOther[0] == InvalidID && vOther[1] == InvalidID ) {
+			break;
+		} else if ( vOther[0] == InvalidID ) {
+			vNext = (vOther[1] == vPrev) ? InvalidID : vOther[1];
+		} else if ( vOther[1] == InvalidID ) {
+			vNext = (vOther[0] == vPrev) ? InvalidID : vOther[0];
+		} else {
+			vNext = (vOther[0] == vPrev) ? vOther[1] : vOther[0];
+		}
+		if ( vNext == InvalidID || vNext == vRing[nStart] )
+			break;
+
+		EdgeID eNext = InvalidID;
+		for ( unsigned int k = 0; k < nEdges && eNext == InvalidID; ++k ) {
+			const Edge & e = m_vEdges[pEdges[k]];
+			if ( e.nVertices[0] == vNext || e.nVertices[1] == vNext )
+				eNext = pEdges[k];
+		}
+		if ( eNext == InvalidID || ++nVisited > nEdges ) {
+			vRing.resize(nStart);
+			return false;
+		}
+
+		vRing.push_back( vNext );
+		pEdge = & m_vEdges[eNext];
+	}
+
+	return true;
+}
+
+
+
 
 
 
@@ -684,10 +1069,13 @@ bool VFTriangleMesh::IsBoundaryTriangle( TriangleID tID ) const
 
 bool VFTriangleMesh::IsBoundaryVertex( VertexID vID ) const
 {
-	const Vertex & v = m_vVertices[vID];
+	if ( m_bTopologyFrozen )
+		return m_topology.HasFlag(vID, TopologySnapshot::BoundaryVertex);
+
+	const VertexData * pData = VtxData(vID);
 
 #if 1
-	EdgeListEntry * pCur = v.pData->vEdges.pFirst;
+	EdgeListEntry * pCur = pData->vEdges.pFirst;
 	while ( pCur != NULL ) {
 		const Edge & e = m_vEdges[ pCur->data ];
 		if ( e.nTriangles[0] == InvalidID || e.nTriangles[1] == InvalidID )
@@ -704,7 +1092,7 @@ bool VFTriangleMesh::IsBoundaryVertex( VertexID vID ) const
 
 	// count triangles and make a list of them
 	int nCount = 0;
-	TriListEntry * pCur = v.pData->vTriangles.pFirst;
+	TriListEntry * pCur = pData->vTriangles.pFirst;
 	while ( pCur != NULL ) {
 		pCur = pCur->pNext;
 		nCount++;
@@ -714,7 +1102,7 @@ bool VFTriangleMesh::IsBoundaryVertex( VertexID vID ) const
 
 	std::vector< TriangleID > vTris;
 	vTris.resize( nCount-1 );
-	pCur = v.pData->vTriangles.pFirst->pNext;
+	pCur = pData->vTriangles.pFirst->pNext;
 	int i = 0;
 	while ( pCur != NULL ) {
 		vTris[ i++ ] = pCur->data;
@@ -724,7 +1112,7 @@ bool VFTriangleMesh::IsBoundaryVertex( VertexID vID ) const
 	// pick first edge
 	VertexID vCurID = InvalidID;
 	VertexID vStopID = InvalidID;
-	pCur = v.pData->vTriangles.pFirst;
+	pCur = pData->vTriangles.pFirst;
 	const VertexID * pTri = m_vTriangles[ pCur->data ].nVertices;
 	for ( int i = 0; i < 3; ++i ) {
 		if ( pTri[i] == vID ) {
@@ -782,9 +1170,22 @@ void VFTriangleMesh::FindNeighbours( TriangleID tID, TriangleID vNbrs[3] ) const
 		VertexID v1 = t.nVertices[i];
 		VertexID v2 = t.nVertices[ (i+1) % 3];
 
+		if ( m_bTopologyFrozen ) {
+			vNbrs[i] = IMesh::InvalidID;
+			const TriangleID * pTris = m_topology.Triangles(v1);
+			unsigned int nCount = m_topology.TriangleCount(v1);
+			for ( unsigned int k = 0; k < nCount && vNbrs[i] == IMesh::InvalidID; ++k ) {
+				if ( pTris[k] == tID )
+					continue;
+				const VertexID * vTri2 = m_vTriangles[pTris[k]].nVertices;
+				if ( vTri2[0] == v2 || vTri2[1] == v2 || vTri2[2] == v2 )
+					vNbrs[i] = pTris[k];
+			}
+			continue;
+		}
+
 		// iterate over triangles of v1, looking for another tri with edge [v1,v2]
-		const Vertex & v = m_vVertices[v1];
-		TriListEntry * pCur = v.pData->vTriangles.pFirst;
+		TriListEntry * pCur = VtxData(v1)->vTriangles.pFirst;
 		TriListEntry * pLast = NULL;
 		bool bFound = false;
 		while ( pCur != NULL && ! bFound ) {
@@ -817,8 +1218,18 @@ IMesh::EdgeID VFTriangleMesh::FindEdge( VertexID v1, VertexID v2 ) const
 		VertexID tmp = v1; v1 = v2; v2 = tmp;
 	}
 
-	const Vertex & v = m_vVertices[v1];
-	const EdgeListEntry * pCur = v.pData->vEdges.pFirst;
+	if ( m_bTopologyFrozen ) {
+		const EdgeID * pEdges = m_topology.Edges(v1);
+		unsigned int nCount = m_topology.EdgeCount(v1);
+		for ( unsigned int k = 0; k < nCount; ++k ) {
+			const Edge & e = m_vEdges[ pEdges[k] ];
+			if ( e.nVertices[0] == v2 || e.nVertices[1] == v2 )
+				return pEdges[k];
+		}
+		return IMesh::InvalidID;
+	}
+
+	const EdgeListEntry * pCur = VtxData(v1)->vEdges.pFirst;
 	while ( pCur != NULL ) {
 		const Edge & e = m_vEdges[ pCur->data ];
 		if ( (e.nVertices[0] == v1 && e.nVertices[1] == v2) ||
@@ -842,10 +1253,9 @@ void VFTriangleMesh::Weld( VertexID vKeep, VertexID vDiscard )
 	lgASSERT( IsVertex(vKeep) && IsVertex(vDiscard) );
 	
 	// make list of tris to rewrite
-	Vertex & v = m_vVertices[vDiscard];
 	std::vector<IMesh::TriangleID> vTris;
 	vTris.reserve(16);
-	TriListEntry * pCur = v.pData->vTriangles.pFirst;
+	TriListEntry * pCur = VtxData(vDiscard)->vTriangles.pFirst;
 	while ( pCur != NULL ) {
 		vTris.push_back( pCur->data );
 		pCur = pCur->pNext;
@@ -880,11 +1290,8 @@ void VFTriangleMesh::SplitEdge( VertexID e1, VertexID e2 )
 	TriangleID t[2] = { InvalidID, InvalidID };
 	int ti = 0;
 
-	Vertex * pV1 = &m_vVertices[e1];
-	Vertex * pV2 = &m_vVertices[e2];
-
 	// find two triangles with edge e1e2
-	TriListEntry * pCur = pV1->pData->vTriangles.pFirst;
+	TriListEntry * pCur = VtxData(e1)->vTriangles.pFirst;
 	while ( pCur != NULL ) {
 		Triangle * pTri = &m_vTriangles[pCur->data];
 		if ( (pTri->nVertices[0] == e1 || pTri->nVertices[1] == e1 || pTri->nVertices[2] == e1)
@@ -896,8 +1303,8 @@ void VFTriangleMesh::SplitEdge( VertexID e1, VertexID e2 )
 		return;
 
 	// append new vertex
-	Wml::Vector3f vInterp = 0.5f * (pV1->vVertex + pV2->vVertex);
-	Wml::Vector3f nInterp = 0.5f * (pV1->vNormal + pV2->vNormal);
+	Wml::Vector3f vInterp = 0.5f * (VtxPosition(e1) + VtxPosition(e2));
+	Wml::Vector3f nInterp = 0.5f * (VtxNormal(e1) + VtxNormal(e2));
 	VertexID vNew = AppendVertex(vInterp, &nInterp);
 	
 	// update triangles
@@ -990,7 +1397,7 @@ bool VFTriangleMesh::CollapseEdge( EdgeID eID )
 
 	// get tris connected to vErase that need to be fixed
 	std::vector<TriangleID> vUpdate;
-	TriListEntry * pCur = m_vVertices[vErase].pData->vTriangles.pFirst;
+	TriListEntry * pCur = VtxData(vErase)->vTriangles.pFirst;
 	while ( pCur != NULL ) {
 		if ( pCur->data != tErase1 && pCur->data != tErase2 )
 			vUpdate.push_back(pCur->data);
@@ -1008,8 +1415,8 @@ bool VFTriangleMesh::CollapseEdge( EdgeID eID )
 
 	// find new position for vKeep
 	if ( ! bKeepIsBoundary ) {
-		Wml::Vector3f vNewPos = 0.5f * (m_vVertices[vKeep].vVertex + m_vVertices[vErase].vVertex);
-		Wml::Vector3f vNewNorm = 0.5f * (m_vVertices[vKeep].vNormal + m_vVertices[vErase].vNormal);
+		Wml::Vector3f vNewPos = 0.5f * (VtxPosition(vKeep) + VtxPosition(vErase));
+		Wml::Vector3f vNewNorm = 0.5f * (VtxNormal(vKeep) + VtxNormal(vErase));
 		vNewNorm.Normalize();
 		SetVertex(vKeep, vNewPos, &vNewNorm);
 	}
@@ -1176,6 +1583,7 @@ bool VFTriangleMesh::FlipEdge( EdgeID eID )
 
 void VFTriangleMesh::ReverseOrientation()
 {
+	InvalidateTopology();
 	triangle_iterator curt(BeginTriangles()), endt(EndTriangles());
 	while ( curt != endt ) {
 		TriangleID tID = *curt;  ++curt;
@@ -1230,7 +1638,7 @@ void VFTriangleMesh::ClipEarTriangles()
 		while ( curv != endv && bDone) {
 			VertexID vID = *curv; ++curv;
 			if ( GetTriangleCount(vID) == 1 ) {
-				TriangleID tID = m_vVertices[vID].pData->vTriangles.pFirst->data;
+				TriangleID tID = VtxData(vID)->vTriangles.pFirst->data;
 				RemoveTriangle(tID);
 				bDone = false;
 			}
@@ -1242,8 +1650,7 @@ void VFTriangleMesh::ClipEarTriangles()
 
 void VFTriangleMesh::GetVertexFrame( VertexID vID, Wml::Vector3f & tan1, Wml::Vector3f & tan2, Wml::Vector3f & vNormal, VertexID vNbr )
 {
-	Vertex & v = m_vVertices[vID];
-	EdgeListEntry * pFirstEdge = v.pData->vEdges.pFirst;
+	EdgeListEntry * pFirstEdge = VtxData(vID)->vEdges.pFirst;
 	EdgeID eFirstEdgeID = pFirstEdge->data;
 	
 	if ( vNbr == IMesh::InvalidID ) {
@@ -1252,9 +1659,9 @@ void VFTriangleMesh::GetVertexFrame( VertexID vID, Wml::Vector3f & tan1, Wml::Ve
 	}
 
 	// compute frame
-	Wml::Vector3f vNbrV = m_vVertices[vNbr].vVertex;
-	vNormal = v.vNormal;
-	tan2 = vNbrV - v.vVertex;
+	Wml::Vector3f vNbrV = VtxPosition(vNbr);
+	vNormal = VtxNormal(vID);
+	tan2 = vNbrV - VtxPosition(vID);
 	tan1 = vNormal.Cross( tan2.Cross(vNormal) );
 	tan1.Normalize();
 	tan2 = vNormal.Cross( tan1 );
@@ -1269,8 +1676,7 @@ void VFTriangleMesh::GetBoundingBox( Wml::AxisAlignedBox3f & bounds ) const
 	vertex_iterator curv( BeginVertices() ), endv( EndVertices() );
 	while ( curv != endv ) {
 		VertexID vID = *curv;  ++curv;
-		Wml::Vector3f vVertex;
-		GetVertex(vID, vVertex);
+		const Wml::Vector3f & vVertex = VtxPosition(vID);
 		if ( bounds.Min[0] == std::numeric_limits<float>::max() )
 			bounds = Wml::AxisAlignedBox3f( vVertex.X(), vVertex.X(), vVertex.Y(), vVertex.Y(), vVertex.Z(), vVertex.Z() );
 		else
@@ -1312,8 +1718,9 @@ void VFTriangleMesh::GetEdgeLengthStats(float & fMin, float & fMax, float & fAve
 
 bool VFTriangleMesh::IsIsolated( VertexID vID ) const
 {
-	const Vertex & v = m_vVertices[vID];
-	const EdgeListEntry * pFirstEdge = v.pData->vEdges.pFirst;
+	if ( m_bTopologyFrozen )
+		return m_topology.EdgeCount(vID) == 0;
+	const EdgeListEntry * pFirstEdge = VtxData(vID)->vEdges.pFirst;
 	return ( pFirstEdge == NULL );
 	//EdgeID eFirstEdgeID = pFirstEdge->data;
 	//return ( eFirstEdgeID != IMesh::InvalidID );
@@ -1348,10 +1755,9 @@ bool VFTriangleMesh::IsCompact() const
 
 void VFTriangleMesh::ClearBit( unsigned int nBit )
 {
-	RefCountedVector<Vertex>::item_iterator 
-		curv(m_vVertices.begin_items()), endv(m_vVertices.end_items());
+	vertex_iterator curv(BeginVertices()), endv(EndVertices());
 	while ( curv != endv ) {
-		(*curv).vecData.nBits &= ~(1<<nBit);
+		VtxBits(*curv) &= ~(1<<nBit);
 		++curv;
 	}
 }
@@ -1503,6 +1909,65 @@ bool VFTriangleMesh::ReadOBJ( const char * pFilename, std::string & errString )
 }
 
 
+// IMesh::ForEachVertexBlock functor for WriteOBJ - gathers each block of vertices and writes v/vn/vt lines
+struct WriteOBJVerticesFunc {
+	const VFTriangleMesh * pMesh;
+	std::ostream * pOut;
+	std::vector<IMesh::VertexID> * pVertMap;
+	unsigned int nCounter;
+	bool bHaveVertexTexCoords;
+	WriteOBJVerticesFunc( const VFTriangleMesh * mesh, std::ostream & out, std::vector<IMesh::VertexID> & vertMap, bool bTexCoords )
+		: pMesh(mesh), pOut(&out), pVertMap(&vertMap), nCounter(0), bHaveVertexTexCoords(bTexCoords) {}
+	void operator()( const IMesh::VertexID * pIDs, unsigned int nCount ) {
+		float vXYZ[3*IMESH_ID_BLOCK_SIZE], vNormals[3*IMESH_ID_BLOCK_SIZE];
+		pMesh->GatherVertices( pIDs, nCount, vXYZ, vNormals );
+		std::ostream & out = *pOut;
+		for ( unsigned int i = 0; i < nCount; ++i ) {
+			(*pVertMap)[pIDs[i]] = nCounter++;
+			const float * v = vXYZ + 3*i, * n = vNormals + 3*i;
+			out << "v " << v[0] << " " << v[1] << " " << v[2] << std::endl;
+			out << "vn " << n[0] << " " << n[1] << " " << n[2] << std::endl; 
+			if ( bHaveVertexTexCoords ) {
+				Wml::Vector2f tex;
+				if ( pMesh->GetUV(pIDs[i], 0, tex) )
+					out << "vt " << tex.X() << " " << tex.Y() << std::endl; 
+				else
+					out << "vt -5 -5" << std::endl;
+			}
+		}
+	}
+};
+
+// IMesh::ForEachTriangleBlock functor for WriteOBJ - gathers each block of triangles and writes f lines
+struct WriteOBJTrianglesFunc {
+	const VFTriangleMesh * pMesh;
+	std::ostream * pOut;
+	const std::vector<IMesh::VertexID> * pVertMap;
+	bool bHaveVertexTexCoords;
+	WriteOBJTrianglesFunc( const VFTriangleMesh * mesh, std::ostream & out, const std::vector<IMesh::VertexID> & vertMap, bool bTexCoords )
+		: pMesh(mesh), pOut(&out), pVertMap(&vertMap), bHaveVertexTexCoords(bTexCoords) {}
+	void operator()( const IMesh::TriangleID * pIDs, unsigned int nCount ) {
+		IMesh::VertexID vTris[3*IMESH_ID_BLOCK_SIZE];
+		pMesh->GatherTriangles( pIDs, nCount, vTris );
+		std::ostream & out = *pOut;
+		for ( unsigned int i = 0; i < nCount; ++i ) {
+			unsigned int tri[3];
+			for ( int j = 0; j < 3; ++j )
+				tri[j] = (*pVertMap)[vTris[3*i+j]];
+
+			if ( bHaveVertexTexCoords ) {
+				out << "f " << (tri[0]+1) << "/" << (tri[0]+1) << "/" << (tri[0]+1) 
+					<< " " << (tri[1]+1) << "/" << (tri[1]+1) << "/" << (tri[1]+1)
+					<< " " << (tri[2]+1) << "/" << (tri[2]+1) << "/" << (tri[2]+1) << std::endl;
+			} else {
+				out << "f " << (tri[0]+1) << "//" << (tri[0]+1) 
+					<< " " << (tri[1]+1) << "//" << (tri[1]+1)
+					<< " " << (tri[2]+1) << "//" << (tri[2]+1) << std::endl;
+			}
+		}
+	}
+};
+
 bool VFTriangleMesh::WriteOBJ( const char * pFilename, std::string & errString )
 {
 	std::ofstream out(pFilename);
@@ -1522,50 +1987,11 @@ bool VFTriangleMesh::WriteOBJ( const char * pFilename, std::string & errString )
 		}
 	}
 
+	// vertices and triangles are written in GetVertexIDs/GetTriangleIDs order, which is the iterator order
 	std::vector<VertexID> vertMap;
 	vertMap.resize( GetMaxVertexID(), IMesh::InvalidID );
-	unsigned int nCounter = 0;
-	vertex_iterator curv(BeginVertices()), endv(EndVertices());
-	while ( curv != endv ) {
-		VertexID vID = *curv;  ++curv;
-		vertMap[vID] = nCounter++;
-
-		Wml::Vector3f vert, norm;
-
-		GetVertex(vID, vert, &norm);
-		out << "v " << vert.X() << " " << vert.Y() << " " << vert.Z() << std::endl;
-		out << "vn " << norm.X() << " " << norm.Y() << " " << norm.Z() << std::endl; 
-		if ( bHaveVertexTexCoords ) {
-			Wml::Vector2f tex;
-			if ( GetUV(vID, 0, tex) )
-				out << "vt " << tex.X() << " " << tex.Y() << std::endl; 
-			else
-				out << "vt -5 -5" << std::endl;
-		}
-	}
-
-	Wml::Vector2f vTriUV[3];
-
-	triangle_iterator curt(BeginTriangles()), endt(EndTriangles());
-	while ( curt != endt ) {
-		TriangleID tID = *curt; ++curt;
-		VertexID vTri[3];
-		GetTriangle(tID, vTri);
-		unsigned int tri[3];
-		for ( int j = 0; j < 3; ++j )
-			tri[j] = vertMap[vTri[j]];
-
-
-		if ( bHaveVertexTexCoords ) {
-			out << "f " << (tri[0]+1) << "/" << (tri[0]+1) << "/" << (tri[0]+1) 
-				<< " " << (tri[1]+1) << "/" << (tri[1]+1) << "/" << (tri[1]+1)
-				<< " " << (tri[2]+1) << "/" << (tri[2]+1) << "/" << (tri[2]+1) << std::endl;
-		} else {
-			out << "f " << (tri[0]+1) << "//" << (tri[0]+1) 
-				<< " " << (tri[1]+1) << "//" << (tri[1]+1)
-				<< " " << (tri[2]+1) << "//" << (tri[2]+1) << std::endl;
-		}
-	}
+	ForEachVertexBlock( WriteOBJVerticesFunc(this, out, vertMap, bHaveVertexTexCoords) );
+	ForEachTriangleBlock( WriteOBJTrianglesFunc(this, out, vertMap, bHaveVertexTexCoords) );
 
 	out.close();
 
@@ -68,6 +68,15 @@ public:
   virtual unsigned int GetTriangleCount() const;
   virtual unsigned int GetMaxTriangleID() const;
 
+  //! batched ID iteration (see IMesh), scans the refcount arrays directly
+  virtual unsigned int GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const;
+  virtual unsigned int GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const;
+
+  //! batch geometry access (see IMesh). With CompactVertexStorage, runs of consecutive VertexIDs are a single memcpy
+  virtual void GatherVertices( const VertexID * pIDs, unsigned int nCount, float * pXYZ, float * pNormals = NULL ) const;
+  virtual void GatherTriangles( const TriangleID * pIDs, unsigned int nCount, VertexID * pTriangles ) const;
+  virtual bool ScatterVertices( const VertexID * pIDs, unsigned int nCount, const float * pXYZ, const float * pNormals = NULL );
+
   /*
  *  IMesh write interface (optional)
  */
@@ -199,6 +208,72 @@ public:
   bool GetBit( VertexID vID, unsigned int nBit );
 
 
+  /*
+   * vertex storage layout
+   */
+  enum VertexStorageMode {
+    InterleavedVertexStorage,	//! one Vertex struct per VertexID (default)
+    CompactVertexStorage		//! positions, normals, colors and bits in separate contiguous arrays
+  };
+  //! converts existing vertices to the new layout. VertexIDs are unchanged.
+  void SetVertexStorageMode( VertexStorageMode eMode );
+  VertexStorageMode GetVertexStorageMode() const { return m_eVertexStorage; }
+
+  //! Raw per-vertex arrays indexed by VertexID, GetMaxVertexID() entries each. Positions and 
+  //! normals are 3 floats per vertex, colors are 4. Only available in CompactVertexStorage
+  //! mode (NULL otherwise). Entries of unused VertexIDs are garbage - skip VertexIDs
+  //! where GetVertexRefCounts()[vID] <= 0. Pointers are invalidated by AppendVertex().
+  inline const float * GetPositionBuffer() const;
+  inline float * GetPositionBuffer();
+  inline const float * GetNormalBuffer() const;
+  inline float * GetNormalBuffer();
+  inline const float * GetColorBuffer() const;
+  inline const unsigned int * GetBitBuffer() const;
+
+  //! per-vertex reference counts (available in both storage modes). vID is a valid vertex if value is > 0
+  inline const int * GetVertexRefCounts() const { return m_vVertexRefs.refcounts(); }
+
+
+  /*
+   * frozen topology
+   */
+  //! Compressed-sparse-row copy of the per-vertex triangle and edge lists, plus ordered one-rings.
+  //! Entries for vertex vID are [vXStart[vID], vXStart[vID+1]), arrays are indexed up to GetMaxVertexID().
+  struct TopologySnapshot {
+    enum VertexFlags {
+      OneRingValid = 1,		//! vertex has an ordered one-ring (ie is manifold)
+      OneRingClosed = 2,	//! ordered one-ring is closed (interior vertex)
+      BoundaryVertex = 4
+    };
+
+    std::vector<unsigned int> vTriStart;
+    std::vector<TriangleID> vTriangles;
+    std::vector<unsigned int> vEdgeStart;
+    std::vector<EdgeID> vEdges;
+    std::vector<unsigned int> vRingStart;
+    std::vector<VertexID> vOneRings;		//! same order as VertexOneRing(vID, vRing, true)
+    std::vector<unsigned char> vFlags;
+
+    unsigned int TriangleCount( VertexID vID ) const { return vTriStart[vID+1] - vTriStart[vID]; }
+    const TriangleID * Triangles( VertexID vID ) const { return vTriangles.empty() ? NULL : &vTriangles[0] + vTriStart[vID]; }
+    unsigned int EdgeCount( VertexID vID ) const { return vEdgeStart[vID+1] - vEdgeStart[vID]; }
+    const EdgeID * Edges( VertexID vID ) const { return vEdges.empty() ? NULL : &vEdges[0] + vEdgeStart[vID]; }
+    unsigned int OneRingSize( VertexID vID ) const { return vRingStart[vID+1] - vRingStart[vID]; }
+    const VertexID * OneRing( VertexID vID ) const { return vOneRings.empty() ? NULL : &vOneRings[0] + vRingStart[vID]; }
+    bool HasFlag( VertexID vID, VertexFlags eFlag ) const { return (vFlags[vID] & eFlag) != 0; }
+  };
+
+  //! Build TopologySnapshot for the current mesh. Until the next topology edit (AppendVertex, AppendTriangle, 
+  //! SetTriangle, RemoveTriangle, edge ops, etc) vertex triangle/edge iteration, VertexOneRing, TriangleOneRing, 
+  //! FindEdge, FindNeighbours, IsBoundaryVertex and GetTriangleCount/GetEdgeCount(vID) read from the snapshot.
+  const TopologySnapshot & FreezeTopology();
+  //! returns NULL if topology is not frozen
+  const TopologySnapshot * GetTopologySnapshot() const { return (m_bTopologyFrozen) ? &m_topology : NULL; }
+  bool IsTopologyFrozen() const { return m_bTopologyFrozen; }
+  //! discard snapshot and free its memory (called automatically by topology edits)
+  void ReleaseTopology();
+
+
 protected:
 
   //! memory pools for fast allocation of per-vertex triangle and edge list elements
@@ -233,9 +308,9 @@ protected:
     VertexData * pData;			//! other per-vertex data
     unsigned int nBits;			//! insanely-useful per-vertex bitmask
 
-    Vertex() : pData(NULL) { }
+    Vertex() : pData(NULL), nBits(0) { }
     Vertex( const Wml::Vector3f & v, const Wml::Vector3f & n )
-      : vVertex(v), vNormal(n), pData(NULL) {}
+      : vVertex(v), vNormal(n), pData(NULL), nBits(0) {}
   };
 
   struct Edge {
@@ -255,7 +330,38 @@ protected:
     { nVertices[0] = v1; nVertices[1] = v2; nVertices[2] = v3; }
   };
 
-  RefCountedVector<Vertex> m_vVertices;
+  //! vertex refcounts and free-list, shared by both storage layouts
+  RefCountedIndexSet m_vVertexRefs;
+  VertexStorageMode m_eVertexStorage;
+
+  //! InterleavedVertexStorage - one Vertex per VertexID
+  std::vector<Vertex> m_vVertexRecords;
+
+  //! CompactVertexStorage - one entry per VertexID in each array
+  std::vector<Wml::Vector3f> m_vPositions;
+  std::vector<Wml::Vector3f> m_vNormals;
+  std::vector<Wml::ColorRGBA> m_vColors;
+  std::vector<unsigned int> m_vBits;
+  std::vector<VertexData *> m_vVertexData;
+
+  // per-vertex field access for either storage layout
+  inline Wml::Vector3f & VtxPosition( VertexID vID );
+  inline const Wml::Vector3f & VtxPosition( VertexID vID ) const;
+  inline Wml::Vector3f & VtxNormal( VertexID vID );
+  inline const Wml::Vector3f & VtxNormal( VertexID vID ) const;
+  inline VertexData *& VtxData( VertexID vID );
+  inline VertexData * VtxData( VertexID vID ) const;
+  inline unsigned int & VtxBits( VertexID vID );
+  inline unsigned int VtxBits( VertexID vID ) const;
+
+  //! allocate new vertex slot (or re-use free one) and initialize it in current storage layout
+  VertexID InsertVertex( const Wml::Vector3f & vVertex, const Wml::Vector3f & vNormal );
+
+  TopologySnapshot m_topology;
+  bool m_bTopologyFrozen;
+  inline void InvalidateTopology() { if ( m_bTopologyFrozen ) ReleaseTopology(); }
+  bool AppendOrderedOneRing( VertexID vID, std::vector<VertexID> & vRing, bool & bClosed ) const;
+
   RefCountedVector<Triangle> m_vTriangles;
 
   RefCountedVector<Edge> m_vEdges;
@@ -265,11 +371,11 @@ protected:
   bool RemoveTriangleEdge( TriangleID tID, VertexID v1, VertexID v2 );
 
 public:
-  typedef RefCountedVector<Vertex>::index_iterator vertex_iterator;
+  typedef RefCountedIndexSet::index_iterator vertex_iterator;
   inline vertex_iterator BeginVertices() const
-  { return m_vVertices.begin_indexes(); }
+  { return m_vVertexRefs.begin_indexes(); }
   inline vertex_iterator EndVertices() const
-  { return m_vVertices.end_indexes(); }
+  { return m_vVertexRefs.end_indexes(); }
 
   typedef RefCountedVector<Edge>::index_iterator edge_iterator;
   inline edge_iterator BeginEdges() const
@@ -321,18 +427,81 @@ protected:
 
 
 
+inline Wml::Vector3f & VFTriangleMesh::VtxPosition( VertexID vID )
+{
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  return ( m_eVertexStorage == CompactVertexStorage ) ? m_vPositions[vID] : m_vVertexRecords[vID].vVertex;
+}
+inline const Wml::Vector3f & VFTriangleMesh::VtxPosition( VertexID vID ) const
+{
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  return ( m_eVertexStorage == CompactVertexStorage ) ? m_vPositions[vID] : m_vVertexRecords[vID].vVertex;
+}
+inline Wml::Vector3f & VFTriangleMesh::VtxNormal( VertexID vID )
+{
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  return ( m_eVertexStorage == CompactVertexStorage ) ? m_vNormals[vID] : m_vVertexRecords[vID].vNormal;
+}
+inline const Wml::Vector3f & VFTriangleMesh::VtxNormal( VertexID vID ) const
+{
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  return ( m_eVertexStorage == CompactVertexStorage ) ? m_vNormals[vID] : m_vVertexRecords[vID].vNormal;
+}
+inline VFTriangleMesh::VertexData *& VFTriangleMesh::VtxData( VertexID vID )
+{
+  return ( m_eVertexStorage == CompactVertexStorage ) ? m_vVertexData[vID] : m_vVertexRecords[vID].pData;
+}
+inline VFTriangleMesh::VertexData * VFTriangleMesh::VtxData( VertexID vID ) const
+{
+  return ( m_eVertexStorage == CompactVertexStorage ) ? m_vVertexData[vID] : m_vVertexRecords[vID].pData;
+}
+inline unsigned int & VFTriangleMesh::VtxBits( VertexID vID )
+{
+  return ( m_eVertexStorage == CompactVertexStorage ) ? m_vBits[vID] : m_vVertexRecords[vID].nBits;
+}
+inline unsigned int VFTriangleMesh::VtxBits( VertexID vID ) const
+{
+  return ( m_eVertexStorage == CompactVertexStorage ) ? m_vBits[vID] : m_vVertexRecords[vID].nBits;
+}
+
+
+inline const float * VFTriangleMesh::GetPositionBuffer() const
+{
+  return ( m_eVertexStorage == CompactVertexStorage && ! m_vPositions.empty() ) ? (const float *)m_vPositions[0] : NULL;
+}
+inline float * VFTriangleMesh::GetPositionBuffer()
+{
+  return ( m_eVertexStorage == CompactVertexStorage && ! m_vPositions.empty() ) ? (float *)m_vPositions[0] : NULL;
+}
+inline const float * VFTriangleMesh::GetNormalBuffer() const
+{
+  return ( m_eVertexStorage == CompactVertexStorage && ! m_vNormals.empty() ) ? (const float *)m_vNormals[0] : NULL;
+}
+inline float * VFTriangleMesh::GetNormalBuffer()
+{
+  return ( m_eVertexStorage == CompactVertexStorage && ! m_vNormals.empty() ) ? (float *)m_vNormals[0] : NULL;
+}
+inline const float * VFTriangleMesh::GetColorBuffer() const
+{
+  return ( m_eVertexStorage == CompactVertexStorage && ! m_vColors.empty() ) ? (const float *)m_vColors[0] : NULL;
+}
+inline const unsigned int * VFTriangleMesh::GetBitBuffer() const
+{
+  return ( m_eVertexStorage == CompactVertexStorage && ! m_vBits.empty() ) ? &m_vBits[0] : NULL;
+}
+
+
+
 inline void VFTriangleMesh::SetVertex( VertexID vID, const Wml::Vector3f & vVertex, const Wml::Vector3f * pNormal )
 {
-  Vertex & v = m_vVertices[vID];
-  v.vVertex = vVertex;
+  VtxPosition(vID) = vVertex;
   if ( pNormal )
-    v.vNormal = *pNormal;
+    VtxNormal(vID) = *pNormal;
 }
 
 inline void VFTriangleMesh::SetNormal( VertexID vID, const Wml::Vector3f & vNormal )
 {
-  Vertex & v = m_vVertices[vID];
-  v.vNormal = vNormal;
+  VtxNormal(vID) = vNormal;
 }
 
 
@@ -341,37 +510,32 @@ inline void VFTriangleMesh::SetNormal( VertexID vID, const Wml::Vector3f & vNorm
 
 inline void VFTriangleMesh::GetVertex( IMesh::VertexID vID, Wml::Vector3f & vVertex, Wml::Vector3f * pNormal ) const 
 { 
-  if (!m_vVertices.isValid(vID)){
-    std::cout << vID << " is not a valid vertex id" << std::endl;
-    assert(false); 
-  }
-  const Vertex & v = m_vVertices[vID];
-  vVertex = v.vVertex;
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  vVertex = VtxPosition(vID);
   if ( pNormal )
-    *pNormal = v.vNormal;
+    *pNormal = VtxNormal(vID);
 }
 
 inline void VFTriangleMesh::GetNormal( IMesh::VertexID vID, Wml::Vector3f & vNormal ) const
 { 
-  assert(m_vVertices.isValid(vID));
-  const Vertex & v = m_vVertices[vID];
-  vNormal = v.vNormal;
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  vNormal = VtxNormal(vID);
 }
 
 
 
 inline const Wml::Vector3f & VFTriangleMesh::GetVertex( VertexID vID ) const
 {
-  return m_vVertices[vID].vVertex;
+  return VtxPosition(vID);
 }
 inline const Wml::Vector3f & VFTriangleMesh::GetNormal( VertexID vID ) const
 {
-  return m_vVertices[vID].vNormal;
+  return VtxNormal(vID);
 }
 
 inline unsigned int VFTriangleMesh::GetVertexCount() const
 { 
-  return m_vVertices.size();
+  return m_vVertexRefs.size();
 }
 
 
@@ -414,7 +578,9 @@ inline unsigned int VFTriangleMesh::GetTriangleCount() const
 
 inline unsigned int VFTriangleMesh::GetTriangleCount( IMesh::VertexID vID ) const
 { 
-  TriListEntry * pCur = m_vVertices[vID].pData->vTriangles.pFirst;
+  if ( m_bTopologyFrozen )
+    return m_topology.TriangleCount(vID);
+  TriListEntry * pCur = VtxData(vID)->vTriangles.pFirst;
   int nCount = 0;
   while ( pCur != NULL ) {
     ++nCount;
@@ -450,7 +616,9 @@ inline unsigned int VFTriangleMesh::GetEdgeCount() const
 
 inline unsigned int VFTriangleMesh::GetEdgeCount( IMesh::VertexID vID ) const
 { 
-  EdgeListEntry * pCur = m_vVertices[vID].pData->vEdges.pFirst;
+  if ( m_bTopologyFrozen )
+    return m_topology.EdgeCount(vID);
+  EdgeListEntry * pCur = VtxData(vID)->vEdges.pFirst;
   int nCount = 0;
   while ( pCur != NULL ) {
     ++nCount;
@@ -463,7 +631,7 @@ inline unsigned int VFTriangleMesh::GetEdgeCount( IMesh::VertexID vID ) const
 
 inline unsigned int VFTriangleMesh::GetMaxVertexID() const
 {
-  return m_vVertices.max_index();
+  return m_vVertexRefs.max_index();
 }
 
 inline unsigned int VFTriangleMesh::GetMaxEdgeID() const
@@ -479,7 +647,7 @@ inline unsigned int VFTriangleMesh::GetMaxTriangleID() const
 
 inline bool VFTriangleMesh::IsVertex( VertexID v ) const
 {
-  return v != InvalidID && m_vVertices.isValid(v);
+  return v != InvalidID && m_vVertexRefs.isValid(v);
 }
 
 inline bool VFTriangleMesh::IsEdge( EdgeID e ) const
@@ -492,12 +660,22 @@ inline bool VFTriangleMesh::IsTriangle( TriangleID t ) const
   return t != InvalidID && m_vTriangles.isValid(t);
 }
 
+inline unsigned int VFTriangleMesh::GetVertexIDs( VertexID nBegin, unsigned int nCount, VertexID * pIDs ) const
+{
+  return m_vVertexRefs.get_indexes( nBegin, nCount, pIDs );
+}
+
+inline unsigned int VFTriangleMesh::GetTriangleIDs( TriangleID nBegin, unsigned int nCount, TriangleID * pIDs ) const
+{
+  return m_vTriangles.refs().get_indexes( nBegin, nCount, pIDs );
+}
+
 
 inline void VFTriangleMesh::GetTriangleNormal( TriangleID tID, Wml::Vector3f & vNormal )
 {
   VertexID * verts = m_vTriangles[tID].nVertices;
-  Wml::Vector3f e1( m_vVertices[verts[1]].vVertex - m_vVertices[verts[0]].vVertex );
-  Wml::Vector3f e2( m_vVertices[verts[2]].vVertex - m_vVertices[verts[0]].vVertex );
+  Wml::Vector3f e1( VtxPosition(verts[1]) - VtxPosition(verts[0]) );
+  Wml::Vector3f e2( VtxPosition(verts[2]) - VtxPosition(verts[0]) );
   e1.Normalize();
   e2.Normalize();
   vNormal = e1.Cross(e2);
@@ -511,22 +689,25 @@ inline void VFTriangleMesh::GetTriangleNormal( TriangleID tID, Wml::Vector3f & v
 
 inline void VFTriangleMesh::AddTriEntry( TriangleID nTriID, VertexID nVertID )
 {
-  lgASSERT( m_vVertices.isValid(nVertID) );
-  VertexData & v = * m_vVertices[nVertID].pData;
+  InvalidateTopology();
+  lgASSERT( m_vVertexRefs.isValid(nVertID) );
+  VertexData & v = * VtxData(nVertID);
   m_VertListPool.Insert( v.vTriangles, nTriID );
 }
 
 inline void VFTriangleMesh::RemoveTriEntry( TriangleID nTriID, VertexID nVertID )
 {
-  lgASSERT( m_vVertices.isValid(nVertID) );
-  VertexData & v = * m_vVertices[nVertID].pData;
+  InvalidateTopology();
+  lgASSERT( m_vVertexRefs.isValid(nVertID) );
+  VertexData & v = * VtxData(nVertID);
   m_VertListPool.Remove( v.vTriangles, nTriID );
 }
 
 inline void VFTriangleMesh::ClearTriList( VertexID nVertID )
 {
-  lgASSERT( m_vVertices.isValid(nVertID) );
-  VertexData & v = * m_vVertices[nVertID].pData;
+  InvalidateTopology();
+  lgASSERT( m_vVertexRefs.isValid(nVertID) );
+  VertexData & v = * VtxData(nVertID);
   m_VertListPool.Clear( v.vTriangles );
 }
 
@@ -534,56 +715,63 @@ inline void VFTriangleMesh::ClearTriList( VertexID nVertID )
 
 inline void VFTriangleMesh::AddEdgeEntry( EdgeID nEdgeID, VertexID nVertID )
 {
-  lgASSERT( m_vVertices.isValid(nVertID) );
-  VertexData & v = * m_vVertices[nVertID].pData;
+  InvalidateTopology();
+  lgASSERT( m_vVertexRefs.isValid(nVertID) );
+  VertexData & v = * VtxData(nVertID);
   m_VertListPool.Insert( v.vEdges, nEdgeID );
 }
 
 inline void VFTriangleMesh::RemoveEdgeEntry( EdgeID nEdgeID, VertexID nVertID )
 {
-  lgASSERT( m_vVertices.isValid(nVertID) );
-  VertexData & v = * m_vVertices[nVertID].pData;
+  InvalidateTopology();
+  lgASSERT( m_vVertexRefs.isValid(nVertID) );
+  VertexData & v = * VtxData(nVertID);
   m_VertListPool.Remove( v.vEdges, nEdgeID );
 }
 
 inline void VFTriangleMesh::ClearEdgeList( VertexID nVertID )
 {
-  lgASSERT( m_vVertices.isValid(nVertID) );
-  VertexData & v = * m_vVertices[nVertID].pData;
+  InvalidateTopology();
+  lgASSERT( m_vVertexRefs.isValid(nVertID) );
+  VertexData & v = * VtxData(nVertID);
   m_VertListPool.Clear( v.vEdges );
 }
 
 
 inline void VFTriangleMesh::GetColor( VertexID vID, Wml::ColorRGBA & cColor ) const
 {
-  lgASSERT( m_vVertices.isValid(vID) );
-  VertexData & v = * m_vVertices[vID].pData;
-  cColor = v.vColor;
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  if ( m_eVertexStorage == CompactVertexStorage )
+    cColor = m_vColors[vID];
+  else
+    cColor = VtxData(vID)->vColor;
 }
 inline void VFTriangleMesh::SetColor( VertexID vID, const Wml::ColorRGBA & cColor )
 {
-  lgASSERT( m_vVertices.isValid(vID) );
-  VertexData & v = * m_vVertices[vID].pData;
-  v.vColor = cColor;
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  if ( m_eVertexStorage == CompactVertexStorage )
+    m_vColors[vID] = cColor;
+  else
+    VtxData(vID)->vColor = cColor;
 }
 
 
 
 inline void VFTriangleMesh::ClearBit( VertexID vID, unsigned int nBit )
 {
-  lgASSERT( m_vVertices.isValid(vID) );
-  m_vVertices[vID].nBits &= ~(1<<nBit);
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  VtxBits(vID) &= ~(1<<nBit);
 }
 
 inline void VFTriangleMesh::SetBit( VertexID vID, unsigned int nBit )
 {
-  lgASSERT( m_vVertices.isValid(vID) );
-  m_vVertices[vID].nBits |= (1<<nBit);
+  lgASSERT( m_vVertexRefs.isValid(vID) );
+  VtxBits(vID) |= (1<<nBit);
 }
 
 inline bool VFTriangleMesh::GetBit( VertexID vID, unsigned int nBit )
 {
-  return ( m_vVertices[vID].nBits & (1<<nBit) ) != 0;
+  return ( VtxBits(vID) & (1<<nBit) ) != 0;
 }
 
 
@@ -0,0 +1,31 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "config.h"
+#include <IMeshBVTree.h>
+
+namespace rms {
+
+/*
+ * Base for classes that move mesh vertices (deformers, smoothers). An optional IMeshBVTree built on
+ * that mesh is refit by RefitBVTree(), which subclasses call after they write new vertex positions.
+ */
+class BVTreeRefitter
+{
+public:
+	BVTreeRefitter() { m_pBVTree = NULL; }
+
+	//! if set, this tree (built on the deformed mesh) is refit each time new vertex positions are written
+	void SetBVTree( IMeshBVTree * pTree ) { m_pBVTree = pTree; }
+	IMeshBVTree * GetBVTree() const { return m_pBVTree; }
+
+protected:
+	IMeshBVTree * m_pBVTree;
+	void RefitBVTree() { if ( m_pBVTree ) m_pBVTree->Refit(); }
+};
+
+
+}   // end namespace rms
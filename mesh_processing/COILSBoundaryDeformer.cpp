@@ -147,6 +147,7 @@ void COILSBoundaryDeformer::RestoreMesh()
 		IMesh::VertexID vID = *curv++;
 		m_pMesh->SetVertex( vID, m_vOrigMesh[vID].vPosition, &m_vOrigMesh[vID].vNormal );
 	}
+	RefitBVTree();
 }
 
 
@@ -311,6 +312,8 @@ void COILSBoundaryDeformer::Decode(bool bBoundaryNbrsOnly)
 
 
 finished_decode:
+	RefitBVTree();
+
 	if ( bTwoPass )
 		m_eEncodeMode = TwoPass;
 
@@ -1705,6 +1708,7 @@ void COILSBoundaryDeformer::InitializeBoundary(EncodingLayer & layer)
 
 		m_pMesh->SetVertex( bv.vID, layer.vEncoding[bv.vID].vFrame.Origin(), &vNormal );
 	}
+	RefitBVTree();
 
 }
 
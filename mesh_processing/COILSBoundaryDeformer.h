@@ -12,12 +12,13 @@
 #include <MeshUtils.h>
 #include <MatrixBlender.h>
 #include <Wm4Triangle3.h>
+#include "BVTreeRefitter.h"
 
 
 namespace rms {
 
 
-class  COILSBoundaryDeformer : public DistanceCache::DistanceCalculator
+class  COILSBoundaryDeformer : public DistanceCache::DistanceCalculator, public BVTreeRefitter
 {
 public:
 
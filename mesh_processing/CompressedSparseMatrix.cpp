@@ -0,0 +1,496 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "CompressedSparseMatrix.h"
+#include <SparseMatrix.h>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace rms;
+
+
+// Build() buckets entries by ranges of this many rows (or columns), then sorts each bucket
+#define COMPRESSED_BUCKET_SIZE 64
+
+// the sort and product loops only run in parallel above this many entries
+#define COMPRESSED_PARALLEL_THRESHOLD 50000
+
+
+SparseTripletList::SparseTripletList( unsigned int nRows, unsigned int nCols )
+{
+	m_nRows = nRows;
+	m_nCols = nCols;
+}
+
+void SparseTripletList::Resize( unsigned int nRows, unsigned int nCols )
+{
+	m_nRows = nRows;
+	m_nCols = nCols;
+}
+
+
+
+
+CompressedSparseMatrix::CompressedSparseMatrix()
+{
+	m_nRows = m_nCols = 0;
+	m_eStorage = RowMajor;
+	m_bSymmetricLower = false;
+	m_vOffsets.resize(1, 0);
+}
+
+
+void CompressedSparseMatrix::SetSize( unsigned int nRows, unsigned int nCols, Storage eStorage, bool bSymmetricLower )
+{
+	m_nRows = nRows;
+	m_nCols = nCols;
+	m_eStorage = eStorage;
+	m_bSymmetricLower = bSymmetricLower;
+	m_vOffsets.assign( MajorSize() + 1, 0 );
+	m_vIndices.resize(0);
+	m_vValues.resize(0);
+}
+
+void CompressedSparseMatrix::Clear()
+{
+	SetSize(0, 0, RowMajor, false);
+	std::vector<unsigned int>(m_vOffsets).swap(m_vOffsets);
+	std::vector<unsigned int>().swap(m_vIndices);
+	std::vector<double>().swap(m_vValues);
+}
+
+
+size_t CompressedSparseMatrix::GetMemoryUsage() const
+{
+	return (m_vOffsets.capacity() + m_vIndices.capacity()) * sizeof(unsigned int) + m_vValues.capacity() * sizeof(double);
+}
+
+
+
+/*
+ * triplet compression
+ */
+
+
+// a range of one triplet list, processed by one thread
+struct TripletChunk {
+	const SparseTripletList * pList;
+	size_t nBegin;
+	size_t nEnd;
+};
+
+// in the bucketed copy of the triplets, r is the major (row or column) index and c the minor index
+static bool MajorMinorLess( const SparseTripletList::Triplet & a, const SparseTripletList::Triplet & b )
+{
+	return ( a.r < b.r ) || ( a.r == b.r && a.c < b.c );
+}
+
+
+void CompressedSparseMatrix::Build( const SparseTripletList & triplets, Storage eStorage, bool bSymmetricLower )
+{
+	const SparseTripletList * pList = &triplets;
+	Build( &pList, 1, eStorage, bSymmetricLower );
+}
+
+void CompressedSparseMatrix::Build( const std::vector<SparseTripletList> & vLists, Storage eStorage, bool bSymmetricLower )
+{
+	std::vector<const SparseTripletList *> vPointers( vLists.size() );
+	for ( unsigned int k = 0; k < vLists.size(); ++k )
+		vPointers[k] = &vLists[k];
+	if ( vPointers.empty() ) {
+		SetSize(0, 0, eStorage, bSymmetricLower);
+		return;
+	}
+	Build( &vPointers[0], (unsigned int)vPointers.size(), eStorage, bSymmetricLower );
+}
+
+
+// The triplets are sorted in three parallel passes: each chunk of triplets counts its entries per
+// bucket (a range of COMPRESSED_BUCKET_SIZE rows or columns), then copies them to their bucket, and
+// then each bucket is sorted, summed and copied to the compressed arrays on its own.
+void CompressedSparseMatrix::Build( const SparseTripletList * const * ppLists, unsigned int nLists, Storage eStorage, bool bSymmetricLower )
+{
+	SetSize( ppLists[0]->Rows(), ppLists[0]->Columns(), eStorage, bSymmetricLower );
+	lgASSERT( ! bSymmetricLower || m_nRows == m_nCols );
+	bool bRowMajor = ( eStorage == RowMajor );
+	unsigned int nMajor = MajorSize();
+
+	size_t nTotal = 0;
+	for ( unsigned int k = 0; k < nLists; ++k ) {
+		lgASSERT( ppLists[k]->Rows() == m_nRows && ppLists[k]->Columns() == m_nCols );
+		nTotal += ppLists[k]->Size();
+	}
+	if ( nMajor == 0 || nTotal == 0 )
+		return;
+
+	int nThreads = 1;
+#ifdef _OPENMP
+	if ( nTotal > COMPRESSED_PARALLEL_THRESHOLD )
+		nThreads = omp_get_max_threads();
+#endif
+	size_t nChunkSize = std::max( nTotal / (size_t)(2*nThreads), (size_t)COMPRESSED_PARALLEL_THRESHOLD/4 );
+	std::vector<TripletChunk> vChunks;
+	for ( unsigned int k = 0; k < nLists; ++k ) {
+		size_t nSize = ppLists[k]->Size();
+		for ( size_t nBegin = 0; nBegin < nSize; nBegin += nChunkSize ) {
+			TripletChunk chunk;
+			chunk.pList = ppLists[k];
+			chunk.nBegin = nBegin;
+			chunk.nEnd = std::min( nBegin + nChunkSize, nSize );
+			vChunks.push_back(chunk);
+		}
+	}
+	int nChunks = (int)vChunks.size();
+	unsigned int nBuckets = (nMajor + COMPRESSED_BUCKET_SIZE - 1) / COMPRESSED_BUCKET_SIZE;
+
+	// entries of each chunk per bucket (skipping entries above the diagonal of symmetric-lower matrices)
+	std::vector<size_t> vCounts( (size_t)nChunks * nBuckets, 0 );
+	#pragma omp parallel for schedule(dynamic,1) num_threads(nThreads)
+	for ( int k = 0; k < nChunks; ++k ) {
+		const TripletChunk & chunk = vChunks[k];
+		size_t * pCounts = &vCounts[ (size_t)k * nBuckets ];
+		for ( size_t i = chunk.nBegin; i < chunk.nEnd; ++i ) {
+			const SparseTripletList::Triplet & t = (*chunk.pList)[i];
+			lgASSERT( t.r < m_nRows && t.c < m_nCols );
+			if ( bSymmetricLower && t.r < t.c )
+				continue;
+			++pCounts[ ((bRowMajor) ? t.r : t.c) / COMPRESSED_BUCKET_SIZE ];
+		}
+	}
+
+	// bucket b holds vSorted[ vBucketStart[b] ... vBucketStart[b+1]-1 ], and chunk k writes its entries
+	// of bucket b starting at vCounts[k*nBuckets + b]
+	std::vector<size_t> vBucketStart(nBuckets+1);
+	size_t nOffset = 0;
+	for ( unsigned int b = 0; b < nBuckets; ++b ) {
+		vBucketStart[b] = nOffset;
+		for ( int k = 0; k < nChunks; ++k ) {
+			size_t nCount = vCounts[ (size_t)k * nBuckets + b ];
+			vCounts[ (size_t)k * nBuckets + b ] = nOffset;
+			nOffset += nCount;
+		}
+	}
+	vBucketStart[nBuckets] = nOffset;
+
+	std::vector<SparseTripletList::Triplet> vSorted( nOffset );
+	#pragma omp parallel for schedule(dynamic,1) num_threads(nThreads)
+	for ( int k = 0; k < nChunks; ++k ) {
+		const TripletChunk & chunk = vChunks[k];
+		size_t * pInsert = &vCounts[ (size_t)k * nBuckets ];
+		for ( size_t i = chunk.nBegin; i < chunk.nEnd; ++i ) {
+			const SparseTripletList::Triplet & t = (*chunk.pList)[i];
+			if ( bSymmetricLower && t.r < t.c )
+				continue;
+			SparseTripletList::Triplet & s = vSorted[ pInsert[ ((bRowMajor) ? t.r : t.c) / COMPRESSED_BUCKET_SIZE ]++ ];
+			s.r = (bRowMajor) ? t.r : t.c;
+			s.c = (bRowMajor) ? t.c : t.r;
+			s.dValue = t.dValue;
+		}
+	}
+
+	// sort each bucket and sum repeated entries in place. vBucketEnd[b] is the end of the summed entries
+	std::vector<size_t> vBucketEnd(nBuckets);
+	#pragma omp parallel for schedule(dynamic,16) num_threads(nThreads)
+	for ( int b = 0; b < (int)nBuckets; ++b ) {
+		size_t nBegin = vBucketStart[b], nEnd = vBucketStart[b+1];
+		std::sort( vSorted.begin() + nBegin, vSorted.begin() + nEnd, MajorMinorLess );
+		size_t nWrite = nBegin;
+		for ( size_t i = nBegin; i < nEnd; ++i ) {
+			if ( nWrite > nBegin && vSorted[nWrite-1].r == vSorted[i].r && vSorted[nWrite-1].c == vSorted[i].c ) {
+				vSorted[nWrite-1].dValue += vSorted[i].dValue;
+			} else {
+				vSorted[nWrite++] = vSorted[i];
+				++m_vOffsets[ vSorted[i].r + 1 ];
+			}
+		}
+		vBucketEnd[b] = nWrite;
+	}
+
+	for ( unsigned int i = 0; i < nMajor; ++i )
+		m_vOffsets[i+1] += m_vOffsets[i];
+	m_vIndices.resize( m_vOffsets[nMajor] );
+	m_vValues.resize( m_vOffsets[nMajor] );
+
+	#pragma omp parallel for schedule(dynamic,16) num_threads(nThreads)
+	for ( int b = 0; b < (int)nBuckets; ++b ) {
+		size_t nWrite = m_vOffsets[ b * COMPRESSED_BUCKET_SIZE ];
+		for ( size_t i = vBucketStart[b]; i < vBucketEnd[b]; ++i, ++nWrite ) {
+			m_vIndices[nWrite] = vSorted[i].c;
+			m_vValues[nWrite] = vSorted[i].dValue;
+		}
+	}
+}
+
+
+
+// collects the entries of a gsi::SparseMatrix column
+class TripletCollector : public gsi::SparseMatrix::IColumnFunction
+{
+public:
+	SparseTripletList * pList;
+	virtual void NextEntry( unsigned int r, unsigned int c, double dVal ) {
+		pList->Add( r, c, dVal );
+	}
+};
+
+void CompressedSparseMatrix::Build( const gsi::SparseMatrix & M, Storage eStorage, bool bSymmetricLower )
+{
+	SparseTripletList triplets( M.Rows(), M.Columns() );
+	triplets.Reserve( M.CountNonZeros() );
+	TripletCollector collector;
+	collector.pList = &triplets;
+	for ( unsigned int c = 0; c < M.Columns(); ++c )
+		M.ApplyColumnFunction(c, &collector);
+	Build( triplets, eStorage, bSymmetricLower );
+}
+
+
+void CompressedSparseMatrix::ToSparseMatrix( gsi::SparseMatrix & M ) const
+{
+	M.Resize(m_nRows, m_nCols);
+	M.Clear();
+	bool bRowMajor = ( m_eStorage == RowMajor );
+	unsigned int nMajor = MajorSize();
+	for ( unsigned int i = 0; i < nMajor; ++i ) {
+		for ( unsigned int p = m_vOffsets[i]; p < m_vOffsets[i+1]; ++p ) {
+			unsigned int j = m_vIndices[p];
+			if ( bRowMajor )
+				M.Set( i, j, m_vValues[p] );
+			else
+				M.Set( j, i, m_vValues[p] );
+			if ( m_bSymmetricLower && i != j ) {
+				if ( bRowMajor )
+					M.Set( j, i, m_vValues[p] );
+				else
+					M.Set( i, j, m_vValues[p] );
+			}
+		}
+	}
+}
+
+
+double CompressedSparseMatrix::Get( unsigned int r, unsigned int c ) const
+{
+	if ( m_bSymmetricLower && r < c )
+		std::swap(r, c);
+	unsigned int i = ( m_eStorage == RowMajor ) ? r : c;
+	unsigned int j = ( m_eStorage == RowMajor ) ? c : r;
+	if ( i >= MajorSize() )
+		return 0;
+	const unsigned int * pBegin = GetIndices() + m_vOffsets[i];
+	const unsigned int * pEnd = GetIndices() + m_vOffsets[i+1];
+	const unsigned int * pFound = std::lower_bound( pBegin, pEnd, j );
+	return ( pFound != pEnd && *pFound == j ) ? m_vValues[ pFound - GetIndices() ] : 0.0;
+}
+
+
+
+/*
+ * products
+ */
+
+
+// transpose of compressed arrays: the result has nMinor rows/columns, each with increasing indices
+static void TransposeArrays( unsigned int nMajor, unsigned int nMinor, const std::vector<unsigned int> & vOffsets,
+							 const std::vector<unsigned int> & vIndices, const std::vector<double> & vValues,
+							 std::vector<unsigned int> & vTOffsets, std::vector<unsigned int> & vTIndices, std::vector<double> & vTValues )
+{
+	vTOffsets.assign( nMinor+1, 0 );
+	size_t nNonZeros = vIndices.size();
+	for ( size_t p = 0; p < nNonZeros; ++p )
+		++vTOffsets[ vIndices[p] + 1 ];
+	for ( unsigned int j = 0; j < nMinor; ++j )
+		vTOffsets[j+1] += vTOffsets[j];
+	vTIndices.resize(nNonZeros);
+	vTValues.resize(nNonZeros);
+	std::vector<unsigned int> vInsert( vTOffsets.begin(), vTOffsets.end()-1 );
+	for ( unsigned int i = 0; i < nMajor; ++i ) {
+		for ( unsigned int p = vOffsets[i]; p < vOffsets[i+1]; ++p ) {
+			unsigned int q = vInsert[ vIndices[p] ]++;
+			vTIndices[q] = i;
+			vTValues[q] = vValues[p];
+		}
+	}
+}
+
+
+void CompressedSparseMatrix::MultiplyArrays( const double * pX, double * pY, bool bGather, bool bSkipDiagonal ) const
+{
+	int nMajor = (int)MajorSize();
+	const unsigned int * pOffsets = GetOffsets();
+	const unsigned int * pIndices = GetIndices();
+	const double * pValues = GetValues();
+	if ( bGather ) {
+		#pragma omp parallel for schedule(dynamic,256) if ( NonZeros() > COMPRESSED_PARALLEL_THRESHOLD )
+		for ( int i = 0; i < nMajor; ++i ) {
+			double dSum = 0;
+			for ( unsigned int p = pOffsets[i]; p < pOffsets[i+1]; ++p ) {
+				if ( ! bSkipDiagonal || pIndices[p] != (unsigned int)i )
+					dSum += pValues[p] * pX[ pIndices[p] ];
+			}
+			pY[i] += dSum;
+		}
+	} else {
+		for ( int i = 0; i < nMajor; ++i ) {
+			double dX = pX[i];
+			for ( unsigned int p = pOffsets[i]; p < pOffsets[i+1]; ++p ) {
+				if ( ! bSkipDiagonal || pIndices[p] != (unsigned int)i )
+					pY[ pIndices[p] ] += pValues[p] * dX;
+			}
+		}
+	}
+}
+
+
+void CompressedSparseMatrix::Multiply( const double * pX, double * pY ) const
+{
+	std::fill( pY, pY + m_nRows, 0.0 );
+	if ( m_bSymmetricLower ) {
+		// stored triangle, then its transpose without the diagonal
+		MultiplyArrays( pX, pY, true, false );
+		MultiplyArrays( pX, pY, false, true );
+	} else
+		MultiplyArrays( pX, pY, (m_eStorage == RowMajor), false );
+}
+
+void CompressedSparseMatrix::MultiplyTranspose( const double * pX, double * pY ) const
+{
+	if ( m_bSymmetricLower ) {
+		Multiply( pX, pY );
+		return;
+	}
+	std::fill( pY, pY + m_nCols, 0.0 );
+	MultiplyArrays( pX, pY, (m_eStorage == ColumnMajor), false );
+}
+
+
+void CompressedSparseMatrix::Transpose( CompressedSparseMatrix & store ) const
+{
+	lgASSERT( &store != this );
+	if ( m_bSymmetricLower ) {
+		store = *this;
+		return;
+	}
+	store.SetSize( m_nCols, m_nRows, m_eStorage, false );
+	TransposeArrays( MajorSize(), MinorSize(), m_vOffsets, m_vIndices, m_vValues, store.m_vOffsets, store.m_vIndices, store.m_vValues );
+}
+
+
+void CompressedSparseMatrix::ExpandSymmetric( CompressedSparseMatrix & store ) const
+{
+	lgASSERT( &store != this );
+	if ( ! m_bSymmetricLower ) {
+		store = *this;
+		return;
+	}
+	unsigned int n = m_nRows;
+	std::vector<unsigned int> vTOffsets, vTIndices;
+	std::vector<double> vTValues;
+	TransposeArrays( n, n, m_vOffsets, m_vIndices, m_vValues, vTOffsets, vTIndices, vTValues );
+
+	// merge each stored row/column with the transposed one, skipping the transposed diagonal
+	store.SetSize( n, n, m_eStorage, false );
+	store.m_vIndices.resize( 2 * m_vIndices.size() );
+	store.m_vValues.resize( 2 * m_vIndices.size() );
+	unsigned int nWrite = 0;
+	for ( unsigned int i = 0; i < n; ++i ) {
+		unsigned int p = m_vOffsets[i], pEnd = m_vOffsets[i+1];
+		unsigned int q = vTOffsets[i], qEnd = vTOffsets[i+1];
+		while ( p < pEnd || q < qEnd ) {
+			if ( q < qEnd && vTIndices[q] == i ) {
+				++q;
+			} else if ( q == qEnd || ( p < pEnd && m_vIndices[p] < vTIndices[q] ) ) {
+				store.m_vIndices[nWrite] = m_vIndices[p];
+				store.m_vValues[nWrite++] = m_vValues[p++];
+			} else {
+				store.m_vIndices[nWrite] = vTIndices[q];
+				store.m_vValues[nWrite++] = vTValues[q++];
+			}
+		}
+		store.m_vOffsets[i+1] = nWrite;
+	}
+	store.m_vIndices.resize(nWrite);
+	store.m_vValues.resize(nWrite);
+}
+
+
+// Row i of C = A^T A (which is also column i) is the sum of the rows k of A that have an entry in
+// column i, each scaled by A(k,i). The rows are computed in parallel, first counted and then filled.
+void CompressedSparseMatrix::TransposeTimesSelf( CompressedSparseMatrix & store, bool bSymmetricLower ) const
+{
+	lgASSERT( &store != this );
+	if ( m_bSymmetricLower ) {
+		CompressedSparseMatrix full;
+		ExpandSymmetric(full);
+		full.TransposeTimesSelf( store, bSymmetricLower );
+		return;
+	}
+
+	// rows and columns of A, one of them a transposed copy
+	std::vector<unsigned int> vTOffsets, vTIndices;
+	std::vector<double> vTValues;
+	TransposeArrays( MajorSize(), MinorSize(), m_vOffsets, m_vIndices, m_vValues, vTOffsets, vTIndices, vTValues );
+	bool bRowMajor = ( m_eStorage == RowMajor );
+	const std::vector<unsigned int> & vRowOffsets = (bRowMajor) ? m_vOffsets : vTOffsets;
+	const std::vector<unsigned int> & vRowIndices = (bRowMajor) ? m_vIndices : vTIndices;
+	const std::vector<double> & vRowValues = (bRowMajor) ? m_vValues : vTValues;
+	const std::vector<unsigned int> & vColOffsets = (bRowMajor) ? vTOffsets : m_vOffsets;
+	const std::vector<unsigned int> & vColIndices = (bRowMajor) ? vTIndices : m_vIndices;
+	const std::vector<double> & vColValues = (bRowMajor) ? vTValues : m_vValues;
+
+	// the lower triangle is j <= i in row i of CSR, and j >= i in column i of CSC
+	int n = (int)m_nCols;
+	store.SetSize( n, n, m_eStorage, bSymmetricLower );
+	std::vector<unsigned int> & vOffsets = store.m_vOffsets;
+	bool bParallel = ( NonZeros() > COMPRESSED_PARALLEL_THRESHOLD );
+
+	for ( int nPass = 0; nPass < 2; ++nPass ) {
+		if ( nPass == 1 ) {
+			for ( int i = 0; i < n; ++i )
+				vOffsets[i+1] += vOffsets[i];
+			store.m_vIndices.resize( vOffsets[n] );
+			store.m_vValues.resize( vOffsets[n] );
+		}
+
+		#pragma omp parallel if ( bParallel )
+		{
+			std::vector<unsigned int> vMark( n, 0xFFFFFFFF ), vPattern;
+			std::vector<double> vSum( (nPass == 1) ? n : 0 );
+			#pragma omp for schedule(dynamic,64)
+			for ( int i = 0; i < n; ++i ) {
+				vPattern.resize(0);
+				for ( unsigned int p = vColOffsets[i]; p < vColOffsets[i+1]; ++p ) {
+					unsigned int k = vColIndices[p];
+					double dAki = vColValues[p];
+					for ( unsigned int q = vRowOffsets[k]; q < vRowOffsets[k+1]; ++q ) {
+						unsigned int j = vRowIndices[q];
+						if ( bSymmetricLower && ( (bRowMajor) ? j > (unsigned int)i : j < (unsigned int)i ) )
+							continue;
+						if ( vMark[j] != (unsigned int)i ) {
+							vMark[j] = i;
+							vPattern.push_back(j);
+							if ( nPass == 1 )
+								vSum[j] = 0;
+						}
+						if ( nPass == 1 )
+							vSum[j] += dAki * vRowValues[q];
+					}
+				}
+				if ( nPass == 0 ) {
+					vOffsets[i+1] = (unsigned int)vPattern.size();
+					continue;
+				}
+				std::sort( vPattern.begin(), vPattern.end() );
+				unsigned int nWrite = vOffsets[i];
+				for ( unsigned int k = 0; k < vPattern.size(); ++k, ++nWrite ) {
+					store.m_vIndices[nWrite] = vPattern[k];
+					store.m_vValues[nWrite] = vSum[ vPattern[k] ];
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,151 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "config.h"
+#include <vector>
+
+
+// predecl to avoid include
+namespace gsi {
+	class SparseMatrix;
+};
+
+
+namespace rms {
+
+
+/*
+ * (row, column, value) entries for building a CompressedSparseMatrix. Entries can be added in any order,
+ * and repeated entries are summed when the matrix is built. To assemble in parallel, fill one list
+ * per thread and pass all of them to CompressedSparseMatrix::Build().
+ */
+class SparseTripletList
+{
+public:
+	struct Triplet {
+		unsigned int r;
+		unsigned int c;
+		double dValue;
+	};
+
+	SparseTripletList( unsigned int nRows = 0, unsigned int nCols = 0 );
+
+	//! set matrix size. Existing entries are kept
+	void Resize( unsigned int nRows, unsigned int nCols );
+	unsigned int Rows() const { return m_nRows; }
+	unsigned int Columns() const { return m_nCols; }
+
+	void Reserve( size_t nEntries ) { m_vTriplets.reserve(nEntries); }
+	//! remove all entries (size is not changed)
+	void Clear() { m_vTriplets.resize(0); }
+
+	void Add( unsigned int r, unsigned int c, double dValue ) {
+		Triplet t;
+		t.r = r;  t.c = c;  t.dValue = dValue;
+		m_vTriplets.push_back(t);
+	}
+
+	size_t Size() const { return m_vTriplets.size(); }
+	const Triplet & operator[]( size_t i ) const { return m_vTriplets[i]; }
+
+protected:
+	unsigned int m_nRows;
+	unsigned int m_nCols;
+	std::vector<Triplet> m_vTriplets;
+};
+
+
+
+/*
+ * Immutable compressed sparse matrix, stored by rows (CSR) or by columns (CSC). The entries of row
+ * (or column) i are [ GetOffsets()[i], GetOffsets()[i+1] ), with increasing indices and no duplicates.
+ *
+ * A symmetric-lower matrix is symmetric and stores only the entries on or below the diagonal. As CSR
+ * these are the same arrays as the upper triangle stored as CSC (and vice versa).
+ *
+ * Build() sorts and compresses triplets in parallel (with OpenMP), and the products read the compressed
+ * arrays directly. SparseLinearSolver accepts these matrices without converting them.
+ */
+class CompressedSparseMatrix
+{
+public:
+	enum Storage {
+		RowMajor,			// CSR - offsets are indexed by row, indices are columns
+		ColumnMajor			// CSC - offsets are indexed by column, indices are rows
+	};
+
+	CompressedSparseMatrix();
+
+	//! build from triplets, summing repeated entries. If bSymmetricLower, entries above the diagonal are
+	//! skipped (so either the full symmetric matrix or only its lower triangle can be added)
+	void Build( const SparseTripletList & triplets, Storage eStorage = RowMajor, bool bSymmetricLower = false );
+	//! build from lists filled in parallel, which must all have the same size
+	void Build( const std::vector<SparseTripletList> & vLists, Storage eStorage = RowMajor, bool bSymmetricLower = false );
+	//! copy of a gsi::SparseMatrix
+	void Build( const gsi::SparseMatrix & M, Storage eStorage = RowMajor, bool bSymmetricLower = false );
+
+	void Clear();
+
+	unsigned int Rows() const { return m_nRows; }
+	unsigned int Columns() const { return m_nCols; }
+	Storage GetStorage() const { return m_eStorage; }
+	bool IsSymmetricLower() const { return m_bSymmetricLower; }
+
+	//! stored entries (for a symmetric-lower matrix, only those on or below the diagonal)
+	size_t NonZeros() const { return m_vIndices.size(); }
+
+	const unsigned int * GetOffsets() const { return &m_vOffsets[0]; }
+	const unsigned int * GetIndices() const { return m_vIndices.empty() ? NULL : &m_vIndices[0]; }
+	const double * GetValues() const { return m_vValues.empty() ? NULL : &m_vValues[0]; }
+
+	//! entry (r,c), or 0 if it is not stored. Binary search
+	double Get( unsigned int r, unsigned int c ) const;
+
+	//! copy into a gsi::SparseMatrix (the full matrix, if symmetric-lower)
+	void ToSparseMatrix( gsi::SparseMatrix & M ) const;
+
+
+	//! compute Y = this * X. X has Columns() and Y has Rows() elements
+	void Multiply( const double * pX, double * pY ) const;
+
+	//! compute Y = this^T * X. X has Rows() and Y has Columns() elements
+	void MultiplyTranspose( const double * pX, double * pY ) const;
+
+	//! compute store = this^T, with the same storage
+	void Transpose( CompressedSparseMatrix & store ) const;
+
+	//! compute store = this^T * this, with the same storage. If bSymmetricLower, only the lower triangle is stored
+	void TransposeTimesSelf( CompressedSparseMatrix & store, bool bSymmetricLower = false ) const;
+
+	//! store both triangles of a symmetric-lower matrix in store (a copy, if this matrix is not symmetric-lower)
+	void ExpandSymmetric( CompressedSparseMatrix & store ) const;
+
+	//! bytes used by the compressed arrays
+	size_t GetMemoryUsage() const;
+
+protected:
+	unsigned int m_nRows;
+	unsigned int m_nCols;
+	Storage m_eStorage;
+	bool m_bSymmetricLower;
+
+	std::vector<unsigned int> m_vOffsets;
+	std::vector<unsigned int> m_vIndices;
+	std::vector<double> m_vValues;
+
+	unsigned int MajorSize() const { return (m_eStorage == RowMajor) ? m_nRows : m_nCols; }
+	unsigned int MinorSize() const { return (m_eStorage == RowMajor) ? m_nCols : m_nRows; }
+	void SetSize( unsigned int nRows, unsigned int nCols, Storage eStorage, bool bSymmetricLower );
+
+	void Build( const SparseTripletList * const * ppLists, unsigned int nLists, Storage eStorage, bool bSymmetricLower );
+
+	// y += A x or y += A^T x over the arrays, gathering along each stored row/column (bGather), or scattering
+	void MultiplyArrays( const double * pX, double * pY, bool bGather, bool bSkipDiagonal ) const;
+};
+
+
+
+}   // end namespace rms
@@ -7,11 +7,12 @@
 #include "config.h"
 #include <vector>
 #include <VFTriangleMesh.h>
+#include "BVTreeRefitter.h"
 #include <Frame.h>
 
 namespace rms {
 
-class IMeshDeformer
+class IMeshDeformer : public BVTreeRefitter
 {
 public:
 	IMeshDeformer() { 
@@ -19,7 +20,7 @@ public:
 	}
 
 	virtual void SetMesh(rms::VFTriangleMesh * pMesh) = 0;
-	
+
 	virtual void AddBoundaryConstraints(float fWeight) = 0;
 	virtual void ClearConstraints() = 0;
 	virtual void UpdatePositionConstraint( IMesh::VertexID vID, const Wml::Vector3f & vPosition, float fWeight ) = 0;
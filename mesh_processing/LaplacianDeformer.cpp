@@ -7,7 +7,6 @@
 #include "MeshUtils.h"
 #include <Wm4LinearSystem.h>
 #include <SparseLinearSystem.h>
-#include <Solver_TAUCS.h>
 
 
 using namespace rms;
@@ -19,13 +18,28 @@ LaplacianDeformer::LaplacianDeformer()
 	m_pSolver = NULL;
 	m_pSystemM = NULL;
 	m_pLs = new gsi::SparseMatrix();
+	m_pLsLs = new gsi::SparseMatrix();
+	m_bLaplacianValid = false;
+	m_bMatricesValid = false;
+}
+
+LaplacianDeformer::~LaplacianDeformer()
+{
+	if ( m_pSolver )
+		delete m_pSolver;
+	if ( m_pSystemM )
+		delete m_pSystemM;
+	if ( m_pLs )
+		delete m_pLs;
+	if ( m_pLsLs )
+		delete m_pLsLs;
 }
 
 
-gsi::Solver_TAUCS * LaplacianDeformer::GetSolver()
+SparseLinearSolver * LaplacianDeformer::GetSolver()
 {
 	if ( m_pSolver == NULL )
-		m_pSolver = new gsi::Solver_TAUCS(GetSystem());
+		m_pSolver = new SparseLinearSolver(GetSystem());
 	return m_pSolver;
 }
 
@@ -44,6 +58,7 @@ void LaplacianDeformer::SetMesh(rms::VFTriangleMesh * pMesh)
 	m_pMesh = pMesh;
 	m_vConstraints.resize(0);
 	ComputeWeights();
+	m_bLaplacianValid = false;
 	m_bMatricesValid = false;
 }
 
@@ -71,7 +86,7 @@ void LaplacianDeformer::UpdateConstraint( IMesh::VertexID vID, const Wml::Vector
 		if ( m_vConstraints[k].vID == vID ) {
 			m_vConstraints[k].vPosition = vPosition;
 			if ( m_vConstraints[k].fWeight != fWeight )
-				m_bMatricesValid = false;
+				UpdateConstraintWeight( vID, m_vConstraints[k].fWeight, fWeight );
 			m_vConstraints[k].fWeight = fWeight;
 			bFound = true;
 		}
@@ -82,10 +97,34 @@ void LaplacianDeformer::UpdateConstraint( IMesh::VertexID vID, const Wml::Vector
 		c.vPosition = vPosition;
 		c.fWeight = fWeight;
 		m_vConstraints.push_back(c);
-		m_bMatricesValid = false;
+		UpdateConstraintWeight( vID, 0.0f, fWeight );
 	}
 }
 
+void LaplacianDeformer::RemoveConstraint( IMesh::VertexID vID )
+{
+	size_t nCount = m_vConstraints.size();
+	for ( unsigned int k = 0; k < nCount; ++k ) {
+		if ( m_vConstraints[k].vID == vID ) {
+			UpdateConstraintWeight( vID, m_vConstraints[k].fWeight, 0.0f );
+			m_vConstraints.erase( m_vConstraints.begin() + k );
+			return;
+		}
+	}
+}
+
+// A soft constraint adds fWeight^2 to its diagonal entry of the system, so adding, removing or re-weighting
+// one is a rank-1 change. The Eigen backend applies it to its stored factorization, TAUCS refactors
+void LaplacianDeformer::UpdateConstraintWeight( IMesh::VertexID vID, float fOldWeight, float fNewWeight )
+{
+	if ( ! m_bMatricesValid )
+		return;
+	unsigned int ri = vID;
+	double dDelta = (double)(fNewWeight*fNewWeight) - (double)(fOldWeight*fOldWeight);
+	GetSystem()->Set( ri, ri, GetSystem()->Get(ri,ri) + dDelta );
+	GetSolver()->UpdateDiagonal( 1, &ri, &dDelta );
+}
+
 
 
 rms::Frame3f LaplacianDeformer::GetCurrentFrame( IMesh::VertexID vID )
@@ -148,6 +187,7 @@ void LaplacianDeformer::PostProcess_SnapConstraints()
 		Constraint & ci = m_vConstraints[i];
 		m_pMesh->SetVertex( ci.vID, ci.vPosition );
 	}
+	RefitBVTree();
 }
 
 
@@ -209,25 +249,31 @@ void LaplacianDeformer::UpdateMatrices()
 	GetSystem()->Resize(nVerts, nVerts);
 	GetSystem()->ResizeRHS(3);
 
-	gsi::SparseMatrix & Ls = (*m_pLs);
-	Ls.Resize(nVerts, nVerts);
-	
-	for ( unsigned int ri = 0; ri < nVerts; ++ri ) {
-		VtxInfo & vi = m_vVertices[ri];
-		size_t nNbrs = vi.vNbrs.size();
-
-		double dSum = 0.0f;
-		for ( unsigned int k = 0; k < nNbrs; ++k ) {
-			Ls(ri, vi.vNbrs[k]) = vi.vNbrWeights[k];
-			dSum += vi.vNbrWeights[k];
+	if ( ! m_bLaplacianValid ) {
+		gsi::SparseMatrix & Ls = (*m_pLs);
+		Ls.Resize(nVerts, nVerts);
+		
+		for ( unsigned int ri = 0; ri < nVerts; ++ri ) {
+			VtxInfo & vi = m_vVertices[ri];
+			size_t nNbrs = vi.vNbrs.size();
+
+			double dSum = 0.0f;
+			for ( unsigned int k = 0; k < nNbrs; ++k ) {
+				Ls(ri, vi.vNbrs[k]) = vi.vNbrWeights[k];
+				dSum += vi.vNbrWeights[k];
+			}
+			Ls(ri, ri) = -dSum;
 		}
-		Ls(ri, ri) = -dSum;
-	}
 
-	// fold in area weights matrix M here
+		// fold in area weights matrix M here
+
+		(*m_pLsLs) = Ls * Ls;
+		m_bLaplacianValid = true;
+	}
 
-	// construct system
-	gsi::SparseMatrix Msys( Ls * Ls );
+	// construct system. The soft constraints only change the diagonal, so the solver
+	// keeps its symbolic factorization when constraints or their weights change
+	gsi::SparseMatrix Msys( *m_pLsLs );
 
 	// add soft constraints
 	unsigned int nCons = (unsigned int)m_vConstraints.size();
@@ -246,8 +292,7 @@ void LaplacianDeformer::UpdateMatrices()
 
 	GetSolver()->OnMatrixChanged();
 	GetSolver()->SetStoreFactorization(true);
-	GetSolver()->SetSolverMode( gsi::Solver_TAUCS::TAUCS_LLT );
-	GetSolver()->SetOrderingMode( gsi::Solver_TAUCS::TAUCS_METIS );
+	GetSolver()->SetFactorization( SparseLinearSolver::Factor_Cholesky );
 
 	m_bMatricesValid = true;
 
@@ -472,6 +517,7 @@ void LaplacianDeformer::Solve(bool bUseTargetNormals)
 		Wml::Vector3f v((float)GetSystem()->GetSolution(i,0), (float)GetSystem()->GetSolution(i,1), (float)GetSystem()->GetSolution(i,2) );
 		m_pMesh->SetVertex(i, v);
 	}
+	RefitBVTree();
 
 
 	//UpdateMatrices();
@@ -9,12 +9,12 @@
 #include "IDeformer.h"
 #include <VFTriangleMesh.h>
 #include <Wm4GMatrix.h>
+#include "SparseLinearSolver.h"
 
 
 // predecl to avoid include
 namespace gsi {
 	class SparseLinearSystem;
-	class Solver_TAUCS;
 	class SparseMatrix;
 };
 
@@ -25,17 +25,19 @@ class LaplacianDeformer : public IMeshDeformer
 {
 public:
 	LaplacianDeformer();
+	~LaplacianDeformer();
 
 	virtual void SetMesh(rms::VFTriangleMesh * pMesh);
 	
 	virtual void AddBoundaryConstraints(float fWeight = 1.0f);
 
-	virtual void ClearConstraints() { m_vConstraints.resize(0); }
+	virtual void ClearConstraints() { m_vConstraints.resize(0); m_bMatricesValid = false; }
 	
 	virtual void UpdatePositionConstraint( IMesh::VertexID vID, const Wml::Vector3f & vPosition, float fWeight ) 
 		{ UpdateConstraint(vID, vPosition, fWeight); }
 
 	void UpdateConstraint( IMesh::VertexID vID, const Wml::Vector3f & vPosition, float fWeight );
+	void RemoveConstraint( IMesh::VertexID vID );
 
 	virtual void UpdateOrientationConstraint( IMesh::VertexID vID, const rms::Frame3f & vFrame, float fWeight )
 		{ }		// no orientation constraint support...
@@ -55,6 +57,12 @@ public:
 
 	void PostProcess_SnapConstraints();
 
+	//! direct solver used for the system (default is SparseLinearSolver::GetDefaultBackend()).
+	//! Only Backend_Eigen reuses the symbolic factorization when weights change, and updates the factorization in place
+	//! when a constraint is added, removed or re-weighted. Backend_TAUCS refactors from scratch in both cases
+	void SetSolverBackend( SparseLinearSolver::Backend eBackend ) { GetSolver()->SetBackend(eBackend); }
+	SparseLinearSolver::Backend GetSolverBackend() { return GetSolver()->GetBackend(); }
+
 	virtual void DebugRender();
 
 protected:
@@ -91,17 +99,22 @@ protected:
 	gsi::SparseLinearSystem * m_pSystemM;
 	gsi::SparseLinearSystem * GetSystem();
 
-	gsi::Solver_TAUCS * m_pSolver;
-	gsi::Solver_TAUCS * GetSolver();
+	SparseLinearSolver * m_pSolver;
+	SparseLinearSolver * GetSolver();
 
 	gsi::SparseMatrix * m_pLs;
 
+	// Ls*Ls only depends on the mesh, constraint changes just add to its diagonal
+	gsi::SparseMatrix * m_pLsLs;
+	bool m_bLaplacianValid;
+
 
 	Wml::GMatrixd m_MTM;
 	Wml::GMatrixd m_MT;
 	Wml::GVectord m_RHS[3], m_MTRHS[3];
 	bool m_bMatricesValid;
 	void UpdateMatrices();
+	void UpdateConstraintWeight( IMesh::VertexID vID, float fOldWeight, float fNewWeight );
 
 	void UpdateRHS(bool bUseTargetNormals, bool bUseTargetTangents, bool bEstimateNormals);
 
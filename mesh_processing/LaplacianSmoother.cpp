@@ -7,7 +7,6 @@
 #include <MeshUtils.h>
 #include <Wm4LinearSystem.h>
 #include <SparseLinearSystem.h>
-#include <Solver_TAUCS.h>
 #include <rmsdebug.h>
 
 #include <Eigen/Core>
@@ -37,6 +36,7 @@ LaplacianSmoother::LaplacianSmoother()
 
 	m_bWeightsValid = false;
 	m_bMatricesValid = false;
+	m_bSolverValid = false;
 	m_bSolutionValid = false;
 }
 LaplacianSmoother::~LaplacianSmoother()
@@ -49,12 +49,16 @@ LaplacianSmoother::~LaplacianSmoother()
 		delete m_pSystem;
 	if ( m_pRHS )
 		delete [] m_pRHS;
+	if ( m_pSolver )
+		delete m_pSolver;
+	if ( m_pSystemM )
+		delete m_pSystemM;
 }
 
-gsi::Solver_TAUCS * LaplacianSmoother::GetSolver()
+SparseLinearSolver * LaplacianSmoother::GetSolver()
 {
 	if ( m_pSolver == NULL )
-		m_pSolver = new gsi::Solver_TAUCS(GetSystem());
+		m_pSolver = new SparseLinearSolver(GetSystem());
 	return m_pSolver;
 }
 
@@ -101,6 +105,7 @@ void LaplacianSmoother::SetMesh(rms::VFTriangleMesh * pMesh)
 	m_vVertices.resize(0);
 	m_bWeightsValid = false;
 	m_bMatricesValid = false;
+	m_bSolverValid = false;
 }
 void LaplacianSmoother::SetROI( const std::vector<IMesh::VertexID> & vROI )
 {
@@ -145,6 +150,7 @@ void LaplacianSmoother::SetROI( const std::vector<IMesh::VertexID> & vROI )
 	m_vVertices.resize(0);
 	m_bWeightsValid = false;
 	m_bMatricesValid = false;
+	m_bSolverValid = false;
 }
 
 
@@ -224,14 +230,13 @@ void LaplacianSmoother::UpdateConstraint( IMesh::VertexID vID, const Wml::Vector
 	for ( unsigned int k = 0; !bFound && k < nCount; ++k ) {
 		if ( m_vConstraints[k].vID == vID ) {
 			m_vConstraints[k].vPosition = vPosition;
-			if ( m_vConstraints[k].eType != eType && eType != CType_Unspecified ) {
-				m_bMatricesValid = false;
+			float fOldWeight = GetSolverWeight( m_vConstraints[k] );
+			if ( m_vConstraints[k].eType != eType && eType != CType_Unspecified )
 				m_vConstraints[k].eType = eType;
-			}
-			if ( m_vConstraints[k].fWeight != fWeight ) {
-				m_bMatricesValid = false;
-				m_vConstraints[k].fWeight = fWeight;
-			}
+			m_vConstraints[k].fWeight = fWeight;
+			float fNewWeight = GetSolverWeight( m_vConstraints[k] );
+			if ( fNewWeight != fOldWeight )
+				UpdateSolverWeight( nIndex, fOldWeight, fNewWeight );
 			bFound = true;
 		}
 	}
@@ -243,9 +248,9 @@ void LaplacianSmoother::UpdateConstraint( IMesh::VertexID vID, const Wml::Vector
 		c.vPosition = vPosition;
 		c.fWeight = fWeight;
 		m_vConstraints.push_back(c);
-		m_bMatricesValid = false;
-	} else
-		m_bSolutionValid = false;
+		UpdateSolverWeight( nIndex, 0.0f, GetSolverWeight(c) );
+	}
+	m_bSolutionValid = false;
 }
 
 
@@ -266,6 +271,37 @@ void LaplacianSmoother::UpdateConstraint( IMesh::VertexID vID, const Wml::Vector
 }
 
 
+void LaplacianSmoother::RemoveConstraint( IMesh::VertexID vID )
+{
+	size_t nCount = m_vConstraints.size();
+	for ( unsigned int k = 0; k < nCount; ++k ) {
+		if ( m_vConstraints[k].vID == vID ) {
+			UpdateSolverWeight( m_vConstraints[k].nIndex, GetSolverWeight(m_vConstraints[k]), 0.0f );
+			m_vConstraints.erase( m_vConstraints.begin() + k );
+			m_bSolutionValid = false;
+			return;
+		}
+	}
+}
+
+
+float LaplacianSmoother::GetSolverWeight( const Constraint & c )
+{
+	return ( c.eType == CType_SoftInterior ) ? c.fWeight * m_fInteriorConstraintWeightScale : c.fWeight;
+}
+
+// Constraints are added to the diagonal of the solver matrix in UpdateSolver_ThinPlate, so adding, removing or
+// re-weighting one is a rank-1 change. The Eigen backend applies it to its stored factorization, TAUCS refactors
+void LaplacianSmoother::UpdateSolverWeight( unsigned int nIndex, float fOldWeight, float fNewWeight )
+{
+	if ( ! m_bMatricesValid || ! m_bSolverValid )
+		return;
+	double dDelta = (double)(fNewWeight*fNewWeight) - (double)(fOldWeight*fOldWeight);
+	GetSystem()->Set( nIndex, nIndex, GetSystem()->Get(nIndex,nIndex) + dDelta );
+	GetSolver()->UpdateDiagonal( 1, &nIndex, &dDelta );
+}
+
+
 LaplacianSmoother::ConstraintType LaplacianSmoother::GetConstraint( IMesh::VertexID vID )
 {
 	size_t nCount = m_vConstraints.size();
@@ -295,6 +331,7 @@ void LaplacianSmoother::SnapRing0BoundaryConstraints()
 		if ( ci.eType == CType_SoftBoundary_Ring0 )
 			m_pMesh->SetVertex( ci.vID, ci.vPosition );
 	}	
+	RefitBVTree();
 }
 
 
@@ -311,6 +348,7 @@ void LaplacianSmoother::ValidateWeights()
 			IMesh::VertexID vID = m_vMap.GetOld(i);
 			m_pMesh->SetVertex( vID, vi.vOrigPosition );
 		}
+		RefitBVTree();
 	}
 	m_vVertices.resize(0);
 
@@ -485,8 +523,7 @@ void LaplacianSmoother::UpdateSolver_ThinPlate()
 
 	GetSolver()->OnMatrixChanged();
 	GetSolver()->SetStoreFactorization(true);
-	GetSolver()->SetSolverMode( gsi::Solver_TAUCS::TAUCS_LLT );
-	GetSolver()->SetOrderingMode( gsi::Solver_TAUCS::TAUCS_METIS );
+	GetSolver()->SetFactorization( SparseLinearSolver::Factor_Cholesky );
 	
 	m_bSolverValid = true;
 	m_bSolutionValid = false;
@@ -547,7 +584,7 @@ void LaplacianSmoother::UpdateMatrices_Shell()
 {
 	ValidateWeights();
 
-	if ( m_bMatricesValid )
+	if ( m_bMatricesValid && m_bSolverValid )
 		return;
 
 	unsigned int nVerts = (unsigned int)m_vVertices.size();
@@ -599,8 +636,7 @@ void LaplacianSmoother::UpdateMatrices_Shell()
 
 	GetSolver()->OnMatrixChanged();
 	GetSolver()->SetStoreFactorization(true);
-	GetSolver()->SetSolverMode( gsi::Solver_TAUCS::TAUCS_LLT );
-	GetSolver()->SetOrderingMode( gsi::Solver_TAUCS::TAUCS_METIS );
+	GetSolver()->SetFactorization( SparseLinearSolver::Factor_Cholesky );
 
 	m_bMatricesValid = true;
 	m_bSolverValid = true;
@@ -666,6 +702,7 @@ bool LaplacianSmoother::Solve()
 		IMesh::VertexID vID = m_vMap.GetOld(i);
 		m_pMesh->SetVertex(vID, v);
 	}
+	RefitBVTree();
 	return true;
 }
 
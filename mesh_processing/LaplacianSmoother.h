@@ -8,12 +8,13 @@
 #include <vector>
 #include <VFTriangleMesh.h>
 #include <Wm4GMatrix.h>
+#include "SparseLinearSolver.h"
+#include "BVTreeRefitter.h"
 
 
 // predecl to avoid include
 namespace gsi {
 	class SparseLinearSystem;
-	class Solver_TAUCS;
 	class SparseMatrix;
 	class Vector;
 };
@@ -21,7 +22,7 @@ namespace gsi {
 
 namespace rms {
 
-class LaplacianSmoother
+class LaplacianSmoother : public BVTreeRefitter
 {
 public:
 	LaplacianSmoother();
@@ -45,7 +46,7 @@ public:
 
 	void SetMesh(rms::VFTriangleMesh * pMesh);
 	void SetROI( const std::vector<IMesh::VertexID> & vROI );
-	
+
 	enum ConstraintType {
 		CType_SoftBoundary,
 		CType_SoftBoundary_Ring0,
@@ -58,7 +59,7 @@ public:
 	void AddSoftBoundaryConstraints(float fWeight = 1.0f, int nRings = 3, bool bBlendWeight = true);
 	void AddAllInteriorConstraints(float fWeight = 1.0f);
 
-	void ClearConstraints() { m_vConstraints.resize(0); }
+	void ClearConstraints() { m_vConstraints.resize(0); m_bSolverValid = false; m_bSolutionValid = false; }
 	ConstraintType GetConstraint( IMesh::VertexID vID );
 
 	//! constraint type overwrites existing unless passed as CType_Unspecified
@@ -67,6 +68,8 @@ public:
 	//! only updates constraint position if it exists, doesn't change weight
 	void UpdateConstraint( IMesh::VertexID vID, const Wml::Vector3f & vPosition );
 
+	void RemoveConstraint( IMesh::VertexID vID );
+
 
 	//! scaling factor for laplacian vectors. Default is 0 (membrane solution). Set to > 1 to exaggerate details
 	float GetLaplacianVectorScale() { return m_fLaplacianVectorScale; }
@@ -78,6 +81,12 @@ public:
 
 	bool Solve();
 
+	//! direct solver used for the system (default is SparseLinearSolver::GetDefaultBackend()).
+	//! Only Backend_Eigen reuses the symbolic factorization when weights change, and updates the factorization in place
+	//! when a constraint is added, removed or re-weighted. Backend_TAUCS refactors from scratch in both cases
+	void SetSolverBackend( SparseLinearSolver::Backend eBackend ) { GetSolver()->SetBackend(eBackend); }
+	SparseLinearSolver::Backend GetSolverBackend() { return GetSolver()->GetBackend(); }
+
 	void UpdateConstraintsFromMesh();
 	void SnapRing0BoundaryConstraints();
 
@@ -117,6 +126,8 @@ protected:
 		float fWeight;
 	};
 	std::vector<Constraint> m_vConstraints;
+	float GetSolverWeight( const Constraint & c );
+	void UpdateSolverWeight( unsigned int nIndex, float fOldWeight, float fNewWeight );
 
 
 	float m_fLaplacianVectorScale;		
@@ -126,8 +137,8 @@ protected:
 	gsi::SparseLinearSystem * m_pSystemM;
 	gsi::SparseLinearSystem * GetSystem();
 
-	gsi::Solver_TAUCS * m_pSolver;
-	gsi::Solver_TAUCS * GetSolver();
+	SparseLinearSolver * m_pSolver;
+	SparseLinearSolver * GetSolver();
 
 	gsi::SparseMatrix * m_pLs;
 	gsi::SparseMatrix * m_pM;
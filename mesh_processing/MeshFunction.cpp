@@ -7,6 +7,7 @@
 #include "MeshUtils.h"
 #include "VertexWeights.h"
 #include <SparseSymmetricMatrixSolver.h>
+#include <SparseLinearSystem.h>
 
 #include "rmsdebug.h"
 
@@ -17,6 +18,7 @@ MeshVFunctionf::MeshVFunctionf(VFTriangleMesh * pMesh, IVertexFunctionf * pFunct
 	m_pMesh = pMesh;
 	V = pFunction; 
 
+	m_eSolverBackend = SparseLinearSolver::GetDefaultBackend();
 	m_pSolver = NULL;
 }
 
@@ -51,15 +53,11 @@ void MeshVFunctionf::ConstrainValue( IMesh::VertexID vID, float * pValue, unsign
 
 
 
-bool MeshVFunctionf::SolveDirichlet(  )
+template<class SystemType>
+bool MeshVFunctionf::SetDirichletSystem( SystemType & system, std::vector<IMesh::VertexID> & vID )
 {
-	if ( V == NULL )
-		return false;
-
-	gsi::SparseSymmetricMatrixSolver * pSolver = Solver();
-
 	// make linear list of vertices (some could be missing)
-	std::vector<IMesh::VertexID> vID;
+	vID.resize(0);
 	std::vector<unsigned int> reverseMap(m_pMesh->GetMaxVertexID());
 	VFTriangleMesh::vertex_iterator curv(m_pMesh->BeginVertices()), endv(m_pMesh->EndVertices());
 	while ( curv != endv ) {
@@ -75,8 +73,8 @@ bool MeshVFunctionf::SolveDirichlet(  )
 	unsigned int nRHS = V->Components();
 
 	// build sparse matrix
-	pSolver->Resize(nVerts, nVerts);
-	pSolver->ResizeRHS( nRHS );
+	system.Resize(nVerts, nVerts);
+	system.ResizeRHS( nRHS );
 
 	// set interior rows
 	std::vector<IMesh::VertexID> vOneRing;
@@ -88,25 +86,55 @@ bool MeshVFunctionf::SolveDirichlet(  )
 			VertexWeights::Cotangent(*m_pMesh, vID[i], vOneRing, vWeights);
 			size_t nOneRing = vOneRing.size();
 			for ( unsigned int j = 0; j < nOneRing; ++j ) {
-				pSolver->Set( i, reverseMap[vOneRing[j]], -vWeights[j] );
-				pSolver->Set( i, i, 1.0f );		// weights sum to 1
+				system.Set( i, reverseMap[vOneRing[j]], -vWeights[j] );
+				system.Set( i, i, 1.0f );		// weights sum to 1
 			}
 			for ( unsigned int k = 0; k < nRHS; ++k )
-				pSolver->SetRHS(i, 0, k);
+				system.SetRHS(i, 0, k);
 		} else {
 			// Constraint & c = *found;
-			pSolver->Set(i, i, 1.0f);
+			system.Set(i, i, 1.0f);
 			for ( unsigned int k = 0; k < nRHS; ++k )
-				pSolver->SetRHS(i, found->vValue[k], k );
+				system.SetRHS(i, found->vValue[k], k );
 		}
 	}
 
-	if ( ! pSolver->Solve() )
+	return true;
+}
+
+
+
+bool MeshVFunctionf::SolveDirichlet(  )
+{
+	if ( V == NULL )
 		return false;
 
-	for ( unsigned int i = 0; i < nVerts; ++i ) {
+	std::vector<IMesh::VertexID> vID;
+	unsigned int nRHS = V->Components();
+
+	if ( m_eSolverBackend == SparseLinearSolver::Backend_TAUCS ) {
+		gsi::SparseSymmetricMatrixSolver * pSolver = Solver();
+		if ( ! SetDirichletSystem(*pSolver, vID) || ! pSolver->Solve() )
+			return false;
+		for ( unsigned int i = 0; i < (unsigned int)vID.size(); ++i ) {
+			for ( unsigned int k = 0; k < nRHS; ++k )
+				(*V)(vID[i],k) = (float)pSolver->GetSolution(i, k);
+		}
+		return true;
+	}
+
+	// rows are not symmetric (normalized weights, constraint rows), so this is an LU solve
+	gsi::SparseLinearSystem system;
+	if ( ! SetDirichletSystem(system, vID) )
+		return false;
+	SparseLinearSolver solver(&system);
+	solver.SetBackend(m_eSolverBackend);
+	solver.SetFactorization(SparseLinearSolver::Factor_LU);
+	if ( ! solver.Solve() )
+		return false;
+	for ( unsigned int i = 0; i < (unsigned int)vID.size(); ++i ) {
 		for ( unsigned int k = 0; k < nRHS; ++k )
-			(*V)(vID[i],k) = (float)pSolver->GetSolution(i, k);
+			(*V)(vID[i],k) = (float)system.GetSolution(i, k);
 	}
 
 	return true;
@@ -7,6 +7,7 @@
 #include "config.h"
 #include <vector>
 #include <VFTriangleMesh.h>
+#include "SparseLinearSolver.h"
 
 
 // predecl to avoid include
@@ -33,6 +34,10 @@ public:
 	//! interpolates boundary values to interior. Can also constrain interior vertices.
 	bool SolveDirichlet();
 
+	//! Backend_TAUCS solves with gsi::SparseSymmetricMatrixSolver, Backend_Eigen with an in-tree sparse LU
+	void SetSolverBackend( SparseLinearSolver::Backend eBackend ) { m_eSolverBackend = eBackend; }
+	SparseLinearSolver::Backend GetSolverBackend() const { return m_eSolverBackend; }
+
 protected:
 
 	struct Constraint {
@@ -47,8 +52,14 @@ protected:
 	};
 	std::set<Constraint> m_vConstraints;
 
+	SparseLinearSolver::Backend m_eSolverBackend;
 	gsi::SparseSymmetricMatrixSolver * m_pSolver;
 	gsi::SparseSymmetricMatrixSolver * Solver();
+
+	//! fills the Dirichlet system over the mesh vertices vID (in system row order). Returns false if
+	//! a boundary vertex is not constrained
+	template<class SystemType>
+	bool SetDirichletSystem( SystemType & system, std::vector<IMesh::VertexID> & vID );
 };
 
 
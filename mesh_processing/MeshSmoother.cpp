@@ -25,6 +25,9 @@ void MeshSmoother::SetSurface(rms::VFTriangleMesh * pMesh)
 {
 	m_pMesh = pMesh;
 
+	// smoothing never changes connectivity, so one-ring queries can use CSR adjacency
+	m_pMesh->FreezeTopology();
+
 	m_pMesh->GetBoundingBox(m_bounds);
 	float fMin = 0, fMax = 0;
 	m_pMesh->GetEdgeLengthStats(fMin, fMax, m_fAvgEdgeLength);
@@ -69,12 +72,16 @@ void MeshSmoother::DoAdaptiveLaplacianSmooth(int nPasses, float fMaxLambda)
 			m_pMesh->SetVertex( v.vID, v.vVertex );
 		}
 	}
+	RefitBVTree();
 }
 
 
 
 void MeshSmoother::DoLaplacianSmooth(int nPasses, float fLambda)
 {
+	// write straight into the position array if mesh uses compact vertex storage
+	float * pPositions = m_pMesh->GetPositionBuffer();
+
 	for ( int pi = 0; pi < nPasses; ++pi ) {
 
 		UpdateWeights();
@@ -93,9 +100,14 @@ void MeshSmoother::DoLaplacianSmooth(int nPasses, float fLambda)
 
 			v.vVertex += fLambda * vDelta;
 
-			m_pMesh->SetVertex( v.vID, v.vVertex );
+			if ( pPositions ) {
+				float * pVertex = pPositions + 3*v.vID;
+				pVertex[0] = v.vVertex.X();  pVertex[1] = v.vVertex.Y();  pVertex[2] = v.vVertex.Z();
+			} else
+				m_pMesh->SetVertex( v.vID, v.vVertex );
 		}
 	}
+	RefitBVTree();
 }
 
 
@@ -144,6 +156,7 @@ void MeshSmoother::DoTaubinSmooth(int nPasses, float fKpb, float fLambda)
 		}
 
 	}
+	RefitBVTree();
 }
 
 
@@ -192,12 +205,18 @@ void MeshSmoother::UpdateWeights()
 
 	m_fMaxLaplacianLenSqr = 0.0f;
 
+	// NULL unless mesh uses compact vertex storage
+	const float * pPositions = ((const VFTriangleMesh *)m_pMesh)->GetPositionBuffer();
+
 	size_t nCount = m_vVerts.size();
 	for ( unsigned int i = 0; i < nCount; ++i ) {
 		Vertex & v = m_vVerts[i];
 
 		// update vert position
-		m_pMesh->GetVertex( v.vID, v.vVertex );
+		if ( pPositions )
+			v.vVertex = Wml::Vector3f( pPositions + 3*v.vID );
+		else
+			m_pMesh->GetVertex( v.vID, v.vVertex );
 
 		if ( v.bIsBoundary )
 			continue;
@@ -219,7 +238,10 @@ void MeshSmoother::UpdateWeights()
 		v.vDeltas.resize( nNbrs );
 		Wml::Vector3f vCentroid = Wml::Vector3f::ZERO;
 		for ( unsigned int k = 0; k < nNbrs; ++k ) {
-			v.vDeltas[k] = Wml::Vector3f(m_pMesh->GetVertex(v.vNbrs[k]));
+			if ( pPositions )
+				v.vDeltas[k] = Wml::Vector3f( pPositions + 3*v.vNbrs[k] );
+			else
+				v.vDeltas[k] = Wml::Vector3f(m_pMesh->GetVertex(v.vNbrs[k]));
 			vCentroid += v.vWeights[k] * v.vDeltas[k];
 			v.vDeltas[k] -= v.vVertex;
 		}
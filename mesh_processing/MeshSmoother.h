@@ -6,13 +6,13 @@
 
 #include "config.h"
 #include <VFTriangleMesh.h>
-#include <IMeshBVTree.h>
 #include <Frame.h>
 #include <MeshSelection.h>
+#include "BVTreeRefitter.h"
 
 namespace rms {
 
-class MeshSmoother
+class MeshSmoother : public BVTreeRefitter
 {
 public:
 	MeshSmoother(void);
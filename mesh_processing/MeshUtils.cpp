@@ -481,6 +481,63 @@ bool MeshUtils::CheckMeshValidity( VFTriangleMesh & mesh, bool bTopologyChecks )
 
 
 
+// IMesh::ForEachTriangle functor for CopyMesh, flags the vertices used by triangles
+struct MarkTriangleVerticesFunc {
+	const IMesh * pMesh;
+	std::vector<bool> * pUsed;
+	MarkTriangleVerticesFunc( const IMesh * pUseMesh, std::vector<bool> & vUsed ) : pMesh(pUseMesh), pUsed(&vUsed) {}
+	inline void operator()( IMesh::TriangleID tID ) {
+		IMesh::VertexID nTri[3];
+		pMesh->GetTriangle(tID, nTri);
+		(*pUsed)[nTri[0]] = true;		(*pUsed)[nTri[1]] = true;		(*pUsed)[nTri[2]] = true;  
+	}
+};
+
+// IMesh::ForEachVertexBlock functor for CopyMesh. Vertices not in pKeep (if not NULL) are mapped to InvalidID
+struct CopyMeshVerticesFunc {
+	const IMesh * pFrom;
+	IMesh * pTo;
+	VertexMap * pVMap;
+	const std::vector<bool> * pKeep;
+	CopyMeshVerticesFunc( const IMesh * pUseFrom, IMesh * pUseTo, VertexMap & VMap, const std::vector<bool> * pUseKeep )
+		: pFrom(pUseFrom), pTo(pUseTo), pVMap(&VMap), pKeep(pUseKeep) {}
+	inline void operator()( const IMesh::VertexID * pIDs, unsigned int nCount ) {
+		float vXYZ[3*IMESH_ID_BLOCK_SIZE], vNormals[3*IMESH_ID_BLOCK_SIZE];
+		pFrom->GatherVertices(pIDs, nCount, vXYZ, vNormals);
+		for ( unsigned int k = 0; k < nCount; ++k ) {
+			IMesh::VertexID vID = pIDs[k];
+			if ( pKeep && ! (*pKeep)[vID] ) {
+				pVMap->SetMap(vID, IMesh::InvalidID);
+				continue;
+			}
+			Wml::Vector3f vNormal( vNormals + 3*k );
+			IMesh::VertexID vNewID = pTo->AppendVertex( Wml::Vector3f(vXYZ + 3*k), &vNormal );
+			pVMap->SetMap(vID, vNewID);
+		}
+	}
+};
+
+// IMesh::ForEachTriangleBlock functor for CopyMesh
+struct CopyMeshTrianglesFunc {
+	const IMesh * pFrom;
+	IMesh * pTo;
+	const VertexMap * pVMap;
+	TriangleMap * pFaceMap;
+	CopyMeshTrianglesFunc( const IMesh * pUseFrom, IMesh * pUseTo, const VertexMap & VMap, TriangleMap * pUseFaceMap )
+		: pFrom(pUseFrom), pTo(pUseTo), pVMap(&VMap), pFaceMap(pUseFaceMap) {}
+	inline void operator()( const IMesh::TriangleID * pIDs, unsigned int nCount ) {
+		IMesh::VertexID vTris[3*IMESH_ID_BLOCK_SIZE], nTri[3];
+		pFrom->GatherTriangles(pIDs, nCount, vTris);
+		for ( unsigned int k = 0; k < nCount; ++k ) {
+			for ( int j = 0; j < 3; ++j )
+				nTri[j] = pVMap->GetNew(vTris[3*k+j]);
+			IMesh::TriangleID tNewID = pTo->AppendTriangle( nTri[0], nTri[1], nTri[2] );
+			if ( pFaceMap )
+				pFaceMap->SetMap(pIDs[k], tNewID);
+		}
+	}
+};
+
 void MeshUtils::CopyMesh( IMesh * pFrom, IMesh * pTo, VertexMap * pVtxMap, TriangleMap * pFaceMap, bool bCompact )
 {
 	pTo->Clear(false);
@@ -489,43 +546,17 @@ void MeshUtils::CopyMesh( IMesh * pFrom, IMesh * pTo, VertexMap * pVtxMap, Trian
 	VertexMap & VMap = (pVtxMap != NULL) ? *pVtxMap : vLocalVertMap;
 	VMap.Resize(pFrom->GetMaxVertexID(), pFrom->GetMaxVertexID());
 
-	std::set<IMesh::VertexID> vKeep;
+	std::vector<bool> vKeep;
 	if ( bCompact ) {
-		IMesh::VertexID nTri[3];
-		IMesh::ITriIterator curt(pFrom->BeginITriangles()), endt(pFrom->EndITriangles());
-		while ( curt != endt ) {
-			IMesh::TriangleID tID = *curt;  ++curt;
-			pFrom->GetTriangle(tID, nTri);
-			vKeep.insert(nTri[0]);		vKeep.insert(nTri[1]);		vKeep.insert(nTri[2]);  
-		}
+		vKeep.resize( pFrom->GetMaxVertexID(), false );
+		pFrom->ForEachTriangle( MarkTriangleVerticesFunc(pFrom, vKeep) );
 	}
 
-	Wml::Vector3f vVertex, vNormal;
-	IMesh::IVtxIterator curv(pFrom->BeginIVertices()), endv(pFrom->EndIVertices());
-	while ( curv != endv ) {
-		IMesh::VertexID vID = *curv;  ++curv;
-		if ( bCompact && vKeep.find(vID) == vKeep.end() ) {
-			VMap.SetMap(vID, IMesh::InvalidID);
-			continue;
-		}
-		pFrom->GetVertex(vID, vVertex, &vNormal );
-		IMesh::VertexID vNewID = pTo->AppendVertex(vVertex, &vNormal);
-		VMap.SetMap(vID, vNewID);
-	}
+	pFrom->ForEachVertexBlock( CopyMeshVerticesFunc(pFrom, pTo, VMap, (bCompact) ? &vKeep : NULL) );
 
 	if ( pFaceMap )
 		pFaceMap->Resize( pFrom->GetMaxTriangleID(), pFrom->GetMaxTriangleID() );
-	IMesh::VertexID nTri[3];
-	IMesh::ITriIterator curt(pFrom->BeginITriangles()), endt(pFrom->EndITriangles());
-	while ( curt != endt ) {
-		IMesh::TriangleID tID = *curt;  ++curt;
-		pFrom->GetTriangle(tID, nTri);
-		for ( int j = 0; j < 3; ++j )
-			nTri[j] = VMap.GetNew(nTri[j]);
-		IMesh::TriangleID tNewID = pTo->AppendTriangle( nTri[0], nTri[1], nTri[2] );
-		if ( pFaceMap )
-			pFaceMap->SetMap(tID, tNewID);
-	}
+	pFrom->ForEachTriangleBlock( CopyMeshTrianglesFunc(pFrom, pTo, VMap, pFaceMap) );
 }
 
 
@@ -737,6 +768,25 @@ void MeshUtils::CopyUVs( IMesh::UVSet & from, IMesh::UVSet & to, rms::VertexMap
 
 
 
+// IMesh::ForEachVertex functor for CopyUVs
+struct CopyUVsFunc {
+	const IMesh * pFrom;
+	VFTriangleMesh * pTo;
+	IMesh::UVSetID nFromSetID, nToSetID;
+	const VertexMap * pVMap;
+	bool bBoundaryOnly;
+	CopyUVsFunc( const IMesh & from, VFTriangleMesh & to, IMesh::UVSetID nFromSet, IMesh::UVSetID nToSet, const VertexMap & VMap, bool bBoundary )
+		: pFrom(&from), pTo(&to), nFromSetID(nFromSet), nToSetID(nToSet), pVMap(&VMap), bBoundaryOnly(bBoundary) {}
+	inline void operator()( IMesh::VertexID vFromID ) {
+		IMesh::VertexID vToID = pVMap->GetNew(vFromID);
+		if ( bBoundaryOnly && ! pFrom->IsBoundaryVertex(vToID) )
+			return;
+		Wml::Vector2f vUV;
+		if ( pFrom->GetUV(vFromID, nFromSetID, vUV) ) 
+			pTo->SetUV(vToID, nToSetID, vUV);
+	}
+};
+
 void MeshUtils::CopyUVs( const IMesh & from, VFTriangleMesh & to, IMesh::UVSetID nFromSetID, IMesh::UVSetID nToSetID,
 								const VertexMap & VMap, bool bBoundaryOnly )
 {
@@ -747,17 +797,7 @@ void MeshUtils::CopyUVs( const IMesh & from, VFTriangleMesh & to, IMesh::UVSetID
 	to.ClearUVSet( nToSetID );
 	to.InitializeUVSet( nToSetID );
 
-	Wml::Vector2f vUV;
-	IMesh::IVtxIterator curv(from.BeginIVertices()), endv(from.EndIVertices());
-	while ( curv != endv ) {
-		IMesh::VertexID vFromID = *curv; curv++;
-		IMesh::VertexID vToID = VMap.GetNew(vFromID);
-
-		if ( bBoundaryOnly && ! from.IsBoundaryVertex(vToID) )
-			continue;
-		if ( from.GetUV(vFromID, nFromSetID, vUV) ) 
-			to.SetUV(vToID, nToSetID, vUV);
-	}
+	from.ForEachVertex( CopyUVsFunc(from, to, nFromSetID, nToSetID, VMap, bBoundaryOnly) );
 }
 
 
@@ -1133,17 +1173,20 @@ Wml::Vector3f MeshUtils::MeshLaplacian( VFTriangleMesh & mesh, IMesh::VertexID v
 }
 
 
-void MeshUtils::GetEdgeLengthStats( IMesh * pMesh, float & fMin, float & fMax, float & fAvg )
-{
-	fMax = std::numeric_limits<float>::min();
-	fMin = std::numeric_limits<float>::max();
-	fAvg = 0;
-	
-	int nCount = 0;
-	IMesh::ITriIterator curt( pMesh->BeginITriangles()), endt( pMesh->EndITriangles());
-	while ( curt != endt ) {
-		IMesh::TriangleID nID = *curt;
-		curt++;
+// IMesh::ForEachTriangle functor for GetEdgeLengthStats
+struct EdgeLengthStatsFunc {
+	const IMesh * pMesh;
+	float fMin, fMax, fAvg;
+	int nCount;
+
+	EdgeLengthStatsFunc( const IMesh * pUseMesh ) : pMesh(pUseMesh) {
+		fMax = std::numeric_limits<float>::min();
+		fMin = std::numeric_limits<float>::max();
+		fAvg = 0;
+		nCount = 0;
+	}
+
+	inline void operator()( IMesh::TriangleID nID ) {
 		++nCount;
 
 		Wml::Vector3f vVertices[3];
@@ -1158,7 +1201,14 @@ void MeshUtils::GetEdgeLengthStats( IMesh * pMesh, float & fMin, float & fMax, f
 			fAvg += fLen / 3.0f;
 		}
 	}
-	fAvg /= (float)nCount;
+};
+
+void MeshUtils::GetEdgeLengthStats( IMesh * pMesh, float & fMin, float & fMax, float & fAvg )
+{
+	EdgeLengthStatsFunc stats = pMesh->ForEachTriangle( EdgeLengthStatsFunc(pMesh) );
+	fMin = stats.fMin;
+	fMax = stats.fMax;
+	fAvg = stats.fAvg / (float)stats.nCount;
 }
 
 
@@ -1451,6 +1501,43 @@ Wml::Vector3f MeshUtils::EstimateNormal( VFTriangleMesh & mesh, IMesh::VertexID
 
 void MeshUtils::EstimateNormals( VFTriangleMesh & mesh, NormalEstMode eMode, bool bSkipBoundary, Wml::Vector3f * pBuffer )
 {
+	// with compact vertex storage we can accumulate face normals in a single
+	// pass over the triangles, reading positions directly from the array
+	const float * pPositions = ((const VFTriangleMesh &)mesh).GetPositionBuffer();
+	if ( pPositions != NULL && ! bSkipBoundary ) {
+		std::vector<Wml::Vector3f> vSums( mesh.GetMaxVertexID(), Wml::Vector3f::ZERO );
+		IMesh::VertexID nTri[3];
+		VFTriangleMesh::triangle_iterator curt(mesh.BeginTriangles()), endt(mesh.EndTriangles());
+		while ( curt != endt ) {
+			IMesh::TriangleID tID = *curt;  ++curt;
+			mesh.GetTriangle(tID, nTri);
+			Wml::Vector3f vTri[3] = { Wml::Vector3f(pPositions + 3*nTri[0]), 
+				Wml::Vector3f(pPositions + 3*nTri[1]), Wml::Vector3f(pPositions + 3*nTri[2]) };
+			Wml::Vector3f vNormal;
+			if ( eMode == AreaWeightedFaceAvg ) {
+				float fWeight;
+				vNormal = Normal(vTri[0], vTri[1], vTri[2], &fWeight );
+				vNormal *= fWeight;
+			} else
+				vNormal = Normal(vTri[0], vTri[1], vTri[2]);
+			for ( int j = 0; j < 3; ++j )
+				vSums[nTri[j]] += vNormal;
+		}
+
+		float * pNormals = mesh.GetNormalBuffer();
+		VFTriangleMesh::vertex_iterator curv(mesh.BeginVertices()), endv(mesh.EndVertices());
+		while ( curv != endv ) {
+			IMesh::VertexID vID = *curv++;
+			vSums[vID].Normalize();
+			if ( pBuffer )
+				pBuffer[vID] = vSums[vID];
+			else {
+				pNormals[3*vID] = vSums[vID].X();  pNormals[3*vID+1] = vSums[vID].Y();  pNormals[3*vID+2] = vSums[vID].Z();
+			}
+		}
+		return;
+	}
+
 	VFTriangleMesh::vertex_iterator curv(mesh.BeginVertices()), endv(mesh.EndVertices());
 	while ( curv != endv ) {
 		IMesh::VertexID vID = *curv++;
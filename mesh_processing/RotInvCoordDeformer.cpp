@@ -7,7 +7,6 @@
 #include "MeshUtils.h"
 #include <Wm4LinearSystem.h>
 #include <SparseLinearSystem.h>
-#include <Solver_TAUCS.h>
 
 #include <Eigen/Core>
 #include <Eigen/Sparse>
@@ -52,10 +51,10 @@ RotInvCoordDeformer::~RotInvCoordDeformer()
 }
 
 
-gsi::Solver_TAUCS * RotInvCoordDeformer::GetSolverPos()
+SparseLinearSolver * RotInvCoordDeformer::GetSolverPos()
 {
 	if ( m_pSolverPos == NULL )
-		m_pSolverPos = new gsi::Solver_TAUCS(GetSystemPos());
+		m_pSolverPos = new SparseLinearSolver(GetSystemPos());
 	return m_pSolverPos;
 }
 gsi::SparseLinearSystem * RotInvCoordDeformer::GetSystemPos()
@@ -66,10 +65,10 @@ gsi::SparseLinearSystem * RotInvCoordDeformer::GetSystemPos()
 }
 
 
-gsi::Solver_TAUCS * RotInvCoordDeformer::GetSolverRot()
+SparseLinearSolver * RotInvCoordDeformer::GetSolverRot()
 {
 	if ( m_pSolverRot == NULL )
-		m_pSolverRot = new gsi::Solver_TAUCS(GetSystemRot());
+		m_pSolverRot = new SparseLinearSolver(GetSystemRot());
 	return m_pSolverRot;
 }
 gsi::SparseLinearSystem * RotInvCoordDeformer::GetSystemRot()
@@ -395,8 +394,7 @@ void RotInvCoordDeformer::UpdateMatrices()
 
 	GetSolverRot()->OnMatrixChanged();
 	GetSolverRot()->SetStoreFactorization(true);
-	GetSolverRot()->SetSolverMode( gsi::Solver_TAUCS::TAUCS_LLT );
-	GetSolverRot()->SetOrderingMode( gsi::Solver_TAUCS::TAUCS_METIS );
+	GetSolverRot()->SetFactorization( SparseLinearSolver::Factor_Cholesky );
 
 
 
@@ -486,8 +484,7 @@ void RotInvCoordDeformer::UpdateMatrices()
 
 	GetSolverPos()->OnMatrixChanged();
 	GetSolverPos()->SetStoreFactorization(true);
-	GetSolverPos()->SetSolverMode( gsi::Solver_TAUCS::TAUCS_LLT );
-	GetSolverPos()->SetOrderingMode( gsi::Solver_TAUCS::TAUCS_METIS );
+	GetSolverPos()->SetFactorization( SparseLinearSolver::Factor_Cholesky );
 
 	m_bMatricesValid = true;
 }
@@ -647,6 +644,7 @@ void RotInvCoordDeformer::Solve()
 		Wml::Vector3f v((float)pSystem->GetSolution(i,0), (float)pSystem->GetSolution(i,1), (float)pSystem->GetSolution(i,2) );
 		m_pMesh->SetVertex(i, v);
 	}
+	RefitBVTree();
 
 }
 
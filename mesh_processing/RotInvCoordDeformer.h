@@ -9,12 +9,12 @@
 #include "IDeformer.h"
 #include <VFTriangleMesh.h>
 #include <Frame.h>
+#include "SparseLinearSolver.h"
 
 
 // predecl to avoid include
 namespace gsi {
 	class SparseLinearSystem;
-	class Solver_TAUCS;
 	class SparseMatrix;
 	class Vector;
 };
@@ -47,6 +47,11 @@ public:
 
 	float GetLaplacianError();
 
+	//! direct solver used for both systems (default is SparseLinearSolver::GetDefaultBackend()).
+	//! Only Backend_Eigen reuses the symbolic factorization when weights change, Backend_TAUCS refactors from scratch
+	void SetSolverBackend( SparseLinearSolver::Backend eBackend ) { GetSolverRot()->SetBackend(eBackend); GetSolverPos()->SetBackend(eBackend); }
+	SparseLinearSolver::Backend GetSolverBackend() { return GetSolverPos()->GetBackend(); }
+
 	virtual void DebugRender();
 
 protected:
@@ -95,15 +100,15 @@ protected:
 	// system and solver for orientation (frames)
 	gsi::SparseLinearSystem * m_pSystemRot;
 	gsi::SparseLinearSystem * GetSystemRot();
-	gsi::Solver_TAUCS * m_pSolverRot;
-	gsi::Solver_TAUCS * GetSolverRot();
+	SparseLinearSolver * m_pSolverRot;
+	SparseLinearSolver * GetSolverRot();
 
 
 	// system and solver for positions (laplacian)
 	gsi::SparseLinearSystem * m_pSystemPos;
 	gsi::SparseLinearSystem * GetSystemPos();
-	gsi::Solver_TAUCS * m_pSolverPos;
-	gsi::Solver_TAUCS * GetSolverPos();
+	SparseLinearSolver * m_pSolverPos;
+	SparseLinearSolver * GetSolverPos();
 
 	// laplacian matrix for positions
 	gsi::SparseMatrix * m_pLs;
@@ -0,0 +1,1601 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "SparseLinearSolver.h"
+#include "CompressedSparseMatrix.h"
+#include <SparseLinearSystem.h>
+#include <Solver_TAUCS.h>
+#include <Solver_UMFPACK.h>
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+
+using namespace rms;
+
+
+SparseLinearSolver::Backend SparseLinearSolver::s_eDefaultBackend = SparseLinearSolver::Backend_TAUCS;
+
+
+// Eigen::SparseLDLT has no fill-reducing ordering of its own, so the matrix is permuted before
+// it is factored. This subclass exposes the factors for the permuted solve, and the symbolic and
+// numeric phases separately, so that matrices with the same pattern only repeat the numeric phase.
+//
+// The numeric phase of SparseLDLT computes one row of L at a time with sparse scalar operations, which is
+// slow when L has dense blocks (eg the separators of a nested dissection ordering). Factorize() is instead a
+// left-looking supernodal LDL^T: consecutive columns with nested patterns are factored together as a dense
+// block, and the updates between blocks are dense matrix products. The result is copied into the same
+// compressed column L, so the solve and UpdateDiagonal() do not change.
+class EigenLDLT : public Eigen::SparseLDLT< Eigen::SparseMatrix<double> >
+{
+public:
+	//! elimination tree, pattern of L and supernodes, from the pattern of the upper triangle of C
+	void Analyze( const Eigen::SparseMatrix<double> & C );
+	//! factor the upper triangle of C, which must have the pattern passed to Analyze()
+	bool Factorize( const Eigen::SparseMatrix<double> & C );
+	const Eigen::SparseMatrix<double> & L() const { return m_matrix; }
+	const Eigen::VectorXd & D() const { return m_diag; }
+
+	//! L D L^T + dDelta e_k e_k^T, in place (Gill, Golub, Murray and Saunders, method C1). e_k only fills the ancestors of
+	//! k in the elimination tree, so only the columns on the path from k to the root change, and the pattern of L does not.
+	//! pWork must have size() zeros and is cleared again. Returns false if a pivot is no longer positive, which leaves
+	//! the factorization invalid
+	bool UpdateDiagonal( int k, double dDelta, double * pWork ) {
+		const int * pLOffsets = m_matrix._outerIndexPtr();
+		const int * pLRows = m_matrix._innerIndexPtr();
+		double * pLValues = m_matrix._valuePtr();
+		double * w = pWork;
+		w[k] = 1.0;
+		double fAlpha = dDelta;
+		bool bOK = true;
+		for ( int j = k; j >= 0 && bOK; j = m_parent[j] ) {
+			double fP = w[j];
+			double fD = m_diag[j];
+			double fNewD = fD + fAlpha * fP * fP;
+			if ( ! (fNewD > 0) ) {
+				bOK = false;
+				break;
+			}
+			double fBeta = fP * fAlpha / fNewD;
+			fAlpha *= fD / fNewD;
+			m_diag[j] = fNewD;
+			for ( int p = pLOffsets[j]; p < pLOffsets[j+1]; ++p ) {
+				int r = pLRows[p];
+				w[r] -= fP * pLValues[p];
+				pLValues[p] += fBeta * w[r];
+			}
+		}
+		for ( int j = k; j >= 0; j = m_parent[j] )
+			w[j] = 0;
+		m_succeeded = bOK;
+		return bOK;
+	}
+	void Clear() {
+		m_matrix.resize(0,0);
+		m_diag.resize(0);
+		m_parent.resize(0);
+		m_nonZerosPerCol.resize(0);
+		m_succeeded = false;
+		std::vector<int>().swap(m_vSuperStart);  std::vector<int>().swap(m_vColSuper);
+		std::vector<int>().swap(m_vSuperRowOffsets);  std::vector<int>().swap(m_vSuperRows);
+		std::vector<size_t>().swap(m_vSuperValueOffsets);
+		std::vector<int>().swap(m_vLowerOffsets);  std::vector<int>().swap(m_vLowerRows);  std::vector<int>().swap(m_vLowerSource);
+	}
+	size_t GetSymbolicMemoryUsage() const {
+		return ( m_vSuperStart.capacity() + m_vColSuper.capacity() + m_vSuperRowOffsets.capacity() + m_vSuperRows.capacity()
+				 + m_vLowerOffsets.capacity() + m_vLowerRows.capacity() + m_vLowerSource.capacity() ) * sizeof(int)
+			   + m_vSuperValueOffsets.capacity() * sizeof(size_t);
+	}
+
+protected:
+	// supernode s is columns m_vSuperStart[s] ... m_vSuperStart[s+1]-1 of L. Its rows are
+	// m_vSuperRows[ m_vSuperRowOffsets[s] ... m_vSuperRowOffsets[s+1]-1 ], the columns themselves first.
+	// In Factorize(), it is stored as a dense column-major block at m_vSuperValueOffsets[s]
+	std::vector<int> m_vSuperStart, m_vColSuper;
+	std::vector<int> m_vSuperRowOffsets, m_vSuperRows;
+	std::vector<size_t> m_vSuperValueOffsets;
+	size_t m_nMaxSuperBlock;
+
+	// lower triangle of C in compressed columns (the transpose of its upper triangle), m_vLowerSource[q] is the position in C
+	std::vector<int> m_vLowerOffsets, m_vLowerRows, m_vLowerSource;
+
+	static bool FactorSupernode( double * pBlock, int nRows, int nCols, double * pDiag, double * pWork );
+};
+
+
+void EigenLDLT::Analyze( const Eigen::SparseMatrix<double> & C )
+{
+	_symbolic(C);
+	m_succeeded = false;
+	int n = C.cols();
+	const int * pCOffsets = C._outerIndexPtr();
+	const int * pCRows = C._innerIndexPtr();
+	const int * pLOffsets = m_matrix._outerIndexPtr();
+	int * pLRows = m_matrix._innerIndexPtr();
+
+	// pattern of L, one row at a time as in _numeric(), so the rows of each column are sorted
+	std::vector<int> vCount(n, 0), vTags(n);
+	for ( int k = 0; k < n; ++k ) {
+		vTags[k] = k;
+		for ( int p = pCOffsets[k]; p < pCOffsets[k+1]; ++p ) {
+			for ( int i = pCRows[p]; i < k && vTags[i] != k; i = m_parent[i] ) {
+				pLRows[ pLOffsets[i] + vCount[i]++ ] = k;
+				vTags[i] = k;
+			}
+		}
+	}
+
+	// fundamental supernodes: column j+1 joins the supernode of column j if the pattern of column j is j+1 followed by the pattern of column j+1
+	m_vSuperStart.resize(0);
+	m_vColSuper.resize(n);
+	for ( int j = 0; j < n; ++j ) {
+		if ( j == 0 || m_parent[j-1] != j || vCount[j-1] != vCount[j] + 1 )
+			m_vSuperStart.push_back(j);
+		m_vColSuper[j] = (int)m_vSuperStart.size() - 1;
+	}
+	int nSuper = (int)m_vSuperStart.size();
+	m_vSuperStart.push_back(n);
+
+	m_vSuperRowOffsets.resize(nSuper+1);
+	m_vSuperValueOffsets.resize(nSuper+1);
+	m_vSuperRowOffsets[0] = 0;
+	m_vSuperValueOffsets[0] = 0;
+	m_nMaxSuperBlock = 0;
+	for ( int s = 0; s < nSuper; ++s ) {
+		int nRows = 1 + vCount[ m_vSuperStart[s] ];
+		size_t nBlock = (size_t)nRows * (size_t)(m_vSuperStart[s+1] - m_vSuperStart[s]);
+		m_vSuperRowOffsets[s+1] = m_vSuperRowOffsets[s] + nRows;
+		m_vSuperValueOffsets[s+1] = m_vSuperValueOffsets[s] + nBlock;
+		m_nMaxSuperBlock = std::max( m_nMaxSuperBlock, nBlock );
+	}
+	m_vSuperRows.resize( m_vSuperRowOffsets[nSuper] );
+	for ( int s = 0; s < nSuper; ++s ) {
+		int j = m_vSuperStart[s];
+		int * pRows = &m_vSuperRows[ m_vSuperRowOffsets[s] ];
+		pRows[0] = j;
+		std::copy( pLRows + pLOffsets[j], pLRows + pLOffsets[j+1], pRows + 1 );
+	}
+
+	// lower triangle of C. The upper triangle is visited by columns, so the rows of each column are sorted
+	m_vLowerOffsets.assign(n+1, 0);
+	for ( int p = 0; p < pCOffsets[n]; ++p )
+		++m_vLowerOffsets[ pCRows[p] + 1 ];
+	for ( int k = 0; k < n; ++k )
+		m_vLowerOffsets[k+1] += m_vLowerOffsets[k];
+	m_vLowerRows.resize( pCOffsets[n] );
+	m_vLowerSource.resize( pCOffsets[n] );
+	std::vector<int> vInsert( m_vLowerOffsets.begin(), m_vLowerOffsets.end() - 1 );
+	for ( int k = 0; k < n; ++k ) {
+		for ( int p = pCOffsets[k]; p < pCOffsets[k+1]; ++p ) {
+			int q = vInsert[ pCRows[p] ]++;
+			m_vLowerRows[q] = k;
+			m_vLowerSource[q] = p;
+		}
+	}
+}
+
+
+// The supernodes are visited in order. Each is assembled from its columns of C and the updates of all descendant
+// supernodes with rows in its columns, and then factored. A factored supernode is kept in a linked list of the next
+// supernode it updates (the supernode of its next row below the current target), as in CHOLMOD's supernodal numeric phase.
+bool EigenLDLT::Factorize( const Eigen::SparseMatrix<double> & C )
+{
+	int n = C.cols();
+	int nSuper = (int)m_vSuperStart.size() - 1;
+	const double * pCValues = C._valuePtr();
+	m_diag.resize(n);
+	double * pDiag = m_diag.data();
+
+	std::vector<double> vValues( m_vSuperValueOffsets[nSuper], 0.0 );
+	std::vector<double> vUpdate( m_nMaxSuperBlock ), vScaled( m_nMaxSuperBlock );
+	std::vector<int> vMap(n), vHead(nSuper, -1), vNext(nSuper, -1), vPos(nSuper, 0);
+	typedef Eigen::Map<Eigen::MatrixXd> DenseMap;
+
+	bool bOK = true;
+	for ( int s = 0; s < nSuper && bOK; ++s ) {
+		int nFirst = m_vSuperStart[s], nCols = m_vSuperStart[s+1] - nFirst;
+		const int * pRows = &m_vSuperRows[ m_vSuperRowOffsets[s] ];
+		int nRows = m_vSuperRowOffsets[s+1] - m_vSuperRowOffsets[s];
+		double * pBlock = &vValues[ m_vSuperValueOffsets[s] ];
+		DenseMap block( pBlock, nRows, nCols );
+		for ( int i = 0; i < nRows; ++i )
+			vMap[ pRows[i] ] = i;
+
+		for ( int c = 0; c < nCols; ++c ) {
+			int j = nFirst + c;
+			for ( int q = m_vLowerOffsets[j]; q < m_vLowerOffsets[j+1]; ++q )
+				pBlock[ c*nRows + vMap[ m_vLowerRows[q] ] ] += pCValues[ m_vLowerSource[q] ];
+		}
+
+		// W = L_K D_K L_K1^T, where L_K1 are the rows of descendant K in the columns of s, and L_K all of its rows from there on.
+		// Only the lower triangle of W is subtracted from the block
+		int nK = vHead[s];
+		while ( nK != -1 ) {
+			int nNextK = vNext[nK];
+			int nKFirst = m_vSuperStart[nK], nKCols = m_vSuperStart[nK+1] - nKFirst;
+			const int * pKRows = &m_vSuperRows[ m_vSuperRowOffsets[nK] ];
+			int nKRows = m_vSuperRowOffsets[nK+1] - m_vSuperRowOffsets[nK];
+			const double * pKBlock = &vValues[ m_vSuperValueOffsets[nK] ];
+			int p1 = vPos[nK], p2 = p1;
+			while ( p2 < nKRows && pKRows[p2] < nFirst + nCols )
+				++p2;
+			int n1 = p2 - p1, n2 = nKRows - p1;
+
+			if ( (size_t)n1 * (size_t)n2 * (size_t)nKCols < 512 ) {
+				for ( int c = 0; c < n1; ++c ) {
+					double * pTarget = pBlock + (pKRows[p1+c] - nFirst) * nRows;
+					for ( int r = c; r < n2; ++r ) {
+						double fSum = 0;
+						for ( int k = 0; k < nKCols; ++k )
+							fSum += pKBlock[k*nKRows + p1+r] * pDiag[nKFirst+k] * pKBlock[k*nKRows + p1+c];
+						pTarget[ vMap[ pKRows[p1+r] ] ] -= fSum;
+					}
+				}
+			} else {
+				DenseMap scaled( &vScaled[0], n2, nKCols ), update( &vUpdate[0], n2, n1 );
+				DenseMap kblock( const_cast<double *>(pKBlock), nKRows, nKCols );
+				for ( int k = 0; k < nKCols; ++k )
+					scaled.col(k) = kblock.col(k).segment(p1, n2) * pDiag[nKFirst+k];
+				update.noalias() = scaled * kblock.block(p1, 0, n1, nKCols).transpose();
+				for ( int c = 0; c < n1; ++c ) {
+					double * pTarget = pBlock + (pKRows[p1+c] - nFirst) * nRows;
+					const double * pUpdate = &vUpdate[ c*n2 ];
+					for ( int r = c; r < n2; ++r )
+						pTarget[ vMap[ pKRows[p1+r] ] ] -= pUpdate[r];
+				}
+			}
+
+			vPos[nK] = p2;
+			if ( p2 < nKRows ) {
+				int nTarget = m_vColSuper[ pKRows[p2] ];
+				vNext[nK] = vHead[nTarget];
+				vHead[nTarget] = nK;
+			}
+			nK = nNextK;
+		}
+
+		bOK = FactorSupernode( pBlock, nRows, nCols, pDiag + nFirst, &vScaled[0] );
+		vPos[s] = nCols;
+		if ( nCols < nRows ) {
+			int nTarget = m_vColSuper[ pRows[nCols] ];
+			vNext[s] = vHead[nTarget];
+			vHead[nTarget] = s;
+		}
+	}
+
+	// below-diagonal part of each supernode column, into the compressed columns of L
+	if ( bOK ) {
+		const int * pLOffsets = m_matrix._outerIndexPtr();
+		double * pLValues = m_matrix._valuePtr();
+		for ( int s = 0; s < nSuper; ++s ) {
+			int nFirst = m_vSuperStart[s], nCols = m_vSuperStart[s+1] - nFirst;
+			int nRows = m_vSuperRowOffsets[s+1] - m_vSuperRowOffsets[s];
+			const double * pBlock = &vValues[ m_vSuperValueOffsets[s] ];
+			for ( int c = 0; c < nCols; ++c ) {
+				lgASSERT( pLOffsets[nFirst+c+1] - pLOffsets[nFirst+c] == nRows - c - 1 );
+				std::copy( pBlock + c*nRows + c+1, pBlock + (c+1)*nRows, pLValues + pLOffsets[nFirst+c] );
+			}
+		}
+	}
+	m_succeeded = bOK;
+	return bOK;
+}
+
+
+// dense LDL^T of the nCols x nCols diagonal block (the lower triangle of the first nCols rows), in panels of 32
+// columns. Each panel updates the columns to its right with one matrix product. The remaining rows are
+// B = L21 D L11^T, and are solved for L21 with L11. Narrow supernodes are factored with scalar loops over
+// all rows instead. pWork must have nCols*nCols entries
+bool EigenLDLT::FactorSupernode( double * pBlock, int nRows, int nCols, double * pDiag, double * pWork )
+{
+	typedef Eigen::Map<Eigen::MatrixXd> DenseMap;
+	DenseMap block( pBlock, nRows, nCols );
+	const int nPanel = 32;
+	bool bDense = ( nCols > 8 );
+	int nPanelRows = ( bDense ) ? nCols : nRows;
+	for ( int c0 = 0; c0 < nCols; c0 += nPanel ) {
+		int c1 = std::min( c0 + nPanel, nCols );
+		for ( int c = c0; c < c1; ++c ) {
+			double * pCol = pBlock + c*nRows;
+			double fD = pCol[c];
+			if ( fD == 0.0 )
+				return false;
+			pDiag[c] = fD;
+			for ( int c2 = c+1; c2 < c1; ++c2 ) {
+				double * pCol2 = pBlock + c2*nRows;
+				double fScale = pCol[c2] / fD;
+				for ( int r = c2; r < nPanelRows; ++r )
+					pCol2[r] -= pCol[r] * fScale;
+			}
+			for ( int r = c+1; r < nPanelRows; ++r )
+				pCol[r] /= fD;
+		}
+		if ( c1 < nCols ) {
+			DenseMap scaled( pWork, nCols - c1, c1 - c0 );
+			for ( int c = c0; c < c1; ++c )
+				scaled.col(c - c0) = block.col(c).segment(c1, nCols - c1) * pDiag[c];
+			block.block(c1, c1, nCols - c1, nCols - c1).noalias() -= scaled * block.block(c1, c0, nCols - c1, c1 - c0).transpose();
+		}
+	}
+
+	if ( bDense && nCols < nRows ) {
+		block.block(0, 0, nCols, nCols).transpose().triangularView<Eigen::UnitUpper>().solveInPlace<Eigen::OnTheRight>(
+			block.block(nCols, 0, nRows - nCols, nCols) );
+		for ( int c = 0; c < nCols; ++c )
+			block.col(c).segment(nCols, nRows - nCols) /= pDiag[c];
+	}
+	return true;
+}
+
+
+struct SparseLinearSolver::EigenFactor
+{
+	unsigned int nSize;
+	bool bCholesky;
+	// the LU factors are of the transpose of the matrix (which was given as CSR)
+	bool bTransposed;
+
+	// fill-reducing ordering, vPerm[k] is the row/column eliminated k'th
+	std::vector<unsigned int> vPerm;
+
+	// The ordering and the symbolic factorization only depend on the pattern of the matrix, which is kept
+	// to detect when they can be reused. Only the numeric phase is repeated for new values with the same pattern
+	bool bSymbolicValid;
+	bool bSymmetricLower;
+	std::vector<unsigned int> vPatternOffsets, vPatternIndices;
+
+	// Factor_Cholesky:  P A P^T = L D L^T. C holds the upper triangle of P A P^T, and vScatter[p] is the
+	// position in C of the matrix entry p (or -1 if it permutes below the diagonal)
+	EigenLDLT ldlt;
+	Eigen::SparseMatrix<double> C;
+	std::vector<int> vScatter;
+	std::vector<int> vInvPerm;
+	// zeros, for UpdateDiagonal()
+	std::vector<double> vUpdateWork;
+
+	// Factor_LU:  P A Q = L U, where Q is vPerm and P is vRowPerm (vRowPerm[k] is the row of pivot k).
+	// L is unit lower triangular with the 1 stored first in each column, the diagonal of U is stored last
+	std::vector<int> vRowPerm;
+	std::vector<int> vLOffsets, vLRows;
+	std::vector<double> vLValues;
+	std::vector<int> vUOffsets, vURows;
+	std::vector<double> vUValues;
+
+	std::vector<double> vWork;
+
+	EigenFactor() { nSize = 0; bCholesky = true; bTransposed = false; bSymbolicValid = false; bSymmetricLower = false; }
+
+	//! discard the factors and the symbolic analysis
+	void Clear();
+	//! discard the factors, but keep the ordering and symbolic analysis
+	void ClearNumeric();
+
+	bool MatchesPattern( const CompressedSparseMatrix & M, bool bCholeskyIn, bool bTransposedIn ) const;
+	//! store the pattern of M (in compressed columns) and analyze it for the current ordering
+	void Analyze( const CompressedSparseMatrix & M );
+
+	// the matrix is given as compressed columns, with the pattern passed to Analyze(). For Cholesky, these
+	// can be one triangle (a symmetric-lower matrix) or both
+	bool Factor_Cholesky( const double * pValues );
+	bool Factor_LU( const unsigned int * pOffsets, const unsigned int * pRows, const double * pValues );
+	void Solve( const double * pB, double * pX );
+	void Solve_Cholesky( const double * pB, double * pX );
+	void Solve_LU( const double * pB, double * pX );
+	void Solve_LUTransposed( const double * pB, double * pX );
+	size_t GetNonZeros() const;
+	size_t GetMemoryUsage() const;
+};
+
+
+
+SparseLinearSolver::SparseLinearSolver( gsi::SparseLinearSystem * pSystem )
+{
+	Initialize();
+	m_pSystem = pSystem;
+}
+
+SparseLinearSolver::SparseLinearSolver( const CompressedSparseMatrix * pMatrix )
+{
+	Initialize();
+	m_pMatrix = pMatrix;
+}
+
+void SparseLinearSolver::Initialize()
+{
+	m_pSystem = NULL;
+	m_pMatrix = NULL;
+	m_eBackend = s_eDefaultBackend;
+	m_eFactor = Factor_Cholesky;
+	m_eOrdering = Ordering_Automatic;
+	m_bStoreFactorization = false;
+	m_pTaucs = NULL;
+	m_pUmfpack = NULL;
+	m_bUmfpackFactorValid = false;
+	m_pMatrixSystem = NULL;
+	m_bMatrixSystemValid = false;
+	m_pEigen = NULL;
+	m_bEigenFactorValid = false;
+	m_nMaxFactorUpdates = 100;
+	m_nFactorUpdates = 0;
+}
+
+SparseLinearSolver::~SparseLinearSolver()
+{
+	delete m_pTaucs;
+	delete m_pUmfpack;
+	delete m_pMatrixSystem;
+	delete m_pEigen;
+}
+
+
+void SparseLinearSolver::SetMatrix( const CompressedSparseMatrix * pMatrix )
+{
+	lgASSERT( m_pSystem == NULL );
+	m_pMatrix = pMatrix;
+	OnMatrixChanged();
+}
+
+
+void SparseLinearSolver::SetDefaultBackend( Backend eBackend )
+{
+	s_eDefaultBackend = eBackend;
+}
+
+SparseLinearSolver::Backend SparseLinearSolver::GetDefaultBackend()
+{
+	return s_eDefaultBackend;
+}
+
+
+void SparseLinearSolver::SetBackend( Backend eBackend )
+{
+	if ( eBackend == m_eBackend )
+		return;
+	m_eBackend = eBackend;
+	ClearFactorization();
+}
+
+void SparseLinearSolver::SetFactorization( Factorization eFactor )
+{
+	if ( eFactor == m_eFactor )
+		return;
+	m_eFactor = eFactor;
+	ClearFactorization();
+}
+
+void SparseLinearSolver::SetOrdering( Ordering eOrdering )
+{
+	if ( eOrdering == m_eOrdering )
+		return;
+	m_eOrdering = eOrdering;
+	ClearFactorization();
+}
+
+void SparseLinearSolver::SetStoreFactorization( bool bEnable )
+{
+	m_bStoreFactorization = bEnable;
+	if ( m_pTaucs )
+		m_pTaucs->SetStoreFactorization(bEnable);
+	if ( ! bEnable )
+		ClearFactorization();
+}
+
+void SparseLinearSolver::OnMatrixChanged()
+{
+	if ( m_pTaucs )
+		m_pTaucs->OnMatrixChanged();
+	m_bUmfpackFactorValid = false;
+	m_bMatrixSystemValid = false;
+	if ( m_pEigen )
+		m_pEigen->ClearNumeric();
+	m_bEigenFactorValid = false;
+}
+
+bool SparseLinearSolver::UpdateDiagonal( unsigned int nCount, const unsigned int * pIndices, const double * pDeltas )
+{
+	bool bCanUpdate = ( m_eBackend == Backend_Eigen && m_bEigenFactorValid && m_pEigen->bCholesky );
+	if ( ! bCanUpdate || m_nFactorUpdates + nCount > m_nMaxFactorUpdates ) {
+		OnMatrixChanged();
+		return false;
+	}
+
+	EigenFactor & factor = *m_pEigen;
+	if ( factor.vUpdateWork.size() != factor.nSize )
+		factor.vUpdateWork.assign( factor.nSize, 0.0 );
+	for ( unsigned int k = 0; k < nCount; ++k ) {
+		if ( pDeltas[k] == 0 )
+			continue;
+		if ( pIndices[k] >= factor.nSize ) {
+			OnMatrixChanged();
+			return false;
+		}
+		if ( ! factor.ldlt.UpdateDiagonal( factor.vInvPerm[ pIndices[k] ], pDeltas[k], &factor.vUpdateWork[0] ) ) {
+			OnMatrixChanged();
+			return false;
+		}
+		++m_nFactorUpdates;
+	}
+	return true;
+}
+
+void SparseLinearSolver::SetMaxFactorUpdates( unsigned int nMax )
+{
+	m_nMaxFactorUpdates = nMax;
+}
+
+
+void SparseLinearSolver::ClearFactorization()
+{
+	OnMatrixChanged();
+	if ( m_pEigen )
+		m_pEigen->Clear();
+}
+
+
+bool SparseLinearSolver::Solve()
+{
+	if ( m_pSystem == NULL )
+		return false;
+	if ( m_eBackend == Backend_TAUCS )
+		return Solve_TAUCS();
+
+	if ( ! m_bEigenFactorValid ) {
+		if ( ! Factorize_Eigen() )
+			return false;
+	}
+	bool bOK = Solve_Eigen();
+	if ( ! m_bStoreFactorization ) {
+		m_pEigen->ClearNumeric();
+		m_bEigenFactorValid = false;
+	}
+	return bOK;
+}
+
+
+bool SparseLinearSolver::Solve( const double * pRHS, double * pSolution, unsigned int nRHS )
+{
+	if ( m_eBackend == Backend_TAUCS )
+		return Solve_TAUCS( pRHS, pSolution, nRHS );
+
+	if ( ! m_bEigenFactorValid ) {
+		if ( ! Factorize_Eigen() )
+			return false;
+	}
+	unsigned int nSize = m_pEigen->nSize;
+	for ( unsigned int k = 0; k < nRHS && nSize > 0; ++k )
+		m_pEigen->Solve( pRHS + (size_t)k*nSize, pSolution + (size_t)k*nSize );
+	if ( ! m_bStoreFactorization ) {
+		m_pEigen->ClearNumeric();
+		m_bEigenFactorValid = false;
+	}
+	return true;
+}
+
+
+size_t SparseLinearSolver::GetFactorNonZeros() const
+{
+	return ( m_bEigenFactorValid ) ? m_pEigen->GetNonZeros() : 0;
+}
+
+bool SparseLinearSolver::HasSymbolicFactorization() const
+{
+	return ( m_pEigen ) ? m_pEigen->bSymbolicValid : false;
+}
+
+size_t SparseLinearSolver::GetMemoryUsage() const
+{
+	return ( m_pEigen ) ? m_pEigen->GetMemoryUsage() : 0;
+}
+
+
+
+gsi::SparseLinearSystem * SparseLinearSolver::GetTaucsSystem()
+{
+	if ( m_pMatrix == NULL )
+		return m_pSystem;
+	if ( m_pMatrixSystem == NULL )
+		m_pMatrixSystem = new gsi::SparseLinearSystem();
+	if ( ! m_bMatrixSystemValid ) {
+		gsi::SparseMatrix M;
+		m_pMatrix->ToSparseMatrix(M);
+		m_pMatrixSystem->Resize( M.Rows(), M.Columns() );
+		m_pMatrixSystem->SetMatrix(M);
+		m_bMatrixSystemValid = true;
+	}
+	return m_pMatrixSystem;
+}
+
+
+bool SparseLinearSolver::Solve_TAUCS()
+{
+	if ( m_eFactor == Factor_Cholesky ) {
+		if ( m_pTaucs == NULL ) {
+			m_pTaucs = new gsi::Solver_TAUCS( GetTaucsSystem() );
+			m_pTaucs->SetSolverMode( gsi::Solver_TAUCS::TAUCS_LLT );
+			m_pTaucs->SetOrderingMode( gsi::Solver_TAUCS::TAUCS_METIS );
+			m_pTaucs->SetStoreFactorization( m_bStoreFactorization );
+		}
+		return m_pTaucs->Solve();
+	}
+
+	if ( ! m_bStoreFactorization ) {
+		gsi::Solver_UMFPACK solver( GetTaucsSystem() );
+		return solver.Solve();
+	}
+	if ( m_pUmfpack == NULL )
+		m_pUmfpack = new gsi::Solver_UMFPACK( GetTaucsSystem() );
+	if ( ! m_bUmfpackFactorValid ) {
+		if ( ! m_pUmfpack->Factorize() )
+			return false;
+		m_bUmfpackFactorValid = true;
+	}
+	return m_pUmfpack->Solve_Factorized();
+}
+
+bool SparseLinearSolver::Solve_TAUCS( const double * pRHS, double * pSolution, unsigned int nRHS )
+{
+	gsi::SparseLinearSystem * pSystem = GetTaucsSystem();
+	if ( pSystem == NULL )
+		return false;
+	unsigned int nRows = pSystem->Matrix().Rows(), nCols = pSystem->Matrix().Columns();
+	pSystem->ResizeRHS(nRHS);
+	for ( unsigned int k = 0; k < nRHS; ++k )
+		std::copy( pRHS + (size_t)k*nRows, pRHS + (size_t)(k+1)*nRows, pSystem->GetRHS(k).GetValues() );
+	if ( ! Solve_TAUCS() )
+		return false;
+	for ( unsigned int k = 0; k < nRHS; ++k ) {
+		const double * pValues = pSystem->GetSolution(k).GetValues();
+		std::copy( pValues, pValues + nCols, pSolution + (size_t)k*nCols );
+	}
+	return true;
+}
+
+
+
+
+/*
+ * Eigen backend
+ */
+
+
+// adjacency lists of the pattern of A + A^T (given as compressed rows or columns), without the diagonal
+static void BuildSymmetricGraph( unsigned int nSize, const unsigned int * pOffsets, const unsigned int * pRows,
+								 std::vector<unsigned int> & vGraphOffsets, std::vector<unsigned int> & vGraphNbrs )
+{
+	std::vector<unsigned int> vCount(nSize+1, 0);
+	for ( unsigned int c = 0; c < nSize; ++c ) {
+		for ( unsigned int p = pOffsets[c]; p < pOffsets[c+1]; ++p ) {
+			unsigned int r = pRows[p];
+			if ( r != c ) {
+				++vCount[r];
+				++vCount[c];
+			}
+		}
+	}
+	std::vector<unsigned int> vInsert(nSize+1, 0);
+	for ( unsigned int i = 0; i < nSize; ++i )
+		vInsert[i+1] = vInsert[i] + vCount[i];
+	vGraphNbrs.resize( vInsert[nSize] );
+	for ( unsigned int c = 0; c < nSize; ++c ) {
+		for ( unsigned int p = pOffsets[c]; p < pOffsets[c+1]; ++p ) {
+			unsigned int r = pRows[p];
+			if ( r != c ) {
+				vGraphNbrs[ vInsert[r]++ ] = c;
+				vGraphNbrs[ vInsert[c]++ ] = r;
+			}
+		}
+	}
+
+	// remove duplicates (from entries present in both A and A^T) and compact
+	vGraphOffsets.resize(nSize+1);
+	unsigned int nWrite = 0, nStart = 0;
+	for ( unsigned int i = 0; i < nSize; ++i ) {
+		unsigned int nEnd = nStart + vCount[i];
+		std::sort( vGraphNbrs.begin() + nStart, vGraphNbrs.begin() + nEnd );
+		vGraphOffsets[i] = nWrite;
+		for ( unsigned int p = nStart; p < nEnd; ++p ) {
+			if ( p == nStart || vGraphNbrs[p] != vGraphNbrs[p-1] )
+				vGraphNbrs[nWrite++] = vGraphNbrs[p];
+		}
+		nStart = nEnd;
+	}
+	vGraphOffsets[nSize] = nWrite;
+	vGraphNbrs.resize(nWrite);
+}
+
+
+
+// breadth-first search from nRoot, restricted to vertices v with vRange[v] == nRange. The reached vertices
+// are returned in vQueue in BFS order, and level l is vQueue[ vLevels[l] ... vLevels[l+1]-1 ]
+static unsigned int LevelStructure( unsigned int nRoot, const unsigned int * pOffsets, const unsigned int * pNbrs,
+									const std::vector<unsigned int> & vRange, unsigned int nRange,
+									std::vector<unsigned int> & vVisit, unsigned int nVisit,
+									std::vector<unsigned int> & vQueue, std::vector<unsigned int> & vLevels )
+{
+	unsigned int nHead = 0, nTail = 0;
+	vQueue[nTail++] = nRoot;
+	vVisit[nRoot] = nVisit;
+	vLevels.resize(0);
+	while ( nHead < nTail ) {
+		vLevels.push_back(nHead);
+		unsigned int nLevelEnd = nTail;
+		while ( nHead < nLevelEnd ) {
+			unsigned int v = vQueue[nHead++];
+			for ( unsigned int p = pOffsets[v]; p < pOffsets[v+1]; ++p ) {
+				unsigned int u = pNbrs[p];
+				if ( vRange[u] == nRange && vVisit[u] != nVisit ) {
+					vVisit[u] = nVisit;
+					vQueue[nTail++] = u;
+				}
+			}
+		}
+	}
+	vLevels.push_back(nTail);
+	return nTail;
+}
+
+
+void SparseLinearSolver::ComputeOrdering( unsigned int nVertices, const unsigned int * pOffsets, const unsigned int * pNbrs,
+										  std::vector<unsigned int> & vPerm )
+{
+	// subgraphs up to this size are ordered by reverse Cuthill-McKee instead of being split further
+	const unsigned int nLeafSize = 16;
+	// the separator level is the smallest level that has at least this fraction of the vertices on either side
+	const double fMinBalance = 0.35;
+
+	vPerm.resize(nVertices);
+	for ( unsigned int i = 0; i < nVertices; ++i )
+		vPerm[i] = i;
+
+	// Each pending range of vPerm holds the (unordered) vertices of a subgraph that will be eliminated at
+	// those positions. A subgraph is split at a level-set separator from a pseudo-peripheral vertex: the
+	// two parts go first, the separator last.
+	std::vector<unsigned int> vRange(nVertices, 0), vVisit(nVertices, 0), vLevel(nVertices, 0);
+	std::vector<unsigned int> vQueue(nVertices), vQueue2(nVertices), vLevels, vLevels2, vSeparator;
+	unsigned int nRange = 0, nVisit = 0;
+	const unsigned int nInSeparator = 0xFFFFFFFF;
+
+	std::vector< std::pair<unsigned int, unsigned int> > vPending;
+	if ( nVertices > 0 )
+		vPending.push_back( std::make_pair(0u, nVertices) );
+	while ( ! vPending.empty() ) {
+		unsigned int nBegin = vPending.back().first;
+		unsigned int nEnd = vPending.back().second;
+		vPending.pop_back();
+		unsigned int nCount = nEnd - nBegin;
+		if ( nCount < 2 )
+			continue;
+
+		++nRange;
+		for ( unsigned int k = nBegin; k < nEnd; ++k )
+			vRange[ vPerm[k] ] = nRange;
+
+		unsigned int nReached = LevelStructure( vPerm[nBegin], pOffsets, pNbrs, vRange, nRange, vVisit, ++nVisit, vQueue, vLevels );
+
+		// disconnected - split off the component of the first vertex
+		if ( nReached < nCount ) {
+			unsigned int nRest = nBegin + nReached;
+			vQueue2.assign( vPerm.begin() + nBegin, vPerm.begin() + nEnd );
+			for ( unsigned int k = 0; k < nCount; ++k ) {
+				if ( vVisit[ vQueue2[k] ] != nVisit )
+					vPerm[nRest++] = vQueue2[k];
+			}
+			std::copy( vQueue.begin(), vQueue.begin() + nReached, vPerm.begin() + nBegin );
+			vPending.push_back( std::make_pair(nBegin, nBegin + nReached) );
+			vPending.push_back( std::make_pair(nBegin + nReached, nEnd) );
+			continue;
+		}
+
+		// pseudo-peripheral vertex: restart from a minimum-degree vertex of the last level while the depth grows
+		for ( int nIter = 0; nIter < 8 && nCount > nLeafSize; ++nIter ) {
+			unsigned int nLast = (unsigned int)vLevels.size() - 2;
+			unsigned int nNext = vQueue[ vLevels[nLast] ], nMinDegree = 0xFFFFFFFF;
+			for ( unsigned int k = vLevels[nLast]; k < vLevels[nLast+1]; ++k ) {
+				unsigned int v = vQueue[k];
+				if ( pOffsets[v+1] - pOffsets[v] < nMinDegree ) {
+					nMinDegree = pOffsets[v+1] - pOffsets[v];
+					nNext = v;
+				}
+			}
+			LevelStructure( nNext, pOffsets, pNbrs, vRange, nRange, vVisit, ++nVisit, vQueue2, vLevels2 );
+			if ( vLevels2.size() <= vLevels.size() )
+				break;
+			vQueue.swap(vQueue2);
+			vLevels.swap(vLevels2);
+		}
+
+		unsigned int nDepth = (unsigned int)vLevels.size() - 1;
+		if ( nCount <= nLeafSize || nDepth < 3 ) {
+			for ( unsigned int k = 0; k < nCount; ++k )
+				vPerm[nEnd-1-k] = vQueue[k];
+			continue;
+		}
+
+		// separator level: the median level, or a smaller level that still gives a balanced split
+		unsigned int nMid = 1;
+		while ( nMid < nDepth-2 && vLevels[nMid+1] <= nCount/2 )
+			++nMid;
+		for ( unsigned int l = 1; l <= nDepth-2; ++l ) {
+			if ( vLevels[l] < fMinBalance*nCount || vLevels[l+1] > (1.0-fMinBalance)*nCount )
+				continue;
+			if ( vLevels[l+1] - vLevels[l] < vLevels[nMid+1] - vLevels[nMid] )
+				nMid = l;
+		}
+		for ( unsigned int l = nMid; l < nMid+2; ++l ) {
+			for ( unsigned int k = vLevels[l]; k < vLevels[l+1]; ++k )
+				vLevel[ vQueue[k] ] = l;
+		}
+
+		// separator vertices are the vertices of level nMid with a neighbour in level nMid+1.
+		// The other vertices of level nMid only connect to earlier levels.
+		vSeparator.resize(0);
+		for ( unsigned int k = vLevels[nMid]; k < vLevels[nMid+1]; ++k ) {
+			unsigned int v = vQueue[k];
+			for ( unsigned int p = pOffsets[v]; p < pOffsets[v+1]; ++p ) {
+				unsigned int u = pNbrs[p];
+				if ( vRange[u] == nRange && vLevel[u] == nMid+1 ) {
+					vSeparator.push_back(v);
+					break;
+				}
+			}
+		}
+		for ( unsigned int k = 0; k < vSeparator.size(); ++k )
+			vLevel[ vSeparator[k] ] = nInSeparator;
+
+		unsigned int nWrite = nBegin;
+		for ( unsigned int k = 0; k < vLevels[nMid]; ++k )
+			vPerm[nWrite++] = vQueue[k];
+		for ( unsigned int k = vLevels[nMid]; k < vLevels[nMid+1]; ++k ) {
+			if ( vLevel[ vQueue[k] ] != nInSeparator )
+				vPerm[nWrite++] = vQueue[k];
+		}
+		unsigned int nSplit = nWrite;
+		for ( unsigned int k = vLevels[nMid+1]; k < nCount; ++k )
+			vPerm[nWrite++] = vQueue[k];
+		unsigned int nSeparatorStart = nWrite;
+		for ( unsigned int k = 0; k < vSeparator.size(); ++k )
+			vPerm[nWrite++] = vSeparator[k];
+
+		// clear level tags, they are compared against nMid+1 in later subgraphs
+		for ( unsigned int k = vLevels[nMid]; k < vLevels[nMid+2]; ++k )
+			vLevel[ vQueue[k] ] = 0;
+
+		vPending.push_back( std::make_pair(nBegin, nSplit) );
+		vPending.push_back( std::make_pair(nSplit, nSeparatorStart) );
+	}
+}
+
+
+
+// buckets of variables by degree, for ComputeMinimumDegreeOrdering()
+struct MinimumDegreeLists
+{
+	std::vector<unsigned int> vHead, vNext, vPrev;
+	unsigned int nMinDegree;
+	static const unsigned int None = 0xFFFFFFFF;
+
+	MinimumDegreeLists( unsigned int nVertices ) : vHead(nVertices+1, None), vNext(nVertices), vPrev(nVertices), nMinDegree(0) {}
+	void Insert( unsigned int i, unsigned int nDegree ) {
+		vPrev[i] = None;
+		vNext[i] = vHead[nDegree];
+		if ( vHead[nDegree] != None )
+			vPrev[ vHead[nDegree] ] = i;
+		vHead[nDegree] = i;
+		nMinDegree = std::min(nMinDegree, nDegree);
+	}
+	void Remove( unsigned int i, unsigned int nDegree ) {
+		if ( vNext[i] != None )
+			vPrev[ vNext[i] ] = vPrev[i];
+		if ( vPrev[i] != None )
+			vNext[ vPrev[i] ] = vNext[i];
+		else
+			vHead[nDegree] = vNext[i];
+	}
+	unsigned int PopMin() {
+		while ( vHead[nMinDegree] == None )
+			++nMinDegree;
+		unsigned int i = vHead[nMinDegree];
+		Remove(i, nMinDegree);
+		return i;
+	}
+};
+
+
+void SparseLinearSolver::ComputeMinimumDegreeOrdering( unsigned int nVertices, const unsigned int * pOffsets, const unsigned int * pNbrs,
+													   std::vector<unsigned int> & vPerm )
+{
+	const unsigned int None = MinimumDegreeLists::None;
+	enum NodeState { Variable, Element, Dead };
+
+	// Quotient graph of the elimination: an eliminated vertex becomes an element, which stands for the clique of its
+	// uneliminated neighbours. For a variable i, vElements[i] are its adjacent elements and vAdjacent[i] its adjacent
+	// variables that are not covered by an element. For an element e, vAdjacent[e] is its variable list Le.
+	// Indistinguishable variables are merged into supervariables, vWeight[i] is the number of vertices in i.
+	// vDegree is the approximate external degree of a variable (weighted), and |Le| (weighted) of an element.
+	std::vector<unsigned char> vState(nVertices, Variable);
+	std::vector< std::vector<unsigned int> > vElements(nVertices), vAdjacent(nVertices);
+	std::vector<unsigned int> vWeight(nVertices, 1), vDegree(nVertices);
+	std::vector<unsigned int> vNextMember(nVertices, None), vLastMember(nVertices);
+	MinimumDegreeLists lists(nVertices);
+	for ( unsigned int i = 0; i < nVertices; ++i ) {
+		for ( unsigned int p = pOffsets[i]; p < pOffsets[i+1]; ++p ) {
+			if ( pNbrs[p] != i )
+				vAdjacent[i].push_back( pNbrs[p] );
+		}
+		vDegree[i] = (unsigned int)vAdjacent[i].size();
+		vLastMember[i] = i;
+		lists.Insert(i, vDegree[i]);
+	}
+
+	std::vector<unsigned int> vMark(nVertices, 0), vWMark(nVertices, 0), vCompareMark(nVertices, 0);
+	std::vector<int> vW(nVertices, 0);
+	std::vector<unsigned int> vExternal(nVertices, 0);
+	unsigned int nMark = 0, nWMark = 0, nCompareMark = 0;
+	std::vector<unsigned int> vLp;
+	std::vector< std::pair<unsigned int, unsigned int> > vHashes;
+
+	vPerm.resize(0);
+	vPerm.reserve(nVertices);
+	unsigned int nEliminated = 0;
+	while ( nEliminated < nVertices ) {
+		unsigned int nPivot = lists.PopMin();
+		for ( unsigned int v = nPivot; v != None; v = vNextMember[v] )
+			vPerm.push_back(v);
+		nEliminated += vWeight[nPivot];
+
+		// Lp, the variables adjacent to the pivot. Its elements are absorbed into the new element
+		vMark[nPivot] = ++nMark;
+		vLp.resize(0);
+		unsigned int nDegreeP = 0;
+		std::vector<unsigned int> & vPivotElements = vElements[nPivot];
+		for ( unsigned int k = 0; k < vPivotElements.size(); ++k ) {
+			unsigned int e = vPivotElements[k];
+			if ( vState[e] != Element )
+				continue;
+			for ( unsigned int j = 0; j < vAdjacent[e].size(); ++j ) {
+				unsigned int i = vAdjacent[e][j];
+				if ( vState[i] == Variable && vMark[i] != nMark ) {
+					vMark[i] = nMark;
+					vLp.push_back(i);
+					nDegreeP += vWeight[i];
+				}
+			}
+			vState[e] = Dead;
+			std::vector<unsigned int>().swap(vAdjacent[e]);
+		}
+		for ( unsigned int j = 0; j < vAdjacent[nPivot].size(); ++j ) {
+			unsigned int i = vAdjacent[nPivot][j];
+			if ( vState[i] == Variable && vMark[i] != nMark ) {
+				vMark[i] = nMark;
+				vLp.push_back(i);
+				nDegreeP += vWeight[i];
+			}
+		}
+		vState[nPivot] = Element;
+		std::vector<unsigned int>().swap(vPivotElements);
+
+		// replace the absorbed elements by the pivot, and remove the variables covered by it. A variable that
+		// is then only adjacent to the pivot element is indistinguishable from the pivot, and eliminated with it
+		for ( unsigned int k = 0; k < vLp.size(); ++k ) {
+			unsigned int i = vLp[k];
+			lists.Remove(i, vDegree[i]);
+			std::vector<unsigned int> & E = vElements[i];
+			unsigned int nKeep = 0;
+			for ( unsigned int j = 0; j < E.size(); ++j ) {
+				if ( vState[ E[j] ] == Element )
+					E[nKeep++] = E[j];
+			}
+			E.resize(nKeep);
+			E.push_back(nPivot);
+			std::vector<unsigned int> & A = vAdjacent[i];
+			nKeep = 0;
+			for ( unsigned int j = 0; j < A.size(); ++j ) {
+				if ( vState[ A[j] ] == Variable && vMark[ A[j] ] != nMark )
+					A[nKeep++] = A[j];
+			}
+			A.resize(nKeep);
+			if ( E.size() == 1 && A.empty() ) {
+				for ( unsigned int v = i; v != None; v = vNextMember[v] )
+					vPerm.push_back(v);
+				nEliminated += vWeight[i];
+				nDegreeP -= vWeight[i];
+				vState[i] = Dead;
+				std::vector<unsigned int>().swap(E);
+			}
+		}
+
+		// vW[e] = |Le \ Lp| for the other elements adjacent to Lp
+		++nWMark;
+		for ( unsigned int k = 0; k < vLp.size(); ++k ) {
+			unsigned int i = vLp[k];
+			if ( vState[i] != Variable )
+				continue;
+			const std::vector<unsigned int> & E = vElements[i];
+			for ( unsigned int j = 0; j < E.size(); ++j ) {
+				unsigned int e = E[j];
+				if ( e == nPivot )
+					continue;
+				if ( vWMark[e] != nWMark ) {
+					vWMark[e] = nWMark;
+					vW[e] = (int)vDegree[e];
+				}
+				vW[e] -= (int)vWeight[i];
+			}
+		}
+
+		// external degree outside Lp. Elements with Le inside Lp are absorbed into the pivot element (aggressive absorption)
+		vHashes.resize(0);
+		for ( unsigned int k = 0; k < vLp.size(); ++k ) {
+			unsigned int i = vLp[k];
+			if ( vState[i] != Variable )
+				continue;
+			unsigned int nExternal = 0;
+			std::vector<unsigned int> & E = vElements[i];
+			unsigned int nKeep = 0;
+			for ( unsigned int j = 0; j < E.size(); ++j ) {
+				unsigned int e = E[j];
+				if ( e != nPivot ) {
+					if ( vState[e] != Element )
+						continue;
+					if ( vW[e] <= 0 ) {
+						vState[e] = Dead;
+						std::vector<unsigned int>().swap(vAdjacent[e]);
+						continue;
+					}
+					nExternal += (unsigned int)vW[e];
+				}
+				E[nKeep++] = e;
+			}
+			E.resize(nKeep);
+			const std::vector<unsigned int> & A = vAdjacent[i];
+			for ( unsigned int j = 0; j < A.size(); ++j )
+				nExternal += vWeight[ A[j] ];
+			vExternal[i] = nExternal;
+			vHashes.push_back( std::make_pair(0u, i) );
+		}
+
+		// merge indistinguishable variables (same elements and adjacent variables) into supervariables. The element
+		// lists are compacted again first, elements may have been absorbed after a list was compacted above
+		for ( unsigned int k = 0; k < vHashes.size(); ++k ) {
+			unsigned int i = vHashes[k].second, nHash = 0;
+			std::vector<unsigned int> & E = vElements[i];
+			unsigned int nKeep = 0;
+			for ( unsigned int j = 0; j < E.size(); ++j ) {
+				if ( vState[ E[j] ] == Element ) {
+					E[nKeep++] = E[j];
+					nHash += E[j];
+				}
+			}
+			E.resize(nKeep);
+			for ( unsigned int j = 0; j < vAdjacent[i].size(); ++j )
+				nHash += vAdjacent[i][j];
+			vHashes[k].first = nHash;
+		}
+		std::sort( vHashes.begin(), vHashes.end() );
+		for ( unsigned int k = 0; k < vHashes.size(); ) {
+			unsigned int nRunEnd = k+1;
+			while ( nRunEnd < vHashes.size() && vHashes[nRunEnd].first == vHashes[k].first )
+				++nRunEnd;
+			for ( unsigned int a = k; a+1 < nRunEnd; ++a ) {
+				unsigned int i = vHashes[a].second;
+				if ( vState[i] != Variable )
+					continue;
+				const std::vector<unsigned int> & Ei = vElements[i];
+				++nCompareMark;
+				for ( unsigned int j = 0; j < Ei.size(); ++j )
+					vCompareMark[ Ei[j] ] = nCompareMark;
+				for ( unsigned int j = 0; j < vAdjacent[i].size(); ++j )
+					vCompareMark[ vAdjacent[i][j] ] = nCompareMark;
+				for ( unsigned int b = a+1; b < nRunEnd; ++b ) {
+					unsigned int i2 = vHashes[b].second;
+					if ( vState[i2] != Variable )
+						continue;
+					std::vector<unsigned int> & Ei2 = vElements[i2];
+					if ( Ei2.size() != Ei.size() || vAdjacent[i2].size() != vAdjacent[i].size() )
+						continue;
+					bool bSame = true;
+					for ( unsigned int j = 0; j < Ei2.size() && bSame; ++j )
+						bSame = ( vCompareMark[ Ei2[j] ] == nCompareMark );
+					for ( unsigned int j = 0; j < vAdjacent[i2].size() && bSame; ++j )
+						bSame = ( vCompareMark[ vAdjacent[i2][j] ] == nCompareMark );
+					if ( ! bSame )
+						continue;
+					vWeight[i] += vWeight[i2];
+					vWeight[i2] = 0;
+					vState[i2] = Dead;
+					vNextMember[ vLastMember[i] ] = i2;
+					vLastMember[i] = vLastMember[i2];
+					std::vector<unsigned int>().swap(Ei2);
+					std::vector<unsigned int>().swap(vAdjacent[i2]);
+				}
+			}
+			k = nRunEnd;
+		}
+
+		// new degrees, and the variable list of the pivot element
+		unsigned int nRemaining = nVertices - nEliminated;
+		std::vector<unsigned int> & vLe = vAdjacent[nPivot];
+		vLe.resize(0);
+		for ( unsigned int k = 0; k < vLp.size(); ++k ) {
+			unsigned int i = vLp[k];
+			if ( vState[i] != Variable )
+				continue;
+			unsigned int nInLp = nDegreeP - vWeight[i];
+			unsigned int nDegree = std::min( vDegree[i], vExternal[i] ) + nInLp;
+			nDegree = std::min( nDegree, nRemaining - vWeight[i] );
+			vDegree[i] = nDegree;
+			lists.Insert(i, nDegree);
+			vLe.push_back(i);
+		}
+		vDegree[nPivot] = nDegreeP;
+	}
+}
+
+
+size_t SparseLinearSolver::CountFactorNonZeros( unsigned int nVertices, const unsigned int * pOffsets, const unsigned int * pNbrs,
+												const std::vector<unsigned int> & vPerm )
+{
+	// row k of L is the set of vertices reached from the neighbours eliminated before k, walking up the
+	// elimination tree until a vertex already visited for row k
+	const unsigned int None = 0xFFFFFFFF;
+	std::vector<unsigned int> vInvPerm(nVertices), vParent(nVertices, None), vFlag(nVertices, None);
+	for ( unsigned int k = 0; k < nVertices; ++k )
+		vInvPerm[ vPerm[k] ] = k;
+	size_t nNonZeros = 0;
+	for ( unsigned int k = 0; k < nVertices; ++k ) {
+		unsigned int v = vPerm[k];
+		vFlag[k] = k;
+		for ( unsigned int p = pOffsets[v]; p < pOffsets[v+1]; ++p ) {
+			unsigned int i = vInvPerm[ pNbrs[p] ];
+			if ( i >= k )
+				continue;
+			for ( ; vFlag[i] != k; i = vParent[i] ) {
+				if ( vParent[i] == None )
+					vParent[i] = k;
+				++nNonZeros;
+				vFlag[i] = k;
+			}
+		}
+	}
+	return nNonZeros;
+}
+
+
+
+
+void SparseLinearSolver::EigenFactor::Clear()
+{
+	ClearNumeric();
+	nSize = 0;
+	bSymbolicValid = false;
+	std::vector<unsigned int>().swap(vPerm);
+	std::vector<unsigned int>().swap(vPatternOffsets);  std::vector<unsigned int>().swap(vPatternIndices);
+	ldlt.Clear();
+	C = Eigen::SparseMatrix<double>();
+	std::vector<int>().swap(vScatter);
+	std::vector<int>().swap(vInvPerm);
+	std::vector<double>().swap(vUpdateWork);
+	std::vector<double>().swap(vWork);
+}
+
+// The Cholesky factor is overwritten in place by the next numeric phase, so only the LU factors are freed
+void SparseLinearSolver::EigenFactor::ClearNumeric()
+{
+	std::vector<int>().swap(vRowPerm);
+	std::vector<int>().swap(vLOffsets);  std::vector<int>().swap(vLRows);  std::vector<double>().swap(vLValues);
+	std::vector<int>().swap(vUOffsets);  std::vector<int>().swap(vURows);  std::vector<double>().swap(vUValues);
+}
+
+
+bool SparseLinearSolver::EigenFactor::MatchesPattern( const CompressedSparseMatrix & M, bool bCholeskyIn, bool bTransposedIn ) const
+{
+	if ( ! bSymbolicValid || bCholesky != bCholeskyIn || bTransposed != bTransposedIn || bSymmetricLower != M.IsSymmetricLower() )
+		return false;
+	if ( M.Rows() != nSize || M.NonZeros() != vPatternIndices.size() )
+		return false;
+	return std::equal( vPatternOffsets.begin(), vPatternOffsets.end(), M.GetOffsets() )
+		&& std::equal( vPatternIndices.begin(), vPatternIndices.end(), M.GetIndices() );
+}
+
+
+void SparseLinearSolver::EigenFactor::Analyze( const CompressedSparseMatrix & M )
+{
+	const unsigned int * pOffsets = M.GetOffsets();
+	const unsigned int * pRows = M.GetIndices();
+	bSymmetricLower = M.IsSymmetricLower();
+	vPatternOffsets.assign( pOffsets, pOffsets + nSize + 1 );
+	vPatternIndices.assign( pRows, pRows + M.NonZeros() );
+	bSymbolicValid = true;
+
+	// the rows of the LU factors depend on the pivots, so only the ordering is reused
+	if ( ! bCholesky )
+		return;
+
+	int n = (int)nSize;
+	vInvPerm.resize(n);
+	for ( int k = 0; k < n; ++k )
+		vInvPerm[ vPerm[k] ] = k;
+
+	// upper triangle of P A P^T. If only one triangle of A is given, each entry is mirrored
+	// into the upper triangle, otherwise the entries that permute below the diagonal are skipped
+	C.resize(n, n);
+	int * pCOffsets = C._outerIndexPtr();
+	for ( int k = 0; k <= n; ++k )
+		pCOffsets[k] = 0;
+	for ( int c = 0; c < n; ++c ) {
+		int j = vInvPerm[c];
+		for ( unsigned int p = pOffsets[c]; p < pOffsets[c+1]; ++p ) {
+			int i = vInvPerm[ pRows[p] ];
+			if ( i <= j )
+				++pCOffsets[j+1];
+			else if ( bSymmetricLower )
+				++pCOffsets[i+1];
+		}
+	}
+	for ( int k = 0; k < n; ++k )
+		pCOffsets[k+1] += pCOffsets[k];
+	C.resizeNonZeros( pCOffsets[n] );
+	int * pCRows = C._innerIndexPtr();
+	vScatter.assign( M.NonZeros(), -1 );
+	std::vector<int> vInsert( pCOffsets, pCOffsets + n );
+	for ( int c = 0; c < n; ++c ) {
+		int j = vInvPerm[c];
+		for ( unsigned int p = pOffsets[c]; p < pOffsets[c+1]; ++p ) {
+			int i = vInvPerm[ pRows[p] ];
+			if ( i <= j ) {
+				pCRows[ vInsert[j] ] = i;
+				vScatter[p] = vInsert[j]++;
+			} else if ( bSymmetricLower ) {
+				pCRows[ vInsert[i] ] = j;
+				vScatter[p] = vInsert[i]++;
+			}
+		}
+	}
+
+	ldlt.Analyze(C);
+}
+
+
+bool SparseLinearSolver::EigenFactor::Factor_Cholesky( const double * pValues )
+{
+	// each entry of C comes from exactly one entry of the matrix
+	double * pCValues = C._valuePtr();
+	int nEntries = (int)vScatter.size();
+	for ( int p = 0; p < nEntries; ++p ) {
+		if ( vScatter[p] >= 0 )
+			pCValues[ vScatter[p] ] = pValues[p];
+	}
+	return ldlt.Factorize(C);
+}
+
+
+void SparseLinearSolver::EigenFactor::Solve( const double * pB, double * pX )
+{
+	if ( bCholesky )
+		Solve_Cholesky( pB, pX );
+	else if ( bTransposed )
+		Solve_LUTransposed( pB, pX );
+	else
+		Solve_LU( pB, pX );
+}
+
+
+void SparseLinearSolver::EigenFactor::Solve_Cholesky( const double * pB, double * pX )
+{
+	int n = (int)nSize;
+	const Eigen::SparseMatrix<double> & L = ldlt.L();
+	const int * pLOffsets = L._outerIndexPtr();
+	const int * pLRows = L._innerIndexPtr();
+	const double * pLValues = L._valuePtr();
+	const Eigen::VectorXd & D = ldlt.D();
+
+	double * x = &vWork[0];
+	for ( int k = 0; k < n; ++k )
+		x[k] = pB[ vPerm[k] ];
+	for ( int j = 0; j < n; ++j ) {
+		double xj = x[j];
+		if ( xj != 0 ) {
+			for ( int p = pLOffsets[j]; p < pLOffsets[j+1]; ++p )
+				x[ pLRows[p] ] -= pLValues[p] * xj;
+		}
+	}
+	for ( int j = 0; j < n; ++j )
+		x[j] /= D[j];
+	for ( int j = n-1; j >= 0; --j ) {
+		double xj = x[j];
+		for ( int p = pLOffsets[j]; p < pLOffsets[j+1]; ++p )
+			xj -= pLValues[p] * x[ pLRows[p] ];
+		x[j] = xj;
+	}
+	for ( int k = 0; k < n; ++k )
+		pX[ vPerm[k] ] = x[k];
+}
+
+
+
+// Left-looking LU (Gilbert-Peierls) with threshold partial pivoting, in the form used by CSparse's cs_lu.
+// Column k of L and U is a sparse triangular solve with the first k columns of L, whose non-zero
+// pattern is found by a depth-first search in the graph of L.
+bool SparseLinearSolver::EigenFactor::Factor_LU( const unsigned int * pOffsets, const unsigned int * pRows, const double * pValues )
+{
+	// the diagonal entry is used as pivot if it is at least this fraction of the largest candidate
+	const double fPivotTolerance = 0.1;
+
+	int n = (int)nSize;
+	vLOffsets.resize(n+1);  vUOffsets.resize(n+1);
+	size_t nGuess = 4 * (size_t)pOffsets[n] + (size_t)n;
+	vLRows.resize(0);  vLValues.resize(0);  vLRows.reserve(nGuess);  vLValues.reserve(nGuess);
+	vURows.resize(0);  vUValues.resize(0);  vURows.reserve(nGuess);  vUValues.reserve(nGuess);
+
+	// vPivotStep[row] is the step at which row was chosen as pivot, or -1
+	std::vector<int> vPivotStep(n, -1);
+	std::vector<double> x(n, 0.0);
+	std::vector<int> vReach(n), vStack(n), vStackPos(n), vMark(n, -1);
+
+	for ( int k = 0; k < n; ++k ) {
+		vLOffsets[k] = (int)vLRows.size();
+		vUOffsets[k] = (int)vURows.size();
+		int nCol = (int)vPerm[k];
+
+		// rows reachable in the graph of L from the non-zeros of A(:,nCol), in topological order
+		int nTop = n;
+		for ( unsigned int q = pOffsets[nCol]; q < pOffsets[nCol+1]; ++q ) {
+			int nStart = (int)pRows[q];
+			if ( vMark[nStart] == k )
+				continue;
+			int nHead = 0;
+			vStack[0] = nStart;
+			while ( nHead >= 0 ) {
+				int j = vStack[nHead];
+				int J = vPivotStep[j];
+				if ( vMark[j] != k ) {
+					vMark[j] = k;
+					vStackPos[nHead] = ( J < 0 ) ? 0 : vLOffsets[J];
+				}
+				int nEnd = ( J < 0 ) ? 0 : vLOffsets[J+1];
+				bool bDone = true;
+				for ( int p = vStackPos[nHead]; p < nEnd; ++p ) {
+					int i = vLRows[p];
+					if ( vMark[i] == k )
+						continue;
+					vStackPos[nHead] = p+1;
+					vStack[++nHead] = i;
+					bDone = false;
+					break;
+				}
+				if ( bDone ) {
+					--nHead;
+					vReach[--nTop] = j;
+				}
+			}
+		}
+
+		// x = L \ A(:,nCol)
+		for ( unsigned int q = pOffsets[nCol]; q < pOffsets[nCol+1]; ++q )
+			x[ pRows[q] ] = pValues[q];
+		for ( int t = nTop; t < n; ++t ) {
+			int j = vReach[t];
+			int J = vPivotStep[j];
+			if ( J < 0 )
+				continue;
+			double xj = x[j];
+			for ( int p = vLOffsets[J]+1; p < vLOffsets[J+1]; ++p )
+				x[ vLRows[p] ] -= vLValues[p] * xj;
+		}
+
+		// pivot
+		int nPivot = -1;
+		double fLargest = -1.0;
+		for ( int t = nTop; t < n; ++t ) {
+			int i = vReach[t];
+			if ( vPivotStep[i] < 0 ) {
+				double fAbs = fabs(x[i]);
+				if ( fAbs > fLargest ) {
+					fLargest = fAbs;
+					nPivot = i;
+				}
+			} else {
+				vURows.push_back( vPivotStep[i] );
+				vUValues.push_back( x[i] );
+			}
+		}
+		if ( nPivot < 0 || fLargest <= 0 )
+			return false;		// structurally or numerically singular
+		if ( vPivotStep[nCol] < 0 && vMark[nCol] == k && fabs(x[nCol]) >= fPivotTolerance * fLargest )
+			nPivot = nCol;
+
+		double fPivot = x[nPivot];
+		vURows.push_back(k);
+		vUValues.push_back(fPivot);
+		vPivotStep[nPivot] = k;
+		vLRows.push_back(nPivot);
+		vLValues.push_back(1.0);
+		for ( int t = nTop; t < n; ++t ) {
+			int i = vReach[t];
+			if ( vPivotStep[i] < 0 ) {
+				vLRows.push_back(i);
+				vLValues.push_back( x[i] / fPivot );
+			}
+			x[i] = 0;
+		}
+	}
+	vLOffsets[n] = (int)vLRows.size();
+	vUOffsets[n] = (int)vURows.size();
+
+	// release the unused reserve
+	std::vector<int>(vLRows).swap(vLRows);
+	std::vector<double>(vLValues).swap(vLValues);
+	std::vector<int>(vURows).swap(vURows);
+	std::vector<double>(vUValues).swap(vUValues);
+
+	// L row indices to pivot steps
+	size_t nLNonZeros = vLRows.size();
+	for ( size_t p = 0; p < nLNonZeros; ++p )
+		vLRows[p] = vPivotStep[ vLRows[p] ];
+	vRowPerm.resize(n);
+	for ( int i = 0; i < n; ++i )
+		vRowPerm[ vPivotStep[i] ] = i;
+	return true;
+}
+
+
+void SparseLinearSolver::EigenFactor::Solve_LU( const double * pB, double * pX )
+{
+	int n = (int)nSize;
+	double * x = &vWork[0];
+	for ( int k = 0; k < n; ++k )
+		x[k] = pB[ vRowPerm[k] ];
+	for ( int j = 0; j < n; ++j ) {
+		double xj = x[j];
+		if ( xj != 0 ) {
+			for ( int p = vLOffsets[j]+1; p < vLOffsets[j+1]; ++p )
+				x[ vLRows[p] ] -= vLValues[p] * xj;
+		}
+	}
+	for ( int j = n-1; j >= 0; --j ) {
+		x[j] /= vUValues[ vUOffsets[j+1]-1 ];
+		double xj = x[j];
+		if ( xj != 0 ) {
+			for ( int p = vUOffsets[j]; p < vUOffsets[j+1]-1; ++p )
+				x[ vURows[p] ] -= vUValues[p] * xj;
+		}
+	}
+	for ( int k = 0; k < n; ++k )
+		pX[ vPerm[k] ] = x[k];
+}
+
+
+// The factors are P A^T Q = L U, so A = Q U^T L^T P. Columns of U and L are rows of U^T and L^T.
+void SparseLinearSolver::EigenFactor::Solve_LUTransposed( const double * pB, double * pX )
+{
+	int n = (int)nSize;
+	double * x = &vWork[0];
+	for ( int k = 0; k < n; ++k )
+		x[k] = pB[ vPerm[k] ];
+	for ( int j = 0; j < n; ++j ) {
+		double xj = x[j];
+		for ( int p = vUOffsets[j]; p < vUOffsets[j+1]-1; ++p )
+			xj -= vUValues[p] * x[ vURows[p] ];
+		x[j] = xj / vUValues[ vUOffsets[j+1]-1 ];
+	}
+	for ( int j = n-1; j >= 0; --j ) {
+		double xj = x[j];
+		for ( int p = vLOffsets[j]+1; p < vLOffsets[j+1]; ++p )
+			xj -= vLValues[p] * x[ vLRows[p] ];
+		x[j] = xj;
+	}
+	for ( int k = 0; k < n; ++k )
+		pX[ vRowPerm[k] ] = x[k];
+}
+
+
+size_t SparseLinearSolver::EigenFactor::GetNonZeros() const
+{
+	return (size_t)ldlt.L().nonZeros() + vLRows.size() + vURows.size();
+}
+
+size_t SparseLinearSolver::EigenFactor::GetMemoryUsage() const
+{
+	const Eigen::SparseMatrix<double> & L = ldlt.L();
+	size_t nBytes = vPerm.capacity() * sizeof(unsigned int) + vWork.capacity() * sizeof(double);
+	nBytes += (vPatternOffsets.capacity() + vPatternIndices.capacity()) * sizeof(unsigned int) + (vScatter.capacity() + vInvPerm.capacity()) * sizeof(int);
+	nBytes += (size_t)C.nonZeros() * (sizeof(int) + sizeof(double)) + (size_t)(C.cols()+1) * sizeof(int) + vUpdateWork.capacity() * sizeof(double);
+	nBytes += (size_t)L.nonZeros() * (sizeof(int) + sizeof(double)) + (size_t)(L.cols()+1) * sizeof(int);
+	nBytes += (size_t)ldlt.D().size() * (sizeof(double) + 2*sizeof(int)) + ldlt.GetSymbolicMemoryUsage();
+	nBytes += (vRowPerm.capacity() + vLOffsets.capacity() + vLRows.capacity() + vUOffsets.capacity() + vURows.capacity()) * sizeof(int);
+	nBytes += (vLValues.capacity() + vUValues.capacity()) * sizeof(double);
+	return nBytes;
+}
+
+
+
+bool SparseLinearSolver::Factorize_Eigen()
+{
+	if ( m_pEigen == NULL )
+		m_pEigen = new EigenFactor();
+	EigenFactor & factor = *m_pEigen;
+	factor.ClearNumeric();
+	m_bEigenFactorValid = false;
+
+	// a gsi matrix is copied to compressed columns, a CompressedSparseMatrix is used directly
+	CompressedSparseMatrix copy;
+	const CompressedSparseMatrix * pMatrix = m_pMatrix;
+	if ( pMatrix == NULL ) {
+		if ( m_pSystem == NULL )
+			return false;
+		copy.Build( m_pSystem->Matrix(), CompressedSparseMatrix::ColumnMajor );
+		pMatrix = &copy;
+	}
+	unsigned int nSize = pMatrix->Rows();
+	if ( pMatrix->Columns() != nSize )
+		return false;
+
+	if ( nSize == 0 ) {
+		factor.Clear();
+		m_bEigenFactorValid = true;
+		return true;
+	}
+
+	// CSR arrays are the CSC arrays of the transpose, which is the same matrix if it is symmetric.
+	// LU needs both triangles of a symmetric-lower matrix
+	bool bCholesky = ( m_eFactor == Factor_Cholesky );
+	bool bTransposed = ( ! bCholesky && pMatrix->GetStorage() == CompressedSparseMatrix::RowMajor && ! pMatrix->IsSymmetricLower() );
+	CompressedSparseMatrix expanded;
+	if ( ! bCholesky && pMatrix->IsSymmetricLower() ) {
+		pMatrix->ExpandSymmetric(expanded);
+		pMatrix = &expanded;
+	}
+
+	// reorder and analyze only if the pattern changed since the last factorization
+	if ( ! factor.MatchesPattern( *pMatrix, bCholesky, bTransposed ) ) {
+		factor.Clear();
+		factor.bCholesky = bCholesky;
+		factor.bTransposed = bTransposed;
+		std::vector<unsigned int> vGraphOffsets, vGraphNbrs;
+		BuildSymmetricGraph( nSize, pMatrix->GetOffsets(), pMatrix->GetIndices(), vGraphOffsets, vGraphNbrs );
+		const unsigned int * pNbrs = (vGraphNbrs.empty()) ? NULL : &vGraphNbrs[0];
+		if ( m_eOrdering == Ordering_MinimumDegree )
+			ComputeMinimumDegreeOrdering( nSize, &vGraphOffsets[0], pNbrs, factor.vPerm );
+		else
+			ComputeOrdering( nSize, &vGraphOffsets[0], pNbrs, factor.vPerm );
+		if ( m_eOrdering == Ordering_Automatic ) {
+			std::vector<unsigned int> vMinDegree;
+			ComputeMinimumDegreeOrdering( nSize, &vGraphOffsets[0], pNbrs, vMinDegree );
+			if ( CountFactorNonZeros( nSize, &vGraphOffsets[0], pNbrs, vMinDegree ) < CountFactorNonZeros( nSize, &vGraphOffsets[0], pNbrs, factor.vPerm ) )
+				factor.vPerm.swap(vMinDegree);
+		}
+		factor.nSize = nSize;
+		factor.Analyze( *pMatrix );
+	}
+
+	bool bOK = ( factor.bCholesky ) ?
+		factor.Factor_Cholesky( pMatrix->GetValues() ) : 
+		factor.Factor_LU( pMatrix->GetOffsets(), pMatrix->GetIndices(), pMatrix->GetValues() );
+	if ( ! bOK ) {
+		factor.ClearNumeric();
+		return false;
+	}
+	factor.vWork.resize(nSize);
+	m_nFactorUpdates = 0;
+	m_bEigenFactorValid = true;
+	return true;
+}
+
+
+bool SparseLinearSolver::Solve_Eigen()
+{
+	EigenFactor & factor = *m_pEigen;
+	unsigned int nSize = factor.nSize;
+	unsigned int nRHS = m_pSystem->NumRHS();
+	for ( unsigned int k = 0; k < nRHS; ++k ) {
+		gsi::Vector & vSolution = m_pSystem->GetSolution(k);
+		if ( vSolution.Size() != nSize )
+			vSolution.Resize(nSize);
+		if ( nSize == 0 )
+			continue;
+		factor.Solve( m_pSystem->GetRHS(k).GetValues(), vSolution.GetValues() );
+	}
+	return true;
+}
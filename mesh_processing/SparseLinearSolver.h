@@ -0,0 +1,154 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "config.h"
+#include <vector>
+
+
+// predecl to avoid include
+namespace gsi {
+	class SparseLinearSystem;
+	class Solver_TAUCS;
+	class Solver_UMFPACK;
+};
+
+
+namespace rms {
+
+class CompressedSparseMatrix;
+
+
+/*
+ * Direct solver for a gsi::SparseLinearSystem or a CompressedSparseMatrix. Backend_TAUCS (the default) uses
+ * gsi::Solver_TAUCS (Cholesky) or gsi::Solver_UMFPACK (LU). Backend_Eigen is an experimental in-tree
+ * supernodal LDL^T / left-looking LU on external/eigen, with a fill-reducing ordering (see SetOrdering()).
+ *
+ * With SetStoreFactorization(true) the factorization is kept until OnMatrixChanged(). Only Backend_Eigen
+ * keeps the symbolic factorization across OnMatrixChanged() (a matrix with the same pattern is only refactored
+ * numerically) and updates a stored factorization in UpdateDiagonal(). Backend_TAUCS always refactors from scratch.
+ */
+class SparseLinearSolver
+{
+public:
+	enum Backend {
+		Backend_TAUCS,
+		Backend_Eigen
+	};
+	enum Factorization {
+		Factor_Cholesky,		// symmetric positive definite matrices (LL^T in TAUCS, LDL^T in Eigen)
+		Factor_LU				// any non-singular matrix
+	};
+	enum Ordering {
+		Ordering_Automatic,			// compute both orderings, and use the one with fewer non-zeros in L
+		Ordering_NestedDissection,
+		Ordering_MinimumDegree		// approximate minimum degree
+	};
+
+	SparseLinearSolver( gsi::SparseLinearSystem * pSystem );
+	//! pMatrix is not copied, and must not change (or be deleted) while the solver uses it
+	SparseLinearSolver( const CompressedSparseMatrix * pMatrix );
+	~SparseLinearSolver();
+
+	//! replace the compressed matrix (invalidates the stored factorization, the symbolic one is reused if the pattern matches)
+	void SetMatrix( const CompressedSparseMatrix * pMatrix );
+
+	void SetBackend( Backend eBackend );
+	Backend GetBackend() const { return m_eBackend; }
+
+	void SetFactorization( Factorization eFactor );
+	Factorization GetFactorization() const { return m_eFactor; }
+
+	//! fill-reducing ordering of the Eigen backend. Ordering_Automatic unless changed
+	void SetOrdering( Ordering eOrdering );
+	Ordering GetOrdering() const { return m_eOrdering; }
+
+	void SetStoreFactorization( bool bEnable );
+	bool GetStoreFactorization() const { return m_bStoreFactorization; }
+
+	//! notify that the matrix values changed, invalidating the stored factorization. The pattern may also have
+	//! changed, this is detected when the matrix is factored
+	void OnMatrixChanged();
+
+	//! notify that pDeltas[k] was added to diagonal entry pIndices[k] of the matrix, for k < nCount. A stored Eigen
+	//! Cholesky factorization is updated in place, with one rank-1 update (or downdate, for a negative delta) per entry.
+	//! Otherwise, or once GetMaxFactorUpdates() updates were applied since the last factorization, or if an index is
+	//! outside the factored matrix, or if a downdate fails, this is the same as OnMatrixChanged(). Returns true if the
+	//! factorization was updated
+	bool UpdateDiagonal( unsigned int nCount, const unsigned int * pIndices, const double * pDeltas );
+
+	//! rank-1 updates allowed before UpdateDiagonal() refactors instead, to limit accumulated rounding error. Default is 100
+	void SetMaxFactorUpdates( unsigned int nMax );
+	unsigned int GetMaxFactorUpdates() const { return m_nMaxFactorUpdates; }
+
+	//! factors the matrix if necessary and solves for all right-hand sides of the system.
+	//! Returns false if the factorization failed (eg zero pivot), or if the solver has no gsi::SparseLinearSystem
+	bool Solve();
+
+	//! factors the matrix if necessary and solves for nRHS right-hand sides stored one after the other in pRHS,
+	//! with the solutions stored the same way in pSolution. With a gsi::SparseLinearSystem and the TAUCS backend,
+	//! the RHS and solution vectors of the system are overwritten
+	bool Solve( const double * pRHS, double * pSolution, unsigned int nRHS = 1 );
+
+	//! non-zeros in the Eigen backend factors (L, or L and U), or 0 if there is no stored factorization
+	size_t GetFactorNonZeros() const;
+	//! true if the Eigen backend has an ordering and symbolic factorization that the next factorization can reuse
+	bool HasSymbolicFactorization() const;
+	//! bytes used by the Eigen backend factorization (ordering, factors and workspace)
+	size_t GetMemoryUsage() const;
+
+	//! backend of new solvers. Backend_TAUCS unless changed
+	static void SetDefaultBackend( Backend eBackend );
+	static Backend GetDefaultBackend();
+
+	//! nested dissection ordering of a symmetric graph given as CSR adjacency lists (self-loops are ignored).
+	//! vPerm[k] is the vertex that is eliminated k'th
+	static void ComputeOrdering( unsigned int nVertices, const unsigned int * pOffsets, const unsigned int * pNbrs,
+								 std::vector<unsigned int> & vPerm );
+	//! approximate minimum degree ordering (Amestoy, Davis and Duff) of a symmetric graph, arguments as in ComputeOrdering()
+	static void ComputeMinimumDegreeOrdering( unsigned int nVertices, const unsigned int * pOffsets, const unsigned int * pNbrs,
+											  std::vector<unsigned int> & vPerm );
+	//! number of non-zeros below the diagonal of the Cholesky factor of the graph, when eliminated in the order vPerm
+	static size_t CountFactorNonZeros( unsigned int nVertices, const unsigned int * pOffsets, const unsigned int * pNbrs,
+									   const std::vector<unsigned int> & vPerm );
+
+protected:
+	gsi::SparseLinearSystem * m_pSystem;
+	const CompressedSparseMatrix * m_pMatrix;
+	Backend m_eBackend;
+	Factorization m_eFactor;
+	Ordering m_eOrdering;
+	bool m_bStoreFactorization;
+	void Initialize();
+
+	// discard the stored factorization, including the symbolic factorization
+	void ClearFactorization();
+
+	gsi::Solver_TAUCS * m_pTaucs;
+	gsi::Solver_UMFPACK * m_pUmfpack;
+	bool m_bUmfpackFactorValid;
+	bool Solve_TAUCS();
+	bool Solve_TAUCS( const double * pRHS, double * pSolution, unsigned int nRHS );
+
+	// copy of m_pMatrix for the TAUCS backend
+	gsi::SparseLinearSystem * m_pMatrixSystem;
+	bool m_bMatrixSystemValid;
+	gsi::SparseLinearSystem * GetTaucsSystem();
+
+	// Eigen backend data is defined in the .cpp, so that Eigen is only included there
+	struct EigenFactor;
+	EigenFactor * m_pEigen;
+	bool m_bEigenFactorValid;
+	unsigned int m_nMaxFactorUpdates;
+	unsigned int m_nFactorUpdates;
+	bool Factorize_Eigen();
+	bool Solve_Eigen();
+
+	static Backend s_eDefaultBackend;
+};
+
+
+
+}   // end namespace rms
@@ -0,0 +1,346 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "ExpMapBatch.h"
+#include "rmsdebug.h"
+#include <limits>
+
+using namespace rms;
+
+
+ExpMapBatch::ExpMapBatch()
+{
+	m_pGenerator = NULL;
+	m_nParticles = 0;
+	m_pPositions = NULL;
+	m_pNormals = NULL;
+	m_pTangents = NULL;
+	m_pNbrOffsets = NULL;
+	m_pNbrs = NULL;
+	m_bUseUpwindAveraging = false;
+	m_bUseVectorizedPropagation = true;
+	m_bEnableSquareCulling = false;
+	m_bUseClipPoly = false;
+	m_fMaxEdgeLength = 0.0f;
+}
+
+ExpMapBatch::~ExpMapBatch()
+{
+}
+
+
+void ExpMapBatch::Clear()
+{
+	m_pGenerator = NULL;
+	m_nParticles = 0;
+	m_pPositions = NULL;
+	m_pNormals = NULL;
+	m_pTangents = NULL;
+	m_pNbrOffsets = NULL;
+	m_pNbrs = NULL;
+}
+
+
+void ExpMapBatch::Initialize( ExpMapGenerator & expmapgen )
+{
+	Clear();
+	m_pGenerator = &expmapgen;
+
+	// force neighbour list (and smoothed normal) computation for all particles
+	expmapgen.InitializeNeighbourLists();
+
+	m_bUseUpwindAveraging = expmapgen.m_bUseUpwindAveraging;
+	m_bUseVectorizedPropagation = expmapgen.m_bUseVectorizedPropagation;
+	m_bEnableSquareCulling = expmapgen.m_bEnableSquareCulling;
+	m_bUseClipPoly = expmapgen.m_bUseClipPoly;
+	m_ClipPoly.ClearVertices();
+	m_ClipPoly.AppendVertices( expmapgen.m_ClipPoly.Vertices() );
+	m_fMaxEdgeLength = expmapgen.m_fMaxEdgeLength;
+
+	m_nParticles = expmapgen.m_nParticles;
+	m_pPositions = expmapgen.m_pPositions;
+	m_pNormals = expmapgen.m_pNormals;
+	m_pTangents = expmapgen.m_pTangents;
+	m_pNbrOffsets = expmapgen.m_pNbrOffsets;
+	m_pNbrs = expmapgen.m_pNbrs;
+}
+
+
+
+void ExpMapBatch::Compute( const std::vector<Frame3f> & vSeeds, float fStopDistance, unsigned int nMaxCount, 
+						   std::vector<ExpMapUVSet> & vResults )
+{
+	int nSeeds = (int)vSeeds.size();
+	vResults.resize( nSeeds );
+	if ( m_pGenerator == NULL || nSeeds == 0 )
+		return;
+
+	// seed neighbours and frames use the generator's mesh and BV tree queries, so are found serially
+	std::vector<Seed> vSeedData;
+	vSeedData.reserve( nSeeds );
+	std::vector<unsigned int> vSeedNbrs;
+	std::vector<unsigned int> vNbrs;
+	for ( int i = 0; i < nSeeds; ++i ) {
+		const Wml::Vector3f & vPosition = vSeeds[i].Origin();
+		m_pGenerator->FindSeedNeighbours( vPosition, vNbrs );
+		Wml::Vector3f vNormal( vSeeds[i].Z() );
+		Frame3f vFrame( m_pGenerator->ComputeSeedFrame( vPosition, vNormal, vNbrs, &vSeeds[i] ) );
+
+		unsigned int nNbrBegin = (unsigned int)vSeedNbrs.size();
+		vSeedNbrs.insert( vSeedNbrs.end(), vNbrs.begin(), vNbrs.end() );
+		Seed seed = { vFrame, vNormal, nNbrBegin, (unsigned int)vSeedNbrs.size() };
+		vSeedData.push_back( seed );
+	}
+	if ( vSeedNbrs.empty() )
+		vSeedNbrs.push_back(0);
+
+	#pragma omp parallel
+	{
+		Query q;
+		InitializeQuery(q);
+		q.pSeedNbrs = &vSeedNbrs[0];
+
+		#pragma omp for schedule(dynamic,1)
+		for ( int i = 0; i < nSeeds; ++i ) {
+			q.pSeed = &vSeedData[i];
+			ComputeSeed( q, fStopDistance, nMaxCount, vResults[i] );
+		}
+	}
+}
+
+
+
+void ExpMapBatch::InitializeQuery( Query & q )
+{
+	ExpMapParticle init;
+	init.Clear();
+	q.vParticles.resize( m_nParticles + 1, init );
+	q.queue.SetParticles( &q.vParticles[0] );
+	q.pSeed = NULL;
+	q.pSeedNbrs = NULL;
+}
+
+
+// this is ExpMapGenerator::ComputeExpMap() on the shared arrays
+void ExpMapBatch::ComputeSeed( Query & q, float fStopDistance, unsigned int nMaxCount, ExpMapUVSet & result )
+{
+	unsigned int nSeed = m_nParticles;
+	ExpMapParticle & seed = q.vParticles[nSeed];
+	seed.SurfaceDistance() = 0.0f;
+	seed.SurfaceVector() = Wml::Vector2f::ZERO;
+	seed.SetState( ExpMapParticle::Frozen );
+
+	q.vFrozen.resize(0);
+	UpdateNeighbours( q, nSeed );
+
+	float fStopDistSquare = fStopDistance / (float)sqrt(2.0f);
+	unsigned int nTouched = 0;
+	while ( ! q.queue.empty() ) {
+
+		if ( fStopDistance == std::numeric_limits<float>::max() && nTouched >= nMaxCount )
+			break;
+
+		unsigned int nFront = q.queue.Pop();
+		ExpMapParticle & front = q.vParticles[nFront];
+		front.SetState( ExpMapParticle::Frozen );
+		q.vFrozen.push_back( nFront );
+
+		if ( m_bUseUpwindAveraging ) 
+			PropagateFrameFromNearest_Average( q, nFront );
+		else
+			PropagateFrameFromNearest( q, nFront );
+
+		if ( front.SurfaceDistance() > fStopDistance && nTouched >= nMaxCount )
+			continue;
+
+		if ( m_bEnableSquareCulling ) {
+			if ( (float)fabs(front.SurfaceVector().X()) > fStopDistSquare || 
+				 (float)fabs(front.SurfaceVector().Y()) > fStopDistSquare )
+				continue;
+		} 
+
+		if ( m_bUseClipPoly ) {
+			bool bIsInside = m_ClipPoly.IsInside( front.SurfaceVector() );
+			for ( unsigned int k = m_pNbrOffsets[nFront]; ! bIsInside && k < m_pNbrOffsets[nFront+1]; ++k ) {
+				const ExpMapParticle & nbr = q.vParticles[ m_pNbrs[k] ];
+				if ( nbr.State() == ExpMapParticle::Frozen && m_ClipPoly.IsInside( nbr.SurfaceVector() ) )
+					bIsInside = true;
+			}
+			if ( ! bIsInside )
+				continue;
+		}
+
+		UpdateNeighbours( q, nFront );
+		++nTouched;
+	}
+
+	// frozen particles are the result, in the order that they were frozen
+	size_t nFrozen = q.vFrozen.size();
+	result.vIDs.resize( nFrozen );
+	result.vU.resize( nFrozen );
+	result.vV.resize( nFrozen );
+	for ( unsigned int i = 0; i < nFrozen; ++i ) {
+		const ExpMapParticle & particle = q.vParticles[ q.vFrozen[i] ];
+		result.vIDs[i] = q.vFrozen[i];
+		result.vU[i] = particle.SurfaceVector().X();
+		result.vV[i] = particle.SurfaceVector().Y();
+	}
+
+	// reset touched particles and heap for next query
+	size_t nTouchedCount = q.vTouched.size();
+	for ( unsigned int i = 0; i < nTouchedCount; ++i )
+		q.vParticles[ q.vTouched[i] ].Clear();
+	q.vParticles[ m_nParticles ].Clear();
+	q.vTouched.resize(0);
+	q.queue.Clear();
+}
+
+
+
+void ExpMapBatch::UpdateNeighbours( Query & q, unsigned int nParticle )
+{
+	const unsigned int * pNbrs;
+	unsigned int nNbrs;
+	if ( nParticle == m_nParticles ) {
+		pNbrs = q.pSeedNbrs + q.pSeed->nNbrBegin;
+		nNbrs = q.pSeed->nNbrEnd - q.pSeed->nNbrBegin;
+	} else {
+		pNbrs = m_pNbrs + m_pNbrOffsets[nParticle];
+		nNbrs = m_pNbrOffsets[nParticle+1] - m_pNbrOffsets[nParticle];
+	}
+	if ( nNbrs == 0 ) lgBreakToDebugger();
+
+	const Wml::Vector3f & vPosition = Position( q, nParticle );
+	float fDistance = q.vParticles[nParticle].SurfaceDistance();
+	for ( unsigned int k = 0; k < nNbrs; ++k ) {
+		unsigned int nNbr = pNbrs[k];
+		ExpMapParticle & nbr = q.vParticles[nNbr];
+		if ( nbr.State() == ExpMapParticle::Frozen )
+			continue;
+
+		float fSurfDist = (vPosition - m_pPositions[nNbr]).Length() + fDistance;
+		bool bUpdated = false;
+		if ( fSurfDist < nbr.SurfaceDistance() ) {
+			nbr.Nearest() = nParticle;
+			nbr.SurfaceDistance() = fSurfDist;
+			bUpdated = true;
+		}
+
+		if ( nbr.State() != ExpMapParticle::Active ) {
+			nbr.SetState( ExpMapParticle::Active );
+			q.vTouched.push_back( nNbr );
+			q.queue.Insert( nNbr );
+		} else if ( bUpdated ) {
+			q.queue.DecreaseKey( nNbr );
+		}
+	}
+}
+
+
+
+void ExpMapBatch::ComputePropagation( Query & q, unsigned int nCenter, unsigned int nParticle, 
+									  Wml::Vector2f & vSurfaceVector )
+{
+	ExtPlane3f vTangentPlane;
+	Frame3f vCenterWorldFrame;
+	Wml::Matrix2f matFrameRotate;
+	if ( nCenter == m_nParticles )
+		ExpMapGenerator::PrecomputePropagationData( q.pSeed->vFrame.Origin(), q.pSeed->vNormal, q.pSeed->vFrame,
+			q.pSeed->vFrame, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+	else
+		ExpMapGenerator::PrecomputePropagationData( m_pPositions[nCenter], m_pNormals[nCenter], 
+			ExpMapGenerator::MakeFrame( m_pPositions[nCenter], m_pNormals[nCenter], m_pTangents[nCenter] ),
+			q.pSeed->vFrame, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+	vSurfaceVector = ExpMapGenerator::ComputeSurfaceVector( Position(q, nCenter), q.vParticles[nCenter].SurfaceVector(),
+		m_pPositions[nParticle], vTangentPlane, vCenterWorldFrame, matFrameRotate );
+}
+
+
+void ExpMapBatch::PropagateFrameFromNearest( Query & q, unsigned int nParticle )
+{
+	ExpMapParticle & particle = q.vParticles[nParticle];
+	if ( particle.SurfaceDistance() == 0.0f ) {
+		// pathological case where seed point == input point (or other duplicate points)
+		particle.SurfaceVector() = q.vParticles[ particle.Nearest() ].SurfaceVector();
+		return;
+	}
+	ComputePropagation( q, particle.Nearest(), nParticle, particle.SurfaceVector() );
+	ExpMapGenerator::ClampSurfaceVector( particle.SurfaceVector(), particle.SurfaceDistance() );
+}
+
+
+void ExpMapBatch::PropagateFrameFromNearest_Average( Query & q, unsigned int nParticle )
+{
+	ExpMapParticle & particle = q.vParticles[nParticle];
+	unsigned int nNearest = particle.Nearest();
+	if ( particle.SurfaceDistance() == 0.0f ) {
+		particle.SurfaceVector() = q.vParticles[nNearest].SurfaceVector();
+		return;
+	}
+
+	// weighted average of surface vectors propagated from frozen neighbours (and nearest particle,
+	// which is not in the neighbour list if it is the seed point)
+	if ( m_bUseVectorizedPropagation ) {
+		ExpMapUpwindKernel & kernel = q.upwindKernel;
+		kernel.Clear();
+		bool bSawNearest = false;
+		for ( unsigned int k = m_pNbrOffsets[nParticle]; k < m_pNbrOffsets[nParticle+1]; ++k ) {
+			unsigned int nCenter = m_pNbrs[k];
+			if ( nCenter == nNearest )
+				bSawNearest = true;
+			if ( q.vParticles[nCenter].State() == ExpMapParticle::Frozen )
+				kernel.Add( m_pPositions[nCenter], m_pNormals[nCenter], m_pTangents[nCenter], q.vParticles[nCenter].SurfaceVector() );
+		}
+
+		const Wml::Vector3f & vPosition = m_pPositions[nParticle];
+		float fWeightOffset = 0.00001f*m_fMaxEdgeLength;
+		Wml::Vector2f vWeightedSum = Wml::Vector2f::ZERO;
+		float fWeightSum = 0.0f;
+		if ( ! bSawNearest && nNearest == m_nParticles ) {
+			ComputePropagation( q, nNearest, nParticle, vWeightedSum );
+			fWeightSum = 1.0f / ( ( Position(q, nNearest) - vPosition ).Length() + fWeightOffset );
+			vWeightedSum *= fWeightSum;
+		} else if ( ! bSawNearest )
+			kernel.Add( m_pPositions[nNearest], m_pNormals[nNearest], m_pTangents[nNearest], q.vParticles[nNearest].SurfaceVector() );
+		kernel.Accumulate( vPosition, q.pSeed->vFrame, fWeightOffset, vWeightedSum, fWeightSum );
+
+		particle.SurfaceVector() = vWeightedSum / fWeightSum;
+		ExpMapGenerator::ClampSurfaceVector( particle.SurfaceVector(), particle.SurfaceDistance() );
+		return;
+	}
+
+	q.vNbrWeights.resize(0);
+	q.vNbrUVs.resize(0);
+	float fWeightSum = 0.0f;
+	bool bSawNearest = false;
+	const Wml::Vector3f & vPosition = m_pPositions[nParticle];
+	for ( unsigned int k = m_pNbrOffsets[nParticle]; k <= m_pNbrOffsets[nParticle+1]; ++k ) {
+		unsigned int nCenter;
+		if ( k < m_pNbrOffsets[nParticle+1] ) {
+			nCenter = m_pNbrs[k];
+			if ( nCenter == nNearest )
+				bSawNearest = true;
+			if ( q.vParticles[nCenter].State() != ExpMapParticle::Frozen )
+				continue;
+		} else if ( ! bSawNearest ) {
+			nCenter = nNearest;
+		} else
+			break;
+
+		Wml::Vector2f vUV;
+		ComputePropagation( q, nCenter, nParticle, vUV );
+		float fWeight = 1.0f / ( ( Position(q, nCenter) - vPosition ).Length() + (0.00001f*m_fMaxEdgeLength) );
+		fWeightSum += fWeight;
+		q.vNbrWeights.push_back( fWeight );
+		q.vNbrUVs.push_back( vUV );
+	}
+
+	Wml::Vector2f vUV = Wml::Vector2f::ZERO;
+	size_t nCount = q.vNbrWeights.size();
+	for ( unsigned int i = 0; i < nCount; ++i ) 
+		vUV += (q.vNbrWeights[i] / fWeightSum) * q.vNbrUVs[i];
+	particle.SurfaceVector() = vUV;
+
+	ExpMapGenerator::ClampSurfaceVector( particle.SurfaceVector(), particle.SurfaceDistance() );
+}
@@ -0,0 +1,114 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __RMS_EXPMAP_BATCH_H
+#define __RMS_EXPMAP_BATCH_H
+
+#include "config.h"
+#include <vector>
+
+#include "ExpMapGenerator.h"
+
+
+namespace rms {
+
+
+//! per-seed result of ExpMapBatch, in the same layout as ExpMapGenerator::GetVertexUVs()
+struct ExpMapUVSet
+{
+	std::vector<unsigned int> vIDs;
+	std::vector<float> vU;
+	std::vector<float> vV;
+};
+
+
+/*
+ * Computes expmaps at many seed frames in parallel (OpenMP). Initialize() makes sure the neighbour
+ * graph and normals of an ExpMapGenerator are computed, and then reads its (read-only) position, 
+ * normal, tangent and neighbour arrays directly. Each thread propagates with its own per-query state
+ * (particles and front heap), so seeds do not interact. For the same seed frame and settings, results
+ * are the same as ExpMapGenerator::SetSurfaceDistances() followed by GetVertexUVs().
+ *
+ * The generator is also used (serially) to find the neighbours of each seed point, so it 
+ * must not be modified or destroyed while the batch is in use.
+ */
+class ExpMapBatch
+{
+public:
+	ExpMapBatch();
+	~ExpMapBatch();
+
+	//! expmapgen must have a surface. Neighbour lists are computed if necessary. Propagation settings
+	//! (upwind averaging and its vectorization, square culling, clip polygon) are copied from expmapgen.
+	void Initialize( ExpMapGenerator & expmapgen );
+	void Clear();
+
+	unsigned int GetParticleCount() const { return m_nParticles; }
+
+	//! vResults[i] is the UV set for vSeeds[i]. fStopDistance and nMaxCount work as in 
+	//! ExpMapGenerator::SetSurfaceDistances() (pass std::numeric_limits<float>::max() to only use the count)
+	void Compute( const std::vector<Frame3f> & vSeeds, float fStopDistance, unsigned int nMaxCount, 
+				  std::vector<ExpMapUVSet> & vResults );
+
+protected:
+	ExpMapGenerator * m_pGenerator;
+
+	// read-only particle data shared with m_pGenerator, indexed by particle (== VertexID). 
+	// Index m_nParticles is used for the seed point
+	unsigned int m_nParticles;
+	const Wml::Vector3f * m_pPositions;
+	const Wml::Vector3f * m_pNormals;
+	const Wml::Vector3f * m_pTangents;
+
+	// neighbours of particle i are m_pNbrs[ m_pNbrOffsets[i] ... m_pNbrOffsets[i+1]-1 ]
+	const unsigned int * m_pNbrOffsets;
+	const unsigned int * m_pNbrs;
+
+	bool m_bUseUpwindAveraging;
+	bool m_bUseVectorizedPropagation;
+	bool m_bEnableSquareCulling;
+	bool m_bUseClipPoly;
+	rms::Polygon2f m_ClipPoly;
+	float m_fMaxEdgeLength;
+
+	struct Seed {
+		Frame3f vFrame;
+		Wml::Vector3f vNormal;
+		unsigned int nNbrBegin;
+		unsigned int nNbrEnd;
+	};
+
+	// per-thread state. vParticles has an entry for every particle, but only the vTouched 
+	// entries are reset after each query
+	struct Query {
+		std::vector<ExpMapParticle> vParticles;
+		ParticleQueue queue;
+		std::vector<unsigned int> vTouched;
+		std::vector<unsigned int> vFrozen;
+		std::vector<float> vNbrWeights;
+		std::vector<Wml::Vector2f> vNbrUVs;
+		ExpMapUpwindKernel upwindKernel;
+		const Seed * pSeed;
+		const unsigned int * pSeedNbrs;
+	};
+
+	void InitializeQuery( Query & q );
+	void ComputeSeed( Query & q, float fStopDistance, unsigned int nMaxCount, ExpMapUVSet & result );
+
+	void UpdateNeighbours( Query & q, unsigned int nParticle );
+	void PropagateFrameFromNearest( Query & q, unsigned int nParticle );
+	void PropagateFrameFromNearest_Average( Query & q, unsigned int nParticle );
+	void ComputePropagation( Query & q, unsigned int nCenter, unsigned int nParticle, 
+							 Wml::Vector2f & vSurfaceVector );
+
+	const Wml::Vector3f & Position( const Query & q, unsigned int i ) const
+		{ return (i == m_nParticles) ? q.pSeed->vFrame.Origin() : m_pPositions[i]; }
+};
+
+
+
+} // end namespace rms
+
+
+#endif // __RMS_EXPMAP_BATCH_H
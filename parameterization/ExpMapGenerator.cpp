@@ -13,48 +13,14 @@
 #include "VectorUtil.h"
 #include "Triangulator2D.h"
 #include "MeshUtils.h"
+#include "PointKdTree.h"
+#include <Wm4DistVector3Triangle3.h>
 
 using namespace rms;
 
 
 Wml::Vector2f ExpMapParticle::INVALID_PARAM = Wml::Vector2f( std::numeric_limits<float>::max(), std::numeric_limits<float>::max() );
-
-ExpMapParticle::ExpMapParticle(const Wml::Vector3f & vPosition,
-							   const Wml::Vector3f & vNormal)
-							   : m_vPosition(vPosition), m_vNormal(vNormal)
-{
-	m_fSurfaceDistance = 0.0f;
-	m_vSurfaceVector = Wml::Vector2f::ZERO;
-	ClearNeighbourList();
-	m_nVertexID = std::numeric_limits<unsigned int>::max();
-
-	m_eState = ExpMapParticle::Inactive;
-	m_pNearest = NULL;
-	m_bNbrFlag = false;
-	m_bNormalSmoothed = false;
-}
-
-ExpMapParticle::~ExpMapParticle()
-{
-	ClearNeighbourList();
-}
-
-void ExpMapParticle::AddNeighbour( ListEntry * pNeighbour )
-{
-	if ( m_pNeighbourList == NULL ) {
-		m_pNeighbourList = pNeighbour;
-		pNeighbour->pNext = NULL;
-	} else {
-		pNeighbour->pNext = m_pNeighbourList;
-		m_pNeighbourList = pNeighbour;
-	}
-}
-
-void ExpMapParticle::ClearNeighbourList()
-{
-	// cleared using memory pool in particle system!
-	m_pNeighbourList = NULL;
-}
+const unsigned int ExpMapParticle::InvalidIndex;
 
 
 
@@ -66,23 +32,41 @@ void ExpMapParticle::ClearNeighbourList()
 
 ExpMapGenerator::ExpMapGenerator()
 {
-	m_bNeighbourListsValid = false;
+	m_pNbrOffsets = NULL;
+	m_pNbrs = NULL;
 	m_bParticleGridValid = false;
 	m_fMaxNbrDist = 0.0f;
-	m_pSeedParticle = NULL;
 
 	m_pVFMesh = NULL;
 	m_pIMesh = NULL;
 	m_pMeshBVTree = NULL;
 
-	m_bPrecomputeNeighbours = true;
+	m_nParticles = 0;
+	m_pPositions = NULL;
+	m_pNormals = NULL;
+	m_pTangents = NULL;
+	m_bSeedValid = false;
+
 	m_bUseMeshNeighbours = true;
 	m_bUseUpwindAveraging = false;
+	m_bUseVectorizedPropagation = true;
 	m_bUseNeighbourNormalSmoothing = false;
 
+	m_bUseIndexedQueue = true;
 	m_bEnableSquareCulling = false;
 	m_bUseClipPoly = false;
 	m_fLastMaxRadius = 0.0f;
+
+	m_bUseIncrementalUpdate = true;
+	m_bLastExpMapValid = false;
+	m_fLastStopDistance = 0.0f;
+	m_nLastMaxCount = 0;
+	m_nLastExpanded = 0;
+
+	m_bUseLocalizedQueries = false;
+
+	m_fUVGridCellSize = 0.0f;
+	m_nUVGridWidth = m_nUVGridHeight = 0;
 }
 
 ExpMapGenerator::~ExpMapGenerator()
@@ -104,39 +88,42 @@ void ExpMapGenerator::EstimateEdgeLength(VFTriangleMesh * pMesh, float & fMin, f
 	while ( vIDs.size() < D )
 		vIDs.insert( rand() % pMesh->GetMaxVertexID() );
 
-	// list of distances
-	std::vector<float> vDistances(pMesh->GetMaxVertexID(), std::numeric_limits<float>::max());
+	// kd-tree over all vertices
+	std::vector<IMesh::VertexID> vVertices;
+	vVertices.reserve( pMesh->GetVertexCount() );
+	VFTriangleMesh::vertex_iterator curv(pMesh->BeginVertices()), endv(pMesh->EndVertices());
+	while ( curv != endv ) {
+		vVertices.push_back( *curv );  ++curv;
+	}
+	MeshPositionSource source(pMesh);
+	PointKdTree kdtree;
+	kdtree.Build( source, vVertices );
 
 	int nEdges = 0;
 	double fEdgeLengths = 0;
 
+	std::vector<unsigned int> vNbrs;
+	std::vector<float> vDistances;
 	std::set<IMesh::VertexID>::iterator cursv(vIDs.begin()), endsv(vIDs.end());
 	while ( cursv != endsv ) {
 		IMesh::VertexID vID = *cursv++;
 		Wml::Vector3f vVtx;
 		pMesh->GetVertex(vID, vVtx);
 
-		// compute distance to all points
-		VFTriangleMesh::vertex_iterator curv(pMesh->BeginVertices()), endv(pMesh->EndVertices());
-		while ( curv != endv ) {
-			IMesh::VertexID vNbr = *curv; ++curv;
-			if ( vNbr == vID ) 
-				vDistances[vNbr] = std::numeric_limits<float>::max();
-			 else 
-				vDistances[vNbr] = ( vVtx - Wml::Vector3f(pMesh->GetVertex(vNbr)) ).SquaredLength();
-		}
-
-		std::sort(vDistances.begin(), vDistances.end());
-		for ( int k = 0; k < K; ++k ) {
-			if ( vDistances[k] != std::numeric_limits<float>::max() ) {
-				nEdges++;
-				double fDist = sqrt(vDistances[k]);
-				fEdgeLengths += fDist;
-				if ( fDist > fMax )
-					fMax = (float)fDist;
-				if ( fDist < fMin )
-					fMin = (float)fDist;
-			}
+		// K nearest, skipping vID itself
+		unsigned int nFound = kdtree.KNearest( vVtx, K+1, vNbrs, &vDistances );
+		int nUsed = 0;
+		for ( unsigned int k = 0; k < nFound && nUsed < K; ++k ) {
+			if ( vNbrs[k] == vID )
+				continue;
+			++nUsed;
+			nEdges++;
+			double fDist = sqrt(vDistances[k]);
+			fEdgeLengths += fDist;
+			if ( fDist > fMax )
+				fMax = (float)fDist;
+			if ( fDist < fMin )
+				fMin = (float)fDist;
 		}
 	}
 
@@ -158,30 +145,11 @@ void ExpMapGenerator::SetSurface( IMesh * pMesh, IMeshBVTree * pMeshBVTree )
 	if ( m_fMaxEdgeLength == 0 )
 		lgBreakToDebugger();
 
-	Reset();
-
-	unsigned int nMaxVert = pMesh->GetMaxVertexID();
-	m_vVtxToParticleMap.resize(0);
-	m_vVtxToParticleMap.resize( nMaxVert, IMesh::InvalidID );
-
-	IMesh::IVtxIterator curv(pMesh->BeginIVertices()), endv(pMesh->EndIVertices());
-	while ( curv != endv ) {
-		IMesh::VertexID nID = *curv;	curv++;
-
-		// create particle
-		ExpMapParticle * p = AllocateParticle();
-		pMesh->GetVertex( nID, p->Position(), & p->Normal() );
+	// point sets have no one-rings, so neighbours have to come from the particle grid
+	m_bUseMeshNeighbours = ( pMesh->GetTriangleCount() > 0 );
 
-		// associate w/ vertex
-		p->VertexID() = nID;
-		m_vVtxToParticleMap[nID] = AddParticle(p);
-
-		// set arbitrary surface frame
-		p->WorldFrame() = Frame3f( p->Position(), p->Normal() );
-	}
-
-	if ( m_bUseNeighbourNormalSmoothing )
-		SetUseNeighbourNormalSmoothing(true);
+	Reset();
+	InitializeParticleGeometry();
 }
 
 
@@ -202,30 +170,93 @@ void ExpMapGenerator::SetSurface( VFTriangleMesh * pMesh, IMeshBVTree * pMeshBVT
 		//m_fMaxMeshEdgeLength = 0.0676263f;
 	}
 
+	// point sets have no one-rings, so neighbours have to come from the particle grid
+	m_bUseMeshNeighbours = ( pMesh->GetTriangleCount() > 0 );
+
 	Reset();
+	InitializeParticleGeometry();
+}
 
-	unsigned int nMaxVert = pMesh->GetMaxVertexID();
-	m_vVtxToParticleMap.resize(0);
-	m_vVtxToParticleMap.resize( nMaxVert, IMesh::InvalidID );
 
-	IMesh::IVtxIterator curv(pMesh->BeginIVertices()), endv(pMesh->EndIVertices());
-	while ( curv != endv ) {
-		IMesh::VertexID nID = *curv;	curv++;
+void ExpMapGenerator::InitializeParticleGeometry()
+{
+	IMesh * pMesh = GetMesh();
+	m_nParticles = pMesh->GetMaxVertexID();
+
+	ExpMapParticle init;
+	init.Clear();
+	m_vParticles.resize(0);
+	m_vParticles.resize( m_nParticles + 1, init );
+	m_particleQueue.SetParticles( &m_vParticles[0] );
+	m_vLastParticles.resize(0);
+	m_bSeedValid = false;
+
+	// normals and tangents come with the neighbour lists (normals may be smoothed)
+	InitializeParticlePositions();
+}
+
+
+void ExpMapGenerator::InitializeParticlePositions()
+{
+	IMesh * pMesh = GetMesh();
+
+	// share position buffer with the mesh if possible, otherwise copy positions
+	const float * pMeshPositions = (m_pVFMesh) ? m_pVFMesh->GetPositionBuffer() : NULL;
+	if ( pMeshPositions ) {
+		std::vector<Wml::Vector3f>().swap(m_vPositionBuf);
+		m_pPositions = (const Wml::Vector3f *)pMeshPositions;
+	} else {
+		m_vPositionBuf.resize( m_nParticles + 1 );
+		pMesh->ForEachVertexBlock( IMeshGatherByIDFunc( pMesh, (float *)&m_vPositionBuf[0] ) );
+		m_pPositions = &m_vPositionBuf[0];
+	}
+}
 
-		// create particle
-		ExpMapParticle * p = AllocateParticle();
-		pMesh->GetVertex( nID, p->Position(), & p->Normal() );
 
-		// associate w/ vertex
-		p->VertexID() = nID;
-		m_vVtxToParticleMap[nID] = AddParticle(p);
+Frame3f ExpMapGenerator::MakeFrame( const Wml::Vector3f & vPosition, const Wml::Vector3f & vNormal, const Wml::Vector3f & vTangent )
+{
+	// same as Frame3f(vPosition, vNormal), if vTangent was computed by ComputePerpVectors
+	Wml::Vector3f vAxisZ(vNormal);
+	vAxisZ.Normalize();
+	return Frame3f( vPosition, vTangent, vAxisZ.Cross(vTangent), vAxisZ );
+}
+
+Frame3f ExpMapGenerator::WorldFrame( unsigned int i ) const
+{
+	if ( i == m_nParticles )
+		return m_vSeedFrame;
+	return MakeFrame( m_pPositions[i], m_pNormals[i], m_pTangents[i] );
+}
+
 
-		// set arbitrary surface frame
-		p->WorldFrame() = Frame3f( p->Position(), p->Normal() );
+void ExpMapGenerator::NotifySurfaceDeformed()
+{
+	IMesh * pMesh = GetMesh();
+	if ( pMesh == NULL )
+		return;
+
+	if ( m_pVFMesh && m_pVFMesh->GetTriangleCount() == 0 ) {
+		float fMin = 0;
+		EstimateEdgeLength(m_pVFMesh, fMin, m_fMaxEdgeLength, m_fAvgEdgeLength);
+	} else {
+		float fMin = 0;
+		MeshUtils::GetEdgeLengthStats(pMesh, fMin, m_fMaxEdgeLength, m_fAvgEdgeLength);
 	}
 
-	if ( m_bUseNeighbourNormalSmoothing )
-		SetUseNeighbourNormalSmoothing(true);
+	if ( pMesh->GetMaxVertexID() != m_nParticles )
+		lgBreakToDebugger();		// vertex was added - need to call SetSurface() again
+
+	// positions are re-copied (or re-shared). Normals and frames are recomputed with 
+	// the neighbour lists, which depend on positions (as does the particle grid). Shared
+	// surface caches of the mesh are stale now
+	m_bParticleGridValid = false;
+	m_bLastExpMapValid = false;
+	ExpMapSurfaceCache::Invalidate( pMesh );
+	ClearNeighbourLists();
+	InitializeParticleGeometry();
+
+	if ( m_pMeshBVTree )
+		m_pMeshBVTree->Refit();
 }
 
 
@@ -243,11 +274,17 @@ void ExpMapGenerator::Reset()
 {
 	m_bParticleGridValid = false;
 	ClearNeighbourLists();
-	ClearParticles();
+	m_vParticles.clear();
+	m_nParticles = 0;
+	m_pPositions = m_pNormals = m_pTangents = NULL;
+	m_bSeedValid = false;
 	m_vLastParticles.resize(0);
+	m_bLastExpMapValid = false;
 
-	m_uvMesh.Clear(false);
-	m_3dMesh.Clear(false);
+	m_vRegionTris.resize(0);
+	m_nUVGridWidth = m_nUVGridHeight = 0;
+	m_regionBVTree.Clear();
+	m_regionMesh.Clear(false);
 }
 
 
@@ -255,40 +292,29 @@ void ExpMapGenerator::Reset()
 
 void ExpMapGenerator::SetUseNeighbourNormalSmoothing( bool bEnable )
 {
+	if ( bEnable == m_bUseNeighbourNormalSmoothing )
+		return;
 	m_bUseNeighbourNormalSmoothing = bEnable;
+	if ( m_nParticles > 0 ) {
+		ClearNeighbourLists();
+		InitializeParticlePositions();
+	}
+	m_bLastExpMapValid = false;
 }
 
-void ExpMapGenerator::SetSmoothNormal( ExpMapParticle * pParticle, ExpMapParticle::ListEntry * pNbrs, bool bEnable )
-{
-	if ( bEnable && pParticle->m_bNormalSmoothed )
-		return;
-	else if ( !bEnable && !pParticle->m_bNormalSmoothed)
-		return;
-
-	Wml::Vector3f vPos, vNorm, vNbrPos, vNbrNorm;
-	if ( bEnable ) {
-		float fWeightSum = 0.0f;
-		Wml::Vector3f vAverage = Wml::Vector3f::ZERO;
-		GetMesh()->GetVertex( pParticle->VertexID(), vPos, &vNorm);
-		ExpMapParticle::ListEntry * pCur = pNbrs;
-		while ( pCur != NULL ) {
-			IMesh::VertexID nID = pCur->pParticle->VertexID();
-			Wml::Vector3f vNbrPos, vNbrNorm;
-			GetMesh()->GetVertex( pCur->pParticle->VertexID(), vNbrPos, &vNbrNorm);
-			float fWeight = 1.0f / ( (vPos - vNbrPos).Length()  + (0.0001f*m_fMaxEdgeLength) );
-			vAverage += fWeight * vNbrNorm;
-			fWeightSum += fWeight;
-			pCur = pCur->pNext;
-		}
-		vAverage /= fWeightSum;
-		vAverage.Normalize();
-		pParticle->Normal() = vAverage;
-	} else {
-		GetMesh()->GetNormal( pParticle->VertexID(), pParticle->Normal() );
-	}
 
-	pParticle->WorldFrame() = Frame3f( pParticle->Position(), pParticle->Normal() );
-	pParticle->m_bNormalSmoothed = bEnable;
+size_t ExpMapGenerator::GetMemoryUsage() const
+{
+	size_t nBytes = sizeof(ExpMapGenerator);
+	nBytes += m_vParticles.capacity() * sizeof(ExpMapParticle);
+	nBytes += (m_vPositionBuf.capacity() + m_vNormalBuf.capacity() + m_vTangents.capacity()) * sizeof(Wml::Vector3f);
+	nBytes += (m_vNbrs.capacity() + m_vSeedNbrs.capacity() + m_vLocalNbrRanges.capacity()) * sizeof(unsigned int);
+	nBytes += (m_vLastParticles.capacity() + m_vNeighbourBuf.capacity()) * sizeof(unsigned int);
+	nBytes += m_vNbrInfo.capacity() * sizeof(NbrInfo);
+	nBytes += m_particleQueue.GetMemoryUsage();
+	if ( HasNeighbourLists() )
+		nBytes += m_pSurfaceCache->GetMemoryUsage();
+	return nBytes;
 }
 
 
@@ -297,13 +323,11 @@ void ExpMapGenerator::CopyVertexUVs( IMesh * pMesh, IMesh::UVSetID nSetID )
 {
 	pMesh->ClearUVSet( nSetID );
 
-	Wml::Vector2f vTexCoord;
 	size_t nLastCount = m_vLastParticles.size();
 	for ( unsigned int i = 0; i < nLastCount; ++i ) {
-		ExpMapParticle * pParticle = m_vLastParticles[i];
-		if ( pParticle->VertexID() != IMesh::InvalidID &&
-			pParticle->SurfaceDistance() != std::numeric_limits<float>::max() )
-			pMesh->SetUV( pParticle->VertexID(), nSetID, pParticle->SurfaceVector() );
+		const ExpMapParticle & particle = m_vParticles[ m_vLastParticles[i] ];
+		if ( particle.SurfaceDistance() != std::numeric_limits<float>::max() )
+			pMesh->SetUV( m_vLastParticles[i], nSetID, particle.SurfaceVector() );
 	}
 }
 
@@ -312,17 +336,51 @@ void ExpMapGenerator::GetVertexUVs(std::vector<unsigned int> & vID, std::vector<
 {
 	size_t nLastCount = m_vLastParticles.size();
 	for ( unsigned int i = 0; i < nLastCount; ++i ) {
-		ExpMapParticle * pParticle = m_vLastParticles[i];
-		if ( pParticle->VertexID() != IMesh::InvalidID &&
-			pParticle->SurfaceDistance() != std::numeric_limits<float>::max() ) {
-				vID.push_back( pParticle->VertexID() );
-				vU.push_back( pParticle->SurfaceVector().X() );
-				vV.push_back( pParticle->SurfaceVector().Y() );
+		const ExpMapParticle & particle = m_vParticles[ m_vLastParticles[i] ];
+		if ( particle.SurfaceDistance() != std::numeric_limits<float>::max() ) {
+				vID.push_back( m_vLastParticles[i] );
+				vU.push_back( particle.SurfaceVector().X() );
+				vV.push_back( particle.SurfaceVector().Y() );
 		}
 	}
 }
 
 
+void ExpMapGenerator::GetVertexDistances( std::vector<float> & vDistances, std::vector<IMesh::VertexID> * pNearest )
+{
+	vDistances.resize(0);
+	vDistances.resize( m_nParticles, std::numeric_limits<float>::max() );
+	if ( pNearest ) {
+		pNearest->resize(0);
+		pNearest->resize( m_nParticles, IMesh::InvalidID );
+	}
+
+	size_t nLastCount = m_vLastParticles.size();
+	for ( unsigned int i = 0; i < nLastCount; ++i ) {
+		unsigned int nParticle = m_vLastParticles[i];
+		const ExpMapParticle & particle = m_vParticles[nParticle];
+		if ( particle.SurfaceDistance() == std::numeric_limits<float>::max() )
+			continue;
+		vDistances[nParticle] = particle.SurfaceDistance();
+		if ( pNearest && particle.Nearest() != SeedIndex() )
+			(*pNearest)[nParticle] = particle.Nearest();
+	}
+}
+
+
+void ExpMapGenerator::CopyVertexDistances( IMesh * pMesh, IMesh::ScalarSetID nSetID )
+{
+	pMesh->ClearScalarSet( nSetID );
+
+	size_t nLastCount = m_vLastParticles.size();
+	for ( unsigned int i = 0; i < nLastCount; ++i ) {
+		const ExpMapParticle & particle = m_vParticles[ m_vLastParticles[i] ];
+		if ( particle.SurfaceDistance() != std::numeric_limits<float>::max() )
+			pMesh->SetScalar( m_vLastParticles[i], nSetID, particle.SurfaceDistance() );
+	}
+}
+
+
 void ExpMapGenerator::GetVertexFaceUVs( std::vector<unsigned int> & vIDs, std::vector<float> & vU, std::vector<float> & vV, std::vector<unsigned int> & vFaces, rms::VFTriangleMesh * pMesh )
 {
 	SparseArray<IMesh::TriangleID> vTris;
@@ -331,10 +389,10 @@ void ExpMapGenerator::GetVertexFaceUVs( std::vector<unsigned int> & vIDs, std::v
 	// mark triangles that have at least one vertex UV set
 	size_t nLastCount = m_vLastParticles.size();
 	for ( unsigned int k = 0; k < nLastCount; ++k ) {
-		ExpMapParticle * pParticle = m_vLastParticles[k];
-		if ( pParticle->VertexID() == IMesh::InvalidID || pParticle->SurfaceDistance() == std::numeric_limits<float>::max() )
+		IMesh::VertexID vID = m_vLastParticles[k];
+		if ( m_vParticles[vID].SurfaceDistance() == std::numeric_limits<float>::max() )
 			continue;
-		IMesh::VtxNbrItr itr(pParticle->VertexID());
+		IMesh::VtxNbrItr itr(vID);
 		pMesh->BeginVtxTriangles(itr);
 		IMesh::TriangleID tID = pMesh->GetNextVtxTriangle(itr);
 		while ( tID != IMesh::InvalidID ) {
@@ -352,9 +410,9 @@ void ExpMapGenerator::GetVertexFaceUVs( std::vector<unsigned int> & vIDs, std::v
 
 		IMesh::VertexID nTri[3];
 		pMesh->GetTriangle(tID, nTri);
-		bool b1 = m_vParticles[ m_vVtxToParticleMap[nTri[0]] ]->SurfaceDistance() != std::numeric_limits<float>::max();
-		bool b2 = m_vParticles[ m_vVtxToParticleMap[nTri[1]] ]->SurfaceDistance() != std::numeric_limits<float>::max();
-		bool b3 = m_vParticles[ m_vVtxToParticleMap[nTri[2]] ]->SurfaceDistance() != std::numeric_limits<float>::max();
+		bool b1 = m_vParticles[ nTri[0] ].SurfaceDistance() != std::numeric_limits<float>::max();
+		bool b2 = m_vParticles[ nTri[1] ].SurfaceDistance() != std::numeric_limits<float>::max();
+		bool b3 = m_vParticles[ nTri[2] ].SurfaceDistance() != std::numeric_limits<float>::max();
 		if ( b1 && b2 && b3 ) {
 			vVerts.set(nTri[0], nTri[0]);
 			vVerts.set(nTri[2], nTri[1]);
@@ -367,10 +425,9 @@ void ExpMapGenerator::GetVertexFaceUVs( std::vector<unsigned int> & vIDs, std::v
 	SparseArray<IMesh::VertexID>::iterator curv(vVerts.begin()), endv(vVerts.end());
 	while ( curv != endv ) {
 		IMesh::VertexID vID = curv.index();  ++curv;
-		int nIndex = m_vVtxToParticleMap[vID];
 		vIDs.push_back(vID);
-		vU.push_back( m_vParticles[nIndex]->SurfaceVector().X() );
-		vV.push_back( m_vParticles[nIndex]->SurfaceVector().Y() );
+		vU.push_back( m_vParticles[vID].SurfaceVector().X() );
+		vV.push_back( m_vParticles[vID].SurfaceVector().Y() );
 	}
 }
 
@@ -378,49 +435,212 @@ void ExpMapGenerator::GetVertexFaceUVs( std::vector<unsigned int> & vIDs, std::v
 
 bool ExpMapGenerator::MeshCurrentUVs()
 {
-	if ( m_vLastParticles.empty() )
+	m_vRegionTris.resize(0);
+	m_nUVGridWidth = m_nUVGridHeight = 0;
+	m_regionBVTree.Clear();
+	m_regionMesh.Clear(false);
+	IMesh * pMesh = GetMesh();
+	if ( pMesh == NULL || m_vLastParticles.empty() )
+		return false;
+	bool bPointSet = ( pMesh->GetTriangleCount() == 0 );
+
+	// collect mesh triangles with UVs at all vertices. Each one is added from its smallest vertex
+	IMesh::VertexID nTri[3];
+	Wml::Vector2f vMin( std::numeric_limits<float>::max(), std::numeric_limits<float>::max() );
+	Wml::Vector2f vMax( -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() );
+	size_t nLastCount = m_vLastParticles.size();
+	for ( unsigned int i = 0; i < nLastCount; ++i ) {
+		unsigned int vID = m_vLastParticles[i];
+		if ( ! HasUV(vID) )
+			continue;
+		const Wml::Vector2f & vUV = m_vParticles[vID].SurfaceVector();
+		for ( int k = 0; k < 2; ++k ) {
+			if ( vUV[k] < vMin[k] ) vMin[k] = vUV[k];
+			if ( vUV[k] > vMax[k] ) vMax[k] = vUV[k];
+		}
+		if ( bPointSet )
+			continue;
+
+		IMesh::VtxNbrItr itr(vID);
+		pMesh->BeginVtxTriangles(itr);
+		for ( IMesh::TriangleID tID = pMesh->GetNextVtxTriangle(itr); tID != IMesh::InvalidID; tID = pMesh->GetNextVtxTriangle(itr) ) {
+			pMesh->GetTriangle( tID, nTri );
+			if ( vID != std::min( nTri[0], std::min(nTri[1], nTri[2]) ) )
+				continue;
+			if ( HasUV(nTri[0]) && HasUV(nTri[1]) && HasUV(nTri[2]) ) {
+				m_vRegionTris.push_back( nTri[0] );
+				m_vRegionTris.push_back( nTri[1] );
+				m_vRegionTris.push_back( nTri[2] );
+			}
+		}
+	}
+	if ( bPointSet )
+		TriangulateCurrentUVs();
+	unsigned int nTris = (unsigned int)m_vRegionTris.size() / 3;
+	if ( nTris == 0 )
 		return false;
 
-	m_uvMesh.Clear(false);
-	m_3dMesh.Clear(false);
+	if ( m_pMeshBVTree == NULL || bPointSet ) {
+		// vertices are not shared, this mesh is only used for nearest-triangle queries.
+		// The mesh was cleared above, so its triangle t is region triangle t
+		for ( unsigned int t = 0; t < nTris; ++t ) {
+			for ( int j = 0; j < 3; ++j )
+				nTri[j] = m_regionMesh.AppendVertex( m_pPositions[ m_vRegionTris[3*t+j] ] );
+			m_regionMesh.AppendTriangle( nTri[0], nTri[1], nTri[2] );
+		}
+		m_regionBVTree.SetMesh( &m_regionMesh );
+	}
+
+	// about one triangle per cell
+	float fWidth = vMax.X() - vMin.X(), fHeight = vMax.Y() - vMin.Y();
+	m_fUVGridCellSize = (float)sqrt( fWidth * fHeight / (float)nTris );
+	if ( m_fUVGridCellSize < 1.0e-6f * std::max(fWidth, fHeight) || m_fUVGridCellSize == 0.0f )
+		m_fUVGridCellSize = std::max( std::max(fWidth, fHeight), 1.0e-6f );
+	m_vUVGridOrigin = vMin;
+	m_nUVGridWidth = std::min( (unsigned int)(fWidth / m_fUVGridCellSize) + 1, nTris );
+	m_nUVGridHeight = std::min( (unsigned int)(fHeight / m_fUVGridCellSize) + 1, nTris );
+	unsigned int nCells = m_nUVGridWidth * m_nUVGridHeight;
+
+	// bucket triangles by UV bounding box (count, prefix sum, fill)
+	m_vUVGridOffsets.resize(0);
+	m_vUVGridOffsets.resize( nCells + 1, 0 );
+	for ( int nPass = 0; nPass < 2; ++nPass ) {
+		for ( unsigned int t = 0; t < nTris; ++t ) {
+			const unsigned int * pTri = &m_vRegionTris[3*t];
+			unsigned int nMinX, nMinY, nMaxX, nMaxY, nX, nY;
+			GetUVGridCell( m_vParticles[pTri[0]].SurfaceVector(), nMinX, nMinY );
+			nMaxX = nMinX;  nMaxY = nMinY;
+			for ( int j = 1; j < 3; ++j ) {
+				GetUVGridCell( m_vParticles[pTri[j]].SurfaceVector(), nX, nY );
+				nMinX = std::min(nMinX, nX);  nMaxX = std::max(nMaxX, nX);
+				nMinY = std::min(nMinY, nY);  nMaxY = std::max(nMaxY, nY);
+			}
+			for ( nY = nMinY; nY <= nMaxY; ++nY ) {
+				for ( nX = nMinX; nX <= nMaxX; ++nX ) {
+					unsigned int nCell = nY*m_nUVGridWidth + nX;
+					if ( nPass == 0 )
+						++m_vUVGridOffsets[nCell+1];
+					else
+						m_vUVGridTris[ m_vUVGridOffsets[nCell]++ ] = t;
+				}
+			}
+		}
+		if ( nPass == 0 ) {
+			for ( unsigned int c = 0; c < nCells; ++c )
+				m_vUVGridOffsets[c+1] += m_vUVGridOffsets[c];
+			m_vUVGridTris.resize( m_vUVGridOffsets[nCells] );
+		} else {
+			// fill advanced each offset to the start of the next cell
+			for ( unsigned int c = nCells; c > 0; --c )
+				m_vUVGridOffsets[c] = m_vUVGridOffsets[c-1];
+			m_vUVGridOffsets[0] = 0;
+		}
+	}
+
+	return true;
+}
 
-	Triangulator2D dt;
 
+// point sets have no triangles, so the region triangles are a Delaunay triangulation of the expmap UVs
+void ExpMapGenerator::TriangulateCurrentUVs()
+{
+	Triangulator2D dt;
 	size_t nLastCount = m_vLastParticles.size();
 	for ( unsigned int i = 0; i < nLastCount; ++i ) {
-		ExpMapParticle * pParticle = m_vLastParticles[i];
-		if ( pParticle->VertexID() != IMesh::InvalidID ) {
-			unsigned int nPointID = dt.AddPoint( 
-				pParticle->SurfaceVector().X(), pParticle->SurfaceVector().Y(), pParticle->VertexID() );
-		}
+		unsigned int nIndex = m_vLastParticles[i];
+		if ( nIndex < m_nParticles && HasUV(nIndex) )
+			dt.AddPoint( m_vParticles[nIndex].SurfaceVector().X(), m_vParticles[nIndex].SurfaceVector().Y(), (int)nIndex );
 	}
 
 	dt.Compute();
 	dt.SetEnclosingSegmentsProvided(false);
 	dt.SetSubdivideOuterSegments(false);
 	dt.SetSubdivideAnySegments(false);
-	dt.MakeTriMesh(m_uvMesh);
+	VFTriangleMesh uvMesh;
+	dt.MakeTriMesh(uvMesh);
 
-	const std::vector<int> & pointIDs = dt.GetOutputMarkers_MeshVtx();
-	size_t nPoints = pointIDs.size();
-	if ( m_uvMesh.GetMaxVertexID() != nPoints ) {
+	// output vertex markers are the particle indices
+	const std::vector<int> & vMarkers = dt.GetOutputMarkers_MeshVtx();
+	if ( uvMesh.GetMaxVertexID() != vMarkers.size() ) {
 		lgBreakToDebugger();
-		return false;
+		return;
+	}
+	IMesh::VertexID nTri[3];
+	VFTriangleMesh::triangle_iterator curt( uvMesh.BeginTriangles() ), endt( uvMesh.EndTriangles() );
+	for ( ; curt != endt; ++curt ) {
+		uvMesh.GetTriangle( *curt, nTri );
+		for ( int j = 0; j < 3; ++j )
+			m_vRegionTris.push_back( (unsigned int)vMarkers[ nTri[j] ] );
 	}
+}
 
-	// make 3D version
-	m_3dMesh.Copy(m_uvMesh);
-	for ( unsigned int i = 0; i < nPoints; ++i ) {
-		int nPointID = pointIDs[i];
-		IMesh::VertexID vID = nPointID;
-		ExpMapParticle * pParticle = m_vParticles[ m_vVtxToParticleMap[vID] ];
-		m_3dMesh.SetVertex( i, pParticle->Position(), &pParticle->Normal() );
+
+void ExpMapGenerator::GetUVGridCell( const Wml::Vector2f & vUV, unsigned int & nX, unsigned int & nY ) const
+{
+	float fX = (vUV.X() - m_vUVGridOrigin.X()) / m_fUVGridCellSize;
+	float fY = (vUV.Y() - m_vUVGridOrigin.Y()) / m_fUVGridCellSize;
+	nX = (fX <= 0.0f) ? 0 : std::min( (unsigned int)fX, m_nUVGridWidth-1 );
+	nY = (fY <= 0.0f) ? 0 : std::min( (unsigned int)fY, m_nUVGridHeight-1 );
+}
+
+
+unsigned int ExpMapGenerator::FindRegionTriangle( const Wml::Vector2f & vUV, float & fDistance ) const
+{
+	fDistance = std::numeric_limits<float>::max();
+	if ( m_nUVGridWidth == 0 )
+		return ExpMapParticle::InvalidIndex;
+
+	// containing triangle, from grid cell (if vUV is inside grid)
+	unsigned int nX, nY;
+	GetUVGridCell( vUV, nX, nY );
+	unsigned int nCell = nY*m_nUVGridWidth + nX;
+	const float fTol = -1.0e-5f;
+	float fBary[3];
+	for ( unsigned int k = m_vUVGridOffsets[nCell]; k < m_vUVGridOffsets[nCell+1]; ++k ) {
+		const unsigned int * pTri = &m_vRegionTris[ 3*m_vUVGridTris[k] ];
+		rms::BarycentricCoords( m_vParticles[pTri[0]].SurfaceVector(), m_vParticles[pTri[1]].SurfaceVector(),
+			m_vParticles[pTri[2]].SurfaceVector(), vUV, fBary[0], fBary[1], fBary[2] );
+		if ( fBary[0] >= fTol && fBary[1] >= fTol && fBary[2] >= fTol ) {
+			fDistance = 0.0f;
+			return m_vUVGridTris[k];
+		}
 	}
-		
-	m_uvBVTree.SetMesh(&m_uvMesh);
-	m_3dBVTree.SetMesh(&m_3dMesh);
 
-	return true;
+	// outside of region (or in a hole), find nearest triangle. Search rings of cells around 
+	// nX,nY until no cell in the next ring can be closer than the nearest triangle found so far
+	unsigned int nNearest = ExpMapParticle::InvalidIndex;
+	Wml::Vector3f vPoint( vUV.X(), vUV.Y(), 0.0f );
+	int nMaxRing = (int)std::max( m_nUVGridWidth, m_nUVGridHeight );
+	for ( int nRing = 0; nRing <= nMaxRing; ++nRing ) {
+		if ( nNearest != ExpMapParticle::InvalidIndex && fDistance <= (float)(nRing-1) * m_fUVGridCellSize )
+			break;
+		for ( int dy = -nRing; dy <= nRing; ++dy ) {
+			int nCellY = (int)nY + dy;
+			if ( nCellY < 0 || nCellY >= (int)m_nUVGridHeight )
+				continue;
+			int nStep = ( dy == -nRing || dy == nRing ) ? 1 : 2*nRing;
+			for ( int dx = -nRing; dx <= nRing; dx += nStep ) {
+				int nCellX = (int)nX + dx;
+				if ( nCellX < 0 || nCellX >= (int)m_nUVGridWidth )
+					continue;
+				nCell = nCellY*m_nUVGridWidth + nCellX;
+				for ( unsigned int k = m_vUVGridOffsets[nCell]; k < m_vUVGridOffsets[nCell+1]; ++k ) {
+					const unsigned int * pTri = &m_vRegionTris[ 3*m_vUVGridTris[k] ];
+					Wml::Triangle3f vTri;
+					for ( int j = 0; j < 3; ++j ) {
+						const Wml::Vector2f & vTriUV = m_vParticles[ pTri[j] ].SurfaceVector();
+						vTri.V[j] = Wml::Vector3f( vTriUV.X(), vTriUV.Y(), 0.0f );
+					}
+					float fTriDist = Wml::DistVector3Triangle3f( vPoint, vTri ).Get();
+					if ( fTriDist < fDistance ) {
+						fDistance = fTriDist;
+						nNearest = m_vUVGridTris[k];
+					}
+				}
+			}
+		}
+	}
+	return nNearest;
 }
 
 
@@ -429,17 +649,59 @@ Wml::Vector2f ExpMapGenerator::FindUV( const Wml::Vector3f & vPoint, bool * bSta
 	if (bStatus)
 		*bStatus = true;
 
+	// nearest point on surface. If it is not in a region triangle, use nearest region triangle instead
 	Wml::Vector3f vNearest;
 	IMesh::TriangleID tID;
-	if ( ! m_3dBVTree.FindNearest( vPoint, vNearest, tID ) ) {
-		if ( bStatus ) {
+	bool bRegionTree = ( m_regionMesh.GetTriangleCount() > 0 );
+	IMeshBVTree * pTree = ( bRegionTree ) ? &m_regionBVTree : m_pMeshBVTree;
+	if ( m_vRegionTris.empty() || ! pTree->FindNearest( vPoint, vNearest, tID ) ) {
+		if ( bStatus )
 			*bStatus = false;
-			return Wml::Vector2f::ZERO;
+		return Wml::Vector2f::ZERO;
+	}
+	unsigned int nTri[3];
+	if ( bRegionTree ) {
+		for ( int j = 0; j < 3; ++j )
+			nTri[j] = m_vRegionTris[3*tID+j];
+	} else
+		GetMesh()->GetTriangle( tID, nTri );
+	if ( ! HasUV(nTri[0]) || ! HasUV(nTri[1]) || ! HasUV(nTri[2]) ) {
+		// candidates are the region triangles around the hit triangle. If there are none, vPoint
+		// is well outside the region, and all region triangles are checked
+		std::vector<unsigned int> & vCandidates = m_vNeighbourBuf;
+		vCandidates.resize(0);
+		IMesh * pMesh = GetMesh();
+		for ( int j = 0; j < 3; ++j ) {
+			if ( ! HasUV(nTri[j]) )
+				continue;
+			IMesh::VtxNbrItr itr(nTri[j]);
+			pMesh->BeginVtxTriangles(itr);
+			for ( IMesh::TriangleID tNbrID = pMesh->GetNextVtxTriangle(itr); tNbrID != IMesh::InvalidID; tNbrID = pMesh->GetNextVtxTriangle(itr) ) {
+				IMesh::VertexID nNbrTri[3];
+				pMesh->GetTriangle( tNbrID, nNbrTri );
+				if ( HasUV(nNbrTri[0]) && HasUV(nNbrTri[1]) && HasUV(nNbrTri[2]) ) {
+					vCandidates.push_back( nNbrTri[0] );
+					vCandidates.push_back( nNbrTri[1] );
+					vCandidates.push_back( nNbrTri[2] );
+				}
+			}
+		}
+		const std::vector<unsigned int> & vSearchTris = ( vCandidates.empty() ) ? m_vRegionTris : vCandidates;
+
+		float fNearest = std::numeric_limits<float>::max();
+		unsigned int nTris = (unsigned int)vSearchTris.size() / 3;
+		for ( unsigned int t = 0; t < nTris; ++t ) {
+			const unsigned int * pTri = &vSearchTris[3*t];
+			Wml::Triangle3f vTri( m_pPositions[pTri[0]], m_pPositions[pTri[1]], m_pPositions[pTri[2]] );
+			Wml::DistVector3Triangle3f dquery( vPoint, vTri );
+			float fTriDist = dquery.Get();
+			if ( fTriDist < fNearest ) {
+				fNearest = fTriDist;
+				vNearest = dquery.GetClosestPoint1();
+				nTri[0] = pTri[0];  nTri[1] = pTri[1];  nTri[2] = pTri[2];
+			}
 		}
-		//lgBreakToDebugger();
 	}
-	Wml::Vector3f vTri[3];
-	m_3dMesh.GetTriangle( tID, vTri );
 
 	float fDist = (vPoint - vNearest).Length();
 	if ( fDist > 0.1f ) {
@@ -450,13 +712,12 @@ Wml::Vector2f ExpMapGenerator::FindUV( const Wml::Vector3f & vPoint, bool * bSta
 
 	float fBary[3];
 	rms::BarycentricCoords(
-		vTri[0], vTri[1], vTri[2], vPoint, fBary[0], fBary[1], fBary[2] );
+		m_pPositions[nTri[0]], m_pPositions[nTri[1]], m_pPositions[nTri[2]], vPoint, fBary[0], fBary[1], fBary[2] );
 
-	m_uvMesh.GetTriangle( tID, vTri );
 	return
-		fBary[0]*Wml::Vector2f(vTri[0].X(), vTri[0].Y()) + 
-		fBary[1]*Wml::Vector2f(vTri[1].X(), vTri[1].Y()) + 
-		fBary[2]*Wml::Vector2f(vTri[2].X(), vTri[2].Y());
+		fBary[0]*m_vParticles[nTri[0]].SurfaceVector() + 
+		fBary[1]*m_vParticles[nTri[1]].SurfaceVector() + 
+		fBary[2]*m_vParticles[nTri[2]].SurfaceVector();
 }
 
 
@@ -465,45 +726,33 @@ Wml::Vector3f ExpMapGenerator::Find3D( const Wml::Vector2f & vUV, Wml::Vector3f
 	if (bStatus)
 		*bStatus = true;
 
-	Wml::Vector3f vPoint(vUV.X(),vUV.Y(), 0.0f);
-	Wml::Vector3f vNearest;
-	IMesh::TriangleID tID;
-	if ( ! m_uvBVTree.FindNearest( vPoint, vNearest, tID ) ) {
-		if ( bStatus ) {
+	float fDist;
+	unsigned int nRegionTri = FindRegionTriangle( vUV, fDist );
+	if ( nRegionTri == ExpMapParticle::InvalidIndex ) {
+		if ( bStatus )
 			*bStatus = false;
-			return Wml::Vector3f::ZERO;
-		}
-		//lgBreakToDebugger();
+		return Wml::Vector3f::ZERO;
 	}
-	Wml::Vector3f vTri[3], vNorm[3];
-	m_uvMesh.GetTriangle( tID, vTri );
-
-	float fDist = (vPoint - vNearest).Length();
 	if ( fDist > 0.1f ) {
 		if ( bStatus )
 			*bStatus = false;
 		//lgBreakToDebugger();
 	}
 
+	const unsigned int * pTri = &m_vRegionTris[3*nRegionTri];
 	float fBary[3];
 	rms::BarycentricCoords(
-		Wml::Vector2f(vTri[0].X(), vTri[0].Y()),
-		Wml::Vector2f(vTri[1].X(), vTri[1].Y()),
-		Wml::Vector2f(vTri[2].X(), vTri[2].Y()),
+		m_vParticles[pTri[0]].SurfaceVector(),
+		m_vParticles[pTri[1]].SurfaceVector(),
+		m_vParticles[pTri[2]].SurfaceVector(),
 		vUV, fBary[0], fBary[1], fBary[2] );
 
-	//if ( fBary[0] < 0.0f || fBary[0] > 1.0f ||
-	//	 fBary[1] < 0.0f || fBary[1] > 1.0f ||
-	//	 fBary[2] < 0.0f || fBary[2] > 1.0f )
-	//	 lgBreakToDebugger();
-
-	m_3dMesh.GetTriangle( tID, vTri, vNorm );
 	if ( pNormal ) {
-		*pNormal = fBary[0]*vNorm[0] + fBary[1]*vNorm[1] + fBary[2]*vNorm[2];
+		*pNormal = fBary[0]*m_pNormals[pTri[0]] + fBary[1]*m_pNormals[pTri[1]] + fBary[2]*m_pNormals[pTri[2]];
 		pNormal->Normalize();
 	}
 
-	return fBary[0]*vTri[0] + fBary[1]*vTri[1] + fBary[2]*vTri[2];
+	return fBary[0]*m_pPositions[pTri[0]] + fBary[1]*m_pPositions[pTri[1]] + fBary[2]*m_pPositions[pTri[2]];
 }
 
 
@@ -512,30 +761,6 @@ Wml::Vector3f ExpMapGenerator::Find3D( const Wml::Vector2f & vUV, Wml::Vector3f
 // neighbour list setup code
 
 
-ExpMapParticle::ListEntry * ExpMapGenerator::GetNeighbourList( ExpMapParticle * pParticle )
-{
-	if ( pParticle->GetNeighbourList() == NULL ) {
-		m_vNeighbourBuf.resize(0);
-		if ( m_bUseMeshNeighbours ) 
-			FindNeighbours(pParticle, m_vNeighbourBuf);
-		else
-			FindNeighbours( pParticle->Position(), pParticle->Normal(), m_vNeighbourBuf, m_fMaxNbrDist, pParticle );	
-
-		size_t nCount = m_vNeighbourBuf.size();
-		for ( unsigned int i = 0; i < nCount; ++i ) {
-			ExpMapParticle::ListEntry * pEntry = m_NeighbourMemoryPool.Allocate();
-			pEntry->pParticle = m_vNeighbourBuf[i];
-			pParticle->AddNeighbour(pEntry);
-		}
-	}
-
-	if ( pParticle != m_pSeedParticle )
-		SetSmoothNormal(pParticle, pParticle->GetNeighbourList(), m_bUseNeighbourNormalSmoothing);		
-	
-	return pParticle->GetNeighbourList();
-}
-
-
 class  NeighborTriBuffer : public IMesh::NeighborTriCallback
 {
 public:
@@ -553,139 +778,154 @@ protected:
 };
 
 
-void ExpMapGenerator::FindNeighbours( ExpMapParticle * pParticle,
-									  std::vector<ExpMapParticle *> & vParticles)
+void ExpMapGenerator::FindNeighbours( unsigned int nParticle, std::vector<unsigned int> & vNbrs )
 {
-	vParticles.resize(0);
-
-	IMesh::VertexID vID = pParticle->VertexID();
-
-	NeighborTriBuffer vBuffer;
-	GetMesh()->NeighbourIteration(vID, &vBuffer);
-	const std::vector<IMesh::TriangleID> & vTris = vBuffer.Triangles();
-	size_t nCount = vTris.size();
-	for ( unsigned int i = 0; i < nCount; ++i ) {
-		IMesh::VertexID nTri[3];
-		GetMesh()->GetTriangle( vTris[i], nTri);
-
-		// check each vertex
-		for ( int j = 0; j < 3; ++j ) {
-			if ( nTri[j] == vID )
-				continue;
-			ExpMapParticle * pParticle = m_vParticles[ m_vVtxToParticleMap[nTri[j]] ];
-			bool bFound = false;
-			for ( unsigned int k = 0; k < vParticles.size() && ! bFound; ++k ) {
-				if ( vParticles[k] == pParticle )
-					bFound = true;
-			}
-			if ( ! bFound )
-				vParticles.push_back( pParticle );
-		}
-	}
+	ExpMapSurfaceCache::FindMeshNeighbours( GetMesh(), nParticle, vNbrs );
 }
 
 
 
+void ExpMapGenerator::FindNeighbours( const Wml::Vector3f & vPoint, std::vector<unsigned int> & vNbrs, 
+									  float fRadiusThreshold, unsigned int nSkip )
+{
+	if ( HasNeighbourLists() )
+		m_pSurfaceCache->FindNeighbours( vPoint, vNbrs, fRadiusThreshold, nSkip );
+	else
+		ExpMapSurfaceCache::FindGridNeighbours( m_particleGrid, m_pPositions, vPoint, vNbrs, fRadiusThreshold, nSkip );
+}
 
-#define USE_KNN
 
-bool ParticleDistanceSort( ExpMapParticle * p1, ExpMapParticle * p2 )
+void ExpMapGenerator::InitializeNeighbourLists( )
 {
-	return p1->SurfaceDistance() < p2->SurfaceDistance();
+	if ( HasNeighbourLists() )
+		return;
+
+	float fThreshold = (m_bUseMeshNeighbours) ? 0.0f : m_fAvgEdgeLength;
+	ExpMapSurfaceCache * pCache = ExpMapSurfaceCache::Create( m_pVFMesh, m_pIMesh, fThreshold, 
+		m_bUseNeighbourNormalSmoothing, m_fMaxEdgeLength );
+	SetSurfaceCache( pCache );
+	pCache->Release();
 }
 
 
-void ExpMapGenerator::FindNeighbours( const Wml::Vector3f & vPoint, const Wml::Vector3f & vNormal,
-									  std::vector<ExpMapParticle *> & vParticles, float fRadiusThreshold,
-									  ExpMapParticle * pSkip )
+void ExpMapGenerator::SetSurfaceCache( ExpMapSurfaceCache * pCache )
 {
-	float fDistSqrThreshold = fRadiusThreshold*fRadiusThreshold;
+	if ( pCache == m_pSurfaceCache.Get() )
+		return;
+	if ( pCache && ( pCache->GetMesh() != GetMesh() || pCache->GetParticleCount() != m_nParticles ) ) {
+		lgBreakToDebugger();		// cache was built for a different surface
+		return;
+	}
 
-	std::vector<ExpMapParticle *> vNeighbours;
-	const unsigned int sMaxNbrs = 15;
-//	const unsigned int sMaxNbrs = 8;
+	ClearNeighbourLists();
+	if ( pCache == NULL ) {
+		InitializeParticlePositions();
+		return;
+	}
 
-rinse_and_repeat:
+	// the cache decides the neighbour type and normal smoothing, replacing the current settings
+	m_pSurfaceCache.Set( pCache );
+	m_bUseMeshNeighbours = ( pCache->GetNeighbourThreshold() == 0.0f );
+	m_fMaxNbrDist = pCache->GetNeighbourThreshold();
+	m_bUseNeighbourNormalSmoothing = pCache->GetSmoothNormals();
+
+	m_pPositions = pCache->GetPositions();
+	m_pNormals = pCache->GetNormals();
+	m_pTangents = pCache->GetTangents();
+	m_pNbrOffsets = pCache->GetNeighbourOffsets();
+	m_pNbrs = pCache->GetNeighbours();
+	std::vector<Wml::Vector3f>().swap(m_vPositionBuf);
+	std::vector<Wml::Vector3f>().swap(m_vNormalBuf);
+	std::vector<Wml::Vector3f>().swap(m_vTangents);
+	m_bLastExpMapValid = false;
+}
 
-	vNeighbours.resize(0);
-	ParticleGrid<ExpMapParticle *>::BoxIterator itr( &m_particleGrid, vPoint, fRadiusThreshold );
-	if ( itr.Done() ) {
-		fRadiusThreshold *= 1.5f;
-		goto rinse_and_repeat;
-	}
-	while ( ! itr.Done() ) {
-		ExpMapParticle * pTmp = *itr;
-		++itr;
 
-		if ( pTmp == pSkip )
-			continue;
 
-		float fDistSqr = ( pTmp->Position() - vPoint ).SquaredLength();
-		//float fNormalDir = pTmp->Normal().Dot( vNormal );
-		//if ( fDistSqr < fDistSqrThreshold && fNormalDir > -0.1f) {
-		//if ( fDistSqr < fDistSqrThreshold ) {
-		if ( true ) {
-			pTmp->SurfaceDistance() = fDistSqr;
-			vNeighbours.push_back( pTmp );
-		} 
+void ExpMapGenerator::PrepareNeighbourLists()
+{
+	if ( ! m_bUseLocalizedQueries || HasNeighbourLists() ) {
+		InitializeNeighbourLists();
+		return;
 	}
 
-	size_t nFoundNbrs = vNeighbours.size();
-	if ( nFoundNbrs < sMaxNbrs/2 ) {
-		for ( unsigned int k = 0; k < nFoundNbrs; ++k )
-			vNeighbours[k]->SurfaceDistance() = std::numeric_limits<float>::max();
-		fRadiusThreshold *= 1.5f;
-		goto rinse_and_repeat;
+	if (! m_bUseMeshNeighbours ) {
+		m_fMaxNbrDist = m_fAvgEdgeLength;
+		InitializeParticleGrid(m_fMaxNbrDist);
 	}
+	if ( ! m_vLocalNbrRanges.empty() )
+		return;
 
-	std::sort( vNeighbours.begin(), vNeighbours.end(), ParticleDistanceSort );
-	unsigned int nMaxNbrs;
-
-	if (sMaxNbrs < nFoundNbrs)
-	  nMaxNbrs = (unsigned int)sMaxNbrs;
-	else
-	  nMaxNbrs = (unsigned int)nFoundNbrs;
-	// = (unsigned int)std::min(sMaxNbrs, nFoundNbrs );
-	for ( unsigned int k = 0; k < nFoundNbrs; ++k )
-		vNeighbours[k]->SurfaceDistance() = std::numeric_limits<float>::max();
-
-	vParticles.resize(nMaxNbrs);
-	for ( unsigned int i = 0; i < nMaxNbrs; ++i ) {
-		vParticles[i] = vNeighbours[i];
+	// nothing is computed until particles are reached, this just allocates the per-particle arrays
+	m_vLocalNbrRanges.resize( 2*m_nParticles, ExpMapParticle::InvalidIndex );
+	m_vNbrs.resize(0);
+	const float * pMeshNormals = (m_pVFMesh) ? m_pVFMesh->GetNormalBuffer() : NULL;
+	if ( pMeshNormals && ! m_bUseNeighbourNormalSmoothing ) {
+		std::vector<Wml::Vector3f>().swap(m_vNormalBuf);
+		m_pNormals = (const Wml::Vector3f *)pMeshNormals;
+	} else {
+		m_vNormalBuf.resize( m_nParticles + 1 );
+		m_pNormals = &m_vNormalBuf[0];
 	}
+	m_vTangents.resize( m_nParticles );
+	m_pTangents = &m_vTangents[0];
 }
 
 
-void ExpMapGenerator::InitializeNeighbourLists( )
+void ExpMapGenerator::InitializeLocalParticle( unsigned int i )
 {
-	if (! m_bUseMeshNeighbours ) {
-		// find max nbr dist
-		m_fMaxNbrDist = m_fAvgEdgeLength;
-		InitializeParticleGrid(m_fMaxNbrDist);
-	}
+	if ( m_vLocalNbrRanges[2*i] != ExpMapParticle::InvalidIndex )
+		return;
 
-	if ( m_bPrecomputeNeighbours && ! m_bNeighbourListsValid ) {
-		// force nbr generation for all particles
-		size_t nParticleCount = m_vParticles.size();	
-		for ( unsigned int i = 0; i < nParticleCount; ++i ) {
-			ExpMapParticle::ListEntry * pCur = GetNeighbourList(m_vParticles[i]);
+	// same neighbours, normal and tangent as InitializeNeighbourLists() would compute
+	if ( m_bUseMeshNeighbours ) 
+		FindNeighbours( i, m_vNeighbourBuf );
+	else
+		FindNeighbours( m_pPositions[i], m_vNeighbourBuf, m_fMaxNbrDist, i );
+	m_vLocalNbrRanges[2*i] = (unsigned int)m_vNbrs.size();
+	m_vNbrs.insert( m_vNbrs.end(), m_vNeighbourBuf.begin(), m_vNeighbourBuf.end() );
+	m_vLocalNbrRanges[2*i+1] = (unsigned int)m_vNbrs.size();
+
+	if ( ! m_vNormalBuf.empty() ) {
+		IMesh * pMesh = GetMesh();
+		Wml::Vector3f vNormal;
+		pMesh->GetNormal( i, vNormal );
+		size_t nNbrs = m_vNeighbourBuf.size();
+		if ( m_bUseNeighbourNormalSmoothing && nNbrs > 0 ) {
+			float fWeightSum = 0.0f;
+			Wml::Vector3f vAverage = Wml::Vector3f::ZERO;
+			for ( unsigned int j = 0; j < nNbrs; ++j ) {
+				unsigned int nNbr = m_vNeighbourBuf[j];
+				float fWeight = 1.0f / ( (m_pPositions[i] - m_pPositions[nNbr]).Length() + (0.0001f*m_fMaxEdgeLength) );
+				pMesh->GetNormal( nNbr, vNormal );
+				vAverage += fWeight * vNormal;
+				fWeightSum += fWeight;
+			}
+			vAverage /= fWeightSum;
+			vAverage.Normalize();
+			vNormal = vAverage;
 		}
-
-		m_bNeighbourListsValid = true;
+		m_vNormalBuf[i] = vNormal;
 	}
+
+	Wml::Vector3f vNormal( m_pNormals[i] ), vTangent2;
+	vNormal.Normalize();
+	rms::ComputePerpVectors( vNormal, m_vTangents[i], vTangent2, true );
 }
 
 
 
 void ExpMapGenerator::ClearNeighbourLists()
 {
-	size_t nParticleCount = m_vParticles.size();
-	for ( unsigned int i = 0; i < nParticleCount; ++i ) {
-		m_vParticles[i]->ClearNeighbourList();
+	if ( HasNeighbourLists() ) {
+		m_pSurfaceCache.Set( NULL );
+		m_pPositions = m_pNormals = m_pTangents = NULL;
 	}
-	m_NeighbourMemoryPool.ClearAll();
-
-	m_bNeighbourListsValid = false;
+	m_pNbrOffsets = m_pNbrs = NULL;
+	std::vector<unsigned int>().swap(m_vNbrs);
+	std::vector<unsigned int>().swap(m_vLocalNbrRanges);
+	m_vSeedNbrs.resize(0);
+	m_bSeedValid = false;
 }
 
 
@@ -702,56 +942,18 @@ void ExpMapGenerator::InitializeParticleGrid(float fCellSize)
 {
 	if (m_bParticleGridValid == true )
 		return;
-
-	Wml::AxisAlignedBox3f partBounds;
-	size_t nParticleCount = m_vParticles.size();	
-	for ( unsigned int i = 0; i < nParticleCount; ++i ) {
-		ExpMapParticle * pCur = m_vParticles[i];
-		if ( i == 0 )
-			partBounds = Wml::AxisAlignedBox3f( 
-			pCur->Position().X(), pCur->Position().X(),
-			pCur->Position().Y(), pCur->Position().Y(),
-			pCur->Position().Z(), pCur->Position().Z() );
-		else
-			rms::Union( partBounds, pCur->Position() );
-	}
-	// dilate by one cell
-	for ( int k = 0; k < 3; ++k ) {
-		partBounds.Min[k] -= fCellSize;
-		partBounds.Max[k] += fCellSize;
-	}
-
-	m_particleGrid.Initialize( rms::Center(partBounds), fCellSize );
-
-	// add each particle
-	for ( unsigned int i = 0; i < nParticleCount; ++i ) {
-		ExpMapParticle * pCur = m_vParticles[i];
-
-		m_particleGrid.AddParticle( pCur, pCur->Position() );
-	}
-
+	ExpMapSurfaceCache::BuildParticleGrid( m_particleGrid, GetMesh(), m_pPositions, fCellSize );
 	m_bParticleGridValid = true;
 }	
 
 
-void ExpMapGenerator::InitializeParticles( ExpMapParticle * pSkip )
+void ExpMapGenerator::InitializeParticles()
 {
-	if ( m_vLastParticles.empty() ) {
-		size_t nParticleCount = m_vParticles.size();
-		for ( unsigned int i = 0; i < nParticleCount; ++i ) {
-			if ( m_vParticles[i] == pSkip )
-				continue;
-			m_vParticles[i]->Clear();
-		}
-	} else {
-		size_t nCount = m_vLastParticles.size();
-		for ( unsigned int i = 0; i < nCount; ++i ) {
-			if ( m_vLastParticles[i] == pSkip )
-				continue;
-			m_vLastParticles[i]->Clear();
-		}
-		m_vLastParticles.resize(0);
-	}
+	// only the particles touched by the last expmap need to be cleared
+	size_t nCount = m_vLastParticles.size();
+	for ( unsigned int i = 0; i < nCount; ++i )
+		m_vParticles[ m_vLastParticles[i] ].Clear();
+	m_vLastParticles.resize(0);
 }
 
 
@@ -768,13 +970,9 @@ void ExpMapGenerator::SetSurfaceDistances( const Wml::Vector3f & vSeedPoint, flo
 {
 	_RMSTUNE_start(4);
 
-	// create seed particle
-	InitializeNeighbourLists();
-	InitializeSeedParticle( vSeedPoint, & pSeedFrame->Z(), pSeedFrame );
-
 	// compute approximate geodesic distances to seed particle
 	m_fLastMaxRadius = fStopDistance;
-	ComputeExpMap( fStopDistance, 3 );
+	ComputeExpMap( vSeedPoint, *pSeedFrame, fStopDistance, 3 );
 
 	_RMSTUNE_end(4);
 	//_RMSInfo("Total time was %f\n", _RMSTUNE_time(4) );
@@ -785,11 +983,12 @@ void ExpMapGenerator::SetSurfaceDistances( const Frame3f & vSeedFrame, float fNe
 	_RMSTUNE_start(4);
 
 	// create seed particle
-	InitializeNeighbourLists();
+	PrepareNeighbourLists();
 	InitializeSeedParticle( vSeedFrame.Origin(), & vSeedFrame.Z(), &vSeedFrame );
 
 	// compute approximate geodesic distances to seed particle
 	ComputeExpMap( std::numeric_limits<float>::max(), nMaxCount );
+	m_bLastExpMapValid = false;
 
 	_RMSTUNE_end(4);
 //	_RMSInfo("Total time was %f\n", _RMSTUNE_time(4) );
@@ -800,12 +999,8 @@ void ExpMapGenerator::SetSurfaceDistances( const Frame3f & vSeedFrame, float fNe
 {
 	_RMSTUNE_start(4);
 
-	// create seed particle
-	InitializeNeighbourLists();
-	InitializeSeedParticle( vSeedFrame.Origin(), & vSeedFrame.Z(), &vSeedFrame );
-
 	// compute approximate geodesic distances to seed particle
-	ComputeExpMap( fStopDistance, nMaxCount );
+	ComputeExpMap( vSeedFrame.Origin(), vSeedFrame, fStopDistance, nMaxCount );
 
 	_RMSTUNE_end(4);
 	//_RMSInfo("Total time was %f\n", _RMSTUNE_time(4) );
@@ -817,164 +1012,345 @@ void ExpMapGenerator::SetSurfaceDistances( const Frame3f & vSeedFrame, float fNe
 void ExpMapGenerator::ComputeExpMap( float fStopDistance, unsigned int nMaxCount )
 {
 	// set all particle distances to max and state to inactive
-	size_t nParticleCount = m_vParticles.size();
-	InitializeParticles( m_pSeedParticle );
+	InitializeParticles();
+
+	if ( m_bUseIndexedQueue ) {
+		ComputeExpMap( fStopDistance, nMaxCount, m_particleQueue );
+	} else {
+		std::multiset< ParticleQueueWrapper > pq;
+		ComputeExpMap( fStopDistance, nMaxCount, pq );
+	}
+}
+
 
+template<class Queue>
+void ExpMapGenerator::ComputeExpMap( float fStopDistance, unsigned int nMaxCount, Queue & pq )
+{
 	// now initialize pq
-	std::multiset< ParticleQueueWrapper > pq;
-	UpdateNeighbours( m_pSeedParticle, pq );
+	UpdateNeighbours( SeedIndex(), pq );
+
+	PropagateFront( fStopDistance, nMaxCount, 0, pq );
+}
 
+
+template<class Queue>
+void ExpMapGenerator::PropagateFront( float fStopDistance, unsigned int nMaxCount, unsigned int nTouched, Queue & pq )
+{
 	// run until pq is empty
 	float fStopDistSquare = fStopDistance / (float)sqrt(2.0f);
 	// float fCurMaxGeoDist = 0;
-	unsigned int nTouched = 0;
 	while ( ! pq.empty() ) {
 
 		if ( fStopDistance == std::numeric_limits<float>::max() && nTouched >= nMaxCount )
 			break;
 
 		// pop front	
-		// ExpMapParticle * pFront = pq.begin()->Particle();
-
-		ExpMapParticle * pFront = pq.begin()->Particle();
-		pq.erase( pq.begin() );
+		unsigned int nFront = PopFront( pq );
+		ExpMapParticle & front = m_vParticles[nFront];
 
 		// freeze particle
-		pFront->State() = ExpMapParticle::Frozen;
-		m_vLastParticles.push_back( pFront );
+		front.SetState( ExpMapParticle::Frozen );
+		m_vLastParticles.push_back( nFront );
+		if ( ! HasNeighbourLists() )
+			InitializeLocalParticle( nFront );
 
 		// set frame for pFront
 		if ( m_bUseUpwindAveraging ) 
-			PropagateFrameFromNearest_Average( pFront );
+			PropagateFrameFromNearest_Average( nFront );
 		else
-			PropagateFrameFromNearest( pFront );
+			PropagateFrameFromNearest( nFront );
 
-		if ( pFront->SurfaceDistance() > fStopDistance && nTouched >= nMaxCount )
+		if ( front.SurfaceDistance() > fStopDistance && nTouched >= nMaxCount )
 			continue;
 
 		// Square-culling. This gives a significant speed-up...
 		if ( m_bEnableSquareCulling ) {
-			if ( (float)abs(pFront->SurfaceVector().X()) > fStopDistSquare || 
-				(float)abs(pFront->SurfaceVector().Y()) > fStopDistSquare )
+			if ( (float)abs(front.SurfaceVector().X()) > fStopDistSquare || 
+				(float)abs(front.SurfaceVector().Y()) > fStopDistSquare )
 				continue;
 		} 
 
 		if ( m_bUseClipPoly ) {
-			bool bIsInside = m_ClipPoly.IsInside( pFront->SurfaceVector() );
-			if ( ! bIsInside ) {
-				ExpMapParticle::ListEntry * pCur = GetNeighbourList( pFront );
-				while (! bIsInside &&  pCur != NULL ) {
-					ExpMapParticle * pCurParticle = pCur->pParticle;
-					pCur = pCur->pNext;
-					if ( pCurParticle->State() == ExpMapParticle::Frozen &&
-						 m_ClipPoly.IsInside( pCurParticle->SurfaceVector() ) )
-							bIsInside = true;
-				}
+			bool bIsInside = m_ClipPoly.IsInside( front.SurfaceVector() );
+			unsigned int nNbrs;
+			const unsigned int * pNbrs = GetNeighbours( nFront, nNbrs );
+			for ( unsigned int k = 0; ! bIsInside && k < nNbrs; ++k ) {
+				const ExpMapParticle & nbr = m_vParticles[ pNbrs[k] ];
+				if ( nbr.State() == ExpMapParticle::Frozen && m_ClipPoly.IsInside( nbr.SurfaceVector() ) )
+					bIsInside = true;
 			}
 			if ( ! bIsInside )
 				continue;
 		}
 
 		// update neighbours
-		RemoveNeighbours( pFront, pq );
-		UpdateNeighbours( pFront, pq );
+		UpdateNeighbours( nFront, pq );
 		++nTouched;
 	}
 //	_RMSInfo("Touched %d particles while updating\n", nTouched);
+	m_nLastExpanded = nTouched;
 
 	// mark any left-over particles for cleanup
+	FlushQueue( pq );
+}
+
+
+
+void ExpMapGenerator::ComputeExpMap( const Wml::Vector3f & vSeedPoint, const Frame3f & vSeedFrame, float fStopDistance, unsigned int nMaxCount )
+{
+	bool bRotated = false;
+	bool bUpdate = CanUpdateExpMap( vSeedPoint, vSeedFrame, fStopDistance, nMaxCount, bRotated );
+	Frame3f vLastSeedFrame( GetSeedFrame() );
+
+	// create seed particle. The seed neighbours and frame only depend on the seed frame, so 
+	// for an update this re-creates the same seed (up to the rotation)
+	PrepareNeighbourLists();
+	InitializeSeedParticle( vSeedPoint, & vSeedFrame.Z(), &vSeedFrame );
+
+	if ( bUpdate ) {
+		if ( bRotated )
+			RotateSurfaceVectors( vLastSeedFrame );
+		if ( fStopDistance != m_fLastStopDistance || nMaxCount != m_nLastMaxCount )
+			UpdateExpMapRadius( fStopDistance, nMaxCount );
+	} else
+		ComputeExpMap( fStopDistance, nMaxCount );
+
+	// the expanded particles are only a prefix of m_vLastParticles if nothing was culled
+	m_bLastExpMapValid = m_bUseIncrementalUpdate && m_bUseIndexedQueue
+		&& ! m_bEnableSquareCulling && ! m_bUseClipPoly && fStopDistance != std::numeric_limits<float>::max();
+	m_vLastSeedPoint = vSeedPoint;
+	m_vLastSeedFrame = vSeedFrame;
+	m_fLastStopDistance = fStopDistance;
+	m_nLastMaxCount = nMaxCount;
+}
+
+
+bool ExpMapGenerator::CanUpdateExpMap( const Wml::Vector3f & vSeedPoint, const Frame3f & vSeedFrame, 
+									   float fStopDistance, unsigned int nMaxCount, bool & bRotated )
+{
+	if ( ! m_bLastExpMapValid || ! m_bUseIncrementalUpdate || fStopDistance == std::numeric_limits<float>::max() )
+		return false;
+
+	// seed must not have moved
+	float fTol = 0.00001f * m_fAvgEdgeLength;
+	if ( (vSeedPoint - m_vLastSeedPoint).SquaredLength() > fTol*fTol ||
+		 (vSeedFrame.Origin() - m_vLastSeedFrame.Origin()).SquaredLength() > fTol*fTol )
+		return false;
+	const float fDotTol = 1.0f - 0.000001f;
+	if ( vSeedFrame.Z().Dot( m_vLastSeedFrame.Z() ) < fDotTol )
+		return false;
+	bRotated = ( vSeedFrame.X().Dot( m_vLastSeedFrame.X() ) < fDotTol );
+
+	// new front must expand a superset or a subset of the last one
+	bool bGrow = ( fStopDistance >= m_fLastStopDistance && nMaxCount >= m_nLastMaxCount );
+	bool bShrink = ( fStopDistance <= m_fLastStopDistance && nMaxCount <= m_nLastMaxCount );
+	return bGrow || bShrink;
+}
+
+
+void ExpMapGenerator::RotateSurfaceVectors( const Frame3f & vLastSeedFrame )
+{
+	// surface vectors are coordinates in the seed tangent frame. Both frames share the 
+	// same normal, so re-expressing them in the new frame is a 2D rotation
+	const Frame3f & vSeedFrame = m_vSeedFrame;
+	Wml::Vector2f vRotate( vSeedFrame.X().Dot( vLastSeedFrame.X() ), vSeedFrame.X().Dot( vLastSeedFrame.Y() ) );
+	vRotate.Normalize();
+	float fCos = vRotate.X(), fSin = vRotate.Y();
+
+	size_t nCount = m_vLastParticles.size();
+	for ( unsigned int i = 0; i < nCount; ++i ) {
+		ExpMapParticle & particle = m_vParticles[ m_vLastParticles[i] ];
+		if ( particle.State() != ExpMapParticle::Frozen )
+			continue;
+		Wml::Vector2f & vUV = particle.SurfaceVector();
+		vUV = Wml::Vector2f( fCos*vUV.X() + fSin*vUV.Y(), -fSin*vUV.X() + fCos*vUV.Y() );
+	}
+}
+
+
+void ExpMapGenerator::UpdateExpMapRadius( float fStopDistance, unsigned int nMaxCount )
+{
+	// Particles are expanded in the order they are frozen, so a run with a larger (smaller) 
+	// radius expands a longer (shorter) prefix of the same sequence. The particles expanded by
+	// both runs keep their distances and frames, everything else is propagated again.
+	unsigned int nKeep = m_nLastExpanded;
+	if ( fStopDistance < m_fLastStopDistance || nMaxCount < m_nLastMaxCount ) {
+		for ( unsigned int i = nMaxCount; i < nKeep; ++i ) {
+			if ( m_vParticles[ m_vLastParticles[i] ].SurfaceDistance() > fStopDistance ) {
+				nKeep = i;
+				break;
+			}
+		}
+	}
+
+	size_t nCount = m_vLastParticles.size();
+	for ( unsigned int i = nKeep; i < nCount; ++i )
+		m_vParticles[ m_vLastParticles[i] ].Clear();
+	m_vLastParticles.resize(nKeep);
+
+	// rebuild front by replaying neighbour updates of kept particles (this does not touch
+	// frozen particles, so only the distances of the front are recomputed)
+	UpdateNeighbours( SeedIndex(), m_particleQueue );
+	for ( unsigned int i = 0; i < nKeep; ++i )
+		UpdateNeighbours( m_vLastParticles[i], m_particleQueue );
+
+	PropagateFront( fStopDistance, nMaxCount, nKeep, m_particleQueue );
+}
+
+
+
+unsigned int ExpMapGenerator::PopFront( ParticleQueue & pq )
+{
+	return pq.Pop();
+}
+
+void ExpMapGenerator::FlushQueue( ParticleQueue & pq )
+{
+	unsigned int nCount = pq.Size();
+	for ( unsigned int i = 0; i < nCount; ++i ) {
+		m_vParticles[ pq[i] ].SurfaceDistance() = std::numeric_limits<float>::max();
+		m_vLastParticles.push_back( pq[i] );
+	}
+	pq.Clear();
+}
+
+void ExpMapGenerator::UpdateNeighbours( unsigned int nParticle, ParticleQueue & pq )
+{
+	// iterate through neighbours, updating particle distances. Active particles are
+	// already in the heap, so they only need to move up if their distance decreased
+	unsigned int nNbrs;
+	const unsigned int * pNbrs = GetNeighbours( nParticle, nNbrs );
+	if ( nNbrs == 0 ) lgBreakToDebugger();
+
+	const Wml::Vector3f & vPosition = Position(nParticle);
+	float fDistance = m_vParticles[nParticle].SurfaceDistance();
+	for ( unsigned int k = 0; k < nNbrs; ++k ) {
+		unsigned int nNbr = pNbrs[k];
+		ExpMapParticle & nbr = m_vParticles[nNbr];
+
+		// skip inactive particles
+		if ( nbr.State() == ExpMapParticle::Frozen )
+			continue;
+
+		// compute new distance
+		float fDistToPoint = (vPosition - m_pPositions[nNbr]).Length();
+		float fSurfDist = fDistToPoint + fDistance;
+
+		// update particle distance and/or nearest particle
+		bool bUpdated = false;
+		if ( fSurfDist < nbr.SurfaceDistance() ) {
+			nbr.Nearest() = nParticle;
+			nbr.SurfaceDistance() = fSurfDist;
+			bUpdated = true;
+		}
+		if ( nbr.SurfaceDistance() < std::numeric_limits<float>::max() && nbr.Nearest() == ExpMapParticle::InvalidIndex )
+			lgBreakToDebugger();
+
+		// insert new particles into priority queue, or move updated ones
+		if ( nbr.State() != ExpMapParticle::Active ) {
+			nbr.SetState( ExpMapParticle::Active );
+			pq.Insert( nNbr );
+		} else if ( bUpdated ) {
+			lgASSERT( pq.Contains( nNbr ) );
+			pq.DecreaseKey( nNbr );
+		}
+	}	
+}
+
+
+
+unsigned int ExpMapGenerator::PopFront( std::multiset< ParticleQueueWrapper > & pq )
+{
+	unsigned int nFront = pq.begin()->Index();
+	pq.erase( pq.begin() );
+	return nFront;
+}
+
+void ExpMapGenerator::FlushQueue( std::multiset< ParticleQueueWrapper > & pq )
+{
 	std::multiset<ParticleQueueWrapper>::iterator cur(pq.begin()), end(pq.end());
 	while ( cur != end ) {
-		(*cur).Particle()->SurfaceDistance() = std::numeric_limits<float>::max();
-		m_vLastParticles.push_back( (*cur).Particle() );
+		m_vParticles[ (*cur).Index() ].SurfaceDistance() = std::numeric_limits<float>::max();
+		m_vLastParticles.push_back( (*cur).Index() );
 		++cur;
 	}
+	pq.clear();
 }
 
 
 
 
-void ExpMapGenerator::RemoveNeighbours( ExpMapParticle * pParticle, std::multiset< ParticleQueueWrapper > & pq )
+void ExpMapGenerator::RemoveNeighbours( unsigned int nParticle, std::multiset< ParticleQueueWrapper > & pq )
 {
-	ExpMapParticle::ListEntry * pCur = GetNeighbourList( pParticle );
-	if ( pCur == NULL ) lgBreakToDebugger();
-	while ( pCur != NULL ) {
+	unsigned int nNbrs;
+	const unsigned int * pNbrs = GetNeighbours( nParticle, nNbrs );
+	if ( nNbrs == 0 ) lgBreakToDebugger();
+	for ( unsigned int k = 0; k < nNbrs; ++k ) {
 
-		ExpMapParticle * pCurParticle = pCur->pParticle;
-		pCur = pCur->pNext;
+		unsigned int nNbr = pNbrs[k];
+		const ExpMapParticle & nbr = m_vParticles[nNbr];
 
-		if ( pCurParticle->State() != ExpMapParticle::Active )
+		if ( nbr.State() != ExpMapParticle::Active )
 			continue;
 
 		// find entry in pq
-#if 1
 		std::multiset<ParticleQueueWrapper>::iterator found( 
-			pq.find( ParticleQueueWrapper( pCurParticle->SurfaceDistance() ) ) );
+			pq.find( ParticleQueueWrapper( nbr.SurfaceDistance() ) ) );
 		if ( found != pq.end() ) {
 
-			while ( (*found).Particle() != pCurParticle &&
-						(*found).QueueValue() == pCurParticle->SurfaceDistance() )
+			while ( (*found).Index() != nNbr &&
+						(*found).QueueValue() == nbr.SurfaceDistance() )
 				++found;
 
 			// [RMS: this should always happen...]
-			lgASSERT( (*found).Particle() == pCurParticle );
-			if ( (*found).Particle() == pCurParticle ) {
+			lgASSERT( (*found).Index() == nNbr );
+			if ( (*found).Index() == nNbr ) {
 				pq.erase( found );
 			}
 		} else {
 			lgASSERT( found != pq.end() );
 		}
-
-#else 
-		std::multiset<ParticleQueueWrapper>::iterator cur( pq.begin() );
-		bool bFound = false;
-		while ( !bFound && cur != pq.end() ) {
-			if ( (*cur).Particle() == pCurParticle ) {
-				pq.erase( cur );
-				bFound = true;
-			} else
-				++cur;
-		}
-		lgASSERT( bFound );
-#endif
-
 	}
 }
 
 
-void ExpMapGenerator::UpdateNeighbours( ExpMapParticle * pParticle, std::multiset< ParticleQueueWrapper > & pq )
+void ExpMapGenerator::UpdateNeighbours( unsigned int nParticle, std::multiset< ParticleQueueWrapper > & pq )
 {
+	// queue entries are keyed on distance, so active neighbours have to be removed before updating
+	RemoveNeighbours( nParticle, pq );
+
 	// iterate through neighbours, updating particle distances and pushing onto pq
-	ExpMapParticle::ListEntry * pCur = GetNeighbourList( pParticle );
-	if ( pCur == NULL ) lgBreakToDebugger();
-	while ( pCur != NULL ) {
+	unsigned int nNbrs;
+	const unsigned int * pNbrs = GetNeighbours( nParticle, nNbrs );
+	if ( nNbrs == 0 ) lgBreakToDebugger();
 
-		ExpMapParticle * pCurParticle = pCur->pParticle;
-		pCur = pCur->pNext;
+	const Wml::Vector3f & vPosition = Position(nParticle);
+	float fDistance = m_vParticles[nParticle].SurfaceDistance();
+	for ( unsigned int k = 0; k < nNbrs; ++k ) {
+		unsigned int nNbr = pNbrs[k];
+		ExpMapParticle & nbr = m_vParticles[nNbr];
 
 		// skip inactive particles
-		if ( pCurParticle->State() == ExpMapParticle::Frozen )
+		if ( nbr.State() == ExpMapParticle::Frozen )
 			continue;
 
 		// set active state
-		pCurParticle->State() = ExpMapParticle::Active;
+		nbr.SetState( ExpMapParticle::Active );
 
 		// compute new distance
-		float fDistToPoint = (pParticle->Position() - pCurParticle->Position()).Length();
-		float fSurfDist = fDistToPoint + pParticle->SurfaceDistance();
+		float fDistToPoint = (vPosition - m_pPositions[nNbr]).Length();
+		float fSurfDist = fDistToPoint + fDistance;
 
 		// update particle distance and/or nearest particle
-		bool bUpdated = false;
-		if ( fSurfDist < pCurParticle->SurfaceDistance() ) {
-			pCurParticle->SetNearestParticle( pParticle );
-			pCurParticle->SurfaceDistance() = fSurfDist;
-			bUpdated = true;
+		if ( fSurfDist < nbr.SurfaceDistance() ) {
+			nbr.Nearest() = nParticle;
+			nbr.SurfaceDistance() = fSurfDist;
 		}
-		if ( pCurParticle->SurfaceDistance() < std::numeric_limits<float>::max() && pCurParticle->NearestParticle() == NULL )
+		if ( nbr.SurfaceDistance() < std::numeric_limits<float>::max() && nbr.Nearest() == ExpMapParticle::InvalidIndex )
 			lgBreakToDebugger();
 
 		// re-insert particle into priority queue
-		pq.insert( ParticleQueueWrapper(pCurParticle) );
+		pq.insert( ParticleQueueWrapper(&nbr, nNbr) );
 	}	
 
 }
@@ -983,35 +1359,59 @@ void ExpMapGenerator::UpdateNeighbours( ExpMapParticle * pParticle, std::multise
 
 
 
-ExpMapParticle * ExpMapGenerator::InitializeSeedParticle( const Wml::Vector3f & vPosition,
-														  const Wml::Vector3f * pSeedNormal,
-														  const Frame3f * pLastSeedPointFrame )
+void ExpMapGenerator::InitializeSeedParticle( const Wml::Vector3f & vPosition,
+											  const Wml::Vector3f * pSeedNormal,
+											  const Frame3f * pLastSeedPointFrame )
 {
-	if ( m_pSeedParticle == NULL )
-		m_pSeedParticle = new ExpMapParticle();
+	ExpMapParticle & seed = m_vParticles[ SeedIndex() ];
+	seed.Clear();
+	seed.SurfaceDistance() = 0.0f;
+	seed.SetState( ExpMapParticle::Frozen );
+	m_vSeedPosition = vPosition;
+	m_vSeedNormal = *pSeedNormal;
+
+	FindSeedNeighbours( vPosition, m_vSeedNbrs );
 
-	ExpMapParticle * pSeedParticle = m_pSeedParticle;
-	pSeedParticle->Reset();
-	pSeedParticle->Position() = vPosition;
-	pSeedParticle->Normal() = *pSeedNormal;
-	pSeedParticle->State() = ExpMapParticle::Frozen;
+	m_vSeedFrame = ComputeSeedFrame( vPosition, m_vSeedNormal, m_vSeedNbrs, pLastSeedPointFrame );
+	m_bSeedValid = true;
+}
 
 
+void ExpMapGenerator::FindSeedNeighbours( const Wml::Vector3f & vPosition, std::vector<unsigned int> & vNbrs )
+{
 	if ( m_bUseMeshNeighbours ) {
 		// just use 3 nearest mesh neighbours...
 
-		Wml::Vector3f vNearest;
-		IMesh::TriangleID tID;
-		if ( ! m_pMeshBVTree->FindNearest( vPosition, vNearest, tID ) )
-			lgBreakToDebugger();
 		IMesh::VertexID nTri[3], nNbrTri[3];
-		GetMesh()->GetTriangle( tID, nTri );
+		if ( m_pMeshBVTree ) {
+			Wml::Vector3f vNearest;
+			IMesh::TriangleID tID;
+			if ( ! m_pMeshBVTree->FindNearest( vPosition, vNearest, tID ) )
+				lgBreakToDebugger();
+			GetMesh()->GetTriangle( tID, nTri );
+		} else {
+			// no tree - use the triangle around the nearest vertex (linear search, once per seed)
+			unsigned int nNearest = 0;
+			float fNearest = std::numeric_limits<float>::max();
+			for ( unsigned int i = 0; i < m_nParticles; ++i ) {
+				float fDistSqr = (m_pPositions[i] - vPosition).SquaredLength();
+				if ( fDistSqr < fNearest ) {
+					fNearest = fDistSqr;
+					nNearest = i;
+				}
+			}
+			NeighborTriBuffer vNearestBuffer;
+			GetMesh()->NeighbourIteration( nNearest, &vNearestBuffer );
+			if ( vNearestBuffer.Triangles().empty() )
+				lgBreakToDebugger();
+			GetMesh()->GetTriangle( vNearestBuffer.Triangles()[0], nTri );
+		}
 
 		// add direct nbrs
-		m_vNeighbourBuf.resize(0);
+		vNbrs.resize(0);
 		for ( int j = 0; j < 3; ++j ) {
-			m_vNeighbourBuf.push_back( m_vParticles[ m_vVtxToParticleMap[nTri[j]] ] );
-			m_vNeighbourBuf.back()->m_bNbrFlag = true;
+			vNbrs.push_back( nTri[j] );
+			m_vParticles[ nTri[j] ].m_bNbrFlag = true;
 		}
 
 		// add each of their one-rings
@@ -1023,10 +1423,10 @@ ExpMapParticle * ExpMapGenerator::InitializeSeedParticle( const Wml::Vector3f &
 			for ( unsigned int i = 0; i < nCount; ++i ) {
 				GetMesh()->GetTriangle( vTriangles[i], nNbrTri );
 				for ( int k = 0; k < 3; ++k ) {
-					ExpMapParticle * pParticle = m_vParticles[ m_vVtxToParticleMap[nNbrTri[j]] ];
-					if ( pParticle->m_bNbrFlag == false ) {
-						m_vNeighbourBuf.push_back(pParticle);
-						m_vNeighbourBuf.back()->m_bNbrFlag = true;
+					unsigned int nNbr = nNbrTri[j];
+					if ( m_vParticles[nNbr].m_bNbrFlag == false ) {
+						vNbrs.push_back(nNbr);
+						m_vParticles[nNbr].m_bNbrFlag = true;
 					}
 				}
 			}
@@ -1036,43 +1436,39 @@ ExpMapParticle * ExpMapGenerator::InitializeSeedParticle( const Wml::Vector3f &
 		// multiplying distance by 2 here is a hack, to try and fix
 		// some problems where we don't get enough neighbours around the seed point 
 		// if it is in the middle of a triangle or something like that...
-		m_vNeighbourBuf.resize(0);
-		FindNeighbours( pSeedParticle->Position(), pSeedParticle->Normal(), m_vNeighbourBuf, m_fMaxNbrDist*2.0f );	
+		vNbrs.resize(0);
+		FindNeighbours( vPosition, vNbrs, m_fMaxNbrDist*2.0f );	
 	}
 
-	// ok now add them all as neighbours, and clear neighbour flags
-	size_t nCount = m_vNeighbourBuf.size();
-	for ( unsigned int i = 0; i < nCount; ++i ) {
-		ExpMapParticle::ListEntry * pEntry = m_NeighbourMemoryPool.Allocate();
-		pEntry->pParticle = m_vNeighbourBuf[i];
-		pSeedParticle->AddNeighbour( pEntry );
-		m_vNeighbourBuf[i]->m_bNbrFlag = false;
-	}
+	// clear neighbour flags
+	size_t nCount = vNbrs.size();
+	for ( unsigned int i = 0; i < nCount; ++i )
+		m_vParticles[ vNbrs[i] ].m_bNbrFlag = false;
+}
+
 
+Frame3f ExpMapGenerator::ComputeSeedFrame( const Wml::Vector3f & vPosition, Wml::Vector3f & vSeedNormal,
+										   const std::vector<unsigned int> & vNbrs, const Frame3f * pLastSeedPointFrame )
+{
 	// estimate smooth normal
 	// [TODO] make this work w/ m_pIMesh
 	if ( m_pVFMesh && m_bUseNeighbourNormalSmoothing ) {
 		// get average normal...
-		std::vector<IMesh::VertexID> vNbrs;
-		for ( unsigned int k = 0; k < m_vNeighbourBuf.size(); ++k )
-			vNbrs.push_back(m_vNeighbourBuf[k]->VertexID());
-
 		Wml::Vector3f vNewNormal(0,0,0);
 		float fWeightSum = 0.0f;
-		for ( unsigned int i = 0; i < m_vNeighbourBuf.size(); ++i) {
-			ExpMapParticle * pTriParticle = m_vNeighbourBuf[i];
-			float fWeight = 1.0f / ((pTriParticle->Position() - vPosition).Length() + (0.0001f*m_fMaxEdgeLength) );
+		for ( unsigned int i = 0; i < vNbrs.size(); ++i) {
+			float fWeight = 1.0f / ((m_pPositions[vNbrs[i]] - vPosition).Length() + (0.0001f*m_fMaxEdgeLength) );
 			fWeightSum += fWeight;
-			vNewNormal += fWeight * MeshUtils::GetAverageNormal( *m_pVFMesh, pTriParticle->VertexID() );
+			vNewNormal += fWeight * MeshUtils::GetAverageNormal( *m_pVFMesh, vNbrs[i] );
 		}
 		vNewNormal /= fWeightSum;
 		vNewNormal.Normalize();
-		pSeedParticle->Normal() = vNewNormal;
+		vSeedNormal = vNewNormal;
 	}
 
 
 	// compute 3D frame at seed point
-	Frame3f startWorldFrame( pSeedParticle->Position(), pSeedParticle->Normal() );
+	Frame3f startWorldFrame( vPosition, vSeedNormal );
 
 	// if this argument was passed non-null, try to minimize the tangent-frame rotation of the
 	// current seed point wrt the last one
@@ -1083,68 +1479,63 @@ ExpMapParticle * ExpMapGenerator::InitializeSeedParticle( const Wml::Vector3f &
 		startWorldFrame = vLastFrame;
 	}
 
-	pSeedParticle->WorldFrame() = startWorldFrame;
-	//pSeedParticle->WorldFrame() = rms::Frame3f();
-
-	return pSeedParticle;
+	return startWorldFrame;
 }
 
 
 
 
 
-void ExpMapGenerator::PropagateFrameFromNearest( ExpMapParticle * pParticle )
+void ExpMapGenerator::PropagateFrameFromNearest( unsigned int nParticle )
 {
-	ExpMapParticle * pCenterParticle = pParticle->NearestParticle();
+	ExpMapParticle & particle = m_vParticles[nParticle];
+	unsigned int nCenter = particle.Nearest();
 
-	if ( pParticle->SurfaceDistance() == 0.0f ) {
+	if ( particle.SurfaceDistance() == 0.0f ) {
 		// pathological case where seed point == input point (or other duplicate points)
-		pParticle->SurfaceVector() = pCenterParticle->SurfaceVector();
+		particle.SurfaceVector() = m_vParticles[nCenter].SurfaceVector();
 		return;
 	} else { 
 		ExtPlane3f vTangentPlane;
 		Frame3f vCenterWorldFrame;
 		Wml::Matrix2f matFrameRotate;
-		PrecomputePropagationData( pCenterParticle, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+		PrecomputePropagationData( nCenter, vTangentPlane, vCenterWorldFrame, matFrameRotate );
 
-		pParticle->SurfaceVector() = ComputeSurfaceVector( pCenterParticle, pParticle, 
+		particle.SurfaceVector() = ComputeSurfaceVector( nCenter, nParticle, 
 			vTangentPlane, vCenterWorldFrame, matFrameRotate );
 	}
 
 	// check error and re-set distance if it is too high
-#if 1
-	float fVecLengthSqr = pParticle->SurfaceVector().SquaredLength();
+	ClampSurfaceVector( particle.SurfaceVector(), particle.SurfaceDistance() );
+}
+
+
+void ExpMapGenerator::ClampSurfaceVector( Wml::Vector2f & vSurfaceVector, float fSurfaceDistance )
+{
+	float fVecLengthSqr = vSurfaceVector.SquaredLength();
 	float fError = fabs(
-		fVecLengthSqr / (pParticle->SurfaceDistance()*pParticle->SurfaceDistance()) - 1.0f );
+		fVecLengthSqr / (fSurfaceDistance*fSurfaceDistance) - 1.0f );
 	static const float s_fMaxErr = 2*0.5f - 0.5f*0.5f;		// 0.5f == 50% - arbitrary threshold...
 	if ( fError > s_fMaxErr ) {
-		if ( true ) {
-			pParticle->SurfaceVector().Normalize();
-			pParticle->SurfaceVector() *= pParticle->SurfaceDistance();
-			//_RMSInfo("Fix!\n");
-		}
+		vSurfaceVector.Normalize();
+		vSurfaceVector *= fSurfaceDistance;
+		//_RMSInfo("Fix!\n");
 	}
-#endif
 }
 
 
-struct NbrInfo
-{
-	float fNbrWeight;
-	Wml::Vector2f vNbrUV;
-};
-
-void ExpMapGenerator::PropagateFrameFromNearest_Average( ExpMapParticle * pParticle )
+void ExpMapGenerator::PropagateFrameFromNearest_Average( unsigned int nParticle )
 {
-	ExpMapParticle * pNearest = pParticle->NearestParticle();
+	ExpMapParticle & particle = m_vParticles[nParticle];
+	unsigned int nNearest = particle.Nearest();
 
-	if ( pParticle->SurfaceDistance() == 0.0f )  {
+	if ( particle.SurfaceDistance() == 0.0f )  {
 		// pathological case where seed point == input point (or other duplicate points)
-		pParticle->SurfaceVector() = pNearest->SurfaceVector();
+		particle.SurfaceVector() = m_vParticles[nNearest].SurfaceVector();
 		return;
 	}
 
-	static std::vector<NbrInfo> vNbrs;
+	std::vector<NbrInfo> & vNbrs = m_vNbrInfo;
 	ExtPlane3f vTangentPlane;
 	Frame3f vCenterWorldFrame;
 	Wml::Matrix2f matFrameRotate;
@@ -1154,28 +1545,36 @@ void ExpMapGenerator::PropagateFrameFromNearest_Average( ExpMapParticle * pParti
 
 	//! need to look for nearest particle, because if it is seed
 	//! point, it's not in nbr lists...
-	if ( pNearest->State() != ExpMapParticle::Frozen )
+	if ( m_vParticles[nNearest].State() != ExpMapParticle::Frozen )
 		lgBreakToDebugger();
 
+	if ( m_bUseVectorizedPropagation ) {
+		particle.SurfaceVector() = AverageNeighbourSurfaceVectors( nParticle, nNearest );
+		ClampSurfaceVector( particle.SurfaceVector(), particle.SurfaceDistance() );
+		return;
+	}
+
+	const Wml::Vector3f & vPosition = m_pPositions[nParticle];
 	bool bSawNearest = false;
-	ExpMapParticle::ListEntry * pCurNbr = GetNeighbourList(pParticle);
-	while ( pCurNbr != NULL ) {
+	unsigned int nNbrs;
+	const unsigned int * pNbrs = GetNeighbours( nParticle, nNbrs );
+	for ( unsigned int k = 0; k < nNbrs; ++k ) {
 
-		ExpMapParticle * pCenterParticle = pCurNbr->pParticle;
-		if ( pCenterParticle == pNearest )
+		unsigned int nCenter = pNbrs[k];
+		if ( nCenter == nNearest )
 			bSawNearest = true;
 
-		if ( pCenterParticle->State() == ExpMapParticle::Frozen ) {
-			PrecomputePropagationData( pCenterParticle, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+		if ( m_vParticles[nCenter].State() == ExpMapParticle::Frozen ) {
+			PrecomputePropagationData( nCenter, vTangentPlane, vCenterWorldFrame, matFrameRotate );
 
 			NbrInfo info;
-			info.vNbrUV = ComputeSurfaceVector( pCenterParticle, pParticle, 
+			info.vNbrUV = ComputeSurfaceVector( nCenter, nParticle, 
 				vTangentPlane, vCenterWorldFrame, matFrameRotate );
 
 			if ( ! _finite(info.vNbrUV.Length()) )
 				lgBreakToDebugger();
 
-			info.fNbrWeight = 1.0f / ( ( pCenterParticle->Position() - pParticle->Position() ).Length() + (0.00001f*m_fMaxEdgeLength) );
+			info.fNbrWeight = 1.0f / ( ( m_pPositions[nCenter] - vPosition ).Length() + (0.00001f*m_fMaxEdgeLength) );
 			if ( ! _finite(info.fNbrWeight) )
 				lgBreakToDebugger();
 
@@ -1189,8 +1588,6 @@ void ExpMapGenerator::PropagateFrameFromNearest_Average( ExpMapParticle * pParti
 
 			vNbrs.push_back(info);
 		}
-
-		pCurNbr = pCurNbr->pNext;
 	}
 
 	if ( ! _finite(fWeightSum) )
@@ -1198,12 +1595,12 @@ void ExpMapGenerator::PropagateFrameFromNearest_Average( ExpMapParticle * pParti
 
 	// add un-seen "nearest" particle
 	if ( ! bSawNearest ) {
-		PrecomputePropagationData( pNearest, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+		PrecomputePropagationData( nNearest, vTangentPlane, vCenterWorldFrame, matFrameRotate );
 		NbrInfo info;
-		info.vNbrUV =  ComputeSurfaceVector( pNearest, pParticle, 
+		info.vNbrUV =  ComputeSurfaceVector( nNearest, nParticle, 
 				vTangentPlane, vCenterWorldFrame, matFrameRotate );
 
-		info.fNbrWeight = 1.0f / ( ( pNearest->Position() - pParticle->Position() ).Length() + (0.00001f*m_fMaxEdgeLength) );
+		info.fNbrWeight = 1.0f / ( ( Position(nNearest) - vPosition ).Length() + (0.00001f*m_fMaxEdgeLength) );
 
 		// weight by geo delta
 		//float fGeoDelta = fabs(pNearest->SurfaceVector().Length() - info.vNbrUV.Length());
@@ -1227,23 +1624,11 @@ void ExpMapGenerator::PropagateFrameFromNearest_Average( ExpMapParticle * pParti
 	if ( ! _finite(vUV.Length()) )
 		lgBreakToDebugger();
 
-	pParticle->SurfaceVector() = vUV;
+	particle.SurfaceVector() = vUV;
 
 
 	// check error and re-set distance if it is too high
-#if 1
-	float fVecLengthSqr = pParticle->SurfaceVector().SquaredLength();
-	float fError = fabs(
-		fVecLengthSqr / (pParticle->SurfaceDistance()*pParticle->SurfaceDistance()) - 1.0f );
-	static const float s_fMaxErr = 2*0.5f - 0.5f*0.5f;		// 0.5f == 50% - arbitrary threshold...
-	if ( fError > s_fMaxErr ) {
-		if ( true ) {
-			pParticle->SurfaceVector().Normalize();
-			pParticle->SurfaceVector() *= pParticle->SurfaceDistance();
-//			_RMSInfo("Fix!\n");
-		}
-	}
-#endif
+	ClampSurfaceVector( particle.SurfaceVector(), particle.SurfaceDistance() );
 
 }
 
@@ -1252,23 +1637,88 @@ void ExpMapGenerator::PropagateFrameFromNearest_Average( ExpMapParticle * pParti
 
 
 
-void ExpMapGenerator::PrecomputePropagationData( ExpMapParticle * pCenterParticle,
-															 ExtPlane3f & vTangentPlane, 
-															 Frame3f & vCenterWorldFrame,
-															 Wml::Matrix2f & matFrameRotate )
+Wml::Vector2f ExpMapGenerator::AverageNeighbourSurfaceVectors( unsigned int nParticle, unsigned int nNearest )
+{
+	ExpMapUpwindKernel & kernel = m_upwindKernel;
+	kernel.Clear();
+
+	bool bSawNearest = false;
+	unsigned int nNbrs;
+	const unsigned int * pNbrs = GetNeighbours( nParticle, nNbrs );
+	for ( unsigned int k = 0; k < nNbrs; ++k ) {
+		unsigned int nCenter = pNbrs[k];
+		if ( nCenter == nNearest )
+			bSawNearest = true;
+		if ( m_vParticles[nCenter].State() == ExpMapParticle::Frozen )
+			kernel.Add( m_pPositions[nCenter], m_pNormals[nCenter], m_pTangents[nCenter], m_vParticles[nCenter].SurfaceVector() );
+	}
+
+	const Wml::Vector3f & vPosition = m_pPositions[nParticle];
+	float fWeightOffset = 0.00001f*m_fMaxEdgeLength;
+	Wml::Vector2f vWeightedSum = Wml::Vector2f::ZERO;
+	float fWeightSum = 0.0f;
+
+	// nearest particle is not in the neighbour lists if it is the seed point, which has its own frame
+	if ( ! bSawNearest && nNearest == SeedIndex() ) {
+		ExtPlane3f vTangentPlane;
+		Frame3f vCenterWorldFrame;
+		Wml::Matrix2f matFrameRotate;
+		PrecomputePropagationData( nNearest, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+		Wml::Vector2f vUV = ComputeSurfaceVector( nNearest, nParticle, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+		fWeightSum = 1.0f / ( ( Position(nNearest) - vPosition ).Length() + fWeightOffset );
+		vWeightedSum = fWeightSum * vUV;
+	} else if ( ! bSawNearest ) 
+		kernel.Add( m_pPositions[nNearest], m_pNormals[nNearest], m_pTangents[nNearest], m_vParticles[nNearest].SurfaceVector() );
+
+	kernel.Accumulate( vPosition, m_vSeedFrame, fWeightOffset, vWeightedSum, fWeightSum );
+
+	Wml::Vector2f vUV = vWeightedSum / fWeightSum;
+	if ( ! _finite(vUV.Length()) )
+		lgBreakToDebugger();
+	return vUV;
+}
+
+
+void ExpMapGenerator::PrecomputePropagationData( unsigned int nCenter,
+												 ExtPlane3f & vTangentPlane, 
+												 Frame3f & vCenterWorldFrame,
+												 Wml::Matrix2f & matFrameRotate )
+{
+	PrecomputePropagationData( Position(nCenter), Normal(nCenter), WorldFrame(nCenter),
+		m_vSeedFrame, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+}
+
+Wml::Vector2f ExpMapGenerator::ComputeSurfaceVector( unsigned int nCenter, 
+													 unsigned int nParticle,
+													 ExtPlane3f & vTangentPlane, 
+													 Frame3f & vCenterWorldFrame, 
+													 Wml::Matrix2f & matFrameRotate )
+{
+	return ComputeSurfaceVector( Position(nCenter), m_vParticles[nCenter].SurfaceVector(), m_pPositions[nParticle],
+		vTangentPlane, vCenterWorldFrame, matFrameRotate );
+}
+
+
+void ExpMapGenerator::PrecomputePropagationData( const Wml::Vector3f & vCenterPosition, 
+												 const Wml::Vector3f & vCenterNormal,
+												 const Frame3f & vCenterFrame, 
+												 const Frame3f & vSeedFrame,
+												 ExtPlane3f & vTangentPlane, 
+												 Frame3f & vCenterWorldFrame,
+												 Wml::Matrix2f & matFrameRotate )
 {
 	// compute surface-tangent plane at particle
-	Wml::Vector3f vNormal( pCenterParticle->Normal() );
+	const Wml::Vector3f & vNormal = vCenterNormal;
 
 	// compute plane at this point
-	vTangentPlane = ExtPlane3f( vNormal, pCenterParticle->Position() );
+	vTangentPlane = ExtPlane3f( vNormal, vCenterPosition );
 
 	// compute 3D frame at center point
-	//vCenterWorldFrame = Frame3f( pCenterParticle->Position(), vNormal );
-	vCenterWorldFrame = pCenterParticle->WorldFrame();
+	//vCenterWorldFrame = Frame3f( vCenterPosition, vNormal );
+	vCenterWorldFrame = vCenterFrame;
 
 	// rotate seed world frame Z into this particle's Z
-	Frame3f seedWorldFrame( m_pSeedParticle->WorldFrame() );
+	Frame3f seedWorldFrame( vSeedFrame );
 	seedWorldFrame.AlignZAxis( vCenterWorldFrame );
 
 	// compute cos(angle) between axis
@@ -1288,21 +1738,22 @@ void ExpMapGenerator::PrecomputePropagationData( ExpMapParticle * pCenterParticl
 	matFrameRotate = Wml::Matrix2f( fCosTheta, fSinTheta, -fSinTheta, fCosTheta );
 }
 
-Wml::Vector2f ExpMapGenerator::ComputeSurfaceVector( ExpMapParticle * pCenterParticle, 
-																 ExpMapParticle * pNbrParticle,
-																 ExtPlane3f & vTangentPlane, 
-																 Frame3f & vCenterWorldFrame, 
-																 Wml::Matrix2f & matFrameRotate )
+Wml::Vector2f ExpMapGenerator::ComputeSurfaceVector( const Wml::Vector3f & vCenterPosition, 
+													 const Wml::Vector2f & vCenterSurfaceVector,
+													 const Wml::Vector3f & vNbrPosition,
+													 const ExtPlane3f & vTangentPlane, 
+													 const Frame3f & vCenterWorldFrame, 
+													 const Wml::Matrix2f & matFrameRotate )
 {
 	// special case...
-	if ( (pNbrParticle->Position() - pCenterParticle->Position()).Length() < Wml::Mathf::EPSILON )
-		return pCenterParticle->SurfaceVector();
+	if ( (vNbrPosition - vCenterPosition).Length() < Wml::Mathf::EPSILON )
+		return vCenterSurfaceVector;
 
 	// project point into plane
-	Wml::Vector3f vPlanePoint = vTangentPlane.RotatePointIntoPlane( pNbrParticle->Position() );
+	Wml::Vector3f vPlanePoint = vTangentPlane.RotatePointIntoPlane( vNbrPosition );
 
 	// project point into coord system of frame
-	vPlanePoint -= pCenterParticle->Position();
+	vPlanePoint -= vCenterPosition;
 	vCenterWorldFrame.ToFrameLocal(vPlanePoint);
 
 	// now we can project into surface frame simply by dropping z (which should be 0 anyway,
@@ -1314,14 +1765,14 @@ Wml::Vector2f ExpMapGenerator::ComputeSurfaceVector( ExpMapParticle * pCenterPar
 
 	// transform local vector into coord system of initial surface reference frame
 	//  and add accumulated surface vector
-	return pCenterParticle->SurfaceVector() + (matFrameRotate * vSurfaceFrame);
+	return vCenterSurfaceVector + (matFrameRotate * vSurfaceFrame);
 }
 
 
 rms::Frame3f ExpMapGenerator::GetSeedFrame()
 {
-	if ( m_pSeedParticle )
-		return m_pSeedParticle->WorldFrame();
+	if ( m_bSeedValid )
+		return m_vSeedFrame;
 	else
 		return rms::Frame3f();
 }
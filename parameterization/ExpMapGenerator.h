@@ -18,6 +18,8 @@
 #include "VFTriangleMesh.h"
 #include "IMeshBVTree.h"
 #include "WmlExtPlane3.h"
+#include "ExpMapUpwindKernel.h"
+#include "ExpMapSurfaceCache.h"
 #include <WmlPolygon2.h>
 #include <ISurfaceProjector.h>
 
@@ -25,113 +27,178 @@
 namespace rms {
 
 
+/*
+ * Propagation state of one expmap particle. This is the only per-particle data that changes
+ * during front propagation, so it is kept small. Positions, normals, tangent frames and neighbour
+ * lists are stored in separate (read-only) arrays in ExpMapGenerator, indexed the same way.
+ */
 class ExpMapParticle
 {
 public:
-	struct ListEntry {
-		ExpMapParticle * pParticle;
-		ListEntry * pNext;
-	};
-
 	enum PropagationState {
 		Frozen,
 		Active,
 		Inactive
 	};
 
-	ExpMapParticle(
-		const Wml::Vector3f & vPosition = Wml::Vector3f::ZERO,
-		const Wml::Vector3f & vNormal = Wml::Vector3f::ZERO);
-	~ExpMapParticle();
-
-	Wml::Vector3f & Position() { return m_vPosition; }
-	Wml::Vector3f & Normal() { return m_vNormal; }
-
 	float & SurfaceDistance() { return m_fSurfaceDistance; }
 	float SurfaceDistance() const { return m_fSurfaceDistance; }
 
-	Frame3f & WorldFrame() { return m_WorldFrame; }
 	Wml::Vector2f & SurfaceVector() { return m_vSurfaceVector; }
+	const Wml::Vector2f & SurfaceVector() const { return m_vSurfaceVector; }
 
-	unsigned int & VertexID() { return m_nVertexID; }
+	PropagationState State() const { return (PropagationState)m_nState; }
+	void SetState( PropagationState eState ) { m_nState = (unsigned char)eState; }
 
-	ListEntry * GetNeighbourList() { return m_pNeighbourList; }
-	void AddNeighbour( ListEntry * pNeighbour );
-	void ClearNeighbourList();
+	//! slot in ParticleQueue heap, or InvalidIndex if not queued
+	unsigned int & QueueIndex() { return m_nQueueIndex; }
+	unsigned int QueueIndex() const { return m_nQueueIndex; }
 
-	PropagationState & State() { return m_eState; }
-	ExpMapParticle * NearestParticle() { return m_pNearest; }
-	void SetNearestParticle( ExpMapParticle * pNearest ) { m_pNearest = pNearest; }
+	//! index of the particle this particle's distance was propagated from, or InvalidIndex
+	unsigned int & Nearest() { return m_nNearest; }
+	unsigned int Nearest() const { return m_nNearest; }
 
 	void Clear() {
-		SurfaceDistance() = std::numeric_limits<float>::max();
-		State() = ExpMapParticle::Inactive;
-		SetNearestParticle(NULL);
-		SurfaceVector() = Wml::Vector2f::ZERO;
+		m_fSurfaceDistance = std::numeric_limits<float>::max();
+		m_vSurfaceVector = Wml::Vector2f::ZERO;
+		m_nNearest = InvalidIndex;
+		m_nQueueIndex = InvalidIndex;
+		m_nState = (unsigned char)Inactive;
+		m_bNbrFlag = false;
 	}
 
 	bool m_bNbrFlag;
-	bool m_bNormalSmoothed;
 
 protected:
-	Wml::Vector3f m_vPosition;
-	Wml::Vector3f m_vNormal;
-
+	unsigned char m_nState;
 	float m_fSurfaceDistance;
 	Wml::Vector2f m_vSurfaceVector;
-
-	Frame3f m_WorldFrame;
-
-	ListEntry * m_pNeighbourList;
-	ExpMapParticle * m_pNearest;
-
-	unsigned int m_nVertexID;
-
-	PropagationState m_eState;
+	unsigned int m_nNearest;
+	unsigned int m_nQueueIndex;
 
 public:
 	static Wml::Vector2f INVALID_PARAM;
-
-
-	bool operator<( const ExpMapParticle & pParticle2 ) const
-		{ return SurfaceDistance() < pParticle2.SurfaceDistance();  }
-
-
-	// used to clear internal members - this is important sometimes...
-	virtual void Reset() {
-		m_fSurfaceDistance = 0.0f;
-		m_pNeighbourList = NULL;
-		m_nVertexID = IMesh::InvalidID;
-		m_eState = ExpMapParticle::Inactive;
-		m_pNearest = NULL;
-		m_bNbrFlag = false;
-		m_bNormalSmoothed = false;
-	}
+	static const unsigned int InvalidIndex = 0xFFFFFFFF;
 };
 
 
 /*
- * This class is just a wrapper for an ExpMapParticle * that we
+ * This class is just a wrapper for a particle that we
  * can put into STL classes (like std::multiset)
  */
 class ParticleQueueWrapper
 {
 public:
-	ParticleQueueWrapper( ExpMapParticle * pParticle )
-		{ m_pParticle = pParticle; }
+	ParticleQueueWrapper( const ExpMapParticle * pParticle, unsigned int nIndex )
+		{ m_pParticle = pParticle; m_nIndex = nIndex; }
 	ParticleQueueWrapper( float fSearchDistance )
-		{ m_pParticle = NULL; m_fSearchDistance = fSearchDistance; }
-	ExpMapParticle * Particle() const { return m_pParticle; }
+		{ m_pParticle = NULL; m_nIndex = ExpMapParticle::InvalidIndex; m_fSearchDistance = fSearchDistance; }
+	unsigned int Index() const { return m_nIndex; }
 	float QueueValue() const 
 		{ if ( m_pParticle == NULL ) return m_fSearchDistance; else return m_pParticle->SurfaceDistance(); }
 	bool operator<( const ParticleQueueWrapper & pParticle2 ) const
 		{ float f1 = QueueValue(); float f2 = pParticle2.QueueValue(); return f1 < f2; }
 protected:
-	ExpMapParticle * m_pParticle;
+	const ExpMapParticle * m_pParticle;
+	unsigned int m_nIndex;
 	float m_fSearchDistance;
 };
 
 
+/*
+ * Indexed binary min-heap of particle indices, keyed on SurfaceDistance(). Each particle
+ * stores its heap slot (ExpMapParticle::QueueIndex), so a queued particle can be
+ * updated in place after its distance changes, without a search or reallocation.
+ * SetParticles() must be called before use (and again if the particle array moves).
+ */
+class ParticleQueue
+{
+public:
+	ParticleQueue() { m_pParticles = NULL; }
+
+	void SetParticles( ExpMapParticle * pParticles ) { m_pParticles = pParticles; }
+
+	bool empty() const { return m_vHeap.empty(); }		// STL name, same as std::multiset front
+	unsigned int Size() const { return (unsigned int)m_vHeap.size(); }
+	unsigned int operator[]( unsigned int i ) const { return m_vHeap[i]; }
+
+	bool Contains( unsigned int nParticle ) const 
+		{ return m_pParticles[nParticle].QueueIndex() != ExpMapParticle::InvalidIndex; }
+
+	void Insert( unsigned int nParticle ) {
+		m_pParticles[nParticle].QueueIndex() = (unsigned int)m_vHeap.size();
+		m_vHeap.push_back( nParticle );
+		SiftUp( (unsigned int)m_vHeap.size()-1 );
+	}
+
+	//! call after SurfaceDistance() of a queued particle decreased
+	void DecreaseKey( unsigned int nParticle ) 
+		{ SiftUp( m_pParticles[nParticle].QueueIndex() ); }
+
+	unsigned int Pop() {
+		unsigned int nFront = m_vHeap[0];
+		m_pParticles[nFront].QueueIndex() = ExpMapParticle::InvalidIndex;
+		unsigned int nLast = m_vHeap.back();
+		m_vHeap.pop_back();
+		if ( ! m_vHeap.empty() ) {
+			m_vHeap[0] = nLast;
+			m_pParticles[nLast].QueueIndex() = 0;
+			SiftDown( 0 );
+		}
+		return nFront;
+	}
+
+	//! empties queue (storage is kept for next use)
+	void Clear() {
+		size_t nCount = m_vHeap.size();
+		for ( unsigned int i = 0; i < nCount; ++i )
+			m_pParticles[ m_vHeap[i] ].QueueIndex() = ExpMapParticle::InvalidIndex;
+		m_vHeap.resize(0);
+	}
+
+	size_t GetMemoryUsage() const { return m_vHeap.capacity() * sizeof(unsigned int); }
+
+protected:
+	ExpMapParticle * m_pParticles;
+	std::vector<unsigned int> m_vHeap;
+
+	void SiftUp( unsigned int i ) {
+		unsigned int nParticle = m_vHeap[i];
+		float fDist = m_pParticles[nParticle].SurfaceDistance();
+		while ( i > 0 ) {
+			unsigned int nParent = (i-1) / 2;
+			if ( ! (fDist < m_pParticles[ m_vHeap[nParent] ].SurfaceDistance()) )
+				break;
+			m_vHeap[i] = m_vHeap[nParent];
+			m_pParticles[ m_vHeap[i] ].QueueIndex() = i;
+			i = nParent;
+		}
+		m_vHeap[i] = nParticle;
+		m_pParticles[nParticle].QueueIndex() = i;
+	}
+
+	void SiftDown( unsigned int i ) {
+		unsigned int nCount = (unsigned int)m_vHeap.size();
+		unsigned int nParticle = m_vHeap[i];
+		float fDist = m_pParticles[nParticle].SurfaceDistance();
+		while ( true ) {
+			unsigned int nChild = 2*i + 1;
+			if ( nChild >= nCount )
+				break;
+			if ( nChild+1 < nCount && m_pParticles[ m_vHeap[nChild+1] ].SurfaceDistance() < m_pParticles[ m_vHeap[nChild] ].SurfaceDistance() )
+				++nChild;
+			if ( ! (m_pParticles[ m_vHeap[nChild] ].SurfaceDistance() < fDist) )
+				break;
+			m_vHeap[i] = m_vHeap[nChild];
+			m_pParticles[ m_vHeap[i] ].QueueIndex() = i;
+			i = nChild;
+		}
+		m_vHeap[i] = nParticle;
+		m_pParticles[nParticle].QueueIndex() = i;
+	}
+};
+
+
 
 class ExpMapGenerator : public ISurfaceProjector
 {
@@ -142,19 +209,59 @@ public:
 	void SetSurface( IMesh * pMesh, IMeshBVTree * pMeshBVTree );
 	void SetSurface( VFTriangleMesh * pMesh, IMeshBVTree * pMeshBVTree );
 
-	void SetUseUpwindAveraging( bool bEnable ) { m_bUseUpwindAveraging = bEnable; }
+	//! call after surface vertices have moved (topology unchanged). Updates particles from the mesh
+	//! and refits the BV tree, instead of re-creating everything with SetSurface()
+	void NotifySurfaceDeformed();
+
+	//! use the particle normals, tangents and neighbour lists of pCache, which must have been built for the
+	//! current surface (call after SetSurface()), instead of computing them. This overwrites the neighbour type and
+	//! the GetUseNeighbourNormalSmoothing() setting with those of pCache. The generator holds a reference until the
+	//! surface changes, normal smoothing is toggled, or another cache is set. Passing NULL goes back to computing
+	//! them when needed.
+	void SetSurfaceCache( ExpMapSurfaceCache * pCache );
+	//! cache in use (NULL until neighbour lists are computed, and in localized mode). It can be shared with
+	//! other generators over the same surface
+	ExpMapSurfaceCache * GetSurfaceCache() { return m_pSurfaceCache.Get(); }
+
+	void SetUseUpwindAveraging( bool bEnable ) { m_bUseUpwindAveraging = bEnable; m_bLastExpMapValid = false; }
 	bool GetUseUpwindAveraging() { return m_bUseUpwindAveraging; }
 
+	//! upwind averaging propagates from all frozen neighbours of a particle at once with SSE/AVX (see
+	//! ExpMapUpwindKernel) if enabled (default). Otherwise one neighbour at a time with the original
+	//! scalar code. Results are the same up to float rounding
+	void SetUseVectorizedPropagation( bool bEnable ) { m_bUseVectorizedPropagation = bEnable; m_bLastExpMapValid = false; }
+	bool GetUseVectorizedPropagation() { return m_bUseVectorizedPropagation; }
+
 	void SetUseNeighbourNormalSmoothing( bool bEnable );
 	bool GetUseNeighbourNormalSmoothing() { return m_bUseNeighbourNormalSmoothing; }
 
-	void SetUseSquareCulling( bool bEnable ) { m_bEnableSquareCulling = bEnable; }
+	//! front is kept in an indexed heap (default). If disabled, the original std::multiset front
+	//! is used instead (same results up to ties, kept for benchmarking)
+	void SetUseIndexedQueue( bool bEnable ) { m_bUseIndexedQueue = bEnable; m_bLastExpMapValid = false; }
+	bool GetUseIndexedQueue() { return m_bUseIndexedQueue; }
+
+	//! if enabled (default), a radius-based SetSurfaceDistances() call whose seed only differs from the 
+	//! previous call by a rotation around the seed normal and/or a new stop distance updates the
+	//! previous expmap instead of recomputing it. Rotations just rotate the UVs, radius changes
+	//! continue (or truncate) the previous front propagation. Any seed translation is a full recompute.
+	void SetUseIncrementalUpdate( bool bEnable ) { m_bUseIncrementalUpdate = bEnable; m_bLastExpMapValid = false; }
+	bool GetUseIncrementalUpdate() { return m_bUseIncrementalUpdate; }
+
+	//! for expmaps that only cover a small part of a large mesh. Neighbour lists, normals and frames
+	//! are computed when the front first reaches a particle (and kept for later queries), instead of 
+	//! for the whole mesh before the first query, so the cost of a query is proportional to the number 
+	//! of particles it visits. Results are the same. If all neighbour lists already exist (eg after 
+	//! ExpMapBatch::Initialize()) they are used.
+	void SetUseLocalizedQueries( bool bEnable ) { m_bUseLocalizedQueries = bEnable; }
+	bool GetUseLocalizedQueries() { return m_bUseLocalizedQueries; }
+
+	void SetUseSquareCulling( bool bEnable ) { m_bEnableSquareCulling = bEnable; m_bLastExpMapValid = false; }
 	bool GetUseSquareCulling() { return m_bEnableSquareCulling; }
 
 	//! propagation is clipped to poly. Note that if polygon is non-convex, the front propagation
 	//! may not really work properly...
-	void SetClipPoly( rms::Polygon2f & poly ) { m_ClipPoly = poly; }
-	void EnableClipPoly(bool bEnable) { m_bUseClipPoly = bEnable; }
+	void SetClipPoly( rms::Polygon2f & poly ) { m_ClipPoly = poly; m_bLastExpMapValid = false; }
+	void EnableClipPoly(bool bEnable) { m_bUseClipPoly = bEnable; m_bLastExpMapValid = false; }
 
 	void Reset();
 
@@ -172,10 +279,20 @@ public:
 	void GetVertexUVs(std::vector<unsigned int> & vID, std::vector<float> & vU, std::vector<float> & vV);
 	void GetVertexFaceUVs( std::vector<unsigned int> & vID, std::vector<float> & vU, std::vector<float> & vV, std::vector<unsigned int> & vFaces, rms::VFTriangleMesh * pMesh );
 
-	rms::VFTriangleMesh m_uvMesh;
-	rms::VFTriangleMesh m_3dMesh;
-	IMeshBVTree m_uvBVTree;
-	IMeshBVTree m_3dBVTree;
+	//! geodesic distances of the last expmap, indexed by VertexID (vDistances has GetMaxVertexID() entries).
+	//! Vertices the expmap did not reach get std::numeric_limits<float>::max(). If pNearest is non-null, it is
+	//! filled with the vertex each distance was propagated from (the parent in the propagation tree), which
+	//! is IMesh::InvalidID for unreached vertices and for vertices whose parent is the seed point
+	void GetVertexDistances( std::vector<float> & vDistances, std::vector<IMesh::VertexID> * pNearest = NULL );
+	//! writes the geodesic distances of the last expmap into scalar set nSetID (which must exist and be
+	//! initialized, see IMesh::InitializeScalarSet()). The set is cleared first, so only the vertices the
+	//! expmap reached have a value
+	void CopyVertexDistances( IMesh * pMesh, IMesh::ScalarSetID nSetID );
+
+	//! prepares FindUV() and Find3D() for the current expmap, which is then used until the next
+	//! MeshCurrentUVs() call (particles must not be recomputed in between). On meshes, this uses the
+	//! mesh triangles whose vertices all have UVs. On point sets (no triangles) the UVs are Delaunay
+	//! triangulated. Returns false if there are no such triangles.
 	bool MeshCurrentUVs();
 
 	Wml::Vector2f FindUV( const Wml::Vector3f & vPoint, bool * bStatus = NULL );
@@ -189,6 +306,13 @@ public:
 	virtual Wml::Vector3f ProjectTo3D( const Wml::Vector2f & vUV, Wml::Vector3f * pNormal = NULL, bool * bStatus = NULL )
 		{ return Find3D(vUV, pNormal, bStatus); }
 
+	//! bytes used by particles, neighbour lists and per-query buffers (positions and normals only count
+	//! if they are copies, ie not shared with the mesh). Includes the surface cache, even if it is shared
+	//! with other generators. Does not include the uv/3d projection meshes.
+	size_t GetMemoryUsage() const;
+
+	//! number of particles (one per VertexID, including unused IDs)
+	unsigned int GetParticleCount() const { return m_nParticles; }
 
 protected:
 	VFTriangleMesh * m_pVFMesh;
@@ -203,119 +327,204 @@ protected:
 	void EstimateEdgeLength(VFTriangleMesh * pMesh, float & fMin, float & fMax, float & fAverage);
 
 	bool m_bUseMeshNeighbours;
-	bool m_bPrecomputeNeighbours;
 	bool m_bUseUpwindAveraging;
+	bool m_bUseVectorizedPropagation;
 	bool m_bUseNeighbourNormalSmoothing;
 
+	bool m_bUseIndexedQueue;
 	bool m_bEnableSquareCulling;
 	float m_fLastMaxRadius;
 
 	bool m_bUseClipPoly;
 	rms::Polygon2f m_ClipPoly;
 
-	// vertex to particle map
-	std::vector< unsigned int > m_vVtxToParticleMap;
-
-	// neighbour list setup
-	bool m_bNeighbourListsValid;
+	/*
+	 * Particles are indexed by VertexID. m_vParticles has one more entry, at index m_nParticles, 
+	 * which is the seed particle. Unused VertexIDs get a particle that is never reached.
+	 */
+	unsigned int m_nParticles;
+	std::vector<ExpMapParticle> m_vParticles;
+	unsigned int SeedIndex() const { return m_nParticles; }
+
+	// Read-only particle geometry, indexed by particle. Once the neighbour lists exist these point into
+	// m_pSurfaceCache. Before that (and in localized mode), positions and normals point into the mesh
+	// buffers if it has CompactVertexStorage (and normals are not smoothed), otherwise to the copies
+	// below. Particle frames are (position, tangent, normal x tangent, normal).
+	const Wml::Vector3f * m_pPositions;
+	const Wml::Vector3f * m_pNormals;
+	const Wml::Vector3f * m_pTangents;
+	std::vector<Wml::Vector3f> m_vPositionBuf;
+	std::vector<Wml::Vector3f> m_vNormalBuf;
+	std::vector<Wml::Vector3f> m_vTangents;
+	//! reset particles and copy (or share) positions of all particles from the mesh
+	void InitializeParticleGeometry();
+	void InitializeParticlePositions();
+
+	// seed particle geometry
+	Wml::Vector3f m_vSeedPosition;
+	Wml::Vector3f m_vSeedNormal;
+	Frame3f m_vSeedFrame;
+
+	const Wml::Vector3f & Position( unsigned int i ) const
+		{ return (i == m_nParticles) ? m_vSeedPosition : m_pPositions[i]; }
+	const Wml::Vector3f & Normal( unsigned int i ) const
+		{ return (i == m_nParticles) ? m_vSeedNormal : m_pNormals[i]; }
+	Frame3f WorldFrame( unsigned int i ) const;
+	static Frame3f MakeFrame( const Wml::Vector3f & vPosition, const Wml::Vector3f & vNormal, const Wml::Vector3f & vTangent );
+
+	// Neighbours of particle i are m_pNbrs[ m_pNbrOffsets[i] ... m_pNbrOffsets[i+1]-1 ], from m_pSurfaceCache
+	// (which also has the normals and tangents). Seed neighbours are in m_vSeedNbrs.
+	ExpMapSurfaceCacheRef m_pSurfaceCache;
+	const unsigned int * m_pNbrOffsets;
+	const unsigned int * m_pNbrs;
 	float m_fMaxNbrDist;
-	std::vector<ExpMapParticle *> m_vNeighbourBuf;
+	std::vector<unsigned int> m_vSeedNbrs;
+	bool HasNeighbourLists() const { return m_pSurfaceCache.Get() != NULL; }
+	//! neighbour lists, normals and tangents of all particles (an unshared cache, if none was set)
 	void InitializeNeighbourLists();
+	//! releases the surface cache and localized neighbour lists. Particle positions must be re-initialized after this
 	void ClearNeighbourLists();
-	void FindNeighbours( ExpMapParticle * pParticle,
-						 std::vector<ExpMapParticle *> & vParticles);
-	void FindNeighbours( const Wml::Vector3f & vPoint, const Wml::Vector3f & vNormal,
-						 std::vector<ExpMapParticle *> & vParticles, 
-						 float fRadiusThreshold, ExpMapParticle * pSkip = NULL );
-	MemoryPool<ExpMapParticle::ListEntry> m_NeighbourMemoryPool;
-
-	// neighbor list init
-	ExpMapParticle::ListEntry * GetNeighbourList( ExpMapParticle * pParticle );
 
-	void SetSmoothNormal( ExpMapParticle * pParticle, ExpMapParticle::ListEntry * pNbrs, bool bEnable );
+	// Localized queries (if there is no surface cache). Neighbours of particle i are 
+	// m_vNbrs[ m_vLocalNbrRanges[2i] ... m_vLocalNbrRanges[2i+1]-1 ], appended when the particle
+	// is first reached. m_vLocalNbrRanges[2i] is InvalidIndex if it has not been reached yet.
+	bool m_bUseLocalizedQueries;
+	std::vector<unsigned int> m_vLocalNbrRanges;
+	std::vector<unsigned int> m_vNbrs;
+	//! InitializeNeighbourLists(), or in localized mode only the storage for per-particle initialization
+	void PrepareNeighbourLists();
+	//! neighbour list, normal and tangent of particle i, if they do not exist yet
+	void InitializeLocalParticle( unsigned int i );
+	void FindNeighbours( unsigned int nParticle, std::vector<unsigned int> & vNbrs );
+	void FindNeighbours( const Wml::Vector3f & vPoint, std::vector<unsigned int> & vNbrs, 
+						 float fRadiusThreshold, unsigned int nSkip = ExpMapParticle::InvalidIndex );
+
+	//! pointer to the first neighbour of particle i, nCount is set to the number of neighbours
+	const unsigned int * GetNeighbours( unsigned int i, unsigned int & nCount ) const {
+		if ( i == m_nParticles ) {
+			nCount = (unsigned int)m_vSeedNbrs.size();
+			return (nCount > 0) ? &m_vSeedNbrs[0] : NULL;
+		}
+		if ( ! HasNeighbourLists() ) {
+			nCount = m_vLocalNbrRanges[2*i+1] - m_vLocalNbrRanges[2*i];
+			return (nCount > 0) ? &m_vNbrs[ m_vLocalNbrRanges[2*i] ] : NULL;
+		}
+		nCount = m_pNbrOffsets[i+1] - m_pNbrOffsets[i];
+		return (nCount > 0) ? m_pNbrs + m_pNbrOffsets[i] : NULL;
+	}
 
 	void ComputeExpMap( float fStopDistance, unsigned int nMaxCount );
-
-	void RemoveNeighbours( ExpMapParticle * pParticle, std::multiset< ParticleQueueWrapper > & pq );
-	void UpdateNeighbours( ExpMapParticle * pParticle, std::multiset< ParticleQueueWrapper > & pq );
-
-	void PropagateFrameFromNearest( ExpMapParticle * pParticle );
-	void PropagateFrameFromNearest_Average( ExpMapParticle * pParticle );
-
-	void PrecomputePropagationData( ExpMapParticle * pCenterParticle, ExtPlane3f & vTangentPlane, 
-										Frame3f & vCenterWorldFrame, Wml::Matrix2f & matFrameRotate );
-	Wml::Vector2f ComputeSurfaceVector( ExpMapParticle * pCenterParticle, 
-											ExpMapParticle * pNbrParticle,
-											ExtPlane3f & vTangentPlane, 
-											Frame3f & vCenterWorldFrame, 
-											Wml::Matrix2f & matFrameRotate );
-
-
-
-	//! seed particle
-	ExpMapParticle * m_pSeedParticle;
-
-	ExpMapParticle * InitializeSeedParticle( const Wml::Vector3f & vPosition,
-							 const Wml::Vector3f * pSeedNormal,	const Frame3f * pLastSeedPointFrame );
-
-	// particle grid (for point-based neighbour finding)
-	ParticleGrid<ExpMapParticle *> m_particleGrid;
+	template<class Queue>
+	void ComputeExpMap( float fStopDistance, unsigned int nMaxCount, Queue & pq );
+	//! pops particles from pq until the stop criteria are met. nTouched is the number of particles already expanded
+	template<class Queue>
+	void PropagateFront( float fStopDistance, unsigned int nMaxCount, unsigned int nTouched, Queue & pq );
+
+	// incremental update of last expmap (see SetUseIncrementalUpdate)
+	bool m_bUseIncrementalUpdate;
+	bool m_bLastExpMapValid;
+	Wml::Vector3f m_vLastSeedPoint;
+	Frame3f m_vLastSeedFrame;
+	float m_fLastStopDistance;
+	unsigned int m_nLastMaxCount;
+	//! number of particles expanded by last propagation. These are the first entries of m_vLastParticles
+	unsigned int m_nLastExpanded;
+	//! initializes seed particle and computes the expmap, updating the last one if possible
+	void ComputeExpMap( const Wml::Vector3f & vSeedPoint, const Frame3f & vSeedFrame, float fStopDistance, unsigned int nMaxCount );
+	//! returns true if last expmap can be updated for the new seed. bRotated is set if seed frame was rotated around its normal
+	bool CanUpdateExpMap( const Wml::Vector3f & vSeedPoint, const Frame3f & vSeedFrame, float fStopDistance, unsigned int nMaxCount, bool & bRotated );
+	//! rotate surface vectors of last expmap from vLastSeedFrame to the current seed frame
+	void RotateSurfaceVectors( const Frame3f & vLastSeedFrame );
+	//! re-runs the last expmap with a new stop distance / count, keeping the expanded particles that would be the same
+	void UpdateExpMapRadius( float fStopDistance, unsigned int nMaxCount );
+
+	ParticleQueue m_particleQueue;
+	static unsigned int PopFront( ParticleQueue & pq );
+	void FlushQueue( ParticleQueue & pq );
+	void UpdateNeighbours( unsigned int nParticle, ParticleQueue & pq );
+
+	static unsigned int PopFront( std::multiset< ParticleQueueWrapper > & pq );
+	void FlushQueue( std::multiset< ParticleQueueWrapper > & pq );
+	void RemoveNeighbours( unsigned int nParticle, std::multiset< ParticleQueueWrapper > & pq );
+	void UpdateNeighbours( unsigned int nParticle, std::multiset< ParticleQueueWrapper > & pq );
+
+	void PropagateFrameFromNearest( unsigned int nParticle );
+	void PropagateFrameFromNearest_Average( unsigned int nParticle );
+	//! weighted average of surface vectors propagated from frozen neighbours, with m_upwindKernel
+	Wml::Vector2f AverageNeighbourSurfaceVectors( unsigned int nParticle, unsigned int nNearest );
+
+	void PrecomputePropagationData( unsigned int nCenter, ExtPlane3f & vTangentPlane, 
+									Frame3f & vCenterWorldFrame, Wml::Matrix2f & matFrameRotate );
+	Wml::Vector2f ComputeSurfaceVector( unsigned int nCenter, unsigned int nParticle,
+										ExtPlane3f & vTangentPlane, 
+										Frame3f & vCenterWorldFrame, 
+										Wml::Matrix2f & matFrameRotate );
+
+	// propagation kernels on plain values, shared with ExpMapBatch
+	static void PrecomputePropagationData( const Wml::Vector3f & vCenterPosition, const Wml::Vector3f & vCenterNormal,
+										   const Frame3f & vCenterFrame, const Frame3f & vSeedFrame,
+										   ExtPlane3f & vTangentPlane, Frame3f & vCenterWorldFrame, Wml::Matrix2f & matFrameRotate );
+	static Wml::Vector2f ComputeSurfaceVector( const Wml::Vector3f & vCenterPosition, const Wml::Vector2f & vCenterSurfaceVector,
+											  const Wml::Vector3f & vNbrPosition,
+											  const ExtPlane3f & vTangentPlane, const Frame3f & vCenterWorldFrame, 
+											  const Wml::Matrix2f & matFrameRotate );
+	//! clamp surface vector length to fSurfaceDistance if they differ by too much
+	static void ClampSurfaceVector( Wml::Vector2f & vSurfaceVector, float fSurfaceDistance );
+
+
+	//! initialize seed particle (position, normal, frame and neighbour list)
+	void InitializeSeedParticle( const Wml::Vector3f & vPosition,
+								 const Wml::Vector3f * pSeedNormal,	const Frame3f * pLastSeedPointFrame );
+	bool m_bSeedValid;
+	//! particles that are connected to a seed point at vPosition
+	void FindSeedNeighbours( const Wml::Vector3f & vPosition, std::vector<unsigned int> & vNbrs );
+	//! seed frame, aligned to pLastSeedPointFrame (if non-NULL). If normal smoothing is enabled, 
+	//! vSeedNormal is replaced with the average over vNbrs
+	Frame3f ComputeSeedFrame( const Wml::Vector3f & vPosition, Wml::Vector3f & vSeedNormal,
+							  const std::vector<unsigned int> & vNbrs, const Frame3f * pLastSeedPointFrame );
+
+	// particle grid (for point-based neighbour finding in localized mode)
+	ParticleGrid<unsigned int> m_particleGrid;
 	bool m_bParticleGridValid;
 	void InitializeParticleGrid(float fCellSize);
 
 	// last-touched cache to speed up clears, etc
-	std::vector<ExpMapParticle *> m_vLastParticles;
-	void InitializeParticles( ExpMapParticle * pSkip );
-
-
-	// Particle management
-public:
-	virtual unsigned int AddParticle( ExpMapParticle * pParticle ) {
-		m_vParticles.push_back( pParticle );
-		return (unsigned int)(m_vParticles.size()-1);
-	}
-
-	virtual ExpMapParticle * AllocateParticle() { 
-		ExpMapParticle * pParticle = m_vParticleMemoryPool.Allocate();
-		pParticle->Reset();
-		return pParticle;
-	}
-
-	virtual void ClearParticles() { 
-		m_vParticles.clear();
-		m_vParticleMemoryPool.ClearAll();
-	}
-
-	class Iterator {
-	public:
-		Iterator( DynamicVector<ExpMapParticle *> * pVector, unsigned int nCur ) 
-			{ m_pVector = pVector; m_nCount = (unsigned int)m_pVector->size(); m_nCur = nCur; }
-		~Iterator() {}
-
-		ExpMapParticle * operator *() 
-			{ return (*m_pVector)[m_nCur]; }
-		void operator++() 
-			{ if ( m_nCur < m_nCount ) m_nCur++; }
-		void operator++(int nPostfix) 
-			{ if ( m_nCur < m_nCount ) m_nCur++; }
-		bool operator==( const Iterator & p2 ) const 
-			{ return m_nCur == p2.m_nCur; }
-		bool operator!=( const Iterator & p2 ) const
-			{ return m_nCur != p2.m_nCur; }
-
-	protected:
-		DynamicVector<ExpMapParticle *> * m_pVector;
-		unsigned int m_nCount;
-		unsigned int m_nCur;
+	std::vector<unsigned int> m_vLastParticles;
+	void InitializeParticles();
+
+	// UV/3D projection (see MeshCurrentUVs). Mesh triangles whose vertices all have UVs (or, for point
+	// sets, the Delaunay triangles of the UVs) are stored as particle index triplets in m_vRegionTris, and 
+	// bucketed into a uniform grid over their UV bounding boxes. Cell c contains region triangles 
+	// m_vUVGridTris[ m_vUVGridOffsets[c] ... m_vUVGridOffsets[c+1]-1 ]
+	std::vector<unsigned int> m_vRegionTris;
+	void TriangulateCurrentUVs();
+	// FindUV uses m_pMeshBVTree. If there is none, or the surface is a point set, it uses a BV tree 
+	// over a copy of the region triangles instead (triangle t of m_regionMesh is region triangle t)
+	VFTriangleMesh m_regionMesh;
+	IMeshBVTree m_regionBVTree;
+	Wml::Vector2f m_vUVGridOrigin;
+	float m_fUVGridCellSize;
+	unsigned int m_nUVGridWidth, m_nUVGridHeight;
+	std::vector<unsigned int> m_vUVGridOffsets;
+	std::vector<unsigned int> m_vUVGridTris;
+	bool HasUV( unsigned int i ) const 
+		{ return m_vParticles[i].SurfaceDistance() != std::numeric_limits<float>::max(); }
+	void GetUVGridCell( const Wml::Vector2f & vUV, unsigned int & nX, unsigned int & nY ) const;
+	//! region triangle that contains vUV (fDistance = 0), or else the nearest one. Returns InvalidIndex if there are none
+	unsigned int FindRegionTriangle( const Wml::Vector2f & vUV, float & fDistance ) const;
+
+	// scratch buffers
+	std::vector<unsigned int> m_vNeighbourBuf;
+	struct NbrInfo {
+		float fNbrWeight;
+		Wml::Vector2f vNbrUV;
 	};
+	std::vector<NbrInfo> m_vNbrInfo;
+	ExpMapUpwindKernel m_upwindKernel;
 
-	Iterator Begin() { return Iterator( &m_vParticles, 0 ); }
-	Iterator End() { return Iterator( &m_vParticles, (unsigned int)m_vParticles.size() ); }
-
-protected:
-	DynamicVector<ExpMapParticle *> m_vParticles;
-	MemoryPool<ExpMapParticle> m_vParticleMemoryPool;
-
+	friend class ExpMapBatch;
+	friend class ExpMapVoronoi;
+	friend class ExpMapUpwindKernel;
 
 };
 
@@ -0,0 +1,388 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "ExpMapSurfaceCache.h"
+#include "rmsdebug.h"
+#include <algorithm>
+
+#include "VectorUtil.h"
+#include "MeshUtils.h"
+
+using namespace rms;
+
+
+std::vector<ExpMapSurfaceCache *> ExpMapSurfaceCache::s_vShared;
+
+
+ExpMapSurfaceCache * ExpMapSurfaceCache::Acquire( VFTriangleMesh * pMesh, float fNeighbourThreshold, bool bSmoothNormals )
+{
+	return AcquireShared( pMesh, NULL, fNeighbourThreshold, bSmoothNormals );
+}
+
+
+ExpMapSurfaceCache * ExpMapSurfaceCache::Acquire( IMesh * pMesh, float fNeighbourThreshold, bool bSmoothNormals )
+{
+	return AcquireShared( NULL, pMesh, fNeighbourThreshold, bSmoothNormals );
+}
+
+
+// Shared caches are keyed by GetMesh(), so both Acquire() overloads find the same cache for a VFTriangleMesh.
+// The critical section is only held to find or insert a cache. A new cache is inserted unbuilt with its build
+// lock set, and built by the thread that inserted it. Other threads that find it block on the build lock.
+ExpMapSurfaceCache * ExpMapSurfaceCache::AcquireShared( VFTriangleMesh * pVFMesh, IMesh * pMesh, float fNeighbourThreshold,
+														bool bSmoothNormals )
+{
+	IMesh * pKey = (pVFMesh) ? pVFMesh : pMesh;
+	ExpMapSurfaceCache * pCache = NULL;
+	bool bBuild = false;
+	#pragma omp critical(ExpMapSurfaceCache)
+	{
+		for ( unsigned int i = 0; i < s_vShared.size() && pCache == NULL; ++i ) {
+			ExpMapSurfaceCache * pShared = s_vShared[i];
+			if ( pShared->GetMesh() == pKey && pShared->m_fNeighbourThreshold == fNeighbourThreshold
+				 && pShared->m_bSmoothNormals == bSmoothNormals ) {
+				pCache = pShared;
+				++pCache->m_nRefCount;
+			}
+		}
+		if ( pCache == NULL ) {
+			pCache = new ExpMapSurfaceCache( pVFMesh, pMesh, fNeighbourThreshold, bSmoothNormals, 0.0f );
+			pCache->m_bShared = true;
+#ifdef _OPENMP
+			omp_set_lock( &pCache->m_buildLock );
+#endif
+			s_vShared.push_back( pCache );
+			bBuild = true;
+		}
+	}
+
+	if ( bBuild ) {
+		// same edge length estimate as ExpMapGenerator::SetSurface(). Point sets have no edges,
+		// their neighbour spacing is the threshold
+		float fMin = 0, fMax = 0, fAverage = 0;
+		if ( pKey->GetTriangleCount() == 0 )
+			fMax = fNeighbourThreshold;
+		else if ( pVFMesh )
+			pVFMesh->GetEdgeLengthStats( fMin, fMax, fAverage );
+		else
+			MeshUtils::GetEdgeLengthStats( pMesh, fMin, fMax, fAverage );
+		pCache->m_fMaxEdgeLength = fMax;
+		pCache->Build();
+#ifdef _OPENMP
+		omp_unset_lock( &pCache->m_buildLock );
+	} else {
+		// setting the lock also flushes, so the data built by the other thread is visible
+		omp_set_lock( &pCache->m_buildLock );
+		omp_unset_lock( &pCache->m_buildLock );
+#endif
+	}
+	return pCache;
+}
+
+
+ExpMapSurfaceCache * ExpMapSurfaceCache::Create( VFTriangleMesh * pVFMesh, IMesh * pMesh, float fNeighbourThreshold,
+												 bool bSmoothNormals, float fMaxEdgeLength )
+{
+	ExpMapSurfaceCache * pCache = new ExpMapSurfaceCache( pVFMesh, pMesh, fNeighbourThreshold, bSmoothNormals, fMaxEdgeLength );
+	pCache->Build();
+	return pCache;
+}
+
+
+void ExpMapSurfaceCache::Invalidate( const IMesh * pMesh )
+{
+	#pragma omp critical(ExpMapSurfaceCache)
+	{
+		for ( unsigned int i = 0; i < s_vShared.size(); ) {
+			if ( s_vShared[i]->GetMesh() == pMesh ) {
+				s_vShared[i]->m_bShared = false;
+				s_vShared.erase( s_vShared.begin() + i );
+			} else
+				++i;
+		}
+	}
+}
+
+
+void ExpMapSurfaceCache::AddRef()
+{
+	#pragma omp critical(ExpMapSurfaceCache)
+	{
+		++m_nRefCount;
+	}
+}
+
+
+void ExpMapSurfaceCache::Release()
+{
+	bool bDelete = false;
+	#pragma omp critical(ExpMapSurfaceCache)
+	{
+		if ( --m_nRefCount == 0 ) {
+			bDelete = true;
+			if ( m_bShared )
+				s_vShared.erase( std::find( s_vShared.begin(), s_vShared.end(), this ) );
+		}
+	}
+	if ( bDelete )
+		delete this;
+}
+
+
+
+ExpMapSurfaceCache::ExpMapSurfaceCache( VFTriangleMesh * pVFMesh, IMesh * pMesh, float fNeighbourThreshold,
+										bool bSmoothNormals, float fMaxEdgeLength )
+{
+	m_pVFMesh = pVFMesh;
+	m_pIMesh = pMesh;
+	m_fNeighbourThreshold = fNeighbourThreshold;
+	m_bSmoothNormals = bSmoothNormals;
+	m_fMaxEdgeLength = fMaxEdgeLength;
+	m_nRefCount = 1;
+	m_bShared = false;
+#ifdef _OPENMP
+	omp_init_lock( &m_buildLock );
+#endif
+	m_nParticles = 0;
+	m_pPositions = NULL;
+	m_pNormals = NULL;
+}
+
+void ExpMapSurfaceCache::Build()
+{
+	m_nParticles = GetMesh()->GetMaxVertexID();
+	InitializePositions();
+	if ( m_fNeighbourThreshold > 0.0f )
+		BuildParticleGrid( m_particleGrid, GetMesh(), m_pPositions, m_fNeighbourThreshold );
+	InitializeNeighbourLists();
+	InitializeNormals();
+}
+
+ExpMapSurfaceCache::~ExpMapSurfaceCache()
+{
+#ifdef _OPENMP
+	omp_destroy_lock( &m_buildLock );
+#endif
+}
+
+
+size_t ExpMapSurfaceCache::GetMemoryUsage() const
+{
+	size_t nBytes = sizeof(ExpMapSurfaceCache);
+	nBytes += (m_vPositionBuf.capacity() + m_vNormalBuf.capacity() + m_vTangents.capacity()) * sizeof(Wml::Vector3f);
+	nBytes += (m_vNbrOffsets.capacity() + m_vNbrs.capacity()) * sizeof(unsigned int);
+	return nBytes;
+}
+
+
+
+void ExpMapSurfaceCache::InitializePositions()
+{
+	// an unshared cache is rebuilt by its generator when the mesh changes, so it can use the mesh buffer.
+	// Shared caches copy positions, so that they do not change with the mesh
+	const float * pMeshPositions = ( ! m_bShared && m_pVFMesh ) ? m_pVFMesh->GetPositionBuffer() : NULL;
+	if ( pMeshPositions ) {
+		m_pPositions = (const Wml::Vector3f *)pMeshPositions;
+		return;
+	}
+	IMesh * pMesh = GetMesh();
+	m_vPositionBuf.resize( m_nParticles + 1 );
+	pMesh->ForEachVertexBlock( IMeshGatherByIDFunc( pMesh, (float *)&m_vPositionBuf[0] ) );
+	m_pPositions = &m_vPositionBuf[0];
+}
+
+
+void ExpMapSurfaceCache::InitializeNeighbourLists()
+{
+	// neighbour lists for all particles, packed into one array
+	IMesh * pMesh = GetMesh();
+	std::vector<unsigned int> vNbrs;
+	m_vNbrOffsets.resize( m_nParticles + 1 );
+	m_vNbrs.resize(0);
+	for ( unsigned int i = 0; i < m_nParticles; ++i ) {
+		m_vNbrOffsets[i] = (unsigned int)m_vNbrs.size();
+		if ( ! pMesh->IsVertex(i) )
+			continue;
+		if ( m_fNeighbourThreshold == 0.0f )
+			FindMeshNeighbours( pMesh, i, vNbrs );
+		else
+			FindNeighbours( m_pPositions[i], vNbrs, m_fNeighbourThreshold, i );
+		m_vNbrs.insert( m_vNbrs.end(), vNbrs.begin(), vNbrs.end() );
+	}
+	m_vNbrOffsets[m_nParticles] = (unsigned int)m_vNbrs.size();
+	std::vector<unsigned int>(m_vNbrs).swap(m_vNbrs);		// trim
+}
+
+
+void ExpMapSurfaceCache::InitializeNormals()
+{
+	IMesh * pMesh = GetMesh();
+	std::vector<IMesh::VertexID> vVertices;
+	vVertices.reserve( pMesh->GetVertexCount() );
+	pMesh->ForEachVertexBlock( IMeshAppendIDsFunc(vVertices) );
+	unsigned int nVertices = (unsigned int)vVertices.size();
+
+	// normals are shared or copied like the positions (and optionally smoothed)
+	const float * pMeshNormals = ( ! m_bShared && m_pVFMesh && ! m_bSmoothNormals ) ? m_pVFMesh->GetNormalBuffer() : NULL;
+	if ( pMeshNormals )
+		m_pNormals = (const Wml::Vector3f *)pMeshNormals;
+	else {
+		m_vNormalBuf.resize( m_nParticles + 1 );
+		pMesh->ForEachVertexBlock( IMeshGatherByIDFunc( pMesh, NULL, (float *)&m_vNormalBuf[0] ) );
+		m_pNormals = &m_vNormalBuf[0];
+	}
+
+	// inverse-distance weighted average of neighbour normals
+	if ( m_bSmoothNormals ) {
+		std::vector<Wml::Vector3f> vMeshNormals( m_vNormalBuf );
+		for ( unsigned int k = 0; k < nVertices; ++k ) {
+			unsigned int i = vVertices[k];
+			if ( m_vNbrOffsets[i+1] == m_vNbrOffsets[i] )
+				continue;
+			float fWeightSum = 0.0f;
+			Wml::Vector3f vAverage = Wml::Vector3f::ZERO;
+			for ( unsigned int j = m_vNbrOffsets[i]; j < m_vNbrOffsets[i+1]; ++j ) {
+				float fWeight = 1.0f / ( (m_pPositions[i] - m_pPositions[m_vNbrs[j]]).Length() + (0.0001f*m_fMaxEdgeLength) );
+				vAverage += fWeight * vMeshNormals[ m_vNbrs[j] ];
+				fWeightSum += fWeight;
+			}
+			vAverage /= fWeightSum;
+			vAverage.Normalize();
+			m_vNormalBuf[i] = vAverage;
+		}
+	}
+
+	// particle frames are arbitrary in the tangent plane. Store the X axis that Frame3f(position, normal) would use
+	m_vTangents.resize( m_nParticles + 1 );
+	for ( unsigned int k = 0; k < nVertices; ++k ) {
+		Wml::Vector3f vNormal( m_pNormals[vVertices[k]] ), vTangent2;
+		vNormal.Normalize();
+		rms::ComputePerpVectors( vNormal, m_vTangents[vVertices[k]], vTangent2, true );
+	}
+}
+
+
+
+void ExpMapSurfaceCache::FindNeighbours( const Wml::Vector3f & vPoint, std::vector<unsigned int> & vNbrs,
+										 float fRadiusThreshold, unsigned int nSkip ) const
+{
+	FindGridNeighbours( m_particleGrid, m_pPositions, vPoint, vNbrs, fRadiusThreshold, nSkip );
+}
+
+
+void ExpMapSurfaceCache::FindMeshNeighbours( IMesh * pMesh, unsigned int i, std::vector<unsigned int> & vNbrs )
+{
+	vNbrs.resize(0);
+
+	IMesh::VertexID vID = i;
+
+	NeighborTriBuffer vBuffer;
+	pMesh->NeighbourIteration(vID, &vBuffer);
+	const std::vector<IMesh::TriangleID> & vTris = vBuffer.Triangles();
+	size_t nCount = vTris.size();
+	for ( unsigned int i = 0; i < nCount; ++i ) {
+		IMesh::VertexID nTri[3];
+		pMesh->GetTriangle( vTris[i], nTri);
+
+		// check each vertex
+		for ( int j = 0; j < 3; ++j ) {
+			if ( nTri[j] == vID )
+				continue;
+			if ( std::find( vNbrs.begin(), vNbrs.end(), nTri[j] ) == vNbrs.end() )
+				vNbrs.push_back( nTri[j] );
+		}
+	}
+}
+
+
+
+void ExpMapSurfaceCache::FindGridNeighbours( ParticleGrid<unsigned int> & grid, const Wml::Vector3f * pPositions,
+											 const Wml::Vector3f & vPoint, std::vector<unsigned int> & vNbrs,
+											 float fRadiusThreshold, unsigned int nSkip )
+{
+	// (squared distance, particle) pairs
+	std::vector< std::pair<float, unsigned int> > vNeighbours;
+	const unsigned int sMaxNbrs = 15;
+//	const unsigned int sMaxNbrs = 8;
+
+rinse_and_repeat:
+
+	vNeighbours.resize(0);
+	ParticleGrid<unsigned int>::BoxIterator itr( &grid, vPoint, fRadiusThreshold );
+	if ( itr.Done() ) {
+		fRadiusThreshold *= 1.5f;
+		goto rinse_and_repeat;
+	}
+	while ( ! itr.Done() ) {
+		unsigned int nTmp = *itr;
+		++itr;
+
+		if ( nTmp == nSkip )
+			continue;
+
+		float fDistSqr = ( pPositions[nTmp] - vPoint ).SquaredLength();
+		vNeighbours.push_back( std::pair<float, unsigned int>(fDistSqr, nTmp) );
+	}
+
+	size_t nFoundNbrs = vNeighbours.size();
+	if ( nFoundNbrs < sMaxNbrs/2 ) {
+		fRadiusThreshold *= 1.5f;
+		goto rinse_and_repeat;
+	}
+
+	std::sort( vNeighbours.begin(), vNeighbours.end() );
+	unsigned int nMaxNbrs;
+
+	if (sMaxNbrs < nFoundNbrs)
+	  nMaxNbrs = (unsigned int)sMaxNbrs;
+	else
+	  nMaxNbrs = (unsigned int)nFoundNbrs;
+
+	vNbrs.resize(nMaxNbrs);
+	for ( unsigned int i = 0; i < nMaxNbrs; ++i ) {
+		vNbrs[i] = vNeighbours[i].second;
+	}
+}
+
+
+
+void ExpMapSurfaceCache::BuildParticleGrid( ParticleGrid<unsigned int> & grid, IMesh * pMesh, const Wml::Vector3f * pPositions,
+											float fCellSize )
+{
+	unsigned int nParticles = pMesh->GetMaxVertexID();
+	std::vector<unsigned int> vGridParticles;
+	vGridParticles.reserve( nParticles );
+	Wml::AxisAlignedBox3f partBounds;
+	for ( unsigned int i = 0; i < nParticles; ++i ) {
+		if ( ! pMesh->IsVertex(i) )
+			continue;
+		const Wml::Vector3f & vPos = pPositions[i];
+		if ( vGridParticles.empty() )
+			partBounds = Wml::AxisAlignedBox3f( vPos.X(), vPos.X(), vPos.Y(), vPos.Y(), vPos.Z(), vPos.Z() );
+		else
+			rms::Union( partBounds, vPos );
+		vGridParticles.push_back(i);
+	}
+	// dilate by one cell
+	for ( int k = 0; k < 3; ++k ) {
+		partBounds.Min[k] -= fCellSize;
+		partBounds.Max[k] += fCellSize;
+	}
+
+	grid.Initialize( rms::Center(partBounds), fCellSize );
+
+	// add all particles at once, so that grid can be built in parallel
+	size_t nParticleCount = vGridParticles.size();
+	std::vector<float> vPositions( 3*nParticleCount );
+	#pragma omp parallel for
+	for ( int i = 0; i < (int)nParticleCount; ++i ) {
+		const Wml::Vector3f & vPos = pPositions[ vGridParticles[i] ];
+		vPositions[3*i] = vPos.X();
+		vPositions[3*i+1] = vPos.Y();
+		vPositions[3*i+2] = vPos.Z();
+	}
+	if ( nParticleCount > 0 )
+		grid.AddParticles( &vGridParticles[0], &vPositions[0], (unsigned int)nParticleCount );
+	grid.Build();
+}
@@ -0,0 +1,166 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __RMS_EXPMAP_SURFACE_CACHE_H
+#define __RMS_EXPMAP_SURFACE_CACHE_H
+
+#include "config.h"
+#include <vector>
+
+#include "IMesh.h"
+#include "VFTriangleMesh.h"
+#include "ParticleGrid.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+namespace rms {
+
+
+/*
+ * Per-surface particle data used by ExpMapGenerator: positions, normals (optionally smoothed),
+ * tangents, the packed neighbour graph and (for point-based neighbours) the particle grid. It is
+ * immutable once built and reference-counted, so any number of generators over the same surface
+ * can use one copy (see ExpMapGenerator::SetSurfaceCache()).
+ *
+ * Acquire() returns a shared cache keyed by (mesh, neighbour threshold, normal smoothing), building
+ * it the first time. The cache does not notice mesh changes - call Invalidate() after editing the
+ * mesh, so that later Acquire() calls rebuild it. References that are already held keep the old data
+ * (positions and normals of shared caches are copies, not the mesh buffers).
+ */
+class ExpMapSurfaceCache
+{
+public:
+	//! shared cache for pMesh, with a reference owned by the caller. fNeighbourThreshold = 0 connects
+	//! particles to their mesh one-ring, otherwise to (up to 15) nearest particles, searched with this radius
+	static ExpMapSurfaceCache * Acquire( VFTriangleMesh * pMesh, float fNeighbourThreshold = 0.0f, bool bSmoothNormals = false );
+	static ExpMapSurfaceCache * Acquire( IMesh * pMesh, float fNeighbourThreshold = 0.0f, bool bSmoothNormals = false );
+
+	//! unshared cache (never returned by Acquire()), with a reference owned by the caller. Exactly one of
+	//! pVFMesh and pMesh is non-null. fMaxEdgeLength scales the normal smoothing weights. If pVFMesh uses
+	//! CompactVertexStorage, positions (and unsmoothed normals) point into its buffers instead of being copied
+	static ExpMapSurfaceCache * Create( VFTriangleMesh * pVFMesh, IMesh * pMesh, float fNeighbourThreshold,
+										bool bSmoothNormals, float fMaxEdgeLength );
+
+	//! drop shared caches of pMesh, so that the next Acquire() rebuilds them
+	static void Invalidate( const IMesh * pMesh );
+
+	void AddRef();
+	//! deletes the cache when the last reference is released
+	void Release();
+
+	IMesh * GetMesh() const { return (m_pVFMesh) ? m_pVFMesh : m_pIMesh; }
+	float GetNeighbourThreshold() const { return m_fNeighbourThreshold; }
+	bool GetSmoothNormals() const { return m_bSmoothNormals; }
+
+	//! particles are indexed by VertexID (including unused IDs, which have no neighbours)
+	unsigned int GetParticleCount() const { return m_nParticles; }
+	const Wml::Vector3f * GetPositions() const { return m_pPositions; }
+	const Wml::Vector3f * GetNormals() const { return m_pNormals; }
+	const Wml::Vector3f * GetTangents() const { return &m_vTangents[0]; }
+
+	//! neighbours of particle i are GetNeighbours()[ GetNeighbourOffsets()[i] ... GetNeighbourOffsets()[i+1]-1 ]
+	const unsigned int * GetNeighbourOffsets() const { return &m_vNbrOffsets[0]; }
+	const unsigned int * GetNeighbours() const { return m_vNbrs.empty() ? NULL : &m_vNbrs[0]; }
+
+	//! nearest particles to vPoint, for point-based neighbours (GetNeighbourThreshold() > 0)
+	void FindNeighbours( const Wml::Vector3f & vPoint, std::vector<unsigned int> & vNbrs,
+						 float fRadiusThreshold, unsigned int nSkip = 0xFFFFFFFF ) const;
+
+	//! bytes used by the cache
+	size_t GetMemoryUsage() const;
+
+
+	// neighbour finding, shared with ExpMapGenerator localized queries
+
+	//! one-ring vertices of vertex i
+	static void FindMeshNeighbours( IMesh * pMesh, unsigned int i, std::vector<unsigned int> & vNbrs );
+	//! up to 15 nearest particles to vPoint within fRadiusThreshold (grown until at least 7 are found), except nSkip
+	static void FindGridNeighbours( ParticleGrid<unsigned int> & grid, const Wml::Vector3f * pPositions,
+									const Wml::Vector3f & vPoint, std::vector<unsigned int> & vNbrs,
+									float fRadiusThreshold, unsigned int nSkip );
+	//! grid over all vertices of pMesh
+	static void BuildParticleGrid( ParticleGrid<unsigned int> & grid, IMesh * pMesh, const Wml::Vector3f * pPositions,
+								   float fCellSize );
+
+protected:
+	ExpMapSurfaceCache( VFTriangleMesh * pVFMesh, IMesh * pMesh, float fNeighbourThreshold, bool bSmoothNormals, float fMaxEdgeLength );
+	~ExpMapSurfaceCache();
+	ExpMapSurfaceCache( const ExpMapSurfaceCache & );
+	ExpMapSurfaceCache & operator=( const ExpMapSurfaceCache & );
+
+	VFTriangleMesh * m_pVFMesh;
+	IMesh * m_pIMesh;
+	float m_fNeighbourThreshold;
+	bool m_bSmoothNormals;
+	float m_fMaxEdgeLength;
+
+	int m_nRefCount;
+	bool m_bShared;
+#ifdef _OPENMP
+	// held by the thread that builds a shared cache, see AcquireShared()
+	omp_lock_t m_buildLock;
+#endif
+
+	static ExpMapSurfaceCache * AcquireShared( VFTriangleMesh * pVFMesh, IMesh * pMesh, float fNeighbourThreshold, bool bSmoothNormals );
+	void Build();
+
+	// positions and normals point to the copies, or to the mesh buffers
+	unsigned int m_nParticles;
+	const Wml::Vector3f * m_pPositions;
+	const Wml::Vector3f * m_pNormals;
+	std::vector<Wml::Vector3f> m_vPositionBuf;
+	std::vector<Wml::Vector3f> m_vNormalBuf;
+	std::vector<Wml::Vector3f> m_vTangents;
+
+	std::vector<unsigned int> m_vNbrOffsets;
+	std::vector<unsigned int> m_vNbrs;
+
+	// built in the constructor (if fNeighbourThreshold > 0). Queries do not change it
+	mutable ParticleGrid<unsigned int> m_particleGrid;
+
+	void InitializePositions();
+	void InitializeNeighbourLists();
+	void InitializeNormals();
+
+	static std::vector<ExpMapSurfaceCache *> s_vShared;
+};
+
+
+/*
+ * Holds a reference to an ExpMapSurfaceCache (or NULL). Copies add a reference, so classes
+ * with a cache member keep their default copy constructor and assignment.
+ */
+class ExpMapSurfaceCacheRef
+{
+public:
+	ExpMapSurfaceCacheRef() { m_pCache = NULL; }
+	ExpMapSurfaceCacheRef( const ExpMapSurfaceCacheRef & r2 ) { m_pCache = NULL; Set( r2.m_pCache ); }
+	~ExpMapSurfaceCacheRef() { Set( NULL ); }
+	ExpMapSurfaceCacheRef & operator=( const ExpMapSurfaceCacheRef & r2 ) { Set( r2.m_pCache ); return *this; }
+
+	ExpMapSurfaceCache * Get() const { return m_pCache; }
+	ExpMapSurfaceCache * operator->() const { return m_pCache; }
+
+	//! adds a reference to pCache and releases the current one
+	void Set( ExpMapSurfaceCache * pCache ) {
+		if ( pCache )
+			pCache->AddRef();
+		if ( m_pCache )
+			m_pCache->Release();
+		m_pCache = pCache;
+	}
+
+protected:
+	ExpMapSurfaceCache * m_pCache;
+};
+
+
+
+} // end namespace rms
+
+
+#endif // __RMS_EXPMAP_SURFACE_CACHE_H
@@ -0,0 +1,259 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "ExpMapUpwindKernel.h"
+#include "ExpMapGenerator.h"
+#include <cmath>
+
+// AVX (8 floats) if the compiler targets it, otherwise SSE (4 floats, VC9 release build uses
+// /arch:SSE2), otherwise plain floats. All three use the same kernel code below.
+#if defined(__AVX__)
+#define RMS_EXPMAP_USE_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RMS_EXPMAP_USE_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace rms;
+
+
+namespace {
+
+#if defined(RMS_EXPMAP_USE_AVX)
+
+struct VecOps {
+	typedef __m256 Float;
+	typedef __m256 Mask;
+	enum { Width = 8 };
+	static Float Load( const float * p ) { return _mm256_loadu_ps(p); }
+	static Float Set( float f ) { return _mm256_set1_ps(f); }
+	static Float LaneIndex() { return _mm256_setr_ps(0,1,2,3,4,5,6,7); }
+	static Float Add( Float a, Float b ) { return _mm256_add_ps(a, b); }
+	static Float Sub( Float a, Float b ) { return _mm256_sub_ps(a, b); }
+	static Float Mul( Float a, Float b ) { return _mm256_mul_ps(a, b); }
+	static Float Div( Float a, Float b ) { return _mm256_div_ps(a, b); }
+	static Float Sqrt( Float a ) { return _mm256_sqrt_ps(a); }
+	static Float Max( Float a, Float b ) { return _mm256_max_ps(a, b); }
+	static Mask Less( Float a, Float b ) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static Mask And( Mask a, Mask b ) { return _mm256_and_ps(a, b); }
+	static Mask Or( Mask a, Mask b ) { return _mm256_or_ps(a, b); }
+	static Mask AndNot( Mask a, Mask b ) { return _mm256_andnot_ps(a, b); }
+	static Float Select( Mask m, Float a, Float b ) { return _mm256_blendv_ps(b, a, m); }
+	static int Bits( Mask m ) { return _mm256_movemask_ps(m); }
+	static float Sum( Float a ) {
+		float f[8];  _mm256_storeu_ps(f, a);
+		return ((f[0]+f[1]) + (f[2]+f[3])) + ((f[4]+f[5]) + (f[6]+f[7]));
+	}
+};
+
+#elif defined(RMS_EXPMAP_USE_SSE)
+
+struct VecOps {
+	typedef __m128 Float;
+	typedef __m128 Mask;
+	enum { Width = 4 };
+	static Float Load( const float * p ) { return _mm_loadu_ps(p); }
+	static Float Set( float f ) { return _mm_set1_ps(f); }
+	static Float LaneIndex() { return _mm_setr_ps(0,1,2,3); }
+	static Float Add( Float a, Float b ) { return _mm_add_ps(a, b); }
+	static Float Sub( Float a, Float b ) { return _mm_sub_ps(a, b); }
+	static Float Mul( Float a, Float b ) { return _mm_mul_ps(a, b); }
+	static Float Div( Float a, Float b ) { return _mm_div_ps(a, b); }
+	static Float Sqrt( Float a ) { return _mm_sqrt_ps(a); }
+	static Float Max( Float a, Float b ) { return _mm_max_ps(a, b); }
+	static Mask Less( Float a, Float b ) { return _mm_cmplt_ps(a, b); }
+	static Mask And( Mask a, Mask b ) { return _mm_and_ps(a, b); }
+	static Mask Or( Mask a, Mask b ) { return _mm_or_ps(a, b); }
+	static Mask AndNot( Mask a, Mask b ) { return _mm_andnot_ps(a, b); }
+	static Float Select( Mask m, Float a, Float b ) { return _mm_or_ps( _mm_and_ps(m, a), _mm_andnot_ps(m, b) ); }
+	static int Bits( Mask m ) { return _mm_movemask_ps(m); }
+	static float Sum( Float a ) {
+		float f[4];  _mm_storeu_ps(f, a);
+		return (f[0]+f[1]) + (f[2]+f[3]);
+	}
+};
+
+#else
+
+struct VecOps {
+	typedef float Float;
+	typedef bool Mask;
+	enum { Width = 1 };
+	static Float Load( const float * p ) { return *p; }
+	static Float Set( float f ) { return f; }
+	static Float LaneIndex() { return 0.0f; }
+	static Float Add( Float a, Float b ) { return a + b; }
+	static Float Sub( Float a, Float b ) { return a - b; }
+	static Float Mul( Float a, Float b ) { return a * b; }
+	static Float Div( Float a, Float b ) { return a / b; }
+	static Float Sqrt( Float a ) { return (float)sqrt(a); }
+	static Float Max( Float a, Float b ) { return (a > b) ? a : b; }
+	static Mask Less( Float a, Float b ) { return a < b; }
+	static Mask And( Mask a, Mask b ) { return a && b; }
+	static Mask Or( Mask a, Mask b ) { return a || b; }
+	static Mask AndNot( Mask a, Mask b ) { return !a && b; }
+	static Float Select( Mask m, Float a, Float b ) { return m ? a : b; }
+	static int Bits( Mask m ) { return m ? 1 : 0; }
+	static float Sum( Float a ) { return a; }
+};
+
+#endif
+
+typedef VecOps V;
+
+struct Vec3 {
+	V::Float x, y, z;
+};
+
+inline Vec3 Load3( const float * px, const float * py, const float * pz )
+	{ Vec3 v = { V::Load(px), V::Load(py), V::Load(pz) };  return v; }
+inline Vec3 Set3( const Wml::Vector3f & v )
+	{ Vec3 r = { V::Set(v.X()), V::Set(v.Y()), V::Set(v.Z()) };  return r; }
+inline Vec3 Add3( const Vec3 & a, const Vec3 & b )
+	{ Vec3 r = { V::Add(a.x, b.x), V::Add(a.y, b.y), V::Add(a.z, b.z) };  return r; }
+inline Vec3 Sub3( const Vec3 & a, const Vec3 & b )
+	{ Vec3 r = { V::Sub(a.x, b.x), V::Sub(a.y, b.y), V::Sub(a.z, b.z) };  return r; }
+inline Vec3 Scale3( const Vec3 & a, V::Float s )
+	{ Vec3 r = { V::Mul(a.x, s), V::Mul(a.y, s), V::Mul(a.z, s) };  return r; }
+inline V::Float Dot3( const Vec3 & a, const Vec3 & b )
+	{ return V::Add( V::Add( V::Mul(a.x, b.x), V::Mul(a.y, b.y) ), V::Mul(a.z, b.z) ); }
+inline Vec3 Cross3( const Vec3 & a, const Vec3 & b ) {
+	Vec3 r = { V::Sub( V::Mul(a.y, b.z), V::Mul(a.z, b.y) ),
+			   V::Sub( V::Mul(a.z, b.x), V::Mul(a.x, b.z) ),
+			   V::Sub( V::Mul(a.x, b.y), V::Mul(a.y, b.x) ) };
+	return r;
+}
+inline Vec3 Select3( V::Mask m, const Vec3 & a, const Vec3 & b )
+	{ Vec3 r = { V::Select(m, a.x, b.x), V::Select(m, a.y, b.y), V::Select(m, a.z, b.z) };  return r; }
+
+}  // end anonymous namespace
+
+
+
+ExpMapUpwindKernel::ExpMapUpwindKernel()
+{
+	m_nCount = 0;
+}
+
+unsigned int ExpMapUpwindKernel::GetVectorWidth()
+{
+	return V::Width;
+}
+
+
+void ExpMapUpwindKernel::Add( const Wml::Vector3f & vPosition, const Wml::Vector3f & vNormal, const Wml::Vector3f & vTangent,
+							  const Wml::Vector2f & vSurfaceVector )
+{
+	if ( m_nCount == m_vArrays[0].size() ) {
+		size_t nSize = m_vArrays[0].size() + 4*V::Width;
+		for ( int k = 0; k < NumArrays; ++k )
+			m_vArrays[k].resize( nSize, 0.0f );
+	}
+	unsigned int i = m_nCount++;
+	m_vArrays[PX][i] = vPosition.X();   m_vArrays[PY][i] = vPosition.Y();   m_vArrays[PZ][i] = vPosition.Z();
+	m_vArrays[NX][i] = vNormal.X();     m_vArrays[NY][i] = vNormal.Y();     m_vArrays[NZ][i] = vNormal.Z();
+	m_vArrays[TX][i] = vTangent.X();    m_vArrays[TY][i] = vTangent.Y();    m_vArrays[TZ][i] = vTangent.Z();
+	m_vArrays[SU][i] = vSurfaceVector.X();
+	m_vArrays[SV][i] = vSurfaceVector.Y();
+}
+
+
+void ExpMapUpwindKernel::Accumulate( const Wml::Vector3f & vPoint, const Frame3f & vSeedFrame, float fWeightOffset,
+									 Wml::Vector2f & vWeightedSum, float & fWeightSum ) const
+{
+	if ( m_nCount == 0 )
+		return;
+
+	const float * pArrays[NumArrays];
+	for ( int k = 0; k < NumArrays; ++k )
+		pArrays[k] = &m_vArrays[k][0];
+
+	Vec3 point = Set3( vPoint );
+	Vec3 seedX = Set3( vSeedFrame.Axis( Frame3f::AxisX ) );
+	Vec3 seedZ = Set3( vSeedFrame.Axis( Frame3f::AxisZ ) );
+	V::Float zero = V::Set(0.0f), one = V::Set(1.0f);
+	V::Float epsilon = V::Set( Wml::Mathf::EPSILON );
+	V::Float offset = V::Set( fWeightOffset );
+	V::Float count = V::Set( (float)m_nCount );
+	V::Float sumU = zero, sumV = zero, sumW = zero;
+
+	for ( unsigned int i = 0; i < m_nCount; i += V::Width ) {
+		Vec3 p = Load3( pArrays[PX]+i, pArrays[PY]+i, pArrays[PZ]+i );
+		Vec3 n = Load3( pArrays[NX]+i, pArrays[NY]+i, pArrays[NZ]+i );
+		Vec3 t = Load3( pArrays[TX]+i, pArrays[TY]+i, pArrays[TZ]+i );
+		V::Float u = V::Load( pArrays[SU]+i );
+		V::Float v = V::Load( pArrays[SV]+i );
+
+		// center frame: X is the tangent, Z the normalized normal, Y = Z x X
+		Vec3 z = Scale3( n, V::Div( one, V::Sqrt( Dot3(n, n) ) ) );
+		Vec3 y = Cross3( z, t );
+
+		// PrecomputePropagationData: seed frame X axis, rotated so that seed Z is aligned with Z. With
+		// k = seedZ x Z and c = seedZ.Z, the rotated axis is X c + k x X + k (k.X)(1-c)/|k|^2.
+		// (1-c)/|k|^2 == 1/(1+c), which is better conditioned for c >= 0
+		Vec3 k = Cross3( seedZ, z );
+		V::Float c = Dot3( seedZ, z );
+		V::Float k2 = Dot3( k, k );
+		V::Mask bOpposite = V::Less( c, zero );
+		V::Float f = V::Select( bOpposite, V::Div( V::Sub(one, c), k2 ), V::Div( one, V::Add(one, c) ) );
+		Vec3 r = Add3( Add3( Scale3(seedX, c), Cross3(k, seedX) ), Scale3( k, V::Mul( f, Dot3(k, seedX) ) ) );
+		// parallel normals are not rotated. Opposite normals (180 degree flip around an arbitrary
+		// perpendicular axis) are left to the scalar code below
+		V::Mask bParallel = V::Less( k2, epsilon );
+		r = Select3( bParallel, seedX, r );
+		V::Mask bScalar = V::And( bParallel, bOpposite );
+
+		// angle between center X axis and rotated seed X axis, signed around the normal
+		V::Float fCos = Dot3( t, r );
+		V::Float fSin = V::Sqrt( V::Max( V::Sub( one, V::Mul(fCos, fCos) ), zero ) );
+		fSin = V::Select( V::Less( Dot3( Cross3(t, r), n ), zero ), V::Sub(zero, fSin), fSin );
+
+		// ComputeSurfaceVector: rotate vector from center to point into the tangent plane (keeping
+		// its length), and transform it into frame coordinates
+		Vec3 d = Sub3( point, p );
+		Vec3 dPlane = Sub3( d, Scale3( n, Dot3(d, n) ) );
+		V::Float fDist = V::Sqrt( Dot3(d, d) );
+		V::Float fPlaneDist = V::Sqrt( Dot3(dPlane, dPlane) );
+		V::Float fScale = V::Div( fDist, fPlaneDist );
+		V::Mask bDegenerate = V::Or( V::Less(fDist, epsilon), V::Less(fPlaneDist, epsilon) );
+		V::Float fLocalX = V::Select( bDegenerate, zero, V::Mul( Dot3(t, dPlane), fScale ) );
+		V::Float fLocalY = V::Select( bDegenerate, zero, V::Mul( Dot3(y, dPlane), fScale ) );
+
+		// reverse local vector (so it points back to the particle), rotate it into the seed frame
+		// and add the center surface vector
+		V::Float fU = V::Sub( u, V::Add( V::Mul(fCos, fLocalX), V::Mul(fSin, fLocalY) ) );
+		V::Float fV = V::Sub( v, V::Sub( V::Mul(fCos, fLocalY), V::Mul(fSin, fLocalX) ) );
+		V::Float fWeight = V::Div( one, V::Add(fDist, offset) );
+
+		// padding lanes past m_nCount are not used
+		V::Mask bActive = V::AndNot( bScalar, V::Less( V::Add( V::Set((float)i), V::LaneIndex() ), count ) );
+		sumW = V::Add( sumW, V::Select( bActive, fWeight, zero ) );
+		sumU = V::Add( sumU, V::Select( bActive, V::Mul(fWeight, fU), zero ) );
+		sumV = V::Add( sumV, V::Select( bActive, V::Mul(fWeight, fV), zero ) );
+
+		int nScalarBits = V::Bits( bScalar );
+		for ( unsigned int j = 0; nScalarBits != 0 && j < V::Width; ++j ) {
+			if ( (nScalarBits & (1 << j)) == 0 || i+j >= m_nCount )
+				continue;
+			unsigned int nCenter = i+j;
+			Wml::Vector3f vPosition( pArrays[PX][nCenter], pArrays[PY][nCenter], pArrays[PZ][nCenter] );
+			Wml::Vector3f vNormal( pArrays[NX][nCenter], pArrays[NY][nCenter], pArrays[NZ][nCenter] );
+			Wml::Vector3f vTangent( pArrays[TX][nCenter], pArrays[TY][nCenter], pArrays[TZ][nCenter] );
+			ExtPlane3f vTangentPlane;
+			Frame3f vCenterWorldFrame;
+			Wml::Matrix2f matFrameRotate;
+			ExpMapGenerator::PrecomputePropagationData( vPosition, vNormal, ExpMapGenerator::MakeFrame(vPosition, vNormal, vTangent),
+				vSeedFrame, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+			Wml::Vector2f vUV = ExpMapGenerator::ComputeSurfaceVector( vPosition,
+				Wml::Vector2f( pArrays[SU][nCenter], pArrays[SV][nCenter] ), vPoint, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+			float fCenterWeight = 1.0f / ( (vPosition - vPoint).Length() + fWeightOffset );
+			vWeightedSum += fCenterWeight * vUV;
+			fWeightSum += fCenterWeight;
+		}
+	}
+
+	vWeightedSum += Wml::Vector2f( V::Sum(sumU), V::Sum(sumV) );
+	fWeightSum += V::Sum(sumW);
+}
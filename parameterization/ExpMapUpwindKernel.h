@@ -0,0 +1,61 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __RMS_EXPMAP_UPWIND_KERNEL_H
+#define __RMS_EXPMAP_UPWIND_KERNEL_H
+
+#include "config.h"
+#include <vector>
+
+#include "Frame.h"
+
+
+namespace rms {
+
+
+/*
+ * Upwind averaging step of expmap propagation. The frozen neighbours ("centers") of a particle
+ * are added in structure-of-arrays form, and Accumulate() propagates the surface vector from every
+ * center to the particle at once - the same math as ExpMapGenerator::PrecomputePropagationData()
+ * followed by ComputeSurfaceVector(), for 8 (AVX), 4 (SSE) or 1 (no SIMD) centers at a time,
+ * depending on what the compiler targets. Results match the scalar code up to float rounding.
+ *
+ * Centers are mesh particles, whose frame is (position, tangent, normal x tangent, normal).
+ */
+class ExpMapUpwindKernel
+{
+public:
+	ExpMapUpwindKernel();
+
+	//! number of centers processed together by Accumulate()
+	static unsigned int GetVectorWidth();
+
+	void Clear() { m_nCount = 0; }
+	void Add( const Wml::Vector3f & vPosition, const Wml::Vector3f & vNormal, const Wml::Vector3f & vTangent,
+			  const Wml::Vector2f & vSurfaceVector );
+	unsigned int GetCount() const { return m_nCount; }
+
+	//! for each center i, adds w_i * uv_i to vWeightedSum and w_i to fWeightSum, where uv_i is the surface
+	//! vector propagated from center i to vPoint and w_i = 1 / ( |vPoint - center_i| + fWeightOffset )
+	void Accumulate( const Wml::Vector3f & vPoint, const Frame3f & vSeedFrame, float fWeightOffset,
+					 Wml::Vector2f & vWeightedSum, float & fWeightSum ) const;
+
+protected:
+	enum Array {
+		PX, PY, PZ,		// position
+		NX, NY, NZ,		// normal
+		TX, TY, TZ,		// tangent (frame x axis)
+		SU, SV,			// surface vector
+		NumArrays
+	};
+	unsigned int m_nCount;
+	std::vector<float> m_vArrays[NumArrays];		// padded to a multiple of GetVectorWidth()
+};
+
+
+
+} // end namespace rms
+
+
+#endif // __RMS_EXPMAP_UPWIND_KERNEL_H
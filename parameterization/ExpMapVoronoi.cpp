@@ -0,0 +1,403 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "ExpMapVoronoi.h"
+#include "rmsdebug.h"
+
+using namespace rms;
+
+
+ExpMapVoronoi::ExpMapVoronoi()
+{
+	m_pGenerator = NULL;
+	m_nParticles = 0;
+	m_pPositions = NULL;
+	m_pNormals = NULL;
+	m_pTangents = NULL;
+	m_pNbrOffsets = NULL;
+	m_pNbrs = NULL;
+	m_bUseUpwindAveraging = false;
+	m_bUseVectorizedPropagation = true;
+	m_fMaxEdgeLength = 0.0f;
+}
+
+ExpMapVoronoi::~ExpMapVoronoi()
+{
+}
+
+
+void ExpMapVoronoi::Clear()
+{
+	m_pGenerator = NULL;
+	m_nParticles = 0;
+	m_pPositions = NULL;
+	m_pNormals = NULL;
+	m_pTangents = NULL;
+	m_pNbrOffsets = NULL;
+	m_pNbrs = NULL;
+	m_vSeeds.resize(0);
+	m_vSeedNbrs.resize(0);
+	m_vParticles.resize(0);
+	m_vSeedLabels.resize(0);
+	m_queue.Clear();
+	m_vSeedTriOffsets.resize(0);
+	m_vSeedTris.resize(0);
+	m_vSeedTriVerts.resize(0);
+}
+
+
+void ExpMapVoronoi::Initialize( ExpMapGenerator & expmapgen )
+{
+	Clear();
+	m_pGenerator = &expmapgen;
+
+	// force neighbour list (and smoothed normal) computation for all particles
+	expmapgen.InitializeNeighbourLists();
+
+	m_bUseUpwindAveraging = expmapgen.m_bUseUpwindAveraging;
+	m_bUseVectorizedPropagation = expmapgen.m_bUseVectorizedPropagation;
+	m_fMaxEdgeLength = expmapgen.m_fMaxEdgeLength;
+
+	m_nParticles = expmapgen.m_nParticles;
+	m_pPositions = expmapgen.m_pPositions;
+	m_pNormals = expmapgen.m_pNormals;
+	m_pTangents = expmapgen.m_pTangents;
+	m_pNbrOffsets = expmapgen.m_pNbrOffsets;
+	m_pNbrs = expmapgen.m_pNbrs;
+}
+
+
+
+void ExpMapVoronoi::Compute( const std::vector<Frame3f> & vSeeds, float fStopDistance )
+{
+	unsigned int nSeeds = (unsigned int)vSeeds.size();
+	m_vSeeds.resize(0);
+	m_vSeeds.reserve( nSeeds );
+	m_vSeedNbrs.resize(0);
+	m_vSeedTriOffsets.assign( nSeeds+1, 0 );
+	m_vSeedTris.resize(0);
+	m_vSeedTriVerts.resize(0);
+	if ( m_pGenerator == NULL )
+		return;
+
+	// seed particles go after the mesh particles, so particle storage is m_nParticles + nSeeds
+	ExpMapParticle init;
+	init.Clear();
+	m_queue.Clear();
+	m_vParticles.assign( m_nParticles + nSeeds, init );
+	m_vSeedLabels.assign( m_nParticles + nSeeds, ExpMapParticle::InvalidIndex );
+	m_queue.SetParticles( &m_vParticles[0] );
+	if ( nSeeds == 0 )
+		return;
+
+	std::vector<unsigned int> vNbrs;
+	for ( unsigned int i = 0; i < nSeeds; ++i ) {
+		const Wml::Vector3f & vPosition = vSeeds[i].Origin();
+		m_pGenerator->FindSeedNeighbours( vPosition, vNbrs );
+		Wml::Vector3f vNormal( vSeeds[i].Z() );
+		Frame3f vFrame( m_pGenerator->ComputeSeedFrame( vPosition, vNormal, vNbrs, &vSeeds[i] ) );
+
+		unsigned int nNbrBegin = (unsigned int)m_vSeedNbrs.size();
+		m_vSeedNbrs.insert( m_vSeedNbrs.end(), vNbrs.begin(), vNbrs.end() );
+		Seed seed = { vFrame, vNormal, nNbrBegin, (unsigned int)m_vSeedNbrs.size() };
+		m_vSeeds.push_back( seed );
+
+		unsigned int nSeedParticle = m_nParticles + i;
+		ExpMapParticle & particle = m_vParticles[nSeedParticle];
+		particle.SurfaceDistance() = 0.0f;
+		particle.SurfaceVector() = Wml::Vector2f::ZERO;
+		particle.SetState( ExpMapParticle::Frozen );
+		m_vSeedLabels[nSeedParticle] = i;
+	}
+	for ( unsigned int i = 0; i < nSeeds; ++i )
+		UpdateNeighbours( m_nParticles + i );
+
+	// single front for all seeds. A particle takes the seed label of the particle its distance came
+	// from, so when it is frozen, its nearest seed is known and its frozen neighbours with the same
+	// label already have surface vectors in that seed's frame
+	while ( ! m_queue.empty() ) {
+		unsigned int nFront = m_queue.Pop();
+		ExpMapParticle & front = m_vParticles[nFront];
+		if ( front.SurfaceDistance() > fStopDistance ) {
+			// the front is popped in order of distance, so this and all remaining particles are past
+			// fStopDistance. They are reset to unreached (no seed label or surface vector)
+			front = init;
+			m_vSeedLabels[nFront] = ExpMapParticle::InvalidIndex;
+			while ( ! m_queue.empty() ) {
+				unsigned int nRemaining = m_queue.Pop();
+				m_vParticles[nRemaining] = init;
+				m_vSeedLabels[nRemaining] = ExpMapParticle::InvalidIndex;
+			}
+			break;
+		}
+		front.SetState( ExpMapParticle::Frozen );
+
+		if ( m_bUseUpwindAveraging )
+			PropagateFrameFromNearest_Average( nFront );
+		else
+			PropagateFrameFromNearest( nFront );
+
+		UpdateNeighbours( nFront );
+	}
+
+	AssignTriangles();
+}
+
+
+
+void ExpMapVoronoi::UpdateNeighbours( unsigned int nParticle )
+{
+	const unsigned int * pNbrs;
+	unsigned int nNbrs;
+	if ( IsSeed(nParticle) ) {
+		const Seed & seed = m_vSeeds[ nParticle - m_nParticles ];
+		pNbrs = m_vSeedNbrs.empty() ? NULL : &m_vSeedNbrs[0] + seed.nNbrBegin;
+		nNbrs = seed.nNbrEnd - seed.nNbrBegin;
+	} else {
+		pNbrs = m_pNbrs + m_pNbrOffsets[nParticle];
+		nNbrs = m_pNbrOffsets[nParticle+1] - m_pNbrOffsets[nParticle];
+	}
+
+	const Wml::Vector3f & vPosition = Position( nParticle );
+	float fDistance = m_vParticles[nParticle].SurfaceDistance();
+	unsigned int nLabel = m_vSeedLabels[nParticle];
+	for ( unsigned int k = 0; k < nNbrs; ++k ) {
+		unsigned int nNbr = pNbrs[k];
+		ExpMapParticle & nbr = m_vParticles[nNbr];
+		if ( nbr.State() == ExpMapParticle::Frozen )
+			continue;
+
+		float fSurfDist = (vPosition - m_pPositions[nNbr]).Length() + fDistance;
+		bool bUpdated = false;
+		if ( fSurfDist < nbr.SurfaceDistance() ) {
+			nbr.Nearest() = nParticle;
+			nbr.SurfaceDistance() = fSurfDist;
+			m_vSeedLabels[nNbr] = nLabel;
+			bUpdated = true;
+		}
+
+		if ( nbr.State() != ExpMapParticle::Active ) {
+			nbr.SetState( ExpMapParticle::Active );
+			m_queue.Insert( nNbr );
+		} else if ( bUpdated ) {
+			m_queue.DecreaseKey( nNbr );
+		}
+	}
+}
+
+
+
+void ExpMapVoronoi::ComputePropagation( unsigned int nSeed, unsigned int nCenter, const Wml::Vector3f & vPoint,
+										Wml::Vector2f & vSurfaceVector )
+{
+	const Seed & seed = m_vSeeds[nSeed];
+	ExtPlane3f vTangentPlane;
+	Frame3f vCenterWorldFrame;
+	Wml::Matrix2f matFrameRotate;
+	if ( IsSeed(nCenter) ) {
+		const Seed & center = m_vSeeds[ nCenter - m_nParticles ];
+		ExpMapGenerator::PrecomputePropagationData( center.vFrame.Origin(), center.vNormal, center.vFrame,
+			seed.vFrame, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+	} else
+		ExpMapGenerator::PrecomputePropagationData( m_pPositions[nCenter], m_pNormals[nCenter],
+			ExpMapGenerator::MakeFrame( m_pPositions[nCenter], m_pNormals[nCenter], m_pTangents[nCenter] ),
+			seed.vFrame, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+	vSurfaceVector = ExpMapGenerator::ComputeSurfaceVector( Position(nCenter), m_vParticles[nCenter].SurfaceVector(),
+		vPoint, vTangentPlane, vCenterWorldFrame, matFrameRotate );
+}
+
+
+void ExpMapVoronoi::PropagateFrameFromNearest( unsigned int nParticle )
+{
+	ExpMapParticle & particle = m_vParticles[nParticle];
+	if ( particle.SurfaceDistance() == 0.0f ) {
+		// pathological case where seed point == input point (or other duplicate points)
+		particle.SurfaceVector() = m_vParticles[ particle.Nearest() ].SurfaceVector();
+		return;
+	}
+	ComputePropagation( m_vSeedLabels[nParticle], particle.Nearest(), m_pPositions[nParticle], particle.SurfaceVector() );
+	ExpMapGenerator::ClampSurfaceVector( particle.SurfaceVector(), particle.SurfaceDistance() );
+}
+
+
+void ExpMapVoronoi::PropagateFrameFromNearest_Average( unsigned int nParticle )
+{
+	ExpMapParticle & particle = m_vParticles[nParticle];
+	unsigned int nNearest = particle.Nearest();
+	if ( particle.SurfaceDistance() == 0.0f ) {
+		particle.SurfaceVector() = m_vParticles[nNearest].SurfaceVector();
+		return;
+	}
+
+	// frozen neighbours of the same seed (and nearest particle, which is not in the neighbour list if it is a seed)
+	unsigned int nLabel = m_vSeedLabels[nParticle];
+	m_vCenters.resize(0);
+	bool bSawNearest = false;
+	for ( unsigned int k = m_pNbrOffsets[nParticle]; k < m_pNbrOffsets[nParticle+1]; ++k ) {
+		unsigned int nCenter = m_pNbrs[k];
+		if ( nCenter == nNearest )
+			bSawNearest = true;
+		if ( m_vParticles[nCenter].State() == ExpMapParticle::Frozen && m_vSeedLabels[nCenter] == nLabel )
+			m_vCenters.push_back( nCenter );
+	}
+	if ( ! bSawNearest )
+		m_vCenters.push_back( nNearest );
+
+	particle.SurfaceVector() = AverageFromCenters( nLabel, m_pPositions[nParticle] );
+	ExpMapGenerator::ClampSurfaceVector( particle.SurfaceVector(), particle.SurfaceDistance() );
+}
+
+
+Wml::Vector2f ExpMapVoronoi::AverageFromCenters( unsigned int nSeed, const Wml::Vector3f & vPoint )
+{
+	float fWeightOffset = 0.00001f*m_fMaxEdgeLength;
+	Wml::Vector2f vWeightedSum = Wml::Vector2f::ZERO;
+	float fWeightSum = 0.0f;
+
+	// seed centers are not mesh particles, so always use the scalar code for them
+	if ( m_bUseVectorizedPropagation )
+		m_upwindKernel.Clear();
+	size_t nCenters = m_vCenters.size();
+	for ( unsigned int i = 0; i < nCenters; ++i ) {
+		unsigned int nCenter = m_vCenters[i];
+		if ( m_bUseVectorizedPropagation && ! IsSeed(nCenter) ) {
+			m_upwindKernel.Add( m_pPositions[nCenter], m_pNormals[nCenter], m_pTangents[nCenter], m_vParticles[nCenter].SurfaceVector() );
+			continue;
+		}
+		Wml::Vector2f vUV;
+		ComputePropagation( nSeed, nCenter, vPoint, vUV );
+		float fWeight = 1.0f / ( ( Position(nCenter) - vPoint ).Length() + fWeightOffset );
+		vWeightedSum += fWeight * vUV;
+		fWeightSum += fWeight;
+	}
+	if ( m_bUseVectorizedPropagation )
+		m_upwindKernel.Accumulate( vPoint, m_vSeeds[nSeed].vFrame, fWeightOffset, vWeightedSum, fWeightSum );
+
+	return vWeightedSum / fWeightSum;
+}
+
+
+
+void ExpMapVoronoi::AssignTriangles()
+{
+	IMesh * pMesh = m_pGenerator->GetMesh();
+	if ( pMesh == NULL )
+		return;
+	unsigned int nSeeds = (unsigned int)m_vSeeds.size();
+
+	// label each triangle, counting triangles per seed
+	std::vector<IMesh::TriangleID> vAllTris;
+	vAllTris.reserve( pMesh->GetTriangleCount() );
+	pMesh->ForEachTriangleBlock( IMeshAppendIDsFunc(vAllTris) );
+	unsigned int nAllTris = (unsigned int)vAllTris.size();
+	std::vector<IMesh::TriangleID> vTris;
+	std::vector<unsigned int> vTriSeeds;
+	for ( unsigned int k = 0; k < nAllTris; ++k ) {
+		IMesh::VertexID nTri[3];
+		pMesh->GetTriangle( vAllTris[k], nTri );
+		unsigned int nLabel[3] = { m_vSeedLabels[nTri[0]], m_vSeedLabels[nTri[1]], m_vSeedLabels[nTri[2]] };
+		if ( nLabel[0] == ExpMapParticle::InvalidIndex || nLabel[1] == ExpMapParticle::InvalidIndex
+			 || nLabel[2] == ExpMapParticle::InvalidIndex )
+			continue;
+
+		unsigned int nSeed;
+		if ( nLabel[0] == nLabel[1] || nLabel[0] == nLabel[2] )
+			nSeed = nLabel[0];
+		else if ( nLabel[1] == nLabel[2] )
+			nSeed = nLabel[1];
+		else {
+			int j = 0;
+			for ( int i = 1; i < 3; ++i )
+				if ( m_vParticles[nTri[i]].SurfaceDistance() < m_vParticles[nTri[j]].SurfaceDistance() )
+					j = i;
+			nSeed = nLabel[j];
+		}
+		vTris.push_back( vAllTris[k] );
+		vTriSeeds.push_back( nSeed );
+		m_vSeedTriOffsets[nSeed+1]++;
+	}
+
+	// bucket by seed
+	for ( unsigned int i = 0; i < nSeeds; ++i )
+		m_vSeedTriOffsets[i+1] += m_vSeedTriOffsets[i];
+	size_t nTris = vTris.size();
+	m_vSeedTris.resize( nTris );
+	m_vSeedTriVerts.resize( 3*nTris );
+	std::vector<unsigned int> vNext( m_vSeedTriOffsets.begin(), m_vSeedTriOffsets.end()-1 );
+	for ( unsigned int k = 0; k < nTris; ++k ) {
+		unsigned int j = vNext[ vTriSeeds[k] ]++;
+		m_vSeedTris[j] = vTris[k];
+		pMesh->GetTriangle( vTris[k], &m_vSeedTriVerts[3*j] );
+	}
+}
+
+
+
+void ExpMapVoronoi::GetSegmentation( Segmentation & segmentation, std::vector<Segmentation::SegmentID> & vSegmentIDs )
+{
+	segmentation.Clear();
+	unsigned int nSeeds = (unsigned int)m_vSeeds.size();
+	vSegmentIDs.resize( nSeeds );
+	std::vector<IMesh::TriangleID> vTris;
+	for ( unsigned int i = 0; i < nSeeds; ++i ) {
+		vTris.assign( m_vSeedTris.begin() + m_vSeedTriOffsets[i], m_vSeedTris.begin() + m_vSeedTriOffsets[i+1] );
+		vSegmentIDs[i] = segmentation.AppendSegment( vTris );
+	}
+}
+
+
+void ExpMapVoronoi::GetSegmentUVs( std::vector<ExpMapUVSet> & vUVSets )
+{
+	unsigned int nSeeds = (unsigned int)m_vSeeds.size();
+	vUVSets.resize( nSeeds );
+
+	// vAdded[v] is the last seed that v was added to
+	std::vector<unsigned int> vAdded( m_nParticles, ExpMapParticle::InvalidIndex );
+	for ( unsigned int i = 0; i < nSeeds; ++i ) {
+		ExpMapUVSet & uvs = vUVSets[i];
+		uvs.vIDs.resize(0);
+		uvs.vU.resize(0);
+		uvs.vV.resize(0);
+
+		for ( unsigned int j = m_vSeedTriOffsets[i]; j < m_vSeedTriOffsets[i+1]; ++j ) {
+			const IMesh::VertexID * pTri = &m_vSeedTriVerts[3*j];
+			for ( int k = 0; k < 3; ++k ) {
+				IMesh::VertexID vID = pTri[k];
+				if ( vAdded[vID] == i )
+					continue;
+				vAdded[vID] = i;
+
+				Wml::Vector2f vUV;
+				if ( m_vSeedLabels[vID] == i )
+					vUV = m_vParticles[vID].SurfaceVector();
+				else {
+					// vertex of another seed. Propagate from its neighbours in this seed, or from
+					// the triangle vertices in this seed if the neighbour graph does not connect them
+					m_vCenters.resize(0);
+					float fDistance = std::numeric_limits<float>::max();
+					for ( unsigned int n = m_pNbrOffsets[vID]; n < m_pNbrOffsets[vID+1]; ++n ) {
+						if ( m_vSeedLabels[ m_pNbrs[n] ] == i )
+							m_vCenters.push_back( m_pNbrs[n] );
+					}
+					if ( m_vCenters.empty() ) {
+						for ( int n = 0; n < 3; ++n )
+							if ( m_vSeedLabels[ pTri[n] ] == i )
+								m_vCenters.push_back( pTri[n] );
+					}
+					for ( unsigned int n = 0; n < m_vCenters.size(); ++n ) {
+						unsigned int nCenter = m_vCenters[n];
+						float fDist = m_vParticles[nCenter].SurfaceDistance() + (m_pPositions[nCenter] - m_pPositions[vID]).Length();
+						if ( fDist < fDistance )
+							fDistance = fDist;
+					}
+					vUV = AverageFromCenters( i, m_pPositions[vID] );
+					ExpMapGenerator::ClampSurfaceVector( vUV, fDistance );
+				}
+				uvs.vIDs.push_back( vID );
+				uvs.vU.push_back( vUV.X() );
+				uvs.vV.push_back( vUV.Y() );
+			}
+		}
+	}
+}
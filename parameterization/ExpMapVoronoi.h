@@ -0,0 +1,123 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __RMS_EXPMAP_VORONOI_H
+#define __RMS_EXPMAP_VORONOI_H
+
+#include "config.h"
+#include <vector>
+#include <limits>
+
+#include "ExpMapGenerator.h"
+#include "ExpMapBatch.h"
+#include "Segmentation.h"
+
+
+namespace rms {
+
+
+/*
+ * Geodesic Voronoi partition with expmap charts. All seeds are propagated together in a single front
+ * (one heap), so each particle is reached first by its nearest seed (in graph distance), and its surface
+ * vector is computed relative to that seed's frame. Upwind averaging only uses neighbours that belong to
+ * the same seed. Cost is one expmap over the region covered by all seeds, independent of the seed count.
+ *
+ * Like ExpMapBatch, the neighbour graph, normals and tangents are read directly from an ExpMapGenerator,
+ * which must not be modified or destroyed while this object is in use.
+ */
+class ExpMapVoronoi
+{
+public:
+	ExpMapVoronoi();
+	~ExpMapVoronoi();
+
+	//! expmapgen must have a surface. Neighbour lists are computed if necessary. Upwind averaging
+	//! settings are copied from expmapgen (square culling and clip polygon are not used).
+	void Initialize( ExpMapGenerator & expmapgen );
+	void Clear();
+
+	//! propagate from all seeds. Particles further than fStopDistance from every seed are not reached.
+	void Compute( const std::vector<Frame3f> & vSeeds, float fStopDistance = std::numeric_limits<float>::max() );
+
+	unsigned int GetSeedCount() const { return (unsigned int)m_vSeeds.size(); }
+
+	//! index of the nearest seed, or ExpMapParticle::InvalidIndex if the vertex was not reached
+	unsigned int GetVertexSeed( IMesh::VertexID vID ) const { return m_vSeedLabels[vID]; }
+	float GetVertexDistance( IMesh::VertexID vID ) const { return m_vParticles[vID].SurfaceDistance(); }
+	//! surface vector relative to the frame of GetVertexSeed(vID)
+	const Wml::Vector2f & GetVertexUV( IMesh::VertexID vID ) const { return m_vParticles[vID].SurfaceVector(); }
+
+	//! Segment vSegmentIDs[i] contains the triangles of seed i. A triangle belongs to the seed of the
+	//! majority of its vertices (or of its vertex nearest to a seed if all three differ). Triangles
+	//! with an unreached vertex are not assigned. Segments are appended to a cleared segmentation,
+	//! so IDs are 1...GetSeedCount() in seed order. Segment boundaries are not computed.
+	void GetSegmentation( Segmentation & segmentation, std::vector<Segmentation::SegmentID> & vSegmentIDs );
+
+	//! vUVSets[i] has UVs, in the frame of seed i, for all vertices of the triangles of seed i (as
+	//! assigned by GetSegmentation()). Vertices owned by another seed are propagated into the frame
+	//! of seed i from their neighbours that belong to seed i, so neighbouring charts overlap on the
+	//! shared triangles instead of leaving gaps.
+	void GetSegmentUVs( std::vector<ExpMapUVSet> & vUVSets );
+
+protected:
+	ExpMapGenerator * m_pGenerator;
+
+	// read-only particle data shared with m_pGenerator, indexed by particle (== VertexID).
+	// Seed i is particle m_nParticles + i
+	unsigned int m_nParticles;
+	const Wml::Vector3f * m_pPositions;
+	const Wml::Vector3f * m_pNormals;
+	const Wml::Vector3f * m_pTangents;
+	const unsigned int * m_pNbrOffsets;
+	const unsigned int * m_pNbrs;
+
+	bool m_bUseUpwindAveraging;
+	bool m_bUseVectorizedPropagation;
+	float m_fMaxEdgeLength;
+
+	struct Seed {
+		Frame3f vFrame;
+		Wml::Vector3f vNormal;
+		unsigned int nNbrBegin;
+		unsigned int nNbrEnd;
+	};
+	std::vector<Seed> m_vSeeds;
+	std::vector<unsigned int> m_vSeedNbrs;
+
+	std::vector<ExpMapParticle> m_vParticles;
+	std::vector<unsigned int> m_vSeedLabels;		// seed index of each particle (including seed particles)
+	ParticleQueue m_queue;
+
+	// triangles of seed i are m_vSeedTris[ m_vSeedTriOffsets[i] ... m_vSeedTriOffsets[i+1]-1 ], with
+	// their vertices in m_vSeedTriVerts (3 per triangle). Filled at the end of Compute()
+	std::vector<unsigned int> m_vSeedTriOffsets;
+	std::vector<IMesh::TriangleID> m_vSeedTris;
+	std::vector<IMesh::VertexID> m_vSeedTriVerts;
+	void AssignTriangles();
+
+	// upwind averaging buffers
+	std::vector<unsigned int> m_vCenters;
+	ExpMapUpwindKernel m_upwindKernel;
+
+	void UpdateNeighbours( unsigned int nParticle );
+	void PropagateFrameFromNearest( unsigned int nParticle );
+	void PropagateFrameFromNearest_Average( unsigned int nParticle );
+	void ComputePropagation( unsigned int nSeed, unsigned int nCenter, const Wml::Vector3f & vPoint,
+							 Wml::Vector2f & vSurfaceVector );
+
+	//! weighted average of the surface vectors propagated from each particle in m_vCenters to vPoint, 
+	//! in the frame of nSeed (centers must belong to nSeed)
+	Wml::Vector2f AverageFromCenters( unsigned int nSeed, const Wml::Vector3f & vPoint );
+
+	bool IsSeed( unsigned int i ) const { return i >= m_nParticles; }
+	const Wml::Vector3f & Position( unsigned int i ) const
+		{ return IsSeed(i) ? m_vSeeds[i - m_nParticles].vFrame.Origin() : m_pPositions[i]; }
+};
+
+
+
+} // end namespace rms
+
+
+#endif // __RMS_EXPMAP_VORONOI_H
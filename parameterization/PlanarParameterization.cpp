@@ -9,8 +9,6 @@
 
 #include <MeshUtils.h>
 #include <SparseLinearSystem.h>
-#include <Solver_TAUCS.h>
-#include <Solver_UMFPACK.h>
 #include <Wm4LinearSystem.h>
 
 #include "rmsdebug.h"
@@ -34,6 +32,8 @@ PlanarParameterization::PlanarParameterization(void)
 
 	m_bScaleUVs = true;
 	m_fUVScaleFactor = 1.9f;
+
+	m_eSolverBackend = SparseLinearSolver::GetDefaultBackend();
 }
 
 PlanarParameterization::~PlanarParameterization(void)
@@ -140,8 +140,11 @@ bool PlanarParameterization::Parameterize_OneRing()
 	if ( ! EmbedBoundary() )
 		return false;
 
+	// uniform and inverse-distance weights are symmetric up to their per-vertex normalization
+	bool bSymmetricWeights = ( m_eEmbedType == UniformWeights || m_eEmbedType == InverseDistance );
+
 	std::vector<double> vU, vV;
-	bool bResult = Solve_FixBoundary(vU, vV, OneRing);
+	bool bResult = Solve_FixBoundary(vU, vV, OneRing, bSymmetricWeights);
 	if ( ! bResult ) {
 		_RMSInfo("Solve_FixBoundary failed in PlanarParameterization::Parameterize_OneRing() !\n");
 		return false;
@@ -223,6 +226,26 @@ bool PlanarParameterization::Parameterize_OneRing_Intrinsic()
 
 	// generate constraints if we are using DNCP
 	bool bUseNaturalBoundary = (m_eEmbedType == DiscreteNaturalConformal);
+
+	// with a fixed boundary U and V are independent, so solve the N x N cotangent system
+	// for both at once instead of the 2N x 2N coupled system below
+	if ( ! bUseNaturalBoundary ) {
+		size_t nCount = m_vVertInfo.size();
+		for ( unsigned int i = 0; i < nCount; ++i )
+			ComputeWeights_Cotangent( m_vVertInfo[i].GetNeighbourSet(OneRing) );
+
+		if ( ! EmbedBoundary() )
+			return false;
+
+		std::vector<double> vU, vV;
+		if ( ! Solve_FixBoundary(vU, vV, OneRing, true) ) {
+			_RMSInfo("Solve_FixBoundary failed in PlanarParameterization::Parameterize_OneRing_Intrinsic() !\n");
+			return false;
+		}
+		SetMeshUVs(&vU[0], &vV[0]);
+		return true;
+	}
+
 	std::vector<Constraint> vConstraints;
 	if ( bUseNaturalBoundary )
 		MakeBoundaryConstraints(vConstraints);
@@ -279,127 +302,93 @@ bool PlanarParameterization::Parameterize_OneRing_Intrinsic()
 	}
 
 
-	if ( ! bUseNaturalBoundary ) {
+	//// initialize boundary node rows in matrix (except for Rot90 term)
+	//size_t nBdry = m_boundaryInfo.vBoundaryLoops.size();
+	//for ( unsigned int i = 0; i < nBdry; ++i ) {
+	//	BoundaryLoop & loop = m_boundaryInfo.vBoundaryLoops[i];
+	//	size_t nLoopCount = loop.vVerts.size();
+	//	for ( unsigned int j = 0; j < nLoopCount; ++j ) {
+	//		int r = loop.vVerts[j];
 
-		if ( ! EmbedBoundary() )
-			return false;
+	//		// clear row
+	//		for ( unsigned int k = 0; k < nCount; ++k ) {
+	//			p.SetMatrixLAPACK(2*r, 2*k, 0.0);
+	//			p.SetMatrixLAPACK(2*r+1, 2*k+1, 0.0);
+	//		}
 
-		// now set boundary values
-		size_t nBdry = m_boundaryInfo.vBoundaryLoops.size();
-		for ( unsigned int i = 0; i < nBdry; ++i ) {
-			BoundaryLoop & loop = m_boundaryInfo.vBoundaryLoops[i];
-			size_t nLoopCount = loop.vVerts.size();
-			for ( unsigned int j = 0; j < nLoopCount; ++j ) {
-				int r = loop.vVerts[j];
-				
-				// clear rows
-				p.Matrix().ClearRow(r);
-				p.Matrix().ClearRow(r+N);
-				
-				p.Set(r, r, 1.0);
-				p.SetRHS(r, loop.vUVs[j].X() );
-
-				p.Set(r+N, r+N, 1.0);
-				p.SetRHS(r+N, loop.vUVs[j].Y() );
-			}
-		}
-	
-	} else { 
-
-		//// initialize boundary node rows in matrix (except for Rot90 term)
-		//size_t nBdry = m_boundaryInfo.vBoundaryLoops.size();
-		//for ( unsigned int i = 0; i < nBdry; ++i ) {
-		//	BoundaryLoop & loop = m_boundaryInfo.vBoundaryLoops[i];
-		//	size_t nLoopCount = loop.vVerts.size();
-		//	for ( unsigned int j = 0; j < nLoopCount; ++j ) {
-		//		int r = loop.vVerts[j];
-
-		//		// clear row
-		//		for ( unsigned int k = 0; k < nCount; ++k ) {
-		//			p.SetMatrixLAPACK(2*r, 2*k, 0.0);
-		//			p.SetMatrixLAPACK(2*r+1, 2*k+1, 0.0);
-		//		}
-
-		//		// set neighbour elements
-		//		NeighbourSet & nbrs = m_vVertInfo[r].GetNeighbourSet(OneRing);
-		//		size_t nTris = nbrs.vTriAngles.size();		if ( nTris == 0 )	lgBreakToDebugger();
-		//		for ( unsigned int k = 0; k < nTris; ++k ) {
-		//			TriangleAngles & tri = nbrs.vTriAngles[k];
-
-		//			// in desbrun's EG02 paper, it would seem that these terms should have
-		//			// the opposite signs. However, he says they are  "the same as the
-		//			// conformal weights", which means these signs are correct
-		//			p.AddMatrixLAPACK( 2*r, 2*r,	 -(tri.fAlpha + tri.fBeta) );
-		//			p.AddMatrixLAPACK( 2*r+1, 2*r+1, -(tri.fAlpha + tri.fBeta) );
-		//			int c1 = m_vVertMap[tri.nJ];
-		//			p.AddMatrixLAPACK( 2*r, 2*c1,	  tri.fBeta );
-		//			p.AddMatrixLAPACK( 2*r+1, 2*c1+1, tri.fBeta );
-		//			int c2 = m_vVertMap[tri.nK];
-		//			p.AddMatrixLAPACK( 2*r, 2*c2,	  tri.fAlpha );
-		//			p.AddMatrixLAPACK( 2*r+1, 2*c2+1, tri.fAlpha );
-		//		}
-		//	}
-		//}
-
-		// add terms from A matrix
-		size_t nBdry = m_boundaryInfo.vBoundaryLoops.size();
-		for ( unsigned int i = 0; i < nBdry; ++i ) {
-			BoundaryLoop & loop = m_boundaryInfo.vBoundaryLoops[i];
-			size_t nLoopCount = loop.vVerts.size();
-			for ( unsigned int j = 0; j < nLoopCount; ++j ) {
-				int vID = loop.vVerts[j];
-
-				IMesh::VtxNbrItr itr(vID);
-				m_pMesh->BeginVtxTriangles(itr);
-				IMesh::TriangleID tID = m_pMesh->GetNextVtxTriangle(itr);
-				while ( tID != IMesh::InvalidID ) {
-					IMesh::VertexID vTri[3];
-					m_pMesh->GetTriangle(tID, vTri);
-
-					IMesh::VertexID j,k;
-					if      ( vTri[0] == vID ) { j = vTri[1];  k = vTri[2]; }
-					else if ( vTri[1] == vID ) { j = vTri[2];  k = vTri[0]; }
-					else                       { j = vTri[0];  k = vTri[1]; }
-					unsigned int jx = m_vVertMap[j];   unsigned int jy = jx+N;
-					unsigned int kx = m_vVertMap[k];   unsigned int ky = kx+N;
-					unsigned int ix = m_vVertMap[vID]; unsigned int iy = ix+N;
-
-					p.Set( ix,ky, p.Get(ix,ky) + 1 );
-					p.Set( ix,jy, p.Get(ix,jy) - 1 );
-					p.Set( iy,jx, p.Get(iy,jx) + 1 );
-					p.Set( iy,kx, p.Get(iy,kx) - 1 );
-
-					tID = m_pMesh->GetNextVtxTriangle(itr);
-				}
+	//		// set neighbour elements
+	//		NeighbourSet & nbrs = m_vVertInfo[r].GetNeighbourSet(OneRing);
+	//		size_t nTris = nbrs.vTriAngles.size();		if ( nTris == 0 )	lgBreakToDebugger();
+	//		for ( unsigned int k = 0; k < nTris; ++k ) {
+	//			TriangleAngles & tri = nbrs.vTriAngles[k];
+
+	//			// in desbrun's EG02 paper, it would seem that these terms should have
+	//			// the opposite signs. However, he says they are  "the same as the
+	//			// conformal weights", which means these signs are correct
+	//			p.AddMatrixLAPACK( 2*r, 2*r,	 -(tri.fAlpha + tri.fBeta) );
+	//			p.AddMatrixLAPACK( 2*r+1, 2*r+1, -(tri.fAlpha + tri.fBeta) );
+	//			int c1 = m_vVertMap[tri.nJ];
+	//			p.AddMatrixLAPACK( 2*r, 2*c1,	  tri.fBeta );
+	//			p.AddMatrixLAPACK( 2*r+1, 2*c1+1, tri.fBeta );
+	//			int c2 = m_vVertMap[tri.nK];
+	//			p.AddMatrixLAPACK( 2*r, 2*c2,	  tri.fAlpha );
+	//			p.AddMatrixLAPACK( 2*r+1, 2*c2+1, tri.fAlpha );
+	//		}
+	//	}
+	//}
+
+	// add terms from A matrix
+	size_t nBdry = m_boundaryInfo.vBoundaryLoops.size();
+	for ( unsigned int i = 0; i < nBdry; ++i ) {
+		BoundaryLoop & loop = m_boundaryInfo.vBoundaryLoops[i];
+		size_t nLoopCount = loop.vVerts.size();
+		for ( unsigned int j = 0; j < nLoopCount; ++j ) {
+			int vID = loop.vVerts[j];
+
+			IMesh::VtxNbrItr itr(vID);
+			m_pMesh->BeginVtxTriangles(itr);
+			IMesh::TriangleID tID = m_pMesh->GetNextVtxTriangle(itr);
+			while ( tID != IMesh::InvalidID ) {
+				IMesh::VertexID vTri[3];
+				m_pMesh->GetTriangle(tID, vTri);
+
+				IMesh::VertexID j,k;
+				if      ( vTri[0] == vID ) { j = vTri[1];  k = vTri[2]; }
+				else if ( vTri[1] == vID ) { j = vTri[2];  k = vTri[0]; }
+				else                       { j = vTri[0];  k = vTri[1]; }
+				unsigned int jx = m_vVertMap[j];   unsigned int jy = jx+N;
+				unsigned int kx = m_vVertMap[k];   unsigned int ky = kx+N;
+				unsigned int ix = m_vVertMap[vID]; unsigned int iy = ix+N;
+
+				p.Set( ix,ky, p.Get(ix,ky) + 1 );
+				p.Set( ix,jy, p.Get(ix,jy) - 1 );
+				p.Set( iy,jx, p.Get(iy,jx) + 1 );
+				p.Set( iy,kx, p.Get(iy,kx) - 1 );
+
+				tID = m_pMesh->GetNextVtxTriangle(itr);
 			}
 		}
+	}
 
-		// add constraints
-		for ( unsigned int i = 0; i < nConstraints; ++i ) {
-			unsigned int r = vConstraints[i].nVertex;
-
-			// clear row
-			p.Matrix().ClearRow(r);
-			p.Matrix().ClearRow(r+N);
+	// add constraints
+	for ( unsigned int i = 0; i < nConstraints; ++i ) {
+		unsigned int r = vConstraints[i].nVertex;
 
-			p.Set( r,   r,   1.0 );
-			p.Set( r+N, r+N, 1.0 );
+		// clear row
+		p.Matrix().ClearRow(r);
+		p.Matrix().ClearRow(r+N);
 
-			p.SetRHS(r,   vConstraints[i].vConstraint.X() );
-			p.SetRHS(r+N, vConstraints[i].vConstraint.Y() );
-		}
+		p.Set( r,   r,   1.0 );
+		p.Set( r+N, r+N, 1.0 );
 
+		p.SetRHS(r,   vConstraints[i].vConstraint.X() );
+		p.SetRHS(r+N, vConstraints[i].vConstraint.Y() );
 	}
 
-	bool bResult = false;
-	if ( ! p.Matrix().IsSymmetric() ) {
-		gsi::Solver_UMFPACK solver(&p);
-		bResult = solver.Solve();
-	} else {
-		gsi::Solver_TAUCS solver(&p);
-		solver.SetSolverMode(gsi::Solver_TAUCS::TAUCS_LLT);
-		bResult = solver.Solve();
-	}
+	SparseLinearSolver solver(&p);
+	solver.SetBackend(m_eSolverBackend);
+	solver.SetFactorization( (p.Matrix().IsSymmetric()) ? SparseLinearSolver::Factor_Cholesky : SparseLinearSolver::Factor_LU );
+	bool bResult = solver.Solve();
 	if ( ! bResult ) {
 		_RMSInfo("Solve() failed in PlanarParameterization::Compute() !\n");
 		return false;
@@ -1794,6 +1783,7 @@ void PlanarParameterization::ComputeWeights_Uniform( NeighbourSet & nbrs )
 	nbrs.fWeights.resize(nCount);
 	for ( unsigned int i = 0; i < nCount; ++i )
 		nbrs.fWeights[i] = 1.0f / (float)nCount;
+	nbrs.fWeightScale = (float)nCount;
 }
 
 void PlanarParameterization::ComputeWeights_InvDist( NeighbourSet & nbrs )
@@ -1815,6 +1805,40 @@ void PlanarParameterization::ComputeWeights_InvDist( NeighbourSet & nbrs )
 	// normalize
 	for ( unsigned int i = 0; i < nCount; ++i )
 		nbrs.fWeights[i] /= fWeightSum;
+	nbrs.fWeightScale = fWeightSum;
+}
+
+void PlanarParameterization::ComputeWeights_Cotangent( NeighbourSet & nbrs )
+{
+	Wml::Vector3f vi, vj, vo;
+	m_pMesh->GetVertex(nbrs.vID, vi);
+	size_t nCount = nbrs.nUseNbrs;
+	nbrs.fWeights.resize(nCount);
+	double dWeightSum = 0.0;
+	for ( unsigned int j = 0; j < nCount; ++j ) {
+		m_pMesh->GetVertex(nbrs.vNbrs[j], vj);
+
+		IMesh::EdgeID eID = m_pMesh->FindEdge(nbrs.vID, nbrs.vNbrs[j]);
+		IMesh::VertexID edgeV[2];
+		m_pMesh->FindNeighboursEV(eID, edgeV);
+
+		double dCotSum = 0;
+		for ( unsigned int k = 0; k < 2; ++k ) {
+			if ( edgeV[k] == IMesh::InvalidID )
+				continue;
+			m_pMesh->GetVertex(edgeV[k], vo);
+			Wml::Vector3f v1 = vi-vo;
+			Wml::Vector3f v2 = vj-vo;
+			dCotSum += rms::VectorCot(v1, v2);
+		}
+		nbrs.fWeights[j] = (float)dCotSum;
+		dWeightSum += dCotSum;
+	}
+
+	// normalize
+	for ( unsigned int j = 0; j < nCount; ++j )
+		nbrs.fWeights[j] = (float)(nbrs.fWeights[j] / dWeightSum);
+	nbrs.fWeightScale = (float)dWeightSum;
 }
 
 void PlanarParameterization::ComputeWeights_ShapePreserving( NeighbourSet & nbrs )
@@ -2392,69 +2416,78 @@ float PlanarParameterization::GetReconstructionError_2D( NeighbourSet & nbrs )
 
 
 
-bool PlanarParameterization::Solve_FixBoundary( std::vector<double> & vU, std::vector<double> & vV, NeighbourhoodType eNbrType)
+bool PlanarParameterization::Solve_FixBoundary( std::vector<double> & vU, std::vector<double> & vV, NeighbourhoodType eNbrType, bool bSymmetricWeights )
 {
-	gsi::SparseLinearSystem p;
 	size_t nCount = m_vVertInfo.size();
-	p.Resize((unsigned int)nCount, (unsigned int)nCount);
-	//p.ResizeRHS(2);
-	p.ResizeRHS(1);
 
-	gsi::SparseLinearSystem p2;
-	p2.Resize((unsigned int)nCount, (unsigned int)nCount);
-	//p.ResizeRHS(2);
-	p2.ResizeRHS(1);
+	// fixed UVs of boundary rows
+	std::vector<bool> vFixed(nCount, false);
+	std::vector<Wml::Vector2f> vFixedUV(nCount);
+	size_t nBdry = m_boundaryInfo.vBoundaryLoops.size();
+	for ( unsigned int i = 0; i < nBdry; ++i ) {
+		BoundaryLoop & loop = m_boundaryInfo.vBoundaryLoops[i];
+		size_t nLoopCount = loop.vVerts.size();
+		for ( unsigned int j = 0; j < nLoopCount; ++j ) {
+			int r = loop.vVerts[j];
+			vFixed[r] = true;
+			vFixedUV[r] = loop.vUVs[j];
+		}
+	}
+
+	// U and V share the matrix, so factor it once and solve both as right-hand sides. Boundary
+	// rows are identity rows, and boundary columns of the free rows are moved to the right-hand
+	// side, which keeps the matrix symmetric if the (scaled) weights are.
+	gsi::SparseLinearSystem p;
+	p.Resize((unsigned int)nCount, (unsigned int)nCount);
+	p.ResizeRHS(2);
 
 	for ( unsigned int i = 0; i < nCount; ++i ) {
-	
-		p.Set(i,i, 1.0);
-		p2.Set(i,i, 1.0);
+		if ( vFixed[i] ) {
+			p.Set(i,i, 1.0);
+			p.SetRHS(i, vFixedUV[i].X(), 0);
+			p.SetRHS(i, vFixedUV[i].Y(), 1);
+			continue;
+		}
 
 		NeighbourSet & nbrs = m_vVertInfo[i].GetNeighbourSet(eNbrType);
+		double dScale = (bSymmetricWeights) ? (double)nbrs.fWeightScale : 1.0;
+		p.Set(i,i, dScale);
+
+		double dRHS[2] = {0,0};
 		size_t nNbrs = nbrs.nUseNbrs;
 		for ( unsigned int j = 0; j < nNbrs; ++j ) {
 			unsigned int nNbrJ = m_vVertMap[nbrs.vNbrs[j]];
-			p.Set(i, nNbrJ, -nbrs.fWeights[j]);
-			p2.Set(i, nNbrJ, -nbrs.fWeights[j]);
+			double dWeight = dScale * (double)nbrs.fWeights[j];
+			if ( vFixed[nNbrJ] ) {
+				dRHS[0] += dWeight * vFixedUV[nNbrJ].X();
+				dRHS[1] += dWeight * vFixedUV[nNbrJ].Y();
+			} else if ( ! bSymmetricWeights ) {
+				p.Set(i, nNbrJ, -dWeight);
+			} else if ( i < nNbrJ ) {
+				// scaled weights only agree up to float rounding, so use one value for both (i,j) and (j,i)
+				p.Set(i, nNbrJ, -dWeight);
+				p.Set(nNbrJ, i, -dWeight);
+			}
 		}
 
-		p.SetRHS(i, 0, 0);
-		//p.SetRHS(i, 0, 1);
-		p2.SetRHS(i, 0, 0);
-	}
-
-	size_t nBdry = m_boundaryInfo.vBoundaryLoops.size();
-	for ( unsigned int i = 0; i < nBdry; ++i ) {
-		BoundaryLoop & loop = m_boundaryInfo.vBoundaryLoops[i];
-		size_t nLoopCount = loop.vVerts.size();
-		for ( unsigned int j = 0; j < nLoopCount; ++j ) {
-			int r = loop.vVerts[j];
-			
-			p.Matrix().ClearRow(r);
-			p.Set(r,r, 1.0);
-			p.SetRHS(r, loop.vUVs[j].X(), 0);
-			//p.SetRHS(r, loop.vUVs[j].Y(), 1);
-
-			p2.Matrix().ClearRow(r);
-			p2.Set(r,r, 1.0);
-			p2.SetRHS(r, loop.vUVs[j].Y(), 0);
-		}
+		p.SetRHS(i, dRHS[0], 0);
+		p.SetRHS(i, dRHS[1], 1);
 	}
 
-	gsi::Solver_UMFPACK solver(&p);
+	SparseLinearSolver solver(&p);
+	solver.SetBackend(m_eSolverBackend);
+	bool bCholesky = bSymmetricWeights && p.Matrix().IsSymmetric();
+	solver.SetFactorization( (bCholesky) ? SparseLinearSolver::Factor_Cholesky : SparseLinearSolver::Factor_LU );
 	bool bOK = solver.Solve();
-	if (! bOK )
-		return false;
-	gsi::Solver_UMFPACK solver2(&p2);
-	bOK = solver2.Solve();
 	if (! bOK )
 		return false;
 
 	vU.resize(nCount);  vV.resize(nCount);
+	const gsi::Vector & vSolutionU = p.GetSolution(0);
+	const gsi::Vector & vSolutionV = p.GetSolution(1);
 	for ( unsigned int k = 0; k < nCount; ++k ) {
-		vU[k] = p.GetSolution(0)[k];
-		//vV[k] = p.GetSolution(1)[k];
-		vV[k] = p2.GetSolution(0)[k];
+		vU[k] = vSolutionU[k];
+		vV[k] = vSolutionV[k];
 	}
 	return true;
 }
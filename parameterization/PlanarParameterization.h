@@ -7,6 +7,7 @@
 #include "config.h"
 #include <VFTriangleMesh.h>
 #include <ExpMapGenerator.h>
+#include <SparseLinearSolver.h>
 
 // predecl to avoid include
 namespace rmssolver {
@@ -75,6 +76,10 @@ public:
 
 	void SetScaleUVs( bool bEnable, float fScaleFactor = 0 ) { m_bScaleUVs = bEnable;  if(fScaleFactor != 0) m_fUVScaleFactor = fScaleFactor; }
 
+	//! direct solver for the linear embeddings (default is SparseLinearSolver::GetDefaultBackend())
+	void SetSolverBackend( SparseLinearSolver::Backend eBackend ) { m_eSolverBackend = eBackend; }
+	SparseLinearSolver::Backend GetSolverBackend() { return m_eSolverBackend; }
+
 protected:
 	rms::VFTriangleMesh * m_pMesh;
 	rms::ExpMapGenerator * m_pExpMap;
@@ -82,6 +87,8 @@ protected:
 	bool m_bScaleUVs;
 	float m_fUVScaleFactor;
 
+	SparseLinearSolver::Backend m_eSolverBackend;
+
 	EmbeddingType m_eEmbedType;
 	BoundaryMapType m_eBoundaryMap;
 
@@ -126,6 +133,10 @@ protected:
 		std::vector< float > fDistances3D;
 		std::vector< float > fWeights;
 
+		// normalization of fWeights, for weights that are a symmetric kernel divided by its row sum
+		// (uniform, inverse distance, cotangent). fWeights[j]*fWeightScale is the kernel value
+		float fWeightScale;
+
 		// used for local expmaps
 		std::vector< Wml::Vector2f > vLocalUVs;
 
@@ -140,7 +151,7 @@ protected:
 		std::vector<TriangleAngles> vTriAngles;
 
 		virtual void Clear() { 
-			vNbrs.resize(0); fDistances3D.resize(0); fWeights.resize(0); 
+			vNbrs.resize(0); fDistances3D.resize(0); fWeights.resize(0); fWeightScale = 1.0f;
 			vLocalUVs.resize(0); 
 			vFlattened.resize(0); vIntersectEdge.resize(0); vIntersect2D.resize(0); vIntersect3D.resize(0); 
 			vAngles.resize(0); vTriAngles.resize(0);
@@ -211,6 +222,7 @@ protected:
 	void ComputeWeights_ShapePreserving( NeighbourSet & nbrs );
 	void ComputeWeights_Geodesic( NeighbourSet & nbrs );
 	void ComputeWeights_Optimal3D( NeighbourSet & nbrs );
+	void ComputeWeights_Cotangent( NeighbourSet & nbrs );
 
 	// TODO: optionally symmetrize weights after computation (??)
 	void ComputeWeights_Optimal2D( NeighbourSet & nbrs );
@@ -246,7 +258,10 @@ protected:
 	};
 
 
-	bool Solve_FixBoundary( std::vector<double> & vU, std::vector<double> & vV, NeighbourhoodType eNbrType);
+	//! solves (I - W) x = 0 with the boundary loops fixed, for U and V at once (one matrix, two right-hand sides).
+	//! Boundary columns are moved to the right-hand side, so if bSymmetricWeights is true (fWeightScale
+	//! has been set for all vertices) the scaled system is symmetric and is solved by Cholesky factorization
+	bool Solve_FixBoundary( std::vector<double> & vU, std::vector<double> & vV, NeighbourhoodType eNbrType, bool bSymmetricWeights = false );
 
 	// driver functions
 	bool Parameterize_OneRing();
@@ -7,19 +7,30 @@
 
 #include "config.h"
 #include <vector>
-#include <map>
+#include <algorithm>
+#include <cmath>
 
-#include "MemoryPool.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace rms {
 
 
-
+/*
+ * Uniform grid of particles. Cells are stored in a flat open-addressing hash table, and all
+ * particles are kept in one contiguous array sorted by cell (counting sort, stable, so particles
+ * in each cell are in the order they were added). The hash table is split into partitions by the
+ * high bits of the cell hash, so that Build() can fill them in parallel. Adding particles only
+ * records them; the sorted layout is built by Build(), which is called automatically by the first
+ * query after a change.
+ * Call Build() explicitly before querying from multiple threads.
+ */
 template<class Type>
 class ParticleGrid
 {
 public:
-	ParticleGrid() {};
+	ParticleGrid() { m_fCellSize = 1.0f; m_nMaxParticleCount = 0; m_bBuilt = true; }
 	~ParticleGrid() {};
 
 	void Initialize( const float * vOrigin, float fCellSize );
@@ -27,8 +38,19 @@ public:
 	float CellSize() { return m_fCellSize; }
 
 	void AddParticle( Type pParticle, const float * vPosition );
+
+	//! add nCount particles. pPositions is packed xyz. Cell keys are computed in parallel
+	void AddParticles( const Type * pParticles, const float * pPositions, unsigned int nCount );
+
 	void Clear();
 
+	//! sort particles into cells. Done automatically by BoxIterator if necessary
+	void Build();
+
+	unsigned int GetParticleCount() const { return (unsigned int)m_vAdded.size(); }
+	unsigned int GetCellCount() const { return m_vCellStart.empty() ? 0 : (unsigned int)m_vCellStart.size() - 1; }
+	unsigned int GetMaxParticlesPerCell() { Build(); return m_nMaxParticleCount; }
+
 
 	struct VoxelKey {
 		int x;
@@ -38,11 +60,9 @@ public:
 		bool operator<( const VoxelKey & voxel2 ) const {
 			return x < voxel2.x || x == voxel2.x && (y < voxel2.y || y == voxel2.y && (z < voxel2.z));
 		}
-	};
-
-	struct Voxel {
-		VoxelKey key;
-		std::vector<Type> particles;
+		bool operator==( const VoxelKey & voxel2 ) const {
+			return x == voxel2.x && y == voxel2.y && z == voxel2.z;
+		}
 	};
 
 
@@ -55,7 +75,7 @@ public:
 		bool Done() { return m_nCur == m_nStop; }
 
 		Type & operator *() 
-			{ return m_pCurVoxel->particles[m_nVoxelCur]; }
+			{ return m_pGrid->m_vParticles[m_nVoxelCur]; }
 		void operator++();
 
 		void operator++(int nPostfix) { this->operator++(); }
@@ -66,14 +86,15 @@ public:
 
 	protected:
 		ParticleGrid * m_pGrid;
-		typename ParticleGrid::Voxel * m_pCurVoxel;
-		unsigned int m_nVoxelCount;
-		unsigned int m_nVoxelCur;
+		unsigned int m_nVoxelCount;	// end of current cell in particle array
+		unsigned int m_nVoxelCur;		// current index in particle array
 
 		int m_nStart[3];		// x,y,z of start cell
 		int m_nDims[3];		// x,y,z widths of iteration
 		int m_nCur;			// cur index
 		int m_nStop;			// stop index
+
+		void FindNextVoxel();
 	};
 	friend class BoxIterator;
 
@@ -81,21 +102,44 @@ protected:
 	float m_vOrigin[3];
 	float m_fCellSize;
 
-
-
 	void GetKey( float fX, float fY, float fZ, VoxelKey & key );
 
+	unsigned int m_nMaxParticleCount;
 
+	// particles in the order they were added, and their cells
+	struct AddedParticle {
+		Type particle;
+		VoxelKey key;
+	};
+	std::vector<AddedParticle> m_vAdded;
+	bool m_bBuilt;
 
-	unsigned int m_nMaxParticleCount;
+	// hash table entry. nCell is index into m_vCellStart, or InvalidCell if slot is empty
+	struct CellSlot {
+		VoxelKey key;
+		unsigned int nCell;
+	};
+	static const unsigned int InvalidCell = 0xFFFFFFFF;
+	std::vector<CellSlot> m_vCellTable;
 
-	typedef std::map<VoxelKey, Voxel *> VoxelMap;
-	VoxelMap m_voxels;
+	// partition of m_vCellTable: open-addressing sub-table of nMask+1 slots starting at nFirstSlot
+	struct TablePartition {
+		unsigned int nFirstSlot;
+		unsigned int nMask;
+	};
+	std::vector<TablePartition> m_vPartitions;
 
-	Voxel * GetVoxel( float fX, float fY, float fZ, bool bCreate = false );
-	Voxel * GetVoxel( const VoxelKey & key, bool bCreate = false );
+	// particles in cell i are m_vParticles[ m_vCellStart[i] .. m_vCellStart[i+1] )
+	std::vector<unsigned int> m_vCellStart;
+	std::vector<Type> m_vParticles;
 
-	MemoryPool<Voxel> m_vVoxelMemoryPool;
+	static unsigned int Hash( const VoxelKey & key ) {
+		return ( (unsigned int)key.x * 73856093u ) ^ ( (unsigned int)key.y * 19349663u ) ^ ( (unsigned int)key.z * 83492791u );
+	}
+	static unsigned int Partition( unsigned int nHash, unsigned int nPartitions ) {
+		return (unsigned int)( ( (unsigned long long)nHash * nPartitions ) >> 32 );
+	}
+	unsigned int FindCell( const VoxelKey & key ) const;
 };
 
 
@@ -111,20 +155,37 @@ void ParticleGrid<Type>::Initialize( const float * vOrigin, float fCellSize )
 template<class Type>
 void ParticleGrid<Type>::AddParticle( Type pParticle, const float * vPosition )
 {
-	// get voxel
-	Voxel * pVoxel = GetVoxel( vPosition[0], vPosition[1], vPosition[2], true );
-
-	pVoxel->particles.push_back(pParticle);
+	AddedParticle p;
+	p.particle = pParticle;
+	GetKey( vPosition[0], vPosition[1], vPosition[2], p.key );
+	m_vAdded.push_back(p);
+	m_bBuilt = false;
+}
 
-	m_nMaxParticleCount = std::max( m_nMaxParticleCount, (unsigned int)pVoxel->particles.size() );
+template<class Type>
+void ParticleGrid<Type>::AddParticles( const Type * pParticles, const float * pPositions, unsigned int nCount )
+{
+	unsigned int nBase = (unsigned int)m_vAdded.size();
+	m_vAdded.resize( nBase + nCount );
+	#pragma omp parallel for
+	for ( int i = 0; i < (int)nCount; ++i ) {
+		AddedParticle & p = m_vAdded[nBase+i];
+		p.particle = pParticles[i];
+		GetKey( pPositions[3*i], pPositions[3*i+1], pPositions[3*i+2], p.key );
+	}
+	m_bBuilt = false;
 }
 
 template<class Type>
 void ParticleGrid<Type>::Clear()
 {
-	m_voxels.clear();
-	m_vVoxelMemoryPool.ClearAll();
+	m_vAdded.resize(0);
+	m_vCellTable.resize(0);
+	m_vPartitions.resize(0);
+	m_vCellStart.resize(0);
+	m_vParticles.resize(0);
 	m_nMaxParticleCount = 0;
+	m_bBuilt = true;
 }
 
 template<class Type>
@@ -135,43 +196,181 @@ void ParticleGrid<Type>::GetKey( float fX, float fY, float fZ, VoxelKey & key )
 	key.z = (int)floorf( (fZ - m_vOrigin[2]) / m_fCellSize );
 }
 
+
 template<class Type>
-typename ParticleGrid<Type>::Voxel * ParticleGrid<Type>::GetVoxel( float fX, float fY, float fZ, bool bCreate )
+unsigned int ParticleGrid<Type>::FindCell( const VoxelKey & key ) const
 {
-	VoxelKey key;
-	GetKey(fX, fY, fZ, key );
-	return GetVoxel( key, bCreate );
+	if ( m_vCellTable.empty() )
+		return InvalidCell;
+	unsigned int nHash = Hash(key);
+	const TablePartition & part = m_vPartitions[ Partition(nHash, (unsigned int)m_vPartitions.size()) ];
+	const CellSlot * pTable = &m_vCellTable[part.nFirstSlot];
+	unsigned int nSlot = nHash & part.nMask;
+	while ( pTable[nSlot].nCell != InvalidCell ) {
+		if ( pTable[nSlot].key == key )
+			return pTable[nSlot].nCell;
+		nSlot = (nSlot + 1) & part.nMask;
+	}
+	return InvalidCell;
 }
 
+
 template<class Type>
-typename ParticleGrid<Type>::Voxel *  ParticleGrid<Type>::GetVoxel(const typename  ParticleGrid<Type>::VoxelKey & key, bool bCreate )
+void ParticleGrid<Type>::Build()
 {
-	typename VoxelMap::iterator found( m_voxels.find(key) );
-	
-	// std::map<VoxelKey, Voxel *>::iterator found = m_voxels.find(key);
-	// std::map<VoxelKey, Voxel *>::iterator found; // = m_voxels.find(key);
-	
-	if ( found != m_voxels.end() ) {
-		return (*found).second;
-	} else if ( bCreate ) {
-		Voxel * pVoxel = m_vVoxelMemoryPool.Allocate();
-		pVoxel->particles.resize(0);
-		pVoxel->key = key;
-		m_voxels[key] = pVoxel;
-		return pVoxel;
-	} else 
-		return NULL;	
+	if ( m_bBuilt )
+		return;
+	m_bBuilt = true;
+
+	int nParticles = (int)m_vAdded.size();
+	m_vCellStart.resize(0);
+	m_vParticles.resize(0);
+	m_nMaxParticleCount = 0;
+
+	// Particles are split into nBlocks contiguous blocks, and the hash table into as many partitions.
+	// The particles are first sorted by partition, so that each partition (its sub-table, cells and
+	// particles) can then be filled by one thread that only visits its own particles.
+	int nBlocks = 1;
+#ifdef _OPENMP
+	if ( nParticles > 65536 )
+		nBlocks = omp_get_max_threads();
+#endif
+	int nBlockSize = (nParticles + nBlocks - 1) / nBlocks;
+	unsigned int nPartitions = (unsigned int)nBlocks;
+
+	// cell hash of each particle, and number of particles in each partition (per block)
+	std::vector<unsigned int> vHash( nParticles );
+	std::vector<unsigned int> vPartitionCounts( (size_t)nBlocks * nPartitions, 0 );
+	#pragma omp parallel for schedule(static,1)
+	for ( int b = 0; b < nBlocks; ++b ) {
+		unsigned int * pCounts = &vPartitionCounts[(size_t)b*nPartitions];
+		int nEnd = std::min( (b+1)*nBlockSize, nParticles );
+		for ( int i = b*nBlockSize; i < nEnd; ++i ) {
+			vHash[i] = Hash( m_vAdded[i].key );
+			pCounts[ Partition(vHash[i], nPartitions) ]++;
+		}
+	}
+
+	// partition p holds vByPartition[ vPartitionStart[p] ... vPartitionStart[p+1]-1 ], and block b
+	// writes its particles of partition p starting at vPartitionCounts[b*nPartitions + p]. Each
+	// partition keeps the order the particles were added in.
+	std::vector<unsigned int> vPartitionStart( nPartitions+1 );
+	unsigned int nOffset = 0;
+	for ( unsigned int p = 0; p < nPartitions; ++p ) {
+		vPartitionStart[p] = nOffset;
+		for ( int b = 0; b < nBlocks; ++b ) {
+			unsigned int nCount = vPartitionCounts[(size_t)b*nPartitions + p];
+			vPartitionCounts[(size_t)b*nPartitions + p] = nOffset;
+			nOffset += nCount;
+		}
+	}
+	vPartitionStart[nPartitions] = nOffset;
+
+	std::vector<unsigned int> vByPartition( nParticles );
+	#pragma omp parallel for schedule(static,1)
+	for ( int b = 0; b < nBlocks; ++b ) {
+		unsigned int * pInsert = &vPartitionCounts[(size_t)b*nPartitions];
+		int nEnd = std::min( (b+1)*nBlockSize, nParticles );
+		for ( int i = b*nBlockSize; i < nEnd; ++i )
+			vByPartition[ pInsert[ Partition(vHash[i], nPartitions) ]++ ] = (unsigned int)i;
+	}
+
+	// each sub-table is at most half full (cells <= particles)
+	m_vPartitions.resize( nPartitions );
+	unsigned int nTableSize = 0;
+	for ( unsigned int p = 0; p < nPartitions; ++p ) {
+		unsigned int nCount = vPartitionStart[p+1] - vPartitionStart[p];
+		unsigned int nSize = 16;
+		while ( nSize < 2*nCount )
+			nSize *= 2;
+		m_vPartitions[p].nFirstSlot = nTableSize;
+		m_vPartitions[p].nMask = nSize-1;
+		nTableSize += nSize;
+	}
+	CellSlot empty;
+	empty.nCell = InvalidCell;
+	m_vCellTable.resize(0);
+	m_vCellTable.resize( nTableSize, empty );
+
+	// assign cell indices within each partition (in order of first particle)
+	std::vector<unsigned int> vCell( nParticles );
+	std::vector<unsigned int> vPartitionCells( nPartitions+1, 0 );
+	#pragma omp parallel for schedule(dynamic,1)
+	for ( int p = 0; p < (int)nPartitions; ++p ) {
+		CellSlot * pTable = &m_vCellTable[ m_vPartitions[p].nFirstSlot ];
+		unsigned int nMask = m_vPartitions[p].nMask;
+		unsigned int nCells = 0;
+		for ( unsigned int k = vPartitionStart[p]; k < vPartitionStart[p+1]; ++k ) {
+			unsigned int i = vByPartition[k];
+			const VoxelKey & key = m_vAdded[i].key;
+			unsigned int nSlot = vHash[i] & nMask;
+			while ( pTable[nSlot].nCell != InvalidCell && ! (pTable[nSlot].key == key) )
+				nSlot = (nSlot + 1) & nMask;
+			if ( pTable[nSlot].nCell == InvalidCell ) {
+				pTable[nSlot].key = key;
+				pTable[nSlot].nCell = nCells++;
+			}
+			vCell[i] = pTable[nSlot].nCell;
+		}
+		vPartitionCells[p+1] = nCells;
+	}
+	for ( unsigned int p = 0; p < nPartitions; ++p )
+		vPartitionCells[p+1] += vPartitionCells[p];
+	unsigned int nCells = vPartitionCells[nPartitions];
+
+	// offset the cell indices so that cells are numbered by partition, and count the particles of
+	// each cell. Partition p owns cells vPartitionCells[p] ... vPartitionCells[p+1]-1.
+	std::vector<unsigned int> vCounts( nCells, 0 );
+	#pragma omp parallel for schedule(dynamic,1)
+	for ( int p = 0; p < (int)nPartitions; ++p ) {
+		unsigned int nBase = vPartitionCells[p];
+		if ( nBase > 0 ) {
+			CellSlot * pTable = &m_vCellTable[ m_vPartitions[p].nFirstSlot ];
+			for ( unsigned int k = 0; k <= m_vPartitions[p].nMask; ++k ) {
+				if ( pTable[k].nCell != InvalidCell )
+					pTable[k].nCell += nBase;
+			}
+		}
+		for ( unsigned int k = vPartitionStart[p]; k < vPartitionStart[p+1]; ++k ) {
+			unsigned int i = vByPartition[k];
+			vCell[i] += nBase;
+			vCounts[ vCell[i] ]++;
+		}
+	}
+
+	// counting sort. vCounts becomes the insert position of each cell
+	m_vCellStart.resize( nCells+1 );
+	unsigned int nSum = 0;
+	for ( unsigned int c = 0; c < nCells; ++c ) {
+		unsigned int nCount = vCounts[c];
+		m_vCellStart[c] = nSum;
+		vCounts[c] = nSum;
+		nSum += nCount;
+		m_nMaxParticleCount = std::max( m_nMaxParticleCount, nCount );
+	}
+	m_vCellStart[nCells] = nSum;
+
+	// each partition scatters its own particles, in the order they were added
+	m_vParticles.resize( nParticles );
+	#pragma omp parallel for schedule(dynamic,1)
+	for ( int p = 0; p < (int)nPartitions; ++p ) {
+		for ( unsigned int k = vPartitionStart[p]; k < vPartitionStart[p+1]; ++k ) {
+			unsigned int i = vByPartition[k];
+			m_vParticles[ vCounts[vCell[i]]++ ] = m_vAdded[i].particle;
+		}
+	}
 }
 
 
+
 template<class Type>
 ParticleGrid<Type>::BoxIterator::BoxIterator( ParticleGrid<Type> * pGrid, const float * vPosition, float fRadius )
 {
 	m_pGrid = pGrid;
+	m_pGrid->Build();
 
 	// find bounds
-	ParticleGrid<Type>::VoxelKey key, lowKey, highKey;
-	m_pGrid->GetKey( vPosition[0], vPosition[1], vPosition[2], key );
+	typename ParticleGrid<Type>::VoxelKey lowKey, highKey;
 	m_pGrid->GetKey( vPosition[0] - fRadius, vPosition[1] - fRadius, vPosition[2] - fRadius, lowKey );
 	m_pGrid->GetKey( vPosition[0] + fRadius, vPosition[1] + fRadius, vPosition[2] + fRadius, highKey );
 
@@ -179,9 +378,6 @@ ParticleGrid<Type>::BoxIterator::BoxIterator( ParticleGrid<Type> * pGrid, const
 	m_nStart[1] = lowKey.y;
 	m_nStart[2] = lowKey.z;
 
-	// find radius dist
-	int nDim = (int)ceilf(fRadius / m_pGrid->CellSize());
-
 	// set search dims
 	m_nDims[0] = highKey.x - lowKey.x + 1;
 	m_nDims[1] = highKey.y - lowKey.y + 1;
@@ -189,11 +385,18 @@ ParticleGrid<Type>::BoxIterator::BoxIterator( ParticleGrid<Type> * pGrid, const
 
 	m_nCur = 0;
 	m_nStop = m_nDims[0] * m_nDims[1] * m_nDims[2];
+	m_nVoxelCur = m_nVoxelCount = 0;
 
 	// find starting voxel
-	m_pCurVoxel = NULL;
+	FindNextVoxel();
+}
+
+
+template<class Type>
+void ParticleGrid<Type>::BoxIterator::FindNextVoxel()
+{
 	VoxelKey which;
-	while ( m_pCurVoxel == NULL && m_nCur < m_nStop ) {
+	while ( m_nCur < m_nStop ) {
 		int nCur = m_nCur;
 		which.z = m_nStart[2] + nCur / (m_nDims[1] * m_nDims[0]);
 		nCur %= (m_nDims[1] * m_nDims[0]);
@@ -201,55 +404,29 @@ ParticleGrid<Type>::BoxIterator::BoxIterator( ParticleGrid<Type> * pGrid, const
 		nCur %= m_nDims[0];
 		which.x = m_nStart[0] + nCur;
 
-		m_pCurVoxel = m_pGrid->GetVoxel( which );
-		if ( m_pCurVoxel == NULL || m_pCurVoxel->particles.size() == 0 ) {
-			m_pCurVoxel = NULL;
-			m_nCur++;
+		unsigned int nCell = m_pGrid->FindCell( which );
+		if ( nCell != InvalidCell ) {
+			m_nVoxelCur = m_pGrid->m_vCellStart[nCell];
+			m_nVoxelCount = m_pGrid->m_vCellStart[nCell+1];
+			return;
 		}
+		m_nCur++;
 	}
-
-	if ( m_nCur < m_nStop ) {
-		m_nVoxelCount = (unsigned int)m_pCurVoxel->particles.size();
-		m_nVoxelCur = 0;
-	}
-
 }
 
 
 template<class Type>
 void ParticleGrid<Type>::BoxIterator::operator++( )
 {
-	// increment through current vector if possible
+	// increment through current cell if possible
 	m_nVoxelCur++;
 	if ( m_nVoxelCur < m_nVoxelCount ) {
 		return;
 	}
 
-	// increment cur voxel
+	// find next occupied voxel
 	m_nCur++;
-
-	// find next allocated voxel
-	m_pCurVoxel = NULL;
-	VoxelKey which;
-	while ( m_pCurVoxel == NULL && m_nCur < m_nStop ) {
-		int nCur = m_nCur;
-		which.z = m_nStart[2] + nCur / (m_nDims[1] * m_nDims[0]);
-		nCur %= (m_nDims[1] * m_nDims[0]);
-		which.y = m_nStart[1] + nCur / m_nDims[0];
-		nCur %= m_nDims[0];
-		which.x = m_nStart[0] + nCur;
-
-		m_pCurVoxel = m_pGrid->GetVoxel( which );
-		if ( m_pCurVoxel == NULL || m_pCurVoxel->particles.size() == 0 ) {
-			m_pCurVoxel = NULL;
-			m_nCur++;
-		}
-	}
-
-	if ( m_nCur < m_nStop ) {
-		m_nVoxelCount = (unsigned int)m_pCurVoxel->particles.size();
-		m_nVoxelCur = 0;
-	}	
+	FindNextVoxel();
 }
 
 
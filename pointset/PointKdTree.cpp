@@ -0,0 +1,381 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "PointKdTree.h"
+
+#include <limits>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace rms;
+
+#define KDTREE_MAX_LEAF_POINTS 8
+#define KDTREE_MAX_DEPTH 32			// balanced with unsigned int point indices, so depth is at most 29
+#define KDTREE_QUERY_BLOCK 256		// queries per block in batched radius search
+
+
+struct PointKdTree::BuildPoint {
+	float v[3];
+	unsigned int nID;
+};
+
+struct PointKdTree::BuildPointLess {
+	int nAxis;
+	bool operator()( const PointKdTree::BuildPoint & a, const PointKdTree::BuildPoint & b ) const
+		{ return a.v[nAxis] < b.v[nAxis]; }
+};
+
+
+PointKdTree::PointKdTree()
+{
+}
+
+PointKdTree::~PointKdTree()
+{
+}
+
+
+void PointKdTree::Clear()
+{
+	m_vNodes.clear(true);
+	m_vPoints.resize(0);
+	m_vIDs.resize(0);
+}
+
+
+void PointKdTree::Build( const float * pPoints, unsigned int nCount, const unsigned int * pIDs )
+{
+	Clear();
+	m_vPoints.resize( nCount );
+	m_vIDs.resize( nCount );
+	#pragma omp parallel for
+	for ( int i = 0; i < (int)nCount; ++i ) {
+		m_vPoints[i] = Wml::Vector3f( pPoints + 3*i );
+		m_vIDs[i] = (pIDs) ? pIDs[i] : (unsigned int)i;
+	}
+	BuildTree();
+}
+
+
+//! number of nodes in tree over nPoints. Median splits make this independent of the point positions:
+//! the ranges at depth d have floor(nPoints/2^d) or floor(nPoints/2^d)+1 points, so every level above
+//! the deepest level D with an internal node is full, and at level D either all nodes are internal or
+//! only the (nPoints mod 2^D) larger ones are.
+unsigned int PointKdTree::SubtreeSize( unsigned int nPoints )
+{
+	if ( nPoints <= KDTREE_MAX_LEAF_POINTS )
+		return 1;
+	unsigned int nLevel = 1;		// 2^D
+	while ( nPoints / (2*nLevel) + ( nPoints % (2*nLevel) != 0 ) > KDTREE_MAX_LEAF_POINTS )
+		nLevel *= 2;
+	unsigned int nInternal = ( nPoints / nLevel > KDTREE_MAX_LEAF_POINTS ) ? nLevel : nPoints % nLevel;
+	return 2*nLevel - 1 + 2*nInternal;
+}
+
+
+void PointKdTree::BuildTree()
+{
+	unsigned int nPoints = (unsigned int)m_vPoints.size();
+	if ( nPoints == 0 )
+		return;
+
+	std::vector<BuildPoint> vBuild( nPoints );
+	#pragma omp parallel for
+	for ( int i = 0; i < (int)nPoints; ++i ) {
+		for ( int k = 0; k < 3; ++k )
+			vBuild[i].v[k] = m_vPoints[i][k];
+		vBuild[i].nID = m_vIDs[i];
+	}
+
+	// node layout is known up front, so subtrees can be built independently. Top levels are
+	// split serially until there are enough subtrees to keep all threads busy.
+	m_vNodes.resize( SubtreeSize(nPoints) );
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	unsigned int nJobSize = (nThreads > 1) ? std::max( nPoints / (8*nThreads), 4096u ) : nPoints;
+	std::vector<unsigned int> vJobs;
+	BuildTop( &vBuild[0], 0, 0, nPoints, nJobSize, vJobs );
+
+	int nJobs = (int)vJobs.size() / 3;
+	#pragma omp parallel for schedule(dynamic,1)
+	for ( int i = 0; i < nJobs; ++i )
+		BuildRange( &vBuild[0], vJobs[3*i], vJobs[3*i+1], vJobs[3*i+2] );
+
+	#pragma omp parallel for
+	for ( int i = 0; i < (int)nPoints; ++i ) {
+		m_vPoints[i] = Wml::Vector3f( vBuild[i].v );
+		m_vIDs[i] = vBuild[i].nID;
+	}
+}
+
+
+void PointKdTree::BuildTop( BuildPoint * pPoints, unsigned int nNode, unsigned int nBegin, unsigned int nEnd, 
+						    unsigned int nJobSize, std::vector<unsigned int> & vJobs )
+{
+	if ( nEnd - nBegin <= nJobSize ) {
+		vJobs.push_back(nNode);  vJobs.push_back(nBegin);  vJobs.push_back(nEnd);
+		return;
+	}
+	unsigned int nMid = SplitRange( pPoints, nNode, nBegin, nEnd );
+	BuildTop( pPoints, nNode+1, nBegin, nMid, nJobSize, vJobs );
+	BuildTop( pPoints, m_vNodes[nNode].nIndex, nMid, nEnd, nJobSize, vJobs );
+}
+
+
+void PointKdTree::BuildRange( BuildPoint * pPoints, unsigned int nNode, unsigned int nBegin, unsigned int nEnd )
+{
+	unsigned int nMid = SplitRange( pPoints, nNode, nBegin, nEnd );
+	if ( nMid == nEnd )
+		return;
+	BuildRange( pPoints, nNode+1, nBegin, nMid );
+	BuildRange( pPoints, m_vNodes[nNode].nIndex, nMid, nEnd );
+}
+
+
+//! set box of node nNode, and split range at median of widest axis. Returns nEnd if node is a leaf
+unsigned int PointKdTree::SplitRange( BuildPoint * pPoints, unsigned int nNode, unsigned int nBegin, unsigned int nEnd )
+{
+	KdNode & node = m_vNodes[nNode];
+	for ( int k = 0; k < 3; ++k ) {
+		node.vMin[k] = std::numeric_limits<float>::max();
+		node.vMax[k] = -std::numeric_limits<float>::max();
+	}
+	for ( unsigned int i = nBegin; i < nEnd; ++i ) {
+		for ( int k = 0; k < 3; ++k ) {
+			if ( pPoints[i].v[k] < node.vMin[k] )  node.vMin[k] = pPoints[i].v[k];
+			if ( pPoints[i].v[k] > node.vMax[k] )  node.vMax[k] = pPoints[i].v[k];
+		}
+	}
+
+	unsigned int nCount = nEnd - nBegin;
+	if ( nCount <= KDTREE_MAX_LEAF_POINTS ) {
+		node.nIndex = nBegin;
+		node.nCount = nCount;
+		return nEnd;
+	}
+
+	BuildPointLess less;
+	float fWidth = node.vMax[0] - node.vMin[0], fHeight = node.vMax[1] - node.vMin[1], fDepth = node.vMax[2] - node.vMin[2];
+	less.nAxis = (fWidth >= fHeight && fWidth >= fDepth) ? 0 : (fHeight >= fDepth) ? 1 : 2;
+	unsigned int nMid = nBegin + nCount/2;
+	std::nth_element( pPoints + nBegin, pPoints + nMid, pPoints + nEnd, less );
+
+	node.nCount = 0;
+	node.nIndex = nNode + 1 + SubtreeSize( nMid - nBegin );
+	return nMid;
+}
+
+
+
+float PointKdTree::MinDistanceSqr( const KdNode & node, const Wml::Vector3f & vPoint )
+{
+	float fDistSqr = 0.0f;
+	for ( int k = 0; k < 3; ++k ) {
+		float d = 0.0f;
+		if ( vPoint[k] < node.vMin[k] )
+			d = node.vMin[k] - vPoint[k];
+		else if ( vPoint[k] > node.vMax[k] )
+			d = vPoint[k] - node.vMax[k];
+		fDistSqr += d*d;
+	}
+	return fDistSqr;
+}
+
+
+unsigned int PointKdTree::FindNearest( const Wml::Vector3f & vPoint, float * pDistSqr ) const
+{
+	unsigned int nID = InvalidID;
+	float fDistSqr = std::numeric_limits<float>::max();
+	KNearest( vPoint, 1, &nID, &fDistSqr );
+	if ( pDistSqr )
+		*pDistSqr = fDistSqr;
+	return nID;
+}
+
+
+unsigned int PointKdTree::KNearest( const Wml::Vector3f & vPoint, unsigned int k, unsigned int * pIDs, float * pDistSqr ) const
+{
+	if ( m_vNodes.empty() || k == 0 )
+		return 0;
+
+	// results are kept sorted by insertion, distances in local buffer if caller did not provide one
+	std::vector<float> vLocalDist;
+	if ( pDistSqr == NULL ) {
+		vLocalDist.resize(k);
+		pDistSqr = &vLocalDist[0];
+	}
+	unsigned int nFound = 0;
+	float fWorst = std::numeric_limits<float>::max();
+
+	unsigned int vStack[KDTREE_MAX_DEPTH+2];
+	float vStackDist[KDTREE_MAX_DEPTH+2];
+	int nStack = 0;
+	vStack[0] = 0;  vStackDist[0] = MinDistanceSqr( m_vNodes[0], vPoint );  nStack = 1;
+	while ( nStack > 0 ) {
+		--nStack;
+		if ( vStackDist[nStack] > fWorst )
+			continue;
+		const KdNode & node = m_vNodes[ vStack[nStack] ];
+
+		if ( node.IsLeaf() ) {
+			for ( unsigned int i = node.nIndex; i < node.nIndex + node.nCount; ++i ) {
+				float fDist = (m_vPoints[i] - vPoint).SquaredLength();
+				if ( nFound == k && fDist >= fWorst )
+					continue;
+				unsigned int j = (nFound < k) ? nFound++ : k-1;
+				while ( j > 0 && pDistSqr[j-1] > fDist ) {
+					pDistSqr[j] = pDistSqr[j-1];  pIDs[j] = pIDs[j-1];
+					--j;
+				}
+				pDistSqr[j] = fDist;  pIDs[j] = m_vIDs[i];
+				if ( nFound == k )
+					fWorst = pDistSqr[k-1];
+			}
+			continue;
+		}
+
+		// push farther child first, so nearer child is visited first
+		unsigned int nLeft = vStack[nStack] + 1, nRight = node.nIndex;
+		float fLeft = MinDistanceSqr( m_vNodes[nLeft], vPoint );
+		float fRight = MinDistanceSqr( m_vNodes[nRight], vPoint );
+		if ( fLeft < fRight ) {
+			std::swap(nLeft, nRight);  std::swap(fLeft, fRight);
+		}
+		if ( fLeft <= fWorst ) {
+			vStack[nStack] = nLeft;  vStackDist[nStack++] = fLeft;
+		}
+		if ( fRight <= fWorst ) {
+			vStack[nStack] = nRight;  vStackDist[nStack++] = fRight;
+		}
+	}
+	return nFound;
+}
+
+
+unsigned int PointKdTree::KNearest( const Wml::Vector3f & vPoint, unsigned int k, 
+								    std::vector<unsigned int> & vIDs, std::vector<float> * pDistSqr ) const
+{
+	vIDs.resize(k);
+	if ( pDistSqr )
+		pDistSqr->resize(k);
+	if ( k == 0 )
+		return 0;
+	unsigned int nFound = KNearest( vPoint, k, &vIDs[0], (pDistSqr) ? &(*pDistSqr)[0] : NULL );
+	vIDs.resize(nFound);
+	if ( pDistSqr )
+		pDistSqr->resize(nFound);
+	return nFound;
+}
+
+
+//! sort helper for RadiusSearch
+struct KdDistanceLess {
+	const std::vector<float> * pDist;
+	bool operator()( unsigned int i, unsigned int j ) const { return (*pDist)[i] < (*pDist)[j]; }
+};
+
+unsigned int PointKdTree::RadiusSearch( const Wml::Vector3f & vPoint, float fRadius, 
+									    std::vector<unsigned int> & vIDs, std::vector<float> * pDistSqr, bool bSort ) const
+{
+	if ( m_vNodes.empty() )
+		return 0;
+
+	size_t nStart = vIDs.size();
+	std::vector<float> vLocalDist;
+	std::vector<float> & vDist = (pDistSqr) ? *pDistSqr : vLocalDist;
+	size_t nDistStart = vDist.size();
+	float fRadiusSqr = fRadius*fRadius;
+
+	unsigned int vStack[KDTREE_MAX_DEPTH+2];
+	int nStack = 0;
+	vStack[nStack++] = 0;
+	while ( nStack > 0 ) {
+		const KdNode & node = m_vNodes[ vStack[--nStack] ];
+		if ( MinDistanceSqr( node, vPoint ) > fRadiusSqr )
+			continue;
+
+		if ( node.IsLeaf() ) {
+			for ( unsigned int i = node.nIndex; i < node.nIndex + node.nCount; ++i ) {
+				float fDist = (m_vPoints[i] - vPoint).SquaredLength();
+				if ( fDist <= fRadiusSqr ) {
+					vIDs.push_back( m_vIDs[i] );
+					vDist.push_back( fDist );
+				}
+			}
+		} else {
+			vStack[nStack++] = node.nIndex;
+			vStack[nStack++] = (unsigned int)(&node - &m_vNodes[0]) + 1;
+		}
+	}
+
+	unsigned int nFound = (unsigned int)(vIDs.size() - nStart);
+	if ( bSort && nFound > 1 ) {
+		std::vector<unsigned int> vOrder( nFound );
+		for ( unsigned int i = 0; i < nFound; ++i )
+			vOrder[i] = (unsigned int)nDistStart + i;
+		KdDistanceLess less;  less.pDist = &vDist;
+		std::sort( vOrder.begin(), vOrder.end(), less );
+		std::vector<unsigned int> vSortedIDs( nFound );
+		std::vector<float> vSortedDist( nFound );
+		for ( unsigned int i = 0; i < nFound; ++i ) {
+			vSortedIDs[i] = vIDs[ nStart + vOrder[i] - nDistStart ];
+			vSortedDist[i] = vDist[ vOrder[i] ];
+		}
+		std::copy( vSortedIDs.begin(), vSortedIDs.end(), vIDs.begin() + nStart );
+		std::copy( vSortedDist.begin(), vSortedDist.end(), vDist.begin() + nDistStart );
+	}
+	return nFound;
+}
+
+
+
+void PointKdTree::KNearest( const Wml::Vector3f * pPoints, unsigned int nCount, unsigned int k, 
+						    unsigned int * pIDs, float * pDistSqr ) const
+{
+	#pragma omp parallel for schedule(dynamic,64)
+	for ( int i = 0; i < (int)nCount; ++i ) {
+		unsigned int * pQueryIDs = pIDs + (size_t)k*i;
+		float * pQueryDist = (pDistSqr) ? pDistSqr + (size_t)k*i : NULL;
+		unsigned int nFound = KNearest( pPoints[i], k, pQueryIDs, pQueryDist );
+		for ( unsigned int j = nFound; j < k; ++j ) {
+			pQueryIDs[j] = InvalidID;
+			if ( pQueryDist )
+				pQueryDist[j] = std::numeric_limits<float>::max();
+		}
+	}
+}
+
+
+void PointKdTree::RadiusSearch( const Wml::Vector3f * pPoints, unsigned int nCount, float fRadius,
+							    std::vector<unsigned int> & vOffsets, std::vector<unsigned int> & vIDs ) const
+{
+	// each block of queries collects its results separately, then blocks are concatenated
+	int nBlocks = (int)( (nCount + KDTREE_QUERY_BLOCK-1) / KDTREE_QUERY_BLOCK );
+	std::vector< std::vector<unsigned int> > vBlockIDs( nBlocks );
+	vOffsets.resize( nCount+1 );
+	#pragma omp parallel for schedule(dynamic,1)
+	for ( int b = 0; b < nBlocks; ++b ) {
+		std::vector<float> vDist;
+		unsigned int nEnd = std::min( (unsigned int)(b+1)*KDTREE_QUERY_BLOCK, nCount );
+		for ( unsigned int i = b*KDTREE_QUERY_BLOCK; i < nEnd; ++i ) {
+			vOffsets[i+1] = RadiusSearch( pPoints[i], fRadius, vBlockIDs[b], &vDist );
+			vDist.resize(0);
+		}
+	}
+
+	vOffsets[0] = 0;
+	for ( unsigned int i = 0; i < nCount; ++i )
+		vOffsets[i+1] += vOffsets[i];
+	vIDs.resize( vOffsets[nCount] );
+	#pragma omp parallel for
+	for ( int b = 0; b < nBlocks; ++b ) {
+		if ( ! vBlockIDs[b].empty() )
+			std::copy( vBlockIDs[b].begin(), vBlockIDs[b].end(), vIDs.begin() + vOffsets[b*KDTREE_QUERY_BLOCK] );
+	}
+}
@@ -0,0 +1,133 @@
+// Copyright Ryan Schmidt 2011.
+// Distributed under the Boost Software License, Version 1.0.
+// (See copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _RMS_POINT_KDTREE_H_
+#define _RMS_POINT_KDTREE_H_
+
+#include "config.h"
+#include <vector>
+#include <Wm4Vector3.h>
+
+#include "IGeometry.h"
+#include "AlignedVector.h"
+
+namespace rms {
+
+
+/*
+ * Static kd-tree over a 3D point set, for k-nearest-neighbour and radius queries.
+ * Points are split at the median of the widest axis, so the tree is balanced and its
+ * layout is known before building; subtrees are built in parallel (OpenMP).
+ * Points are identified by an unsigned int ID (array index by default). 
+ * Queries do not modify the tree, so they can be made from multiple threads.
+ */
+class PointKdTree
+{
+public:
+	PointKdTree();
+	~PointKdTree();
+
+	static const unsigned int InvalidID = 0xFFFFFFFF;
+
+	//! pPoints is packed xyz. IDs are point indices, unless pIDs is provided
+	void Build( const float * pPoints, unsigned int nCount, const unsigned int * pIDs = NULL );
+	void Build( const Wml::Vector3f * pPoints, unsigned int nCount, const unsigned int * pIDs = NULL )
+		{ Build( (const float *)pPoints, nCount, pIDs ); }
+
+	//! source must be valid for all IDs in [0, source.MaxID())
+	template<class T>
+	void Build( IPositionSource<T> & source );
+	template<class T>
+	void Build( IPositionSource<T> & source, const std::vector<T> & vIDs );
+
+	void Clear();
+
+	unsigned int GetPointCount() const { return (unsigned int)m_vIDs.size(); }
+
+
+	//! nearest point to vPoint. Returns InvalidID if tree is empty
+	unsigned int FindNearest( const Wml::Vector3f & vPoint, float * pDistSqr = NULL ) const;
+
+	//! up to k nearest points, sorted by increasing distance. pIDs/pDistSqr must have space for k entries. 
+	//! Returns number of points found (less than k only if there are fewer than k points)
+	unsigned int KNearest( const Wml::Vector3f & vPoint, unsigned int k, unsigned int * pIDs, float * pDistSqr = NULL ) const;
+	unsigned int KNearest( const Wml::Vector3f & vPoint, unsigned int k, 
+						   std::vector<unsigned int> & vIDs, std::vector<float> * pDistSqr = NULL ) const;
+
+	//! all points within fRadius of vPoint (appended to vIDs). If bSort is true, results are sorted by distance.
+	//! Returns number of points found
+	unsigned int RadiusSearch( const Wml::Vector3f & vPoint, float fRadius, 
+							   std::vector<unsigned int> & vIDs, std::vector<float> * pDistSqr = NULL, bool bSort = false ) const;
+
+
+	//! batched KNearest. Results for query i are in pIDs[k*i ... k*i+k-1], padded with InvalidID
+	void KNearest( const Wml::Vector3f * pPoints, unsigned int nCount, unsigned int k, 
+				   unsigned int * pIDs, float * pDistSqr = NULL ) const;
+
+	//! batched RadiusSearch. Results for query i are vIDs[ vOffsets[i] ... vOffsets[i+1]-1 ] (unsorted)
+	void RadiusSearch( const Wml::Vector3f * pPoints, unsigned int nCount, float fRadius,
+					   std::vector<unsigned int> & vOffsets, std::vector<unsigned int> & vIDs ) const;
+
+protected:
+	// nodes are stored depth-first, left child is next node. For internal nodes nIndex is the right
+	// child, for leaves it is the first point (in m_vPoints/m_vIDs)
+	struct KdNode {
+		float vMin[3];
+		unsigned int nIndex;
+		float vMax[3];
+		unsigned int nCount;
+		bool IsLeaf() const { return nCount != 0; }
+	};
+
+	AlignedVector<KdNode> m_vNodes;
+	std::vector<Wml::Vector3f> m_vPoints;		// in leaf order
+	std::vector<unsigned int> m_vIDs;			// in leaf order
+
+	struct BuildPoint;
+	struct BuildPointLess;
+	static unsigned int SubtreeSize( unsigned int nPoints );
+	void BuildTree();
+	void BuildTop( BuildPoint * pPoints, unsigned int nNode, unsigned int nBegin, unsigned int nEnd, 
+				   unsigned int nJobSize, std::vector<unsigned int> & vJobs );
+	void BuildRange( BuildPoint * pPoints, unsigned int nNode, unsigned int nBegin, unsigned int nEnd );
+	unsigned int SplitRange( BuildPoint * pPoints, unsigned int nNode, unsigned int nBegin, unsigned int nEnd );
+
+	static float MinDistanceSqr( const KdNode & node, const Wml::Vector3f & vPoint );
+};
+
+
+
+template<class T>
+void PointKdTree::Build( IPositionSource<T> & source )
+{
+	Clear();
+	unsigned int nCount = (unsigned int)source.MaxID();
+	m_vPoints.resize( nCount );
+	m_vIDs.resize( nCount );
+	for ( unsigned int i = 0; i < nCount; ++i ) {
+		source.GetPosition( (T)i, m_vPoints[i] );
+		m_vIDs[i] = i;
+	}
+	BuildTree();
+}
+
+template<class T>
+void PointKdTree::Build( IPositionSource<T> & source, const std::vector<T> & vIDs )
+{
+	Clear();
+	unsigned int nCount = (unsigned int)vIDs.size();
+	m_vPoints.resize( nCount );
+	m_vIDs.resize( nCount );
+	for ( unsigned int i = 0; i < nCount; ++i ) {
+		source.GetPosition( vIDs[i], m_vPoints[i] );
+		m_vIDs[i] = (unsigned int)vIDs[i];
+	}
+	BuildTree();
+}
+
+
+
+} // namespace rms
+
+#endif // _RMS_POINT_KDTREE_H_
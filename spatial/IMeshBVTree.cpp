@@ -5,24 +5,42 @@
 #include "IMeshBVTree.h"
 
 #include <limits>
+#include <algorithm>
+#include <cstring>
 #include <Wm4IntrRay3Triangle3.h>
 #include <Wm4DistVector3Triangle3.h>
 #include <Wm4DistVector3Line3.h>
 
 #include "VectorUtil.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// SSE box tests for packet queries (VC9 release build uses /arch:SSE2)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define RMS_BVTREE_USE_SSE
+#include <xmmintrin.h>
+#endif
+
 using namespace rms;
 
 IMeshBVTree::IMeshBVTree( )
 {
 	m_pMesh = NULL;
 	m_pRoot = NULL;
+	m_eBuildMode = LazyBuild;
+	m_fRefitRebuildThreshold = 2.0f;
+	m_bFlatBuilt = false;
 }
 
-IMeshBVTree::IMeshBVTree( IMesh * pMesh )
+IMeshBVTree::IMeshBVTree( IMesh * pMesh, BuildMode eMode )
 {
 	m_pMesh = pMesh;
 	m_pRoot = NULL;
+	m_eBuildMode = eMode;
+	m_fRefitRebuildThreshold = 2.0f;
+	m_bFlatBuilt = false;
 }
 
 void IMeshBVTree::SetMesh( IMesh * pMesh )
@@ -31,8 +49,33 @@ void IMeshBVTree::SetMesh( IMesh * pMesh )
 	m_pMesh = pMesh;
 }
 
+void IMeshBVTree::SetBuildMode( BuildMode eMode )
+{
+	if ( eMode != m_eBuildMode ) {
+		Clear();
+		m_eBuildMode = eMode;
+	}
+}
+
+void IMeshBVTree::Build()
+{
+	if ( m_eBuildMode == FlatSAHBuild )
+		BuildFlat();
+	else
+		Initialize();
+}
+
 void IMeshBVTree::GetMeshBounds( Wml::AxisAlignedBox3f & bounds )
 {
+	if ( m_eBuildMode == FlatSAHBuild ) {
+		EnsureFlatBuilt();
+		if ( ! m_vFlatNodes.empty() ) {
+			const FlatBVNode & root = m_vFlatNodes[0];
+			bounds = Wml::AxisAlignedBox3f( root.vMin[0], root.vMax[0], root.vMin[1], root.vMax[1], root.vMin[2], root.vMax[2] );
+		}
+		return;
+	}
+
 	if ( m_pRoot == NULL )
 		Initialize();
 	if ( m_pRoot ) {
@@ -44,6 +87,11 @@ void IMeshBVTree::GetMeshBounds( Wml::AxisAlignedBox3f & bounds )
 bool IMeshBVTree::FindRayIntersection( const Wml::Vector3f & vOrigin, const Wml::Vector3f & vDirection,
 								 	   Wml::Vector3f & vHit, IMesh::TriangleID & nHitTri )
 {
+	if ( m_eBuildMode == FlatSAHBuild ) {
+		EnsureFlatBuilt();
+		return FindRayIntersectionFlat( Ray(vOrigin, vDirection), vHit, nHitTri );
+	}
+
 	if ( m_pRoot == NULL )
 		Initialize();
 	if ( ! m_pRoot )
@@ -107,8 +155,20 @@ bool IMeshBVTree::FindRayIntersection( IMeshBVTree::IMeshBVNode * pNode, Ray & r
 
 
 
-bool IMeshBVTree::FindNearest( const Wml::Vector3f & vPoint, Wml::Vector3f & vNearest, IMesh::TriangleID & nNearestTri )
+bool IMeshBVTree::FindNearest( const Wml::Vector3f & vPoint, Wml::Vector3f & vNearest, IMesh::TriangleID & nNearestTri, float * pDistance )
 {
+	float fNearest = std::numeric_limits<float>::max();
+
+	// flat queries only read the (built) tree, so they can run concurrently. That means
+	// no write to m_fLastQueryDistance (use pDistance instead).
+	if ( m_eBuildMode == FlatSAHBuild ) {
+		EnsureFlatBuilt();
+		bool bFound = FindNearestFlat( vPoint, vNearest, nNearestTri, fNearest );
+		if ( pDistance )
+			*pDistance = fNearest;
+		return bFound;
+	}
+
 	m_fLastQueryDistance = std::numeric_limits<float>::max();
 
 	if ( m_pRoot == NULL )
@@ -116,20 +176,25 @@ bool IMeshBVTree::FindNearest( const Wml::Vector3f & vPoint, Wml::Vector3f & vNe
 	if ( ! m_pRoot )
 		return false;
 
-	float fNearest = std::numeric_limits<float>::max();
 	FindNearest( m_pRoot, vPoint, vNearest, fNearest, nNearestTri );
 	m_fLastQueryDistance = fNearest;
+	if ( pDistance )
+		*pDistance = fNearest;
 	return true;
 }
 
 
-bool IMeshBVTree::FindNearestVtx( const Wml::Vector3f & vPoint, IMesh::VertexID & nNearestVtx )
+bool IMeshBVTree::FindNearestVtx( const Wml::Vector3f & vPoint, IMesh::VertexID & nNearestVtx, float * pDistance )
 {
-	m_fLastQueryDistance = std::numeric_limits<float>::max();
-
 	IMesh::TriangleID tID;
 	Wml::Vector3f vNearest;
-	if ( ! FindNearest(vPoint, vNearest, tID) )
+	bool bFlat = ( m_eBuildMode == FlatSAHBuild );
+	if ( bFlat ) {
+		EnsureFlatBuilt();
+		float fTriDist;
+		if ( ! FindNearestFlat(vPoint, vNearest, tID, fTriDist) )
+			return false;
+	} else if ( ! FindNearest(vPoint, vNearest, tID) )
 		return false;
 	IMesh::VertexID nTri[3];
 	m_pMesh->GetTriangle(tID, nTri);
@@ -145,7 +210,11 @@ bool IMeshBVTree::FindNearestVtx( const Wml::Vector3f & vPoint, IMesh::VertexID
 		}
 	}
 	nNearestVtx = nTri[nNearest];
-	m_fLastQueryDistance = sqrt(fNearest);
+	fNearest = sqrt(fNearest);
+	if ( ! bFlat )
+		m_fLastQueryDistance = fNearest;
+	if ( pDistance )
+		*pDistance = fNearest;
 	return true;
 }
 
@@ -197,6 +266,11 @@ bool IMeshBVTree::FindNearest( IMeshBVTree::IMeshBVNode * pNode, const Wml::Vect
 
 void IMeshBVTree::ExpandAll()
 {
+	if ( m_eBuildMode == FlatSAHBuild ) {
+		BuildFlat();
+		return;
+	}
+
 	if ( m_pRoot == NULL )
 		Initialize();
 	if ( m_pRoot )
@@ -220,6 +294,13 @@ void IMeshBVTree::Clear()
 	m_pRoot = NULL;
 	m_nNodeIDGen = 1;
 	m_nMaxTriangle = 0;
+	m_vBuildTriIDs.resize(0);
+
+	m_vFlatNodes.clear(true);
+	m_vFlatTris.resize(0);
+	m_vFlatTriVerts.resize(0);
+	m_vFlatBuildArea.resize(0);
+	m_bFlatBuilt = false;
 }
 
 IMeshBVTree::IMeshBVNode * IMeshBVTree::GetNewNode()
@@ -239,31 +320,30 @@ void IMeshBVTree::Initialize()
 	if ( ! m_pMesh )
 		return;
 
-	// count tris
-	unsigned int nTris = 0;
-	IMesh::ITriIterator curt(m_pMesh->BeginITriangles()), endt(m_pMesh->EndITriangles());
-	while ( curt != endt ) {
-		++nTris;  ++curt;
-	}
-	if ( nTris < 2 )
+	// collect tris (node IDs are set below, once we know there is a root)
+	std::vector<IMesh::TriangleID> vTriIDs;
+	vTriIDs.reserve( m_pMesh->GetTriangleCount() );
+	m_pMesh->ForEachTriangleBlock( IMeshAppendIDsFunc(vTriIDs) );
+	unsigned int nTris = (unsigned int)vTriIDs.size();
+	TriangleEntry entry;
+	entry.nNodeID = 0;
+	entry.nJump = 1;
+	m_vTriangles.resize( nTris, entry );
+	for ( unsigned int k = 0; k < nTris; ++k )
+		m_vTriangles[k].triID = vTriIDs[k];
+	if ( nTris < 2 ) {
+		m_vTriangles.resize(0);
 		return;
+	}
 	
-	m_vTriangles.resize(nTris);
 	m_nMaxTriangle = nTris;
 	m_pRoot = GetNewNode();
-
-	unsigned int nIndex = 0;
-	curt = m_pMesh->BeginITriangles();
-	while ( curt != endt ) {
-		IMesh::TriangleID tID = *curt;  ++curt;
+	for ( unsigned int nIndex = 0; nIndex < nTris; ++nIndex )
 		m_vTriangles[nIndex].nNodeID = m_pRoot->ID;
-		m_vTriangles[nIndex].triID = tID;
-		m_vTriangles[nIndex].nJump = 1;
-		++nIndex;
-	}
 
 	m_pRoot->SetIndex(0);
 	ComputeBox(m_pRoot);
+	m_vBuildTriIDs.swap( vTriIDs );
 }
 
 
@@ -494,3 +574,1221 @@ float IMeshBVTree::MinDistance( IMeshBVNode * pNode, const Wml::Vector3f & vPoin
 	else
 		return (float)sqrt( fDist[0]*fDist[0] + fDist[1]*fDist[1] + fDist[2]*fDist[2] );
 }
+
+
+
+
+/*
+ * FlatSAHBuild construction
+ */
+
+#define SAH_BIN_COUNT 16
+#define SAH_MAX_LEAF_TRIS 8
+#define SAH_MAX_DEPTH 48			// traversal stacks are sized for this
+#define SAH_PARALLEL_THRESHOLD 16384	// ranges larger than this are binned/bounded in parallel
+#define SAH_RAY_TFAR_SCALE 1.0000004f	// 1 + 2*gamma(3): slab exit is scaled by this so rounding cannot reject hits on a box face
+
+struct IMeshBVTree::SAHBuilder
+{
+	struct Bounds {
+		float vMin[3];
+		float vMax[3];
+		inline void Empty() {
+			for ( int k = 0; k < 3; ++k ) {
+				vMin[k] = std::numeric_limits<float>::max();  vMax[k] = -std::numeric_limits<float>::max(); } }
+		inline void Union( const float * pMin, const float * pMax ) {
+			for ( int k = 0; k < 3; ++k ) {
+				if ( pMin[k] < vMin[k] ) vMin[k] = pMin[k];
+				if ( pMax[k] > vMax[k] ) vMax[k] = pMax[k]; } }
+		inline void Union( const Bounds & b ) { 
+			Union( b.vMin, b.vMax ); }
+		inline float HalfArea() const {
+			float dx = vMax[0]-vMin[0], dy = vMax[1]-vMin[1], dz = vMax[2]-vMin[2];
+			return (dx < 0) ? 0.0f : dx*dy + dy*dz + dz*dx; }
+	};
+
+	struct BuildTri {
+		Bounds box;
+		float vCentroid[3];
+	};
+
+	struct Bin {
+		Bounds box;
+		unsigned int nCount;
+	};
+
+	//! a range that is built into its own node list by one thread, then copied into the final array
+	struct Job {
+		unsigned int nBegin, nEnd, nDepth;
+		std::vector<FlatBVNode> vNodes;
+	};
+
+	//! top levels of the tree, built serially before the jobs
+	struct TopNode {
+		Bounds box;
+		int nLeft, nRight, nJob;
+	};
+
+	std::vector<BuildTri> vTris;
+	std::vector<unsigned int> vOrder;
+	std::vector<Job> vJobs;
+	std::vector<TopNode> vTop;
+	unsigned int nJobSize;
+
+	inline static int BinIndex( float fCentroid, float fMin, float fScale ) {
+		int nBin = (int)( (fCentroid - fMin) * fScale );
+		return (nBin < 0) ? 0 : (nBin >= SAH_BIN_COUNT) ? SAH_BIN_COUNT-1 : nBin;
+	}
+
+	struct InLeftBin {
+		const std::vector<BuildTri> * pTris;
+		int nAxis, nSplitBin;
+		float fMin, fScale;
+		bool operator()( unsigned int i ) const {
+			return BinIndex( (*pTris)[i].vCentroid[nAxis], fMin, fScale ) <= nSplitBin; }
+	};
+
+	void RangeBounds( unsigned int nBegin, unsigned int nEnd, Bounds & box, Bounds & centroids ) const;
+	void FillBins( unsigned int nBegin, unsigned int nEnd, const Bounds & centroids, Bin vBins[3][SAH_BIN_COUNT] ) const;
+	unsigned int Split( unsigned int nBegin, unsigned int nEnd, const Bounds & box, const Bounds & centroids );
+
+	void Build( unsigned int nBaseDepth, AlignedVector<FlatBVNode> & vNodes );
+
+	int BuildTop( unsigned int nBegin, unsigned int nEnd, unsigned int nDepth );
+	void BuildRange( unsigned int nBegin, unsigned int nEnd, unsigned int nDepth, std::vector<FlatBVNode> & vNodes );
+	void Emit( int nTopNode, AlignedVector<FlatBVNode> & vNodes ) const;
+
+	static void SetBox( FlatBVNode & node, const Bounds & box ) {
+		for ( int k = 0; k < 3; ++k ) {
+			node.vMin[k] = box.vMin[k];  node.vMax[k] = box.vMax[k]; } }
+};
+
+
+//! build tree over vTris/vOrder into vNodes (appended). nBaseDepth is depth of the root of this tree in the final tree
+void IMeshBVTree::SAHBuilder::Build( unsigned int nBaseDepth, AlignedVector<FlatBVNode> & vNodes )
+{
+	unsigned int nTris = (unsigned int)vTris.size();
+
+	// build top levels serially until there are enough subtrees to keep all threads busy
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	nJobSize = (nThreads > 1) ? std::max( nTris / (8*nThreads), (unsigned int)SAH_PARALLEL_THRESHOLD/4 ) : nTris;
+	BuildTop( 0, nTris, nBaseDepth );
+
+	int nJobs = (int)vJobs.size();
+	#pragma omp parallel for schedule(dynamic,1)
+	for ( int i = 0; i < nJobs; ++i ) {
+		Job & job = vJobs[i];
+		job.vNodes.reserve( 2 * (job.nEnd - job.nBegin) / 3 + 1 );
+		BuildRange( job.nBegin, job.nEnd, job.nDepth, job.vNodes );
+	}
+
+	// assemble depth-first node array
+	vNodes.reserve( vNodes.size() + vTop.size() + 2*nTris );
+	Emit( 0, vNodes );
+}
+
+
+void IMeshBVTree::SAHBuilder::RangeBounds( unsigned int nBegin, unsigned int nEnd, Bounds & box, Bounds & centroids ) const
+{
+	box.Empty();
+	centroids.Empty();
+#ifdef _OPENMP
+	if ( nEnd - nBegin > SAH_PARALLEL_THRESHOLD ) {
+		std::vector<Bounds> vThreadBox( omp_get_max_threads() ), vThreadCentroids( omp_get_max_threads() );
+		#pragma omp parallel
+		{
+			Bounds & tbox = vThreadBox[omp_get_thread_num()];
+			Bounds & tcentroids = vThreadCentroids[omp_get_thread_num()];
+			tbox.Empty();  tcentroids.Empty();
+			#pragma omp for
+			for ( int i = (int)nBegin; i < (int)nEnd; ++i ) {
+				const BuildTri & t = vTris[ vOrder[i] ];
+				tbox.Union( t.box );
+				tcentroids.Union( t.vCentroid, t.vCentroid );
+			}
+		}
+		for ( unsigned int k = 0; k < vThreadBox.size(); ++k ) {
+			box.Union( vThreadBox[k] );
+			centroids.Union( vThreadCentroids[k] );
+		}
+		return;
+	}
+#endif
+	for ( unsigned int i = nBegin; i < nEnd; ++i ) {
+		const BuildTri & t = vTris[ vOrder[i] ];
+		box.Union( t.box );
+		centroids.Union( t.vCentroid, t.vCentroid );
+	}
+}
+
+
+void IMeshBVTree::SAHBuilder::FillBins( unsigned int nBegin, unsigned int nEnd, const Bounds & centroids, Bin vBins[3][SAH_BIN_COUNT] ) const
+{
+	float fScale[3];
+	for ( int k = 0; k < 3; ++k ) {
+		float fExtent = centroids.vMax[k] - centroids.vMin[k];
+		fScale[k] = (fExtent > 0) ? (float)SAH_BIN_COUNT / fExtent : 0.0f;
+		for ( int b = 0; b < SAH_BIN_COUNT; ++b ) {
+			vBins[k][b].box.Empty();
+			vBins[k][b].nCount = 0;
+		}
+	}
+
+#ifdef _OPENMP
+	if ( nEnd - nBegin > SAH_PARALLEL_THRESHOLD ) {
+		int nThreads = omp_get_max_threads();
+		std::vector<Bin> vThreadBins( nThreads * 3 * SAH_BIN_COUNT );
+		#pragma omp parallel
+		{
+			Bin * pBins = & vThreadBins[ omp_get_thread_num() * 3 * SAH_BIN_COUNT ];
+			for ( int b = 0; b < 3*SAH_BIN_COUNT; ++b ) {
+				pBins[b].box.Empty();
+				pBins[b].nCount = 0;
+			}
+			#pragma omp for
+			for ( int i = (int)nBegin; i < (int)nEnd; ++i ) {
+				const BuildTri & t = vTris[ vOrder[i] ];
+				for ( int k = 0; k < 3; ++k ) {
+					Bin & bin = pBins[ k*SAH_BIN_COUNT + BinIndex(t.vCentroid[k], centroids.vMin[k], fScale[k]) ];
+					bin.box.Union( t.box );
+					bin.nCount++;
+				}
+			}
+		}
+		for ( int t = 0; t < nThreads; ++t ) {
+			for ( int k = 0; k < 3; ++k ) {
+				for ( int b = 0; b < SAH_BIN_COUNT; ++b ) {
+					const Bin & bin = vThreadBins[ (t*3 + k)*SAH_BIN_COUNT + b ];
+					vBins[k][b].box.Union( bin.box );
+					vBins[k][b].nCount += bin.nCount;
+				}
+			}
+		}
+		return;
+	}
+#endif
+
+	for ( unsigned int i = nBegin; i < nEnd; ++i ) {
+		const BuildTri & t = vTris[ vOrder[i] ];
+		for ( int k = 0; k < 3; ++k ) {
+			Bin & bin = vBins[k][ BinIndex(t.vCentroid[k], centroids.vMin[k], fScale[k]) ];
+			bin.box.Union( t.box );
+			bin.nCount++;
+		}
+	}
+}
+
+
+//! returns index of first triangle of right child, or nEnd if range should be a leaf
+unsigned int IMeshBVTree::SAHBuilder::Split( unsigned int nBegin, unsigned int nEnd, const Bounds & box, const Bounds & centroids )
+{
+	unsigned int nCount = nEnd - nBegin;
+	if ( nCount <= 1 )
+		return nEnd;
+
+	Bin vBins[3][SAH_BIN_COUNT];
+	FillBins( nBegin, nEnd, centroids, vBins );
+
+	// sweep bins to find cheapest split plane. cost is  n_left*area_left + n_right*area_right
+	float fBestCost = std::numeric_limits<float>::max();
+	int nBestAxis = -1, nBestBin = 0;
+	for ( int k = 0; k < 3; ++k ) {
+		if ( centroids.vMax[k] - centroids.vMin[k] <= 0 )
+			continue;
+		float vRightCost[SAH_BIN_COUNT];
+		Bounds accum;  accum.Empty();
+		unsigned int nAccum = 0;
+		for ( int b = SAH_BIN_COUNT-1; b > 0; --b ) {
+			accum.Union( vBins[k][b].box );
+			nAccum += vBins[k][b].nCount;
+			vRightCost[b] = (float)nAccum * accum.HalfArea();
+		}
+		accum.Empty();
+		nAccum = 0;
+		for ( int b = 0; b < SAH_BIN_COUNT-1; ++b ) {
+			accum.Union( vBins[k][b].box );
+			nAccum += vBins[k][b].nCount;
+			if ( nAccum == 0 || nAccum == nCount )
+				continue;
+			float fCost = (float)nAccum * accum.HalfArea() + vRightCost[b+1];
+			if ( fCost < fBestCost ) {
+				fBestCost = fCost;
+				nBestAxis = k;
+				nBestBin = b;
+			}
+		}
+	}
+
+	if ( nBestAxis >= 0 ) {
+		// leaf if intersecting all tris is cheaper than traversal + expected intersections in children
+		float fArea = box.HalfArea();
+		float fSplitCost = 1.0f + ( (fArea > 0) ? fBestCost / fArea : (float)nCount );
+		if ( nCount <= SAH_MAX_LEAF_TRIS && (float)nCount <= fSplitCost )
+			return nEnd;
+
+		InLeftBin pred;
+		pred.pTris = &vTris;
+		pred.nAxis = nBestAxis;
+		pred.nSplitBin = nBestBin;
+		pred.fMin = centroids.vMin[nBestAxis];
+		float fExtent = centroids.vMax[nBestAxis] - centroids.vMin[nBestAxis];
+		pred.fScale = (float)SAH_BIN_COUNT / fExtent;
+		unsigned int nMid = (unsigned int)( std::partition( vOrder.begin() + nBegin, vOrder.begin() + nEnd, pred ) - vOrder.begin() );
+		if ( nMid > nBegin && nMid < nEnd )
+			return nMid;
+	}
+
+	// all centroids coincident (or binning failed) - split in middle if there are too many tris for a leaf
+	if ( nCount <= SAH_MAX_LEAF_TRIS )
+		return nEnd;
+	return nBegin + nCount/2;
+}
+
+
+void IMeshBVTree::SAHBuilder::BuildRange( unsigned int nBegin, unsigned int nEnd, unsigned int nDepth, std::vector<FlatBVNode> & vNodes )
+{
+	Bounds box, centroids;
+	RangeBounds( nBegin, nEnd, box, centroids );
+
+	unsigned int nNode = (unsigned int)vNodes.size();
+	vNodes.resize( nNode+1 );
+	SetBox( vNodes[nNode], box );
+
+	unsigned int nMid = ( nDepth < SAH_MAX_DEPTH ) ? Split( nBegin, nEnd, box, centroids ) : nEnd;
+	if ( nMid == nEnd ) {
+		vNodes[nNode].nIndex = nBegin;
+		vNodes[nNode].nCount = nEnd - nBegin;
+		return;
+	}
+
+	vNodes[nNode].nCount = 0;
+	BuildRange( nBegin, nMid, nDepth+1, vNodes );
+	vNodes[nNode].nIndex = (unsigned int)vNodes.size();
+	BuildRange( nMid, nEnd, nDepth+1, vNodes );
+}
+
+
+int IMeshBVTree::SAHBuilder::BuildTop( unsigned int nBegin, unsigned int nEnd, unsigned int nDepth )
+{
+	int nNode = (int)vTop.size();
+	vTop.resize( nNode+1 );
+
+	if ( nEnd - nBegin <= nJobSize || nDepth >= SAH_MAX_DEPTH/2 ) {
+		Job job;
+		job.nBegin = nBegin;  job.nEnd = nEnd;  job.nDepth = nDepth;
+		vJobs.push_back(job);
+		vTop[nNode].nJob = (int)vJobs.size()-1;
+		vTop[nNode].nLeft = vTop[nNode].nRight = -1;
+		return nNode;
+	}
+
+	Bounds centroids;
+	RangeBounds( nBegin, nEnd, vTop[nNode].box, centroids );
+	vTop[nNode].nJob = -1;
+	unsigned int nMid = Split( nBegin, nEnd, vTop[nNode].box, centroids );
+	lgASSERT( nMid != nEnd );		// ranges larger than nJobSize are never leaves
+	int nLeft = BuildTop( nBegin, nMid, nDepth+1 );
+	int nRight = BuildTop( nMid, nEnd, nDepth+1 );
+	vTop[nNode].nLeft = nLeft;
+	vTop[nNode].nRight = nRight;
+	return nNode;
+}
+
+
+void IMeshBVTree::SAHBuilder::Emit( int nTopNode, AlignedVector<FlatBVNode> & vNodes ) const
+{
+	const TopNode & top = vTop[nTopNode];
+	if ( top.nJob >= 0 ) {
+		const std::vector<FlatBVNode> & vJobNodes = vJobs[top.nJob].vNodes;
+		unsigned int nOffset = (unsigned int)vNodes.size();
+		for ( unsigned int k = 0; k < vJobNodes.size(); ++k ) {
+			vNodes.push_back( vJobNodes[k] );
+			if ( ! vJobNodes[k].IsLeaf() )
+				vNodes[nOffset+k].nIndex += nOffset;
+		}
+		return;
+	}
+
+	unsigned int nNode = (unsigned int)vNodes.size();
+	FlatBVNode node;
+	SetBox( node, top.box );
+	node.nCount = 0;
+	vNodes.push_back(node);
+	Emit( top.nLeft, vNodes );
+	vNodes[nNode].nIndex = (unsigned int)vNodes.size();
+	Emit( top.nRight, vNodes );
+}
+
+
+
+// flat tree is built by the first query that needs it. Several threads can make that first query, so
+// the build is done under a lock, and the flushes make sure that a thread that sees m_bFlatBuilt set
+// also sees the finished tree.
+void IMeshBVTree::EnsureFlatBuilt()
+{
+	#pragma omp flush
+	if ( m_bFlatBuilt )
+		return;
+	#pragma omp critical(IMeshBVTree_BuildFlat)
+	{
+		if ( ! m_bFlatBuilt )
+			BuildFlat();
+	}
+	#pragma omp flush
+}
+
+
+void IMeshBVTree::BuildFlat()
+{
+	m_vFlatNodes.clear();
+	m_vFlatTris.resize(0);
+	m_vFlatTriVerts.resize(0);
+	m_vBuildTriIDs.resize(0);
+	m_vFlatBuildArea.resize(0);
+	m_bFlatBuilt = false;
+	if ( m_pMesh )
+		BuildFlatNodes();
+	#pragma omp flush
+	m_bFlatBuilt = true;
+}
+
+void IMeshBVTree::BuildFlatNodes()
+{
+	// collect triangles and vertex positions
+	std::vector<IMesh::TriangleID> vTriIDs;
+	vTriIDs.reserve( m_pMesh->GetTriangleCount() );
+	m_pMesh->ForEachTriangleBlock( IMeshAppendIDsFunc(vTriIDs) );
+	unsigned int nTris = (unsigned int)vTriIDs.size();
+	if ( nTris == 0 )
+		return;
+
+	std::vector<IMesh::VertexID> vTriVerts( 3*nTris );
+	m_pMesh->GatherTriangles( &vTriIDs[0], nTris, &vTriVerts[0] );
+
+	std::vector<float> vPositions( 3*m_pMesh->GetMaxVertexID() );
+	if ( ! vPositions.empty() )
+		m_pMesh->ForEachVertexBlock( IMeshGatherByIDFunc( m_pMesh, &vPositions[0] ) );
+
+	// per-triangle boxes and centroids
+	SAHBuilder builder;
+	builder.vTris.resize( nTris );
+	builder.vOrder.resize( nTris );
+	#pragma omp parallel for
+	for ( int i = 0; i < (int)nTris; ++i ) {
+		SAHBuilder::BuildTri & t = builder.vTris[i];
+		t.box.Empty();
+		for ( int j = 0; j < 3; ++j ) {
+			const float * pV = &vPositions[ 3*vTriVerts[3*i+j] ];
+			t.box.Union( pV, pV );
+		}
+		for ( int k = 0; k < 3; ++k )
+			t.vCentroid[k] = 0.5f * (t.box.vMin[k] + t.box.vMax[k]);
+		builder.vOrder[i] = i;
+	}
+
+	builder.Build( 0, m_vFlatNodes );
+
+	m_vFlatTris.resize( nTris );
+	m_vFlatTriVerts.resize( 3*nTris );
+	#pragma omp parallel for
+	for ( int i = 0; i < (int)nTris; ++i ) {
+		unsigned int nTri = builder.vOrder[i];
+		m_vFlatTris[i] = vTriIDs[nTri];
+		for ( int j = 0; j < 3; ++j )
+			m_vFlatTriVerts[3*i+j] = Wml::Vector3f( &vPositions[ 3*vTriVerts[3*nTri+j] ] );
+	}
+
+	m_vFlatBuildArea.resize( m_vFlatNodes.size() );
+	SetFlatBuildAreas( 0, (unsigned int)m_vFlatNodes.size() );
+	m_vBuildTriIDs.swap( vTriIDs );
+}
+
+
+/*
+ * Refit
+ */
+
+// IMesh::ForEachTriangleBlock functor that checks the mesh triangle IDs against a stored ID list
+struct SameTriangleIDsFunc {
+	const std::vector<IMesh::TriangleID> * pIDs;
+	size_t nNext;
+	bool bSame;
+	SameTriangleIDsFunc( const std::vector<IMesh::TriangleID> & vIDs ) : pIDs(&vIDs), nNext(0), bSame(true) {}
+	inline void operator()( const IMesh::TriangleID * pBlock, unsigned int nCount ) {
+		if ( ! bSame )
+			return;
+		if ( nNext + nCount > pIDs->size() || memcmp( pBlock, &(*pIDs)[nNext], nCount * sizeof(IMesh::TriangleID) ) != 0 )
+			bSame = false;
+		nNext += nCount;
+	}
+};
+
+bool IMeshBVTree::TrianglesChanged() const
+{
+	if ( m_pMesh->GetTriangleCount() != m_vBuildTriIDs.size() )
+		return true;
+	SameTriangleIDsFunc f = m_pMesh->ForEachTriangleBlock( SameTriangleIDsFunc(m_vBuildTriIDs) );
+	return ! f.bSame || f.nNext != m_vBuildTriIDs.size();
+}
+
+void IMeshBVTree::Refit()
+{
+	if ( ! m_pMesh )
+		return;
+
+	if ( m_eBuildMode == LazyBuild ) {
+		if ( m_pRoot == NULL )
+			return;
+		if ( TrianglesChanged() )
+			Clear();		// will be re-initialized by next query
+		else
+			RefitLazy( m_pRoot );
+		return;
+	}
+
+	if ( ! m_bFlatBuilt )
+		return;		// will be built by next query
+	unsigned int nTris = (unsigned int)m_vFlatTris.size();
+	if ( TrianglesChanged() ) {
+		BuildFlat();
+		return;
+	}
+
+	// refresh cached triangle vertices, then leaf boxes
+	UpdateFlatTriangles( 0, nTris );
+	int nNodes = (int)m_vFlatNodes.size();
+	#pragma omp parallel for schedule(dynamic,1024)
+	for ( int i = 0; i < nNodes; ++i ) {
+		FlatBVNode & node = m_vFlatNodes[i];
+		if ( ! node.IsLeaf() )
+			continue;
+		const Wml::Vector3f * pVerts = &m_vFlatTriVerts[ 3*node.nIndex ];
+		for ( int k = 0; k < 3; ++k )
+			node.vMin[k] = node.vMax[k] = pVerts[0][k];
+		for ( unsigned int j = 1; j < 3*node.nCount; ++j ) {
+			for ( int k = 0; k < 3; ++k ) {
+				if ( pVerts[j][k] < node.vMin[k] )  node.vMin[k] = pVerts[j][k];
+				if ( pVerts[j][k] > node.vMax[k] )  node.vMax[k] = pVerts[j][k];
+			}
+		}
+	}
+
+	// children always come after their parent, so a reverse sweep updates internal nodes bottom-up
+	for ( int i = nNodes-1; i >= 0; --i ) {
+		FlatBVNode & node = m_vFlatNodes[i];
+		if ( node.IsLeaf() )
+			continue;
+		const FlatBVNode & left = m_vFlatNodes[i+1];
+		const FlatBVNode & right = m_vFlatNodes[node.nIndex];
+		for ( int k = 0; k < 3; ++k ) {
+			node.vMin[k] = std::min( left.vMin[k], right.vMin[k] );
+			node.vMax[k] = std::max( left.vMax[k], right.vMax[k] );
+		}
+	}
+
+	if ( m_fRefitRebuildThreshold > 0 )
+		RebuildDegradedFlat();
+}
+
+
+void IMeshBVTree::RefitLazy( IMeshBVTree::IMeshBVNode * pNode )
+{
+	// leaves and unexpanded nodes compute box directly from their triangles
+	if ( pNode->pLeft == NULL ) {
+		ComputeBox( pNode );
+		return;
+	}
+
+	RefitLazy( pNode->pLeft );
+	RefitLazy( pNode->pRight );
+	pNode->Box = pNode->pLeft->Box;
+	for ( int k = 0; k < 3; ++k ) {
+		pNode->Box.Min[k] = std::min( pNode->Box.Min[k], pNode->pRight->Box.Min[k] );
+		pNode->Box.Max[k] = std::max( pNode->Box.Max[k], pNode->pRight->Box.Max[k] );
+	}
+}
+
+
+float IMeshBVTree::HalfArea( const FlatBVNode & node )
+{
+	float dx = node.vMax[0]-node.vMin[0], dy = node.vMax[1]-node.vMin[1], dz = node.vMax[2]-node.vMin[2];
+	return (dx < 0) ? 0.0f : dx*dy + dy*dz + dz*dx;
+}
+
+void IMeshBVTree::SetFlatBuildAreas( unsigned int nBegin, unsigned int nEnd )
+{
+	float fRootArea = HalfArea( m_vFlatNodes[0] );
+	float fScale = (fRootArea > 0) ? 1.0f / fRootArea : 0.0f;
+	for ( unsigned int i = nBegin; i < nEnd; ++i )
+		m_vFlatBuildArea[i] = HalfArea( m_vFlatNodes[i] ) * fScale;
+}
+
+
+void IMeshBVTree::UpdateFlatTriangles( unsigned int nBegin, unsigned int nEnd )
+{
+	int nBlocks = (int)( (nEnd - nBegin + IMESH_ID_BLOCK_SIZE-1) / IMESH_ID_BLOCK_SIZE );
+	#pragma omp parallel for schedule(dynamic,16)
+	for ( int b = 0; b < nBlocks; ++b ) {
+		unsigned int nFirst = nBegin + b*IMESH_ID_BLOCK_SIZE;
+		unsigned int nCount = std::min( nEnd - nFirst, (unsigned int)IMESH_ID_BLOCK_SIZE );
+		IMesh::VertexID vTriVerts[3*IMESH_ID_BLOCK_SIZE];
+		m_pMesh->GatherTriangles( &m_vFlatTris[nFirst], nCount, vTriVerts );
+		m_pMesh->GatherVertices( vTriVerts, 3*nCount, (float *)&m_vFlatTriVerts[3*nFirst] );
+	}
+}
+
+
+unsigned int IMeshBVTree::FlatSubtreeEnd( unsigned int nNode ) const
+{
+	while ( ! m_vFlatNodes[nNode].IsLeaf() )
+		nNode = m_vFlatNodes[nNode].nIndex;
+	return nNode + 1;
+}
+
+
+//! a subtree selected for rebuild by RebuildDegradedFlat()
+struct IMeshBVTree::FlatRebuildRange {
+	unsigned int nNode, nNodeEnd;		// node range [nNode,nNodeEnd) in current tree
+	unsigned int nFirst, nLast;			// triangle entry range
+	unsigned int nDepth;
+	AlignedVector<FlatBVNode> vNewNodes;
+	bool operator<( const FlatRebuildRange & r ) const { return nNode < r.nNode; }
+};
+
+
+void IMeshBVTree::RebuildDegradedFlat()
+{
+	unsigned int nTris = (unsigned int)m_vFlatTris.size();
+	float fRootArea = HalfArea( m_vFlatNodes[0] );
+	if ( fRootArea <= 0 )
+		return;
+
+	// find largest subtrees whose relative area has grown past the threshold. 
+	// Build area is clamped so that (nearly) degenerate boxes do not always trigger rebuilds.
+	float fMinRatio = 0.1f / (float)nTris;
+	std::vector<FlatRebuildRange> vRanges;
+	unsigned int nRebuildTris = 0;
+	unsigned int vStack[SAH_MAX_DEPTH+2], vDepth[SAH_MAX_DEPTH+2];
+	int nStack = 0;
+	vStack[nStack] = 0;  vDepth[nStack++] = 0;
+	while ( nStack > 0 ) {
+		--nStack;
+		unsigned int nNode = vStack[nStack], nDepth = vDepth[nStack];
+		const FlatBVNode & node = m_vFlatNodes[nNode];
+		if ( node.IsLeaf() )
+			continue;
+
+		float fBuildArea = std::max( m_vFlatBuildArea[nNode], fMinRatio );
+		if ( HalfArea(node) > m_fRefitRebuildThreshold * fBuildArea * fRootArea ) {
+			FlatRebuildRange range;
+			range.nNode = nNode;
+			range.nNodeEnd = FlatSubtreeEnd(nNode);
+			unsigned int nLeft = nNode;
+			while ( ! m_vFlatNodes[nLeft].IsLeaf() )
+				++nLeft;
+			range.nFirst = m_vFlatNodes[nLeft].nIndex;
+			const FlatBVNode & right = m_vFlatNodes[range.nNodeEnd-1];
+			range.nLast = right.nIndex + right.nCount;
+			range.nDepth = nDepth;
+			nRebuildTris += range.nLast - range.nFirst;
+			vRanges.push_back(range);
+			continue;
+		}
+
+		vStack[nStack] = node.nIndex;  vDepth[nStack++] = nDepth+1;
+		vStack[nStack] = nNode+1;      vDepth[nStack++] = nDepth+1;
+	}
+	if ( vRanges.empty() )
+		return;
+	if ( 2*nRebuildTris > nTris ) {
+		BuildFlat();
+		return;
+	}
+	std::sort( vRanges.begin(), vRanges.end() );
+
+	// rebuild subtrees from cached triangle vertices. Ranges are disjoint, so each one
+	// can permute its own part of the triangle arrays.
+	int nRanges = (int)vRanges.size();
+	#pragma omp parallel for schedule(dynamic,1)
+	for ( int r = 0; r < nRanges; ++r ) {
+		FlatRebuildRange & range = vRanges[r];
+		unsigned int nCount = range.nLast - range.nFirst;
+
+		SAHBuilder builder;
+		builder.vTris.resize( nCount );
+		builder.vOrder.resize( nCount );
+		for ( unsigned int i = 0; i < nCount; ++i ) {
+			SAHBuilder::BuildTri & t = builder.vTris[i];
+			t.box.Empty();
+			for ( int j = 0; j < 3; ++j ) {
+				const float * pV = m_vFlatTriVerts[ 3*(range.nFirst+i) + j ];
+				t.box.Union( pV, pV );
+			}
+			for ( int k = 0; k < 3; ++k )
+				t.vCentroid[k] = 0.5f * (t.box.vMin[k] + t.box.vMax[k]);
+			builder.vOrder[i] = i;
+		}
+		builder.Build( range.nDepth, range.vNewNodes );
+
+		std::vector<IMesh::TriangleID> vOldTris( m_vFlatTris.begin() + range.nFirst, m_vFlatTris.begin() + range.nLast );
+		std::vector<Wml::Vector3f> vOldVerts( m_vFlatTriVerts.begin() + 3*range.nFirst, m_vFlatTriVerts.begin() + 3*range.nLast );
+		for ( unsigned int i = 0; i < nCount; ++i ) {
+			unsigned int nOld = builder.vOrder[i];
+			m_vFlatTris[range.nFirst+i] = vOldTris[nOld];
+			for ( int j = 0; j < 3; ++j )
+				m_vFlatTriVerts[ 3*(range.nFirst+i) + j ] = vOldVerts[3*nOld+j];
+		}
+	}
+
+	// splice new subtrees into node array. Old node index n moves by the size change of
+	// all rebuilt subtrees that end at or before n.
+	std::vector<unsigned int> vRangeEnds( nRanges );
+	std::vector<int> vShift( nRanges+1, 0 );
+	for ( int r = 0; r < nRanges; ++r ) {
+		vRangeEnds[r] = vRanges[r].nNodeEnd;
+		vShift[r+1] = vShift[r] + (int)vRanges[r].vNewNodes.size() - (int)(vRanges[r].nNodeEnd - vRanges[r].nNode);
+	}
+	unsigned int nOldNodes = (unsigned int)m_vFlatNodes.size();
+	AlignedVector<FlatBVNode> vNodes;
+	vNodes.reserve( nOldNodes + vShift[nRanges] );
+	std::vector<float> vBuildArea;
+	vBuildArea.reserve( nOldNodes + vShift[nRanges] );
+
+	unsigned int nOld = 0;
+	for ( int r = 0; r <= nRanges; ++r ) {
+		unsigned int nCopyEnd = (r < nRanges) ? vRanges[r].nNode : nOldNodes;
+		for ( ; nOld < nCopyEnd; ++nOld ) {
+			FlatBVNode node = m_vFlatNodes[nOld];
+			if ( ! node.IsLeaf() ) {
+				int nBefore = (int)( std::upper_bound( vRangeEnds.begin(), vRangeEnds.end(), node.nIndex ) - vRangeEnds.begin() );
+				node.nIndex += vShift[nBefore];
+			}
+			vNodes.push_back( node );
+			vBuildArea.push_back( m_vFlatBuildArea[nOld] );
+		}
+		if ( r == nRanges )
+			break;
+
+		const FlatRebuildRange & range = vRanges[r];
+		unsigned int nBase = (unsigned int)vNodes.size();
+		for ( unsigned int k = 0; k < range.vNewNodes.size(); ++k ) {
+			FlatBVNode node = range.vNewNodes[k];
+			node.nIndex += ( node.IsLeaf() ) ? range.nFirst : nBase;
+			vNodes.push_back( node );
+			vBuildArea.push_back( HalfArea(node) / fRootArea );
+		}
+		nOld = range.nNodeEnd;
+	}
+
+	m_vFlatNodes.swap( vNodes );
+	m_vFlatBuildArea.swap( vBuildArea );
+}
+
+
+
+/*
+ * FlatSAHBuild queries. These only read the tree and use a local traversal stack, so they are thread-safe.
+ */
+
+bool IMeshBVTree::TestIntersection( const FlatBVNode & node, const Ray & r, float fMaxT, float & fNear )
+{
+	const float * vBounds[2] = { node.vMin, node.vMax };
+	float tmin = 0.0f, tmax = fMaxT;
+	for ( int k = 0; k < 3; ++k ) {
+		float t0 = (vBounds[r.sign[k]][k] - r.origin[k]) * r.inv_direction[k];
+		float t1 = (vBounds[1-r.sign[k]][k] - r.origin[k]) * r.inv_direction[k];
+		if ( t0 > tmin ) tmin = t0;
+		if ( t1 < tmax ) tmax = t1;
+	}
+	fNear = tmin;
+	return tmin <= tmax * SAH_RAY_TFAR_SCALE;
+}
+
+
+float IMeshBVTree::MinDistanceSqr( const FlatBVNode & node, const Wml::Vector3f & vPoint )
+{
+	float fDistSqr = 0.0f;
+	for ( int k = 0; k < 3; ++k ) {
+		float d = 0.0f;
+		if ( vPoint[k] < node.vMin[k] )
+			d = node.vMin[k] - vPoint[k];
+		else if ( vPoint[k] > node.vMax[k] )
+			d = vPoint[k] - node.vMax[k];
+		fDistSqr += d*d;
+	}
+	return fDistSqr;
+}
+
+
+bool IMeshBVTree::FindRayIntersectionFlat( const Ray & ray, Wml::Vector3f & vHit, IMesh::TriangleID & nHitTri ) const
+{
+	if ( m_vFlatNodes.empty() )
+		return false;
+
+	float fNearestT = std::numeric_limits<float>::max();
+	unsigned int nHitIndex = IMesh::InvalidID;
+	Wml::Triangle3f tri;
+
+	unsigned int vStack[SAH_MAX_DEPTH+2];
+	int nStack = 0;
+	float fNear;
+	if ( TestIntersection( m_vFlatNodes[0], ray, fNearestT, fNear ) )
+		vStack[nStack++] = 0;
+
+	while ( nStack > 0 ) {
+		const FlatBVNode & node = m_vFlatNodes[ vStack[--nStack] ];
+
+		if ( node.IsLeaf() ) {
+			for ( unsigned int i = node.nIndex; i < node.nIndex + node.nCount; ++i ) {
+				tri.V[0] = m_vFlatTriVerts[3*i];  tri.V[1] = m_vFlatTriVerts[3*i+1];  tri.V[2] = m_vFlatTriVerts[3*i+2];
+				Wml::IntrRay3Triangle3f intr( ray.wmlRay, tri );
+				if ( intr.Find() && intr.GetRayT() < fNearestT ) {
+					fNearestT = intr.GetRayT();
+					nHitIndex = i;
+				}
+			}
+			continue;
+		}
+
+		// push far child first so near child is tested first
+		unsigned int nLeft = (unsigned int)(&node - &m_vFlatNodes[0]) + 1;
+		unsigned int nRight = node.nIndex;
+		float fNearLeft, fNearRight;
+		bool bLeft = TestIntersection( m_vFlatNodes[nLeft], ray, fNearestT, fNearLeft );
+		bool bRight = TestIntersection( m_vFlatNodes[nRight], ray, fNearestT, fNearRight );
+		if ( bLeft && bRight ) {
+			if ( fNearLeft < fNearRight ) {
+				vStack[nStack++] = nRight;  vStack[nStack++] = nLeft;
+			} else {
+				vStack[nStack++] = nLeft;  vStack[nStack++] = nRight;
+			}
+		} else if ( bLeft )
+			vStack[nStack++] = nLeft;
+		else if ( bRight )
+			vStack[nStack++] = nRight;
+	}
+
+	if ( nHitIndex == IMesh::InvalidID )
+		return false;
+	vHit = ray.origin + fNearestT * ray.direction;
+	nHitTri = m_vFlatTris[nHitIndex];
+	return true;
+}
+
+
+bool IMeshBVTree::FindNearestFlat( const Wml::Vector3f & vPoint, Wml::Vector3f & vNearest, IMesh::TriangleID & nNearestTri, float & fNearest ) const
+{
+	fNearest = std::numeric_limits<float>::max();
+	if ( m_vFlatNodes.empty() )
+		return false;
+
+	float fNearestSqr = std::numeric_limits<float>::max();
+	Wml::Triangle3f tri;
+
+	unsigned int vStack[SAH_MAX_DEPTH+2];
+	int nStack = 0;
+	vStack[nStack++] = 0;
+
+	while ( nStack > 0 ) {
+		const FlatBVNode & node = m_vFlatNodes[ vStack[--nStack] ];
+		if ( MinDistanceSqr( node, vPoint ) >= fNearestSqr )
+			continue;
+
+		if ( node.IsLeaf() ) {
+			for ( unsigned int i = node.nIndex; i < node.nIndex + node.nCount; ++i ) {
+				tri.V[0] = m_vFlatTriVerts[3*i];  tri.V[1] = m_vFlatTriVerts[3*i+1];  tri.V[2] = m_vFlatTriVerts[3*i+2];
+				Wml::DistVector3Triangle3f dist( vPoint, tri );
+				float fDistSqr = dist.GetSquared();
+				if ( fDistSqr < fNearestSqr ) {
+					fNearestSqr = fDistSqr;
+					vNearest = Wml::Vector3f::ZERO;
+					for ( int j = 0 ; j < 3; ++j ) 
+						vNearest += tri.V[j] * dist.GetTriangleBary(j);
+					nNearestTri = m_vFlatTris[i];
+				}
+			}
+			continue;
+		}
+
+		unsigned int nLeft = (unsigned int)(&node - &m_vFlatNodes[0]) + 1;
+		unsigned int nRight = node.nIndex;
+		float fLeft = MinDistanceSqr( m_vFlatNodes[nLeft], vPoint );
+		float fRight = MinDistanceSqr( m_vFlatNodes[nRight], vPoint );
+		if ( fLeft < fRight ) {
+			if ( fRight < fNearestSqr ) vStack[nStack++] = nRight;
+			if ( fLeft < fNearestSqr ) vStack[nStack++] = nLeft;
+		} else {
+			if ( fLeft < fNearestSqr ) vStack[nStack++] = nLeft;
+			if ( fRight < fNearestSqr ) vStack[nStack++] = nRight;
+		}
+	}
+
+	fNearest = (float)sqrt(fNearestSqr);
+	return true;
+}
+
+
+
+
+/*
+ * Batch queries
+ */
+
+#define BV_PACKET_SIZE 4
+
+// spread low 10 bits of n so there are two zero bits between each
+static inline unsigned int MortonExpandBits( unsigned int n )
+{
+	n &= 0x3FF;
+	n = (n | (n << 16)) & 0x030000FF;
+	n = (n | (n <<  8)) & 0x0300F00F;
+	n = (n | (n <<  4)) & 0x030C30C3;
+	n = (n | (n <<  2)) & 0x09249249;
+	return n;
+}
+
+struct BVMortonKey {
+	unsigned int nCode;
+	unsigned int nIndex;
+	bool operator<( const BVMortonKey & k ) const { return nCode < k.nCode; }
+};
+
+void IMeshBVTree::MortonOrder( const Wml::Vector3f * pPoints, unsigned int nCount, std::vector<unsigned int> & vOrder ) const
+{
+	const FlatBVNode & root = m_vFlatNodes[0];
+	float fScale[3];
+	for ( int k = 0; k < 3; ++k ) {
+		float fExtent = root.vMax[k] - root.vMin[k];
+		fScale[k] = (fExtent > 0) ? 1023.0f / fExtent : 0.0f;
+	}
+
+	std::vector<BVMortonKey> vKeys( nCount );
+	#pragma omp parallel for
+	for ( int i = 0; i < (int)nCount; ++i ) {
+		unsigned int nCell[3];
+		for ( int k = 0; k < 3; ++k ) {
+			float f = (pPoints[i][k] - root.vMin[k]) * fScale[k];		// points outside bounds are clamped
+			nCell[k] = (f <= 0) ? 0 : (f >= 1023.0f) ? 1023 : (unsigned int)f;
+		}
+		vKeys[i].nCode = (MortonExpandBits(nCell[0]) << 2) | (MortonExpandBits(nCell[1]) << 1) | MortonExpandBits(nCell[2]);
+		vKeys[i].nIndex = i;
+	}
+	std::sort( vKeys.begin(), vKeys.end() );
+
+	vOrder.resize( nCount );
+	for ( unsigned int i = 0; i < nCount; ++i )
+		vOrder[i] = vKeys[i].nIndex;
+}
+
+
+// bit i set if squared distance from point i to box is less than pBestSqr[i]
+static inline int NearestBoxMask( const float * vMin, const float * vMax, 
+								  const float * px, const float * py, const float * pz, const float * pBestSqr )
+{
+#ifdef RMS_BVTREE_USE_SSE
+	__m128 zero = _mm_setzero_ps();
+	__m128 p = _mm_loadu_ps(px);
+	__m128 d = _mm_max_ps( _mm_max_ps( _mm_sub_ps(_mm_set1_ps(vMin[0]), p), _mm_sub_ps(p, _mm_set1_ps(vMax[0])) ), zero );
+	__m128 dsqr = _mm_mul_ps(d, d);
+	p = _mm_loadu_ps(py);
+	d = _mm_max_ps( _mm_max_ps( _mm_sub_ps(_mm_set1_ps(vMin[1]), p), _mm_sub_ps(p, _mm_set1_ps(vMax[1])) ), zero );
+	dsqr = _mm_add_ps( dsqr, _mm_mul_ps(d, d) );
+	p = _mm_loadu_ps(pz);
+	d = _mm_max_ps( _mm_max_ps( _mm_sub_ps(_mm_set1_ps(vMin[2]), p), _mm_sub_ps(p, _mm_set1_ps(vMax[2])) ), zero );
+	dsqr = _mm_add_ps( dsqr, _mm_mul_ps(d, d) );
+	return _mm_movemask_ps( _mm_cmplt_ps( dsqr, _mm_loadu_ps(pBestSqr) ) );
+#else
+	int nMask = 0;
+	for ( int i = 0; i < BV_PACKET_SIZE; ++i ) {
+		float p[3] = { px[i], py[i], pz[i] };
+		float fDistSqr = 0;
+		for ( int k = 0; k < 3; ++k ) {
+			float d = std::max( std::max( vMin[k] - p[k], p[k] - vMax[k] ), 0.0f );
+			fDistSqr += d*d;
+		}
+		if ( fDistSqr < pBestSqr[i] )
+			nMask |= (1 << i);
+	}
+	return nMask;
+#endif
+}
+
+
+struct BVRayPacket {
+	float ox[BV_PACKET_SIZE], oy[BV_PACKET_SIZE], oz[BV_PACKET_SIZE];
+	float ix[BV_PACKET_SIZE], iy[BV_PACKET_SIZE], iz[BV_PACKET_SIZE];
+	float tmax[BV_PACKET_SIZE];		// current nearest hit. -1 for unused lanes
+};
+
+// Same semantics as SSE minps/maxps - if either argument is NaN, the second one is returned.
+// Slab distances are computed against the near/far bound for the ray direction sign, so the only 
+// NaN (0*inf, for a ray parallel to a slab starting exactly on its boundary) is in the first argument and is ignored.
+static inline float SlabMin( float a, float b ) { return (a < b) ? a : b; }
+static inline float SlabMax( float a, float b ) { return (a > b) ? a : b; }
+
+#ifdef RMS_BVTREE_USE_SSE
+static inline void RaySlabSSE( float fMin, float fMax, const float * po, const float * pinv, __m128 & tnear, __m128 & tfar )
+{
+	__m128 o = _mm_loadu_ps(po), inv = _mm_loadu_ps(pinv);
+	__m128 neg = _mm_cmplt_ps( inv, _mm_setzero_ps() );
+	__m128 bmin = _mm_set1_ps(fMin), bmax = _mm_set1_ps(fMax);
+	__m128 bnear = _mm_or_ps( _mm_and_ps(neg, bmax), _mm_andnot_ps(neg, bmin) );
+	__m128 bfar = _mm_or_ps( _mm_and_ps(neg, bmin), _mm_andnot_ps(neg, bmax) );
+	tnear = _mm_max_ps( _mm_mul_ps( _mm_sub_ps(bnear, o), inv ), tnear );
+	tfar = _mm_min_ps( _mm_mul_ps( _mm_sub_ps(bfar, o), inv ), tfar );
+}
+#endif
+
+// bit i set if ray i hits box in [0,tmax[i]]
+static inline int RayBoxMask( const float * vMin, const float * vMax, const BVRayPacket & r )
+{
+#ifdef RMS_BVTREE_USE_SSE
+	__m128 tnear = _mm_setzero_ps();
+	__m128 tfar = _mm_loadu_ps(r.tmax);
+	RaySlabSSE( vMin[0], vMax[0], r.ox, r.ix, tnear, tfar );
+	RaySlabSSE( vMin[1], vMax[1], r.oy, r.iy, tnear, tfar );
+	RaySlabSSE( vMin[2], vMax[2], r.oz, r.iz, tnear, tfar );
+	return _mm_movemask_ps( _mm_cmple_ps( tnear, _mm_mul_ps( tfar, _mm_set1_ps(SAH_RAY_TFAR_SCALE) ) ) );
+#else
+	int nMask = 0;
+	for ( int i = 0; i < BV_PACKET_SIZE; ++i ) {
+		float o[3] = { r.ox[i], r.oy[i], r.oz[i] };
+		float inv[3] = { r.ix[i], r.iy[i], r.iz[i] };
+		float tnear = 0.0f, tfar = r.tmax[i];
+		for ( int k = 0; k < 3; ++k ) {
+			bool bNeg = ( inv[k] < 0 );
+			tnear = SlabMax( ( (bNeg ? vMax[k] : vMin[k]) - o[k] ) * inv[k], tnear );
+			tfar = SlabMin( ( (bNeg ? vMin[k] : vMax[k]) - o[k] ) * inv[k], tfar );
+		}
+		if ( tnear <= tfar * SAH_RAY_TFAR_SCALE )
+			nMask |= (1 << i);
+	}
+	return nMask;
+#endif
+}
+
+// entry parameter of ray i into box (only used to order children)
+static inline float RayBoxNear( const float * vMin, const float * vMax, const BVRayPacket & r, int i )
+{
+	float o[3] = { r.ox[i], r.oy[i], r.oz[i] };
+	float inv[3] = { r.ix[i], r.iy[i], r.iz[i] };
+	float tnear = 0.0f;
+	for ( int k = 0; k < 3; ++k )
+		tnear = SlabMax( ( ((inv[k] < 0) ? vMax[k] : vMin[k]) - o[k] ) * inv[k], tnear );
+	return tnear;
+}
+
+
+
+void IMeshBVTree::FindNearest( const Wml::Vector3f * pPoints, unsigned int nCount, 
+							   Wml::Vector3f * pNearest, IMesh::TriangleID * pNearestTri, float * pDistances )
+{
+	if ( m_eBuildMode != FlatSAHBuild ) {
+		for ( unsigned int i = 0; i < nCount; ++i ) {
+			pNearestTri[i] = IMesh::InvalidID;
+			FindNearest( pPoints[i], pNearest[i], pNearestTri[i], (pDistances) ? &pDistances[i] : NULL );
+		}
+		return;
+	}
+
+	EnsureFlatBuilt();
+	if ( m_vFlatNodes.empty() ) {
+		for ( unsigned int i = 0; i < nCount; ++i ) {
+			pNearestTri[i] = IMesh::InvalidID;
+			if ( pDistances )
+				pDistances[i] = std::numeric_limits<float>::max();
+		}
+		return;
+	}
+
+	std::vector<unsigned int> vOrder;
+	MortonOrder( pPoints, nCount, vOrder );
+
+	int nPackets = (int)( (nCount + BV_PACKET_SIZE-1) / BV_PACKET_SIZE );
+	#pragma omp parallel for schedule(dynamic, 16)
+	for ( int i = 0; i < nPackets; ++i ) {
+		unsigned int nFirst = i * BV_PACKET_SIZE;
+		int nPacket = (int)std::min( (unsigned int)BV_PACKET_SIZE, nCount - nFirst );
+		FindNearestPacket( pPoints, &vOrder[nFirst], nPacket, pNearest, pNearestTri, pDistances );
+	}
+}
+
+
+void IMeshBVTree::FindNearestPacket( const Wml::Vector3f * pPoints, const unsigned int * pIndices, int nPacket, 
+									 Wml::Vector3f * pNearest, IMesh::TriangleID * pNearestTri, float * pDistances ) const
+{
+	float px[BV_PACKET_SIZE], py[BV_PACKET_SIZE], pz[BV_PACKET_SIZE], vBestSqr[BV_PACKET_SIZE];
+	for ( int j = 0; j < BV_PACKET_SIZE; ++j ) {
+		const Wml::Vector3f & v = pPoints[ pIndices[ (j < nPacket) ? j : 0 ] ];
+		px[j] = v.X();  py[j] = v.Y();  pz[j] = v.Z();
+		vBestSqr[j] = (j < nPacket) ? std::numeric_limits<float>::max() : -1.0f;
+	}
+
+	Wml::Triangle3f tri;
+	unsigned int vStack[SAH_MAX_DEPTH+2];
+	int nStack = 0;
+	vStack[nStack++] = 0;
+
+	while ( nStack > 0 ) {
+		const FlatBVNode & node = m_vFlatNodes[ vStack[--nStack] ];
+		int nMask = NearestBoxMask( node.vMin, node.vMax, px, py, pz, vBestSqr );
+		if ( nMask == 0 )
+			continue;
+
+		if ( node.IsLeaf() ) {
+			for ( int j = 0; j < nPacket; ++j ) {
+				if ( (nMask & (1 << j)) == 0 )
+					continue;
+				const Wml::Vector3f & vPoint = pPoints[ pIndices[j] ];
+				for ( unsigned int i = node.nIndex; i < node.nIndex + node.nCount; ++i ) {
+					tri.V[0] = m_vFlatTriVerts[3*i];  tri.V[1] = m_vFlatTriVerts[3*i+1];  tri.V[2] = m_vFlatTriVerts[3*i+2];
+					Wml::DistVector3Triangle3f dist( vPoint, tri );
+					float fDistSqr = dist.GetSquared();
+					if ( fDistSqr < vBestSqr[j] ) {
+						vBestSqr[j] = fDistSqr;
+						Wml::Vector3f & vNearest = pNearest[ pIndices[j] ];
+						vNearest = Wml::Vector3f::ZERO;
+						for ( int k = 0 ; k < 3; ++k ) 
+							vNearest += tri.V[k] * dist.GetTriangleBary(k);
+						pNearestTri[ pIndices[j] ] = m_vFlatTris[i];
+					}
+				}
+			}
+			continue;
+		}
+
+		// visit child nearest to first active query first
+		int nLane = 0;
+		while ( (nMask & (1 << nLane)) == 0 )
+			++nLane;
+		const Wml::Vector3f & vLanePoint = pPoints[ pIndices[nLane] ];
+		unsigned int nLeft = (unsigned int)(&node - &m_vFlatNodes[0]) + 1;
+		unsigned int nRight = node.nIndex;
+		if ( MinDistanceSqr( m_vFlatNodes[nLeft], vLanePoint ) < MinDistanceSqr( m_vFlatNodes[nRight], vLanePoint ) ) {
+			vStack[nStack++] = nRight;  vStack[nStack++] = nLeft;
+		} else {
+			vStack[nStack++] = nLeft;  vStack[nStack++] = nRight;
+		}
+	}
+
+	if ( pDistances ) {
+		for ( int j = 0; j < nPacket; ++j )
+			pDistances[ pIndices[j] ] = (float)sqrt( vBestSqr[j] );
+	}
+}
+
+
+
+unsigned int IMeshBVTree::FindRayIntersections( const Wml::Vector3f * pOrigins, const Wml::Vector3f * pDirections, unsigned int nCount,
+											    Wml::Vector3f * pHits, IMesh::TriangleID * pHitTris )
+{
+	unsigned int nHits = 0;
+	if ( m_eBuildMode != FlatSAHBuild ) {
+		for ( unsigned int i = 0; i < nCount; ++i ) {
+			if ( FindRayIntersection( pOrigins[i], pDirections[i], pHits[i], pHitTris[i] ) )
+				++nHits;
+			else
+				pHitTris[i] = IMesh::InvalidID;
+		}
+		return nHits;
+	}
+
+	EnsureFlatBuilt();
+	if ( m_vFlatNodes.empty() ) {
+		for ( unsigned int i = 0; i < nCount; ++i )
+			pHitTris[i] = IMesh::InvalidID;
+		return 0;
+	}
+
+	// sort by origin. Rays from nearby origins are not necessarily coherent, but 
+	// for the common cases (camera rays, projection along normals) they are
+	std::vector<unsigned int> vOrder;
+	MortonOrder( pOrigins, nCount, vOrder );
+
+	int nPackets = (int)( (nCount + BV_PACKET_SIZE-1) / BV_PACKET_SIZE );
+	#pragma omp parallel for schedule(dynamic, 16) reduction(+:nHits)
+	for ( int i = 0; i < nPackets; ++i ) {
+		unsigned int nFirst = i * BV_PACKET_SIZE;
+		int nPacket = (int)std::min( (unsigned int)BV_PACKET_SIZE, nCount - nFirst );
+		nHits += FindRayIntersectionPacket( pOrigins, pDirections, &vOrder[nFirst], nPacket, pHits, pHitTris );
+	}
+	return nHits;
+}
+
+
+unsigned int IMeshBVTree::FindRayIntersectionPacket( const Wml::Vector3f * pOrigins, const Wml::Vector3f * pDirections, 
+													  const unsigned int * pIndices, int nPacket,
+													  Wml::Vector3f * pHits, IMesh::TriangleID * pHitTris ) const
+{
+	BVRayPacket packet;
+	Wml::Ray3f vRays[BV_PACKET_SIZE];
+	unsigned int vHitIndex[BV_PACKET_SIZE];
+	for ( int j = 0; j < BV_PACKET_SIZE; ++j ) {
+		unsigned int nQuery = pIndices[ (j < nPacket) ? j : 0 ];
+		vRays[j].Origin = pOrigins[nQuery];
+		vRays[j].Direction = pDirections[nQuery];
+		packet.ox[j] = pOrigins[nQuery].X();  packet.oy[j] = pOrigins[nQuery].Y();  packet.oz[j] = pOrigins[nQuery].Z();
+		packet.ix[j] = 1.0f / pDirections[nQuery].X();  
+		packet.iy[j] = 1.0f / pDirections[nQuery].Y();  
+		packet.iz[j] = 1.0f / pDirections[nQuery].Z();
+		packet.tmax[j] = (j < nPacket) ? std::numeric_limits<float>::max() : -1.0f;
+		vHitIndex[j] = IMesh::InvalidID;
+	}
+
+	Wml::Triangle3f tri;
+	unsigned int vStack[SAH_MAX_DEPTH+2];
+	int nStack = 0;
+	vStack[nStack++] = 0;
+
+	while ( nStack > 0 ) {
+		const FlatBVNode & node = m_vFlatNodes[ vStack[--nStack] ];
+		int nMask = RayBoxMask( node.vMin, node.vMax, packet );
+		if ( nMask == 0 )
+			continue;
+
+		if ( node.IsLeaf() ) {
+			for ( unsigned int i = node.nIndex; i < node.nIndex + node.nCount; ++i ) {
+				tri.V[0] = m_vFlatTriVerts[3*i];  tri.V[1] = m_vFlatTriVerts[3*i+1];  tri.V[2] = m_vFlatTriVerts[3*i+2];
+				for ( int j = 0; j < nPacket; ++j ) {
+					if ( (nMask & (1 << j)) == 0 )
+						continue;
+					Wml::IntrRay3Triangle3f intr( vRays[j], tri );
+					if ( intr.Find() && intr.GetRayT() < packet.tmax[j] ) {
+						packet.tmax[j] = intr.GetRayT();
+						vHitIndex[j] = i;
+					}
+				}
+			}
+			continue;
+		}
+
+		// visit child that first active ray enters first
+		int nLane = 0;
+		while ( (nMask & (1 << nLane)) == 0 )
+			++nLane;
+		unsigned int nLeft = (unsigned int)(&node - &m_vFlatNodes[0]) + 1;
+		unsigned int nRight = node.nIndex;
+		if ( RayBoxNear( m_vFlatNodes[nLeft].vMin, m_vFlatNodes[nLeft].vMax, packet, nLane ) < 
+			 RayBoxNear( m_vFlatNodes[nRight].vMin, m_vFlatNodes[nRight].vMax, packet, nLane ) ) {
+			vStack[nStack++] = nRight;  vStack[nStack++] = nLeft;
+		} else {
+			vStack[nStack++] = nLeft;  vStack[nStack++] = nRight;
+		}
+	}
+
+	unsigned int nHits = 0;
+	for ( int j = 0; j < nPacket; ++j ) {
+		unsigned int nQuery = pIndices[j];
+		if ( vHitIndex[j] == IMesh::InvalidID ) {
+			pHitTris[nQuery] = IMesh::InvalidID;
+			continue;
+		}
+		pHits[nQuery] = vRays[j].Origin + packet.tmax[j] * vRays[j].Direction;
+		pHitTris[nQuery] = m_vFlatTris[ vHitIndex[j] ];
+		++nHits;
+	}
+	return nHits;
+}
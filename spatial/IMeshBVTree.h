@@ -11,6 +11,7 @@
 
 #include "IMesh.h"
 #include "MemoryPool.h"
+#include "AlignedVector.h"
 #include "rmsprofile.h"
 
 
@@ -20,33 +21,75 @@ namespace rms {
 class IMeshBVTree
 {
 public:
+	//! LazyBuild splits nodes on demand during queries, so queries modify the tree and are not thread-safe.
+	//! FlatSAHBuild builds the whole tree (binned SAH, in parallel if OpenMP is enabled) into a flat node
+	//! array, the first time any query needs it. That build is done once under a lock, and after it queries
+	//! do not modify the tree, so all queries can be made from many threads at once. Build(), Refit(),
+	//! Clear() and SetMesh() must not run at the same time as queries.
+	enum BuildMode {
+		LazyBuild,
+		FlatSAHBuild
+	};
+
 	IMeshBVTree( );
-	IMeshBVTree( IMesh * pMesh );
+	IMeshBVTree( IMesh * pMesh, BuildMode eMode = LazyBuild );
 
 	void SetMesh( IMesh * pMesh );
 
+	void SetBuildMode( BuildMode eMode );
+	BuildMode GetBuildMode() const { return m_eBuildMode; }
+
 	void Clear();
 
+	//! build tree now. Otherwise it is built by the first query.
+	void Build();
+
 	void GetMeshBounds( Wml::AxisAlignedBox3f & bounds );
 
 	bool FindRayIntersection( const Wml::Vector3f & vOrigin, const Wml::Vector3f & vDirection,
 							  Wml::Vector3f & vHit, IMesh::TriangleID & nHitTri );
 
-	bool FindNearest( const Wml::Vector3f & vPoint, Wml::Vector3f & vNearest, IMesh::TriangleID & nNearestTri );
+	//! if pDistance is non-NULL, distance to nearest point is returned there. In FlatSAHBuild mode
+	//! LastDistance() is not updated (queries can be made from multiple threads), use pDistance.
+	bool FindNearest( const Wml::Vector3f & vPoint, Wml::Vector3f & vNearest, IMesh::TriangleID & nNearestTri, float * pDistance = NULL );
+
+	bool FindNearestVtx( const Wml::Vector3f & vPoint, IMesh::VertexID & nNearestVtx, float * pDistance = NULL );
 
-	bool FindNearestVtx( const Wml::Vector3f & vPoint, IMesh::VertexID & nNearestVtx );
+	//! Batch queries. Queries are sorted spatially (Morton order), traversed in packets of 4 with SIMD box tests,
+	//! and packets are split across threads if OpenMP is enabled. This needs FlatSAHBuild - in LazyBuild
+	//! mode the queries are just done one at a time. Output arrays must have nCount entries (pDistances is optional).
+	void FindNearest( const Wml::Vector3f * pPoints, unsigned int nCount,
+					  Wml::Vector3f * pNearest, IMesh::TriangleID * pNearestTri, float * pDistances = NULL );
+	//! pHitTris[i] is IMesh::InvalidID if ray i does not hit anything. Returns number of rays that hit.
+	unsigned int FindRayIntersections( const Wml::Vector3f * pOrigins, const Wml::Vector3f * pDirections, unsigned int nCount,
+									   Wml::Vector3f * pHits, IMesh::TriangleID * pHitTris );
 
-	//! get nearest distance for last query
+	//! get nearest distance for last FindNearest/FindNearestVtx query (LazyBuild mode only)
 	float LastDistance() { return m_fLastQueryDistance; }
 
-	//! expand entire BV Tree (makes queries faster, but expensive)
+	//! expand entire BV Tree (makes queries faster, but expensive). In FlatSAHBuild mode this is the same as Build().
 	void ExpandAll();
 
+	//! Update tree after mesh vertices have moved. Node boxes are refit bottom-up in O(n). In FlatSAHBuild
+	//! mode, subtrees whose boxes have degraded (see SetRefitRebuildThreshold) are rebuilt. If the set of
+	//! triangle IDs has changed since the tree was built, the whole tree is rebuilt instead.
+	void Refit();
+
+	//! Refit() rebuilds a subtree if its box area, relative to the root box area, has grown by more than
+	//! this factor since it was built. Set to 0 to disable rebuilds. Default is 2.
+	void SetRefitRebuildThreshold( float fRatio ) { m_fRefitRebuildThreshold = fRatio; }
+	float GetRefitRebuildThreshold() const { return m_fRefitRebuildThreshold; }
+
 protected:
 	IMesh * m_pMesh;
+	BuildMode m_eBuildMode;
 
 	float m_fLastQueryDistance;
 
+	// triangle IDs the tree was built from, in GetTriangleIDs order (Refit compares these to the mesh)
+	std::vector<IMesh::TriangleID> m_vBuildTriIDs;
+	bool TrianglesChanged() const;
+
 	class IMeshBVNode {
 	public:
 		unsigned int ID;
@@ -127,6 +170,58 @@ protected:
 					  Wml::Vector3f & vNearest, float & fNearest, IMesh::TriangleID & nNearestTri );
 
 	void ExpandAll( IMeshBVTree::IMeshBVNode * pNode );
+	void RefitLazy( IMeshBVTree::IMeshBVNode * pNode );
+
+
+/*
+ * FlatSAHBuild data. Nodes are stored depth-first, so the left child of an internal node is
+ * the next node in the array and only the right child index is stored. Leaves reference a
+ * contiguous range of m_vFlatTris, and m_vFlatTriVerts holds copies of the triangle vertices
+ * in the same order, so leaf tests do not have to go back to the mesh.
+ */
+	struct FlatBVNode {
+		float vMin[3];
+		unsigned int nIndex;	// internal node: index of right child. leaf: first entry in m_vFlatTris
+		float vMax[3];
+		unsigned int nCount;	// number of triangles in leaf, 0 for internal nodes
+
+		inline bool IsLeaf() const { return nCount != 0; }
+	};
+	AlignedVector<FlatBVNode> m_vFlatNodes;
+	std::vector<IMesh::TriangleID> m_vFlatTris;
+	std::vector<Wml::Vector3f> m_vFlatTriVerts;
+
+	// node box area / root box area when node was built (for Refit quality check)
+	std::vector<float> m_vFlatBuildArea;
+	float m_fRefitRebuildThreshold;
+
+	struct SAHBuilder;
+	friend struct SAHBuilder;
+	void BuildFlat();
+	void BuildFlatNodes();
+
+	// set by BuildFlat(), cleared by Clear(). Queries call EnsureFlatBuilt(), which builds at most once.
+	bool m_bFlatBuilt;
+	void EnsureFlatBuilt();
+	bool FindRayIntersectionFlat( const Ray & ray, Wml::Vector3f & vHit, IMesh::TriangleID & nHitTri ) const;
+	bool FindNearestFlat( const Wml::Vector3f & vPoint, Wml::Vector3f & vNearest, IMesh::TriangleID & nNearestTri, float & fNearest ) const;
+	static bool TestIntersection( const FlatBVNode & node, const Ray & ray, float fMaxT, float & fNear );
+	static float MinDistanceSqr( const FlatBVNode & node, const Wml::Vector3f & vPoint );
+
+	static float HalfArea( const FlatBVNode & node );
+	void SetFlatBuildAreas( unsigned int nBegin, unsigned int nEnd );
+	void UpdateFlatTriangles( unsigned int nBegin, unsigned int nEnd );
+	unsigned int FlatSubtreeEnd( unsigned int nNode ) const;
+	struct FlatRebuildRange;
+	friend struct FlatRebuildRange;
+	void RebuildDegradedFlat();
+
+	//! packet versions of flat queries. pIndices are the (up to 4) query indices in this packet
+	void MortonOrder( const Wml::Vector3f * pPoints, unsigned int nCount, std::vector<unsigned int> & vOrder ) const;
+	void FindNearestPacket( const Wml::Vector3f * pPoints, const unsigned int * pIndices, int nPacket,
+							Wml::Vector3f * pNearest, IMesh::TriangleID * pNearestTri, float * pDistances ) const;
+	unsigned int FindRayIntersectionPacket( const Wml::Vector3f * pOrigins, const Wml::Vector3f * pDirections, const unsigned int * pIndices, int nPacket,
+											Wml::Vector3f * pHits, IMesh::TriangleID * pHitTris ) const;
 };
 
 
@@ -199,9 +199,11 @@ void IMeshUVBVTree::Initialize()
 	// insert triangles w/ UV's
 	unsigned int nIndex = 0;
 	IMesh::VertexID nTri[3];
-	IMesh::ITriIterator curt(m_pMesh->BeginITriangles()), endt(m_pMesh->EndITriangles());
-	while ( curt != endt ) {
-		IMesh::TriangleID tID = *curt;  ++curt;
+	std::vector<IMesh::TriangleID> vTriIDs;
+	vTriIDs.reserve( m_pMesh->GetTriangleCount() );
+	m_pMesh->ForEachTriangleBlock( IMeshAppendIDsFunc(vTriIDs) );
+	for ( unsigned int k = 0; k < vTriIDs.size(); ++k ) {
+		IMesh::TriangleID tID = vTriIDs[k];
 		m_pMesh->GetTriangle( tID, nTri );
 		bool b1 = uvset.HasUV(nTri[0]);
 		bool b2 = uvset.HasUV(nTri[1]);